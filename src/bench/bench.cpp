@@ -0,0 +1,729 @@
+#include "util/batch_dft.hpp"
+#include "util/batch_loader.hpp"
+#include "util/filterbank.hpp"
+#include "util/parse-opt.hpp"
+#include "util/resampler.hpp"
+#include "util/utils.hpp"
+#include "util/wav_utils.hpp"
+#include "util/window.hpp"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+
+
+namespace
+{
+    using namespace neurosynth;
+
+    //timings of one stage, one entry per repetition
+    struct StageResult
+    {
+        std::string         name;
+        std::vector<double> seconds;
+        size_t              bytes = 0; //consumed per repetition
+    };
+
+    struct SignalResult
+    {
+        std::string              name;
+        double                   duration   = 0.0; //seconds of audio
+        size_t                   num_frames = 0;   //stft frames
+        std::vector<StageResult> stages;
+
+        //largest relative difference of StereoDft's spectra to the
+        //two-transform ones, and what StereoDft guarantees
+        double packed_deviation = 0.0;
+        double packed_tolerance = 0.0;
+    };
+
+    double seconds_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start).count();
+    }
+
+    double best(const std::vector<double>& seconds)
+    {
+        return *std::min_element(seconds.begin(), seconds.end());
+    }
+
+    double median(std::vector<double> seconds)
+    {
+        std::sort(seconds.begin(), seconds.end());
+        size_t n = seconds.size();
+        return n % 2 ? seconds[n/2] : 0.5 * (seconds[n/2 - 1] + seconds[n/2]);
+    }
+
+    std::string format_number(double value)
+    {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.6g", value);
+        return buffer;
+    }
+
+    uintmax_t file_size(const std::string& filename)
+    {
+        boost::system::error_code error;
+        uintmax_t size = boost::filesystem::file_size(filename, error);
+        return error ? 0 : size;
+    }
+
+    //sine:  440hz tone with two harmonics, right channel phase shifted
+    //noise: uniform white noise, independent channels
+    //chirp: exponential sweep 25hz - 8khz, right channel sweeps down
+    //returns false if 'name' is none of them
+    template<class T>
+    bool generate_signal(const std::string& name,
+                         double duration,
+                         double sample_rate,
+                         uint32_t seed,
+                         WavData<T>& wav_data)
+    {
+        size_t n = size_t(duration * sample_rate);
+        wav_data.samples_l.resize(n);
+        wav_data.samples_r.resize(n);
+        wav_data.sample_rate = size_t(sample_rate);
+
+        const double two_pi = 2.0 * M_PI;
+        if(name == "sine")
+        {
+            for(size_t i = 0; i < n; i++)
+            {
+                double t = double(i) / sample_rate;
+                double phase = two_pi * 440.0 * t;
+                wav_data.samples_l[i] = T(0.4  * sin(phase) +
+                                          0.2  * sin(2.0 * phase) +
+                                          0.1  * sin(3.0 * phase));
+                wav_data.samples_r[i] = T(0.4  * sin(phase + 0.5) +
+                                          0.2  * sin(2.0 * phase + 1.0) +
+                                          0.1  * sin(3.0 * phase + 1.5));
+            }
+        }
+        else if(name == "noise")
+        {
+            std::mt19937 rng(seed);
+            std::uniform_real_distribution<double> dist(-0.5, 0.5);
+            for(size_t i = 0; i < n; i++)
+            {
+                wav_data.samples_l[i] = T(dist(rng));
+                wav_data.samples_r[i] = T(dist(rng));
+            }
+        }
+        else if(name == "chirp")
+        {
+            //phase of f(t) = f0 * k^(t/d) is 2pi f0 d (k^(t/d) - 1) / ln k
+            const double f0 = 25.0;
+            const double k  = 8000.0 / f0;
+            const double scale = two_pi * f0 * duration / log(k);
+            for(size_t i = 0; i < n; i++)
+            {
+                double t = double(i) / sample_rate;
+                wav_data.samples_l[i] =
+                    T(0.5 * sin(scale * (pow(k, t / duration) - 1.0)));
+                wav_data.samples_r[i] =
+                    T(0.5 * sin(scale * (pow(k, (duration - t) / duration) -
+                                         1.0)));
+            }
+        }
+        else
+            return false;
+        return true;
+    }
+
+    //windowing, transform and filterbank of a whole signal on the
+    //calling thread, each timed on its own; mirrors FrameAnalyzer.
+    //The same frames also go through StereoDft (transform and spectra
+    //separation timed), whose spectra are checked against BatchDft's.
+    template<class T>
+    void time_stages(WavData<T>& wav_data,
+                     const StftParams& params,
+                     StftCache& cache,
+                     Logger& logger,
+                     double& window_seconds,
+                     double& dft_seconds,
+                     double& packed_seconds,
+                     double& filterbank_seconds,
+                     SignalResult& result)
+    {
+        using clock = std::chrono::steady_clock;
+
+        size_t N = params.window_size;
+        size_t M = stft_fft_size(params);
+        size_t H = params.window_step;
+        size_t C = params.num_coeff;
+        size_t input_size = wav_data.samples_l.size();
+        size_t num_frames = input_size >= N ? (input_size - N) / H + 1 : 0;
+        T      energy_scale = T(double(N) / double(M));
+
+        BatchDft<T> batch(M, params.batch_size, cache.plans, logger);
+        StereoDft<T> packed(M, params.batch_size, cache.plans, logger);
+        auto window = cache.windows.get<T>(params.window_type, N);
+        auto filterbank = cache.filterbanks.get({M,
+                                                 params.sample_rate,
+                                                 C,
+                                                 params.min_freq,
+                                                 params.max_freq,
+                                                 params.filter_shape});
+
+        size_t batch_size   = batch.batch_size();
+        size_t power_stride = aligned_count<T>(batch.spectrum_size());
+        AlignedVector<T> power(2 * batch_size * power_stride);
+        AlignedVector<T> energies(2 * batch_size * C);
+        AlignedVector<std::complex<T>> spectra(2 * batch_size *
+                                               batch.spectrum_size());
+
+        result.packed_tolerance = double(packed.tolerance());
+        window_seconds = dft_seconds = packed_seconds = 0.0;
+        filterbank_seconds = 0.0;
+        for(size_t first = 0; first < num_frames; first += batch_size)
+        {
+            size_t count = std::min(batch_size, num_frames - first);
+
+            clock::time_point start = clock::now();
+            for(size_t i = 0; i < count; i++)
+            {
+                size_t t = (first + i) * H;
+                window_frame(&wav_data.samples_l[t], &wav_data.samples_r[t],
+                             window->data(), batch.frame_l(i),
+                             batch.frame_r(i), N);
+                std::fill(batch.frame_l(i) + N, batch.frame_l(i) + M, T(0));
+                std::fill(batch.frame_r(i) + N, batch.frame_r(i) + M, T(0));
+            }
+            clock::time_point windowed = clock::now();
+
+            batch.execute(count);
+            clock::time_point transformed = clock::now();
+
+            for(size_t i = 0; i < count; i++)
+            {
+                size_t t = (first + i) * H;
+                window_frame_packed(&wav_data.samples_l[t],
+                                    &wav_data.samples_r[t], window->data(),
+                                    packed.frame(i), N);
+                std::fill(packed.frame(i) + N, packed.frame(i) + M,
+                          std::complex<T>(0));
+            }
+            clock::time_point packed_start = clock::now();
+            packed.execute(count);
+            size_t S = batch.spectrum_size();
+            for(size_t i = 0; i < count; i++)
+                packed.separate(i, &spectra[2 * i * S],
+                                &spectra[(2 * i + 1) * S]);
+            packed_seconds += std::chrono::duration<double>
+                (clock::now() - packed_start).count();
+
+            for(size_t i = 0; i < count; i++)
+            {
+                double peak = 0.0, deviation = 0.0;
+                for(size_t k = 0; k < S; k++)
+                {
+                    peak = std::max({peak,
+                                     double(std::abs(batch.spectrum_l(i)[k])),
+                                     double(std::abs(batch.spectrum_r(i)[k]))});
+                    deviation = std::max
+                        ({deviation,
+                          double(std::abs(spectra[2 * i * S + k] -
+                                          batch.spectrum_l(i)[k])),
+                          double(std::abs(spectra[(2 * i + 1) * S + k] -
+                                          batch.spectrum_r(i)[k]))});
+                }
+                if(peak > 0.0)
+                    result.packed_deviation = std::max(result.packed_deviation,
+                                                       deviation / peak);
+            }
+            clock::time_point filter_start = clock::now();
+
+            for(size_t i = 0; i < count; i++)
+            {
+                power_spectrum(batch.spectrum_l(i),
+                               &power[i * power_stride],
+                               batch.spectrum_size());
+                power_spectrum(batch.spectrum_r(i),
+                               &power[(count + i) * power_stride],
+                               batch.spectrum_size());
+            }
+            filterbank->apply(power.data(), power_stride,
+                              energies.data(), C, 2 * count);
+            if(M != N)
+                for(size_t k = 0; k < 2 * count * C; k++)
+                    energies[k] *= energy_scale;
+            log_compress(energies.data(), 2 * count * C);
+            clock::time_point filtered = clock::now();
+
+            window_seconds     += std::chrono::duration<double>
+                (windowed - start).count();
+            dft_seconds        += std::chrono::duration<double>
+                (transformed - windowed).count();
+            filterbank_seconds += std::chrono::duration<double>
+                (filtered - filter_start).count();
+        }
+    }
+
+    //runs every stage of one signal 'repeat' times, files go to 'tmp_dir'
+    template<class T>
+    bool bench_signal(const std::string& name,
+                      double duration,
+                      size_t repeat,
+                      StftParams params,
+                      StftCache& cache,
+                      const std::string& tmp_dir,
+                      SignalResult& result,
+                      Logger& logger)
+    {
+        using clock = std::chrono::steady_clock;
+
+        WavData<T> signal;
+        if(!generate_signal(name, duration, params.sample_rate, 1, signal))
+        {
+            logger.err("Unknown benchmark signal: " + name);
+            return false;
+        }
+
+        std::string wav_fn = tmp_dir + "/" + name + ".wav";
+        std::string stf_fn = tmp_dir + "/" + name + ".stf";
+        if(!save_wav(wav_fn, signal, logger))
+            return false;
+
+        size_t input_size = signal.samples_l.size();
+        result.name       = name;
+        result.duration   = double(input_size) / params.sample_rate;
+        result.num_frames = input_size >= params.window_size ?
+            (input_size - params.window_size) / params.window_step + 1 : 0;
+
+        //the same analysis after decimating to the lowest rate that
+        //covers max_freq
+        StftParams decimated_params = params;
+        decimated_params.decimate   = true;
+
+        //plans are created (and measured) outside of the timings
+        {
+            StftData<T> warmup;
+            WavData<T> head;
+            size_t n = std::min(input_size, 2 * params.window_size);
+            head.samples_l.assign(signal.samples_l.begin(),
+                                  signal.samples_l.begin() + n);
+            head.samples_r.assign(signal.samples_r.begin(),
+                                  signal.samples_r.begin() + n);
+            stft(head, warmup, params, cache, logger);
+            StftParams analysis = resample_input(head, decimated_params,
+                                                 params.sample_rate, logger);
+            stft(head, warmup, analysis, cache, logger);
+        }
+
+        enum Stage { LoadWav, Window, Dft, DftPacked, Filterbank, Stft,
+                     Resample, StftDecimated, SaveStft, LoadStft,
+                     LoadBatches, EndToEnd, NumStages };
+        const char* names[NumStages] = {"load_wav", "window", "dft",
+                                        "dft_packed", "filterbank", "stft",
+                                        "resample", "stft_decimated",
+                                        "save_stft", "load_stft",
+                                        "load_batches", "end_to_end"};
+
+        //one epoch of shuffled 32 frame windows at every frame, as a
+        //training job would read the features
+        LoaderParams loader_params;
+        loader_params.window_frames = 32;
+        loader_params.window_step   = 1;
+        result.stages.resize(NumStages);
+        for(size_t s = 0; s < NumStages; s++)
+            result.stages[s].name = names[s];
+
+        for(size_t r = 0; r < repeat; r++)
+        {
+            clock::time_point start = clock::now();
+            WavData<T> wav_data;
+            if(!load_wav(wav_fn, wav_data, logger))
+                return false;
+            result.stages[LoadWav].seconds.push_back(seconds_since(start));
+
+            double window_seconds, dft_seconds, packed_seconds;
+            double filterbank_seconds;
+            time_stages(wav_data, params, cache, logger, window_seconds,
+                        dft_seconds, packed_seconds, filterbank_seconds,
+                        result);
+            if(result.packed_deviation > result.packed_tolerance)
+            {
+                logger.err("Packed stereo dft of " + name + " deviates by " +
+                           format_number(result.packed_deviation) +
+                           " from the two-transform spectra, tolerance is " +
+                           format_number(result.packed_tolerance));
+                return false;
+            }
+            result.stages[Window].seconds.push_back(window_seconds);
+            result.stages[Dft].seconds.push_back(dft_seconds);
+            result.stages[DftPacked].seconds.push_back(packed_seconds);
+            result.stages[Filterbank].seconds.push_back(filterbank_seconds);
+
+            start = clock::now();
+            StftData<T> stft_data;
+            stft(wav_data, stft_data, params, cache, logger);
+            result.stages[Stft].seconds.push_back(seconds_since(start));
+
+            //resampling is charged to the decimated stft as well
+            {
+                WavData<T> decimated = wav_data;
+                StftData<T> decimated_stft;
+                start = clock::now();
+                StftParams analysis = resample_input(decimated,
+                                                     decimated_params,
+                                                     params.sample_rate,
+                                                     logger);
+                double resample_seconds = seconds_since(start);
+                stft(decimated, decimated_stft, analysis, cache, logger);
+                result.stages[Resample].seconds.push_back(resample_seconds);
+                result.stages[StftDecimated].seconds.push_back(
+                    seconds_since(start));
+            }
+
+            start = clock::now();
+            if(!save_stft(stf_fn, stft_data, params, logger))
+                return false;
+            result.stages[SaveStft].seconds.push_back(seconds_since(start));
+
+            start = clock::now();
+            StftData<T> loaded;
+            load_stft(stf_fn, loaded, logger);
+            result.stages[LoadStft].seconds.push_back(seconds_since(start));
+
+            start = clock::now();
+            {
+                BatchLoader<T> loader({stf_fn}, loader_params, logger);
+                FrameBatch<T> batch;
+                size_t num_examples = 0;
+                while(loader.next(batch))
+                    num_examples += batch.size;
+                if(num_examples != loader.num_windows())
+                {
+                    logger.err("Loader served " +
+                               std::to_string(num_examples) + " of " +
+                               std::to_string(loader.num_windows()) +
+                               " windows of " + name);
+                    return false;
+                }
+            }
+            result.stages[LoadBatches].seconds.push_back(
+                seconds_since(start));
+
+            start = clock::now();
+            {
+                WavData<T> e2e_wav;
+                StftData<T> e2e_stft;
+                if(!load_wav(wav_fn, e2e_wav, logger))
+                    return false;
+                stft(e2e_wav, e2e_stft, params, cache, logger);
+                if(!save_stft(stf_fn, e2e_stft, params, logger))
+                    return false;
+            }
+            result.stages[EndToEnd].seconds.push_back(seconds_since(start));
+        }
+
+        //i/o stages are charged their file, compute stages the pcm
+        size_t wav_bytes = size_t(file_size(wav_fn));
+        size_t stf_bytes = size_t(file_size(stf_fn));
+        for(StageResult& stage : result.stages)
+            stage.bytes = wav_bytes;
+        result.stages[SaveStft].bytes = stf_bytes;
+        result.stages[LoadStft].bytes = stf_bytes;
+        result.stages[LoadBatches].bytes = stf_bytes;
+
+        boost::system::error_code error;
+        boost::filesystem::remove(wav_fn, error);
+        boost::filesystem::remove(stf_fn, error);
+        return true;
+    }
+
+    std::string json_string(const std::string& str)
+    {
+        std::string out = "\"";
+        for(char c : str)
+        {
+            if(c == '"' || c == '\\')
+                out += '\\';
+            if((unsigned char)c < 0x20)
+                continue;
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    //machine readable results, one object per signal and stage;
+    //rates are computed from the best repetition
+    std::string to_json(const std::vector<SignalResult>& results,
+                        const StftParams& params,
+                        const std::string& label,
+                        const std::string& precision,
+                        double duration,
+                        size_t repeat)
+    {
+        std::string json = "{\n";
+        json += "  \"label\": " + json_string(label) + ",\n";
+        json += "  \"precision\": " + json_string(precision) + ",\n";
+        json += "  \"params\": {\"window_size\": " +
+            std::to_string(params.window_size) +
+            ", \"window_step\": " + std::to_string(params.window_step) +
+            ", \"fft_size\": " + std::to_string(stft_fft_size(params)) +
+            ", \"num_coeff\": " + std::to_string(params.num_coeff) +
+            ", \"batch_size\": " + std::to_string(params.batch_size) +
+            ", \"threads\": " + std::to_string(params.num_threads) +
+            ", \"packed_stereo\": " +
+            std::string(params.packed_stereo ? "true" : "false") +
+            ", \"sample_rate\": " + format_number(params.sample_rate) +
+            ", \"duration\": " + format_number(duration) +
+            ", \"repeat\": " + std::to_string(repeat) +
+            ", \"hardware_threads\": " +
+            std::to_string(std::thread::hardware_concurrency()) + "},\n";
+        json += "  \"signals\": [\n";
+
+        for(size_t i = 0; i < results.size(); i++)
+        {
+            const SignalResult& signal = results[i];
+            json += "    {\"signal\": " + json_string(signal.name) +
+                ", \"audio_seconds\": " + format_number(signal.duration) +
+                ", \"frames\": " + std::to_string(signal.num_frames) +
+                ", \"packed_deviation\": " +
+                format_number(signal.packed_deviation) +
+                ", \"stages\": [\n";
+
+            for(size_t s = 0; s < signal.stages.size(); s++)
+            {
+                const StageResult& stage = signal.stages[s];
+                double seconds = best(stage.seconds);
+                double rate = seconds > 0.0 ? 1.0 / seconds : 0.0;
+                json += "      {\"stage\": " + json_string(stage.name) +
+                    ", \"seconds\": " + format_number(seconds) +
+                    ", \"median_seconds\": " +
+                    format_number(median(stage.seconds)) +
+                    ", \"frames_per_second\": " +
+                    format_number(double(signal.num_frames) * rate) +
+                    ", \"realtime_factor\": " +
+                    format_number(signal.duration * rate) +
+                    ", \"bytes\": " + std::to_string(stage.bytes) +
+                    ", \"bytes_per_second\": " +
+                    format_number(double(stage.bytes) * rate) + "}" +
+                    (s + 1 < signal.stages.size() ? ",\n" : "\n");
+            }
+            json += std::string("    ]}") +
+                (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        json += "  ]\n}\n";
+        return json;
+    }
+
+    void print_results(std::ostream& console,
+                       const std::vector<SignalResult>& results)
+    {
+        char line[128];
+        for(const SignalResult& signal : results)
+        {
+            snprintf(line, sizeof(line), "%s: %.1fs of audio, %zu frames\n",
+                     signal.name.c_str(), signal.duration, signal.num_frames);
+            console << line;
+            snprintf(line, sizeof(line), "  %-14s %10s %12s %10s %10s\n",
+                     "stage", "ms", "frames/s", "x realtime", "MB/s");
+            console << line;
+
+            for(const StageResult& stage : signal.stages)
+            {
+                double seconds = best(stage.seconds);
+                double rate = seconds > 0.0 ? 1.0 / seconds : 0.0;
+                snprintf(line, sizeof(line),
+                         "  %-14s %10.3f %12.0f %10.1f %10.1f\n",
+                         stage.name.c_str(), seconds * 1e3,
+                         double(signal.num_frames) * rate,
+                         signal.duration * rate,
+                         double(stage.bytes) * rate / 1e6);
+                console << line;
+            }
+            snprintf(line, sizeof(line),
+                     "  dft_packed max deviation %.3g (tolerance %.3g)\n",
+                     signal.packed_deviation, signal.packed_tolerance);
+            console << line;
+        }
+    }
+
+    template<class T>
+    bool run_bench(const std::vector<std::string>& signals,
+                   double duration,
+                   size_t repeat,
+                   const StftParams& params,
+                   StftCache& cache,
+                   std::vector<SignalResult>& results,
+                   Logger& logger)
+    {
+        namespace fs = boost::filesystem;
+
+        boost::system::error_code error;
+        fs::path tmp_dir = fs::temp_directory_path(error) /
+            fs::unique_path("neurosynth-bench-%%%%-%%%%-%%%%");
+        if(error || !fs::create_directories(tmp_dir, error))
+        {
+            logger.err("Cannot create temporary directory: " +
+                       tmp_dir.string());
+            return false;
+        }
+
+        bool good = true;
+        for(const std::string& name : signals)
+        {
+            SignalResult result;
+            if(!bench_signal<T>(name, duration, repeat, params, cache,
+                                tmp_dir.string(), result, logger))
+            {
+                good = false;
+                break;
+            }
+            results.push_back(std::move(result));
+        }
+
+        fs::remove_all(tmp_dir, error);
+        return good;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    using namespace neurosynth;
+    using namespace std;
+
+    ParseOpt parse_opt("Usage: bench <options>\n"
+                       "Times the analysis pipeline stage by stage on "
+                       "synthetic signals");
+
+    StftParams params;
+    string signals_str   = "sine,noise,chirp";
+    string duration_str;
+    string repeat_str;
+    string batch_size_str;
+    string threads_str;
+    string fft_size_str;
+    string json_fn;
+    string label;
+    string logfile = get_working_dir() + "/log/bench.log";
+    string log_level_str = "info";
+    string wisdom_fn;
+    string planner_str   = "measure";
+    string precision_str = "double";
+    bool   packed_stereo;
+    parse_opt.register_opt("l|log", &logfile, false,
+                           "Log file path");
+    parse_opt.register_opt("log-level", &log_level_str, false,
+                           "Least severe messages logged: info, warn,\n"
+                           "error or off (default info)");
+    parse_opt.register_opt("s|signals", &signals_str, false,
+                           "Comma separated signals: sine, noise and\n"
+                           "chirp (default all)");
+    parse_opt.register_opt("d|duration", &duration_str, false,
+                           "Seconds of audio per signal (default 30)");
+    parse_opt.register_opt("r|repeat", &repeat_str, false,
+                           "Repetitions of every stage, the best one\n"
+                           "is reported (default 5)");
+    parse_opt.register_opt("json", &json_fn, false,
+                           "Writes results as JSON to this file,\n"
+                           "- is stdout");
+    parse_opt.register_opt("label", &label, false,
+                           "Recorded in the JSON to tell runs apart,\n"
+                           "e.g. a commit id");
+    parse_opt.register_opt("fft-size", &fft_size_str, false,
+                           "FFT length, windows are zero padded to it;\n"
+                           "default is the next size fftw transforms\n"
+                           "fast (2^a 3^b 5^c)");
+    parse_opt.register_opt("b|batch", &batch_size_str, false,
+                           "Number of frames transformed by a single\n"
+                           "batched fft (default 32)");
+    parse_opt.register_opt("j|threads", &threads_str, false,
+                           "Number of analysis threads of the stft\n"
+                           "and end to end stages, 0 means one per\n"
+                           "hardware thread (default 1)");
+    parse_opt.register_opt("packed-stereo", &packed_stereo, true,
+                           "Stft and end to end stages transform both\n"
+                           "channels with one complex fft (the\n"
+                           "dft_packed stage times it on its own)");
+    parse_opt.register_opt("precision", &precision_str, false,
+                           "Sample and spectrum precision: double or\n"
+                           "float (default double)");
+    parse_opt.register_opt("w|wisdom", &wisdom_fn, false,
+                           "FFTW wisdom file, loaded before and\n"
+                           "updated after the benchmark");
+    parse_opt.register_opt("p|planner", &planner_str, false,
+                           "FFT planner effort: estimate, measure,\n"
+                           "patient or exhaustive (default measure)");
+    parse_opt.parse(argc, argv);
+
+    double duration = duration_str.empty() ? 30.0 : stod(duration_str);
+    size_t repeat = repeat_str.empty() ? 5 : stoul(repeat_str);
+    if(!batch_size_str.empty())
+        params.batch_size = stoul(batch_size_str);
+    if(!threads_str.empty())
+        params.num_threads = stoul(threads_str);
+    if(!fft_size_str.empty())
+        params.fft_size = stoul(fft_size_str);
+    params.packed_stereo = packed_stereo;
+
+    //keep stdout clean when json is written there
+    ostream& console = json_fn == "-" ? cerr : cout;
+    console << "Executing bench with log file: " + logfile + "\n";
+
+    Logger logger(logfile);
+
+    LogLevel log_level;
+    if(!parse_log_level(log_level_str, log_level))
+        handle_error(logger, "Unknown log level: " + log_level_str);
+    logger.set_level(log_level);
+
+    if(duration * params.sample_rate < double(params.window_size))
+        handle_error(logger, "--duration is shorter than a window");
+    if(repeat == 0)
+        handle_error(logger, "--repeat must be at least 1");
+
+    unsigned planner_flags;
+    if(!parse_planner_flags(planner_str, planner_flags))
+        handle_error(logger, "Unknown planner effort: " + planner_str);
+
+    FftPrecision precision;
+    if(!parse_precision(precision_str, precision))
+        handle_error(logger, "Unknown precision: " + precision_str);
+
+    StftCache cache(logger, planner_flags);
+    if(!wisdom_fn.empty())
+        cache.plans.load_wisdom(wisdom_fn);
+
+    vector<string> signals = split(',', signals_str, true);
+    vector<SignalResult> results;
+    bool good = precision == FftPrecision::Double ?
+        run_bench<double>(signals, duration, repeat, params, cache,
+                          results, logger) :
+        run_bench<float>(signals, duration, repeat, params, cache,
+                         results, logger);
+    if(!good)
+        handle_error(logger, "Benchmark failed, see log file: " + logfile);
+
+    print_results(console, results);
+
+    if(!json_fn.empty())
+    {
+        string json = to_json(results, params, label,
+                              precision_name(precision), duration, repeat);
+        if(json_fn == "-")
+            cout << json;
+        else
+        {
+            ofstream file(json_fn);
+            file << json;
+            if(!file)
+                handle_error(logger, "Cannot write: " + json_fn);
+        }
+    }
+
+    if(!wisdom_fn.empty())
+        cache.plans.save_wisdom(wisdom_fn);
+
+    return 0;
+}
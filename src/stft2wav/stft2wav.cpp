@@ -0,0 +1,170 @@
+#include "util/griffin_lim.hpp"
+#include "util/parse-opt.hpp"
+#include "util/wav_format.hpp"
+#include "util/wav_utils.hpp"
+
+#include <chrono>
+#include <iostream>
+
+
+//resynthesizes one feature file with samples and spectra of type T,
+//returns false if input could not be read or output written
+template<class T>
+bool stft2wav(std::string& input_fn,
+              std::string& output_fn,
+              const neurosynth::StftParams& options,
+              const neurosynth::GriffinLimParams& gl_params,
+              neurosynth::StftCache& cache,
+              neurosynth::Logger& logger)
+{
+    using namespace neurosynth;
+    using clock = std::chrono::steady_clock;
+
+    StftData<T> stft_data;
+    StftParams params;
+    if(!load_stft(input_fn, stft_data, params, logger))
+        return false;
+    params.batch_size  = options.batch_size;
+    params.num_threads = options.num_threads;
+
+    //window and hop are validated by load_stft(), the frames of a
+    //small file can still stand for more audio than a wav file holds
+    size_t num_frames = stft_data.num_frames();
+    if(num_frames > 0 && num_frames - 1 >
+       (wav_max_frames_16 - params.window_size) / params.window_step)
+    {
+        logger.warn(std::to_string(num_frames) + " frames of hop " +
+                    std::to_string(params.window_step) + " exceed the "
+                    "length of a wav file: " + input_fn);
+        return false;
+    }
+
+    clock::time_point start = clock::now();
+    WavData<T> wav_data;
+    griffin_lim(stft_data, params, gl_params, cache, wav_data, logger);
+    double seconds = std::chrono::duration<double>(clock::now() -
+                                                   start).count();
+
+    double duration = wav_data.samples_l.size() / params.sample_rate;
+    logger.info("Reconstructed " + std::to_string(duration) +
+                "s of audio in " + std::to_string(seconds) + "s (" +
+                std::to_string(seconds > 0.0 ? duration / seconds : 0.0) +
+                "x real time)");
+
+    return save_wav(output_fn, wav_data, logger);
+}
+
+int main(int argc, char** argv)
+{
+    using namespace neurosynth;
+    using namespace std;
+
+    ParseOpt parse_opt("Usage: stft2wav <options> [input] [output]\n"
+                       "Reconstructs 16-bit stereo RIFF/WAVE from wav2stf "
+                       "features\n"
+                       "Input/Output stream can be - (stdin/stdout))");
+
+    StftParams params;
+    GriffinLimParams gl_params;
+    string iterations_str;
+    string momentum_str;
+    string seed_str;
+    string fft_size_str;
+    string batch_size_str;
+    string threads_str;
+    string logfile = get_working_dir() + "/log/stft2wav.log";
+    string log_level_str = "info";
+    string wisdom_fn;
+    string planner_str = "measure";
+    string precision_str = "double";
+    parse_opt.register_opt("l|log", &logfile, false,
+                           "Log file path");
+    parse_opt.register_opt("log-level", &log_level_str, false,
+                           "Least severe messages logged: info, warn,\n"
+                           "error or off (default info)");
+    parse_opt.register_opt("i|iterations", &iterations_str, false,
+                           "Number of Griffin-Lim phase recovery\n"
+                           "iterations (default 32)");
+    parse_opt.register_opt("m|momentum", &momentum_str, false,
+                           "Fast Griffin-Lim momentum, 0 is plain\n"
+                           "Griffin-Lim (default 0.99)");
+    parse_opt.register_opt("seed", &seed_str, false,
+                           "Seed of the random initial phase\n"
+                           "(default 1)");
+    parse_opt.register_opt("fft-size", &fft_size_str, false,
+                           "FFT length, frames are zero padded from\n"
+                           "the window size; default is the next size\n"
+                           "fftw transforms fast (2^a 3^b 5^c)");
+    parse_opt.register_opt("b|batch", &batch_size_str, false,
+                           "Number of frames transformed by a single\n"
+                           "batched fft (default 32)");
+    parse_opt.register_opt("j|threads", &threads_str, false,
+                           "Number of synthesis threads, 0 means one\n"
+                           "per hardware thread (default 1)");
+    parse_opt.register_opt("precision", &precision_str, false,
+                           "Sample and spectrum precision: double or\n"
+                           "float (default double)");
+    parse_opt.register_opt("w|wisdom", &wisdom_fn, false,
+                           "FFTW wisdom file, loaded before and\n"
+                           "updated after the synthesis");
+    parse_opt.register_opt("p|planner", &planner_str, false,
+                           "FFT planner effort: estimate, measure,\n"
+                           "patient or exhaustive (default measure)");
+    parse_opt.parse(argc, argv);
+
+    if(!iterations_str.empty())
+        gl_params.iterations = stoul(iterations_str);
+    if(!momentum_str.empty())
+        gl_params.momentum = stod(momentum_str);
+    if(!seed_str.empty())
+        gl_params.seed = uint32_t(stoul(seed_str));
+    if(!fft_size_str.empty())
+        gl_params.fft_size = stoul(fft_size_str);
+    if(!batch_size_str.empty())
+        params.batch_size = stoul(batch_size_str);
+    if(!threads_str.empty())
+        params.num_threads = stoul(threads_str);
+
+    string input_fn  = parse_opt.get_positional(0);
+    string output_fn = parse_opt.get_positional(1);
+
+    //keep stdout clean when audio is written there
+    ostream& console = output_fn == "-" ? cerr : cout;
+    console << "Executing stft2wav with log file: " +
+        logfile +
+        ", input: " + input_fn +
+        ", output: " + output_fn + "\n";
+
+    Logger logger(logfile);
+
+    LogLevel log_level;
+    if(!parse_log_level(log_level_str, log_level))
+        handle_error(logger, "Unknown log level: " + log_level_str);
+    logger.set_level(log_level);
+
+    unsigned planner_flags;
+    if(!parse_planner_flags(planner_str, planner_flags))
+        handle_error(logger, "Unknown planner effort: " + planner_str);
+
+    FftPrecision precision;
+    if(!parse_precision(precision_str, precision))
+        handle_error(logger, "Unknown precision: " + precision_str);
+
+    StftCache cache(logger, planner_flags);
+    if(!wisdom_fn.empty())
+        cache.plans.load_wisdom(wisdom_fn);
+
+    bool good = precision == FftPrecision::Double ?
+        stft2wav<double>(input_fn, output_fn, params, gl_params, cache,
+                         logger) :
+        stft2wav<float>(input_fn, output_fn, params, gl_params, cache,
+                        logger);
+    if(!good)
+        handle_error(logger, "Cannot resynthesize " + input_fn + " to: " +
+                     output_fn);
+
+    if(!wisdom_fn.empty())
+        cache.plans.save_wisdom(wisdom_fn);
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "test.hpp"
+#include "util/filterbank.hpp"
+#include "util/griffin_lim.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+namespace
+{
+    using namespace neurosynth;
+
+    //half a second of two sines, the right channel an octave higher
+    WavData<double> sine_wav()
+    {
+        WavData<double> wav_data;
+        wav_data.sample_rate = 44100;
+        for(size_t i = 0; i < 22050; i++)
+        {
+            double t = double(i) / 44100.0;
+            wav_data.samples_l.push_back(0.5 * std::sin(2 * M_PI * 440 * t));
+            wav_data.samples_r.push_back(0.5 * std::sin(2 * M_PI * 880 * t));
+        }
+        return wav_data;
+    }
+
+    //spectral convergence of the band magnitudes of 'wav_data' to the
+    //features they were reconstructed from:
+    //|| |S| - |target| || / || |target| ||
+    double spectral_convergence(WavData<double>& wav_data,
+                                const StftData<double>& target,
+                                const StftParams& params,
+                                StftCache& cache,
+                                Logger& logger)
+    {
+        StftData<double> analyzed;
+        stft(wav_data, analyzed, params, cache, logger);
+        if(analyzed.num_frames() != target.num_frames())
+            return INFINITY;
+
+        double error = 0.0;
+        double norm  = 0.0;
+        size_t num_coeff = target.num_coeff();
+        std::vector<double> a(num_coeff), b(num_coeff);
+        for(size_t c = 0; c < 2; c++)
+            for(size_t t = 0; t < target.num_frames(); t++)
+            {
+                std::copy_n(analyzed.row(c, t), num_coeff, a.begin());
+                std::copy_n(target.row(c, t), num_coeff, b.begin());
+                log_expand(a.data(), num_coeff);
+                log_expand(b.data(), num_coeff);
+                for(size_t k = 0; k < num_coeff; k++)
+                {
+                    double diff = std::sqrt(a[k]) - std::sqrt(b[k]);
+                    error += diff * diff;
+                    norm  += b[k];
+                }
+            }
+        return std::sqrt(error / norm);
+    }
+
+    //convergence after each of 'iterations' runs from the same seed
+    std::vector<double> convergence(const std::vector<size_t>& iterations,
+                                    double momentum)
+    {
+        Logger logger(test::temp_path("griffin_lim.log"));
+        StftCache cache(logger, FFTW_ESTIMATE);
+        StftParams params;
+        params.batch_size = 4;
+
+        WavData<double> wav_data = sine_wav();
+        StftData<double> features;
+        stft(wav_data, features, params, cache, logger);
+
+        std::vector<double> result;
+        for(size_t count : iterations)
+        {
+            GriffinLimParams gl_params;
+            gl_params.iterations = count;
+            gl_params.momentum   = momentum;
+            gl_params.seed       = 7;
+
+            WavData<double> output;
+            griffin_lim(features, params, gl_params, cache, output, logger);
+
+            //frames - 1 hops plus the last window
+            size_t length = (features.num_frames() - 1) *
+                params.window_step + params.window_size;
+            if(output.samples_l.size() != length ||
+               output.samples_r.size() != length ||
+               output.sample_rate != 44100)
+                return std::vector<double>();
+
+            result.push_back(spectral_convergence(output, features, params,
+                                                  cache, logger));
+        }
+        return result;
+    }
+}
+
+NEUROSYNTH_TEST(griffin_lim_plain_does_not_diverge)
+{
+    //plain Griffin-Lim never increases the inconsistency of the
+    //spectrogram it projects
+    std::vector<double> sc = convergence({1, 4, 16, 48}, 0.0);
+    CHECK(sc.size() == 4);
+    for(size_t i = 1; i < sc.size(); i++)
+    {
+        CHECK(std::isfinite(sc[i]));
+        CHECK(sc[i] <= sc[i - 1] * 1.01);
+    }
+    CHECK(!sc.empty() && sc.back() < 0.8 * sc.front());
+}
+
+NEUROSYNTH_TEST(griffin_lim_momentum_converges)
+{
+    std::vector<double> sc = convergence({1, 32}, 0.99);
+    CHECK(sc.size() == 2);
+    CHECK(sc.size() == 2 && std::isfinite(sc[1]) && sc[1] < 0.6 * sc[0]);
+}
@@ -0,0 +1,152 @@
+#include "test.hpp"
+#include "util/quantize.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+
+namespace
+{
+    using namespace neurosynth;
+
+    uint32_t float_bits(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    float bits_float(uint32_t bits)
+    {
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    bool is_half_nan(uint16_t half)
+    {
+        return (half & 0x7c00) == 0x7c00 && (half & 0x03ff) != 0;
+    }
+
+    //every half as float, the float halfway to the next half (a tie)
+    //and one just above that, and random bit patterns of every
+    //exponent, including NaNs and values beyond the half range
+    std::vector<float> conversion_inputs()
+    {
+        std::vector<float> values;
+        for(uint32_t h = 0; h < 0x10000; h++)
+        {
+            uint32_t bits = float_bits(half_to_float(uint16_t(h)));
+            values.push_back(bits_float(bits));
+            if((h & 0x7c00) != 0x7c00)
+            {
+                uint32_t ulp = (h & 0x7c00) == 0 ? 0 : 1u << 12;
+                values.push_back(bits_float(bits + ulp));
+                values.push_back(bits_float(bits + ulp + 1));
+            }
+        }
+
+        std::mt19937 random(12345);
+        for(size_t i = 0; i < 1 << 18; i++)
+            values.push_back(bits_float(uint32_t(random())));
+        return values;
+    }
+}
+
+NEUROSYNTH_TEST(float16_bulk_matches_scalar)
+{
+    //the bulk conversions take the F16C path for all but the last
+    //count % 8 values when the build has it, the scalar one otherwise
+    std::vector<float> values = conversion_inputs();
+    std::vector<uint16_t> bulk(values.size());
+    encode_float16(values.data(), values.size(), bulk.data());
+
+    size_t mismatches = 0;
+    for(size_t i = 0; i < values.size(); i++)
+        if(bulk[i] != float_to_half(values[i]))
+            mismatches++;
+    CHECK(mismatches == 0);
+
+    //doubles are rounded to float first on both paths
+    std::vector<double> doubles(values.begin(), values.end());
+    std::vector<uint16_t> bulk_doubles(doubles.size());
+    encode_float16(doubles.data(), doubles.size(), bulk_doubles.data());
+    CHECK(bulk_doubles == bulk);
+
+    std::vector<uint16_t> halves(0x10000);
+    for(uint32_t h = 0; h < 0x10000; h++)
+        halves[h] = uint16_t(h);
+    std::vector<float> decoded(halves.size());
+    decode_float16(halves.data(), halves.size(), decoded.data());
+
+    mismatches = 0;
+    for(uint32_t h = 0; h < 0x10000; h++)
+        if(float_bits(decoded[h]) != float_bits(half_to_float(uint16_t(h))))
+            mismatches++;
+    CHECK(mismatches == 0);
+}
+
+NEUROSYNTH_TEST(float16_round_trips_every_half)
+{
+    //zeros, subnormals, normals and infinities come back bit exact,
+    //NaNs stay NaNs of the same sign
+    size_t mismatches = 0;
+    for(uint32_t h = 0; h < 0x10000; h++)
+    {
+        uint16_t half  = uint16_t(h);
+        float    value = half_to_float(half);
+        uint16_t back  = float_to_half(value);
+        bool ok = is_half_nan(half) ?
+            std::isnan(value) && is_half_nan(back) &&
+            (back & 0x8000) == (half & 0x8000) :
+            back == half;
+        if(!ok)
+            mismatches++;
+    }
+    CHECK(mismatches == 0);
+
+    CHECK(half_to_float(0x7c00) == INFINITY);
+    CHECK(half_to_float(0xfc00) == -INFINITY);
+    CHECK(half_to_float(0x0001) == std::ldexp(1.0f, -24));
+    CHECK(half_to_float(0x03ff) == std::ldexp(1023.0f, -24));
+    CHECK(half_to_float(0x7bff) == 65504.0f);
+    CHECK(float_to_half(65520.0f) == 0x7c00);
+    CHECK(float_to_half(std::ldexp(1.0f, -26)) == 0x0000);
+    CHECK(float_to_half(std::nextafter(std::ldexp(1.0f, -25), 1.0f)) ==
+          0x0001);
+}
+
+NEUROSYNTH_TEST(uint8_quantization_error_within_half_step)
+{
+    std::mt19937 random(54321);
+    const double ranges[][2] = {{0.0, 1.0}, {-3.5, 12.25}, {1e-6, 2e-6},
+                                {-1e4, -2.0}, {100.0, 100.0}};
+    for(const auto& bounds : ranges)
+    {
+        std::uniform_real_distribution<double> uniform(bounds[0],
+                                                       bounds[1]);
+        std::vector<double> values(4096);
+        for(double& value : values)
+            value = uniform(random);
+        values[0] = bounds[0];
+        values[1] = bounds[1];
+
+        double min, max;
+        min_max(values.data(), values.size(), min, max);
+        QuantRange range = quant_range(min, max);
+
+        std::vector<uint8_t> codes(values.size());
+        std::vector<double> decoded(values.size());
+        quantize_u8(values.data(), values.size(), range, codes.data());
+        dequantize_u8(codes.data(), codes.size(), range, decoded.data());
+
+        //half a step, plus float rounding of the range and values
+        QuantError error;
+        error.add(values.data(), decoded.data(), values.size());
+        double slack = 1e-6 * std::max(std::abs(min), std::abs(max));
+        CHECK(error.max_abs() <= range.scale / 2.0 + slack);
+    }
+}
@@ -0,0 +1,92 @@
+#include "test.hpp"
+#include "util/resampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+namespace
+{
+    using namespace neurosynth;
+
+    //streams 'left'/'right' through process() in blocks cycling through
+    //'blocks' frames, then finish(); returns the interleaved output
+    template<class T>
+    std::vector<T> stream(Resampler<T>& resampler,
+                          const std::vector<T>& left,
+                          const std::vector<T>& right,
+                          const std::vector<size_t>& blocks)
+    {
+        std::vector<T> output;
+        std::vector<T> block;
+        size_t first = 0;
+        for(size_t b = 0; first < left.size(); b++)
+        {
+            size_t count = std::min(blocks[b % blocks.size()],
+                                    left.size() - first);
+            block.resize(2 * count);
+            for(size_t i = 0; i < count; i++)
+            {
+                block[2 * i]     = left[first + i];
+                block[2 * i + 1] = right[first + i];
+            }
+            resampler.process(block.data(), count, output);
+            first += count;
+        }
+        resampler.finish(output);
+        return output;
+    }
+
+    //batch and streamed outputs of a chirp (L) and noise-like (R)
+    //signal of 'num_frames' frames must be the same samples
+    template<class T>
+    bool streams_match_batch(size_t input_rate,
+                             size_t output_rate,
+                             size_t num_frames,
+                             const std::vector<size_t>& blocks)
+    {
+        std::vector<T> left(num_frames), right(num_frames);
+        for(size_t i = 0; i < num_frames; i++)
+        {
+            double t = double(i) / double(input_rate);
+            left[i]  = T(std::sin(2.0 * M_PI * (100.0 + 4000.0 * t) * t));
+            right[i] = T(std::sin(double(i * i % 7919)));
+        }
+
+        Resampler<T> batch(input_rate, output_rate, 4200.0);
+        std::vector<T> out_l, out_r;
+        batch.resample(left, out_l);
+        batch.resample(right, out_r);
+
+        Resampler<T> streaming(input_rate, output_rate, 4200.0);
+        std::vector<T> streamed = stream(streaming, left, right, blocks);
+
+        size_t size = batch.output_size(num_frames);
+        if(out_l.size() != size || out_r.size() != size ||
+           streamed.size() != 2 * size)
+            return false;
+        for(size_t n = 0; n < size; n++)
+            if(streamed[2 * n] != out_l[n] || streamed[2 * n + 1] != out_r[n])
+                return false;
+        return true;
+    }
+}
+
+NEUROSYNTH_TEST(resampler_stream_matches_batch)
+{
+    //uneven blocks put chunk and phase boundaries everywhere, single
+    //frames and blocks longer than a batch chunk included
+    const std::vector<size_t> blocks = {1, 7, 333, 4096, 2, 12345, 64, 5};
+    const size_t rates[][2] = {{44100, 16000}, {48000, 44100},
+                               {16000, 44100}, {44100, 11025}};
+    for(const auto& rate : rates)
+    {
+        CHECK(streams_match_batch<double>(rate[0], rate[1], 30011, blocks));
+        CHECK(streams_match_batch<float>(rate[0], rate[1], 30011, blocks));
+    }
+
+    //inputs shorter than the filter
+    CHECK(streams_match_batch<double>(44100, 16000, 3, {1}));
+    CHECK(streams_match_batch<double>(48000, 44100, 40, {3, 1}));
+}
@@ -0,0 +1,191 @@
+#include "test.hpp"
+#include "util/stft_file.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+
+
+namespace
+{
+    using namespace neurosynth;
+
+    const uint64_t huge = std::numeric_limits<uint64_t>::max();
+
+    //float32 header of 2 channels of 4 frames x 8 coefficients, planes
+    //one alignment apart
+    StftFileHeader valid_header()
+    {
+        StftFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, stft_file_magic, sizeof(header.magic));
+        header.version        = stft_file_version;
+        header.byte_order     = stft_file_byte_order;
+        header.dtype          = uint32_t(StftDtype::Float32);
+        header.num_channels   = 2;
+        header.num_frames     = 4;
+        header.num_coeff      = 8;
+        header.data_offset    = stft_file_alignment;
+        header.channel_stride = stft_file_alignment;
+        header.sample_rate    = 44100.0;
+        header.window_size    = 1024;
+        header.window_step    = 256;
+        return header;
+    }
+
+    //header at the start of a zeroed file of 'size' bytes
+    std::string stft_file(const StftFileHeader& header, size_t size)
+    {
+        std::string file(size, '\0');
+        memcpy(&file[0], &header, sizeof(header));
+        return file;
+    }
+
+    bool parses(const StftFileHeader& header, size_t size)
+    {
+        std::string file = stft_file(header, size);
+        StftFileHeader parsed;
+        std::string error;
+        return parse_stft_header(file.data(), file.size(), parsed, error);
+    }
+
+    const size_t valid_size = 3 * stft_file_alignment;
+}
+
+NEUROSYNTH_TEST(stft_header_accepts_valid_layout)
+{
+    StftFileHeader header = valid_header();
+    CHECK(parses(header, valid_size));
+
+    //the last plane may end right at the end of the file
+    CHECK(parses(header, 2 * stft_file_alignment + 4 * 8 * sizeof(float)));
+    CHECK(!parses(header, 2 * stft_file_alignment + 4 * 8 * sizeof(float)
+                  - 1));
+}
+
+NEUROSYNTH_TEST(stft_header_rejects_overflowing_plane_size)
+{
+    //num_frames * num_coeff * value_size wraps around to 0
+    StftFileHeader header = valid_header();
+    header.num_frames = uint64_t(1) << 62;
+    header.num_coeff  = 4;
+    CHECK(!parses(header, valid_size));
+
+    header = valid_header();
+    header.num_frames = huge;
+    CHECK(!parses(header, valid_size));
+}
+
+NEUROSYNTH_TEST(stft_header_rejects_overflowing_channel_end)
+{
+    //(num_channels - 1) * channel_stride wraps around
+    StftFileHeader header = valid_header();
+    header.num_channels   = 3;
+    header.channel_stride = (huge / 2 + 1) / stft_file_alignment *
+        stft_file_alignment;
+    CHECK(!parses(header, valid_size));
+
+    //channel_stride larger than the file
+    header = valid_header();
+    header.channel_stride = 4 * stft_file_alignment;
+    CHECK(!parses(header, valid_size));
+
+    //more channels than the file holds planes
+    header = valid_header();
+    header.num_channels = 3;
+    CHECK(!parses(header, valid_size));
+    header.num_channels = std::numeric_limits<uint32_t>::max();
+    CHECK(!parses(header, valid_size));
+
+    //data_offset + ... wraps around
+    header = valid_header();
+    header.data_offset = huge - 3;
+    CHECK(!parses(header, valid_size));
+}
+
+NEUROSYNTH_TEST(stft_header_rejects_overflowing_quant_table)
+{
+    StftFileHeader header = valid_header();
+    header.dtype          = uint32_t(StftDtype::UInt8);
+    header.quantization   = uint32_t(StftQuantization::PerFrame);
+
+    //table right after the last channel stride, 8 bytes per frame and
+    //channel
+    size_t table_end = valid_size + 4 * 2 * 2 * sizeof(float);
+    CHECK(parses(header, table_end));
+    CHECK(!parses(header, table_end - 1));
+    CHECK(!parses(header, valid_size));
+
+    //planes that still fit, the table of their frames doesn't
+    header.num_frames = stft_file_alignment;
+    header.num_coeff  = 1;
+    CHECK(!parses(header, table_end));
+}
+
+NEUROSYNTH_TEST(stft_header_rejects_short_and_foreign_data)
+{
+    StftFileHeader header = valid_header();
+    std::string file = stft_file(header, valid_size);
+    StftFileHeader parsed;
+    std::string error;
+    CHECK(!parse_stft_header(file.data(), sizeof(header) - 1, parsed,
+                             error));
+
+    header.byte_order = 0x04030201;
+    CHECK(!parses(header, valid_size));
+
+    header = valid_header();
+    header.dtype = 17;
+    CHECK(!parses(header, valid_size));
+
+    header = valid_header();
+    header.num_channels = 0;
+    CHECK(!parses(header, valid_size));
+}
+
+NEUROSYNTH_TEST(stft_header_rejects_invalid_analysis_params)
+{
+    StftFileHeader header = valid_header();
+    header.fft_size = 2048;
+    CHECK(parses(header, valid_size));
+
+    header = valid_header();
+    header.window_step = 0;
+    CHECK(!parses(header, valid_size));
+    header.window_step = stft_file_max_window + 1;
+    CHECK(!parses(header, valid_size));
+
+    header = valid_header();
+    header.window_size = 1;
+    CHECK(!parses(header, valid_size));
+    header.window_size = huge;
+    CHECK(!parses(header, valid_size));
+
+    header = valid_header();
+    header.fft_size = 512;
+    CHECK(!parses(header, valid_size));
+
+    const double rates[] = {0.0, -44100.0, 1e300,
+                            std::numeric_limits<double>::quiet_NaN(),
+                            std::numeric_limits<double>::infinity()};
+    for(double rate : rates)
+    {
+        header = valid_header();
+        header.sample_rate = rate;
+        CHECK(!parses(header, valid_size));
+    }
+
+    header = valid_header();
+    header.window_type  = uint32_t(WindowType::SqrtHann);
+    header.filter_shape = uint32_t(FilterShape::Triangular);
+    CHECK(parses(header, valid_size));
+    header.window_type = uint32_t(WindowType::SqrtHann) + 1;
+    CHECK(!parses(header, valid_size));
+
+    header = valid_header();
+    header.filter_shape = uint32_t(FilterShape::Triangular) + 1;
+    CHECK(!parses(header, valid_size));
+    header.filter_shape = 0xffffffffu;
+    CHECK(!parses(header, valid_size));
+}
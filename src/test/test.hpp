@@ -0,0 +1,48 @@
+#ifndef NEUROSYNTH_TEST_HPP
+#define NEUROSYNTH_TEST_HPP
+
+#include <string>
+#include <vector>
+
+
+namespace neurosynth
+{
+    namespace test
+    {
+        struct TestCase
+        {
+            const char* name;
+            void      (*run)();
+        };
+
+        //every test of the binary, in the order they were linked
+        std::vector<TestCase>& registry();
+
+        //adds a test at static initialization, see NEUROSYNTH_TEST
+        struct Registration
+        {
+            Registration(const char* name, void (*run)())
+            {
+                registry().push_back({name, run});
+            }
+        };
+
+        //counts and reports a failed check, the test goes on
+        void check(bool ok, const char* expr, const char* file, int line);
+
+        //file in a fresh temporary directory, removed after the run
+        std::string temp_path(const std::string& name);
+    }
+}
+
+//defines a test, its body follows
+#define NEUROSYNTH_TEST(name)                                           \
+    static void test_##name();                                          \
+    static neurosynth::test::Registration                               \
+        registration_##name(#name, test_##name);                        \
+    static void test_##name()
+
+#define CHECK(expr) \
+    neurosynth::test::check(bool(expr), #expr, __FILE__, __LINE__)
+
+#endif
@@ -0,0 +1,73 @@
+#include "test.hpp"
+
+#include <boost/filesystem.hpp>
+
+#include <cstdio>
+
+
+namespace
+{
+    size_t num_failures = 0;
+
+    boost::filesystem::path& temp_dir()
+    {
+        static boost::filesystem::path dir =
+            boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("neurosynth-test-%%%%-%%%%");
+        return dir;
+    }
+}
+
+namespace neurosynth
+{
+    namespace test
+    {
+        std::vector<TestCase>& registry()
+        {
+            static std::vector<TestCase> tests;
+            return tests;
+        }
+
+        void check(bool ok, const char* expr, const char* file, int line)
+        {
+            if(ok)
+                return;
+            num_failures++;
+            std::fprintf(stderr, "%s:%d: check failed: %s\n",
+                         file, line, expr);
+        }
+
+        std::string temp_path(const std::string& name)
+        {
+            boost::filesystem::create_directories(temp_dir());
+            return (temp_dir() / name).string();
+        }
+    }
+}
+
+//runs every test, or those named on the command line
+int main(int argc, char** argv)
+{
+    using namespace neurosynth::test;
+
+    size_t num_run = 0;
+    for(const TestCase& test : registry())
+    {
+        bool selected = argc < 2;
+        for(int i = 1; i < argc; i++)
+            selected = selected || std::string(argv[i]) == test.name;
+        if(!selected)
+            continue;
+
+        size_t failures = num_failures;
+        test.run();
+        num_run++;
+        std::printf("%-40s %s\n", test.name,
+                    num_failures == failures ? "ok" : "FAILED");
+    }
+
+    boost::system::error_code error;
+    boost::filesystem::remove_all(temp_dir(), error);
+    std::printf("%zu tests, %zu failed checks\n", num_run, num_failures);
+    return num_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+#include "test.hpp"
+#include "util/wav_format.hpp"
+
+#include <cstdint>
+#include <sstream>
+
+
+namespace
+{
+    using namespace neurosynth;
+
+    void append_u32(std::string& out, uint32_t value)
+    {
+        for(int i = 0; i < 4; i++)
+            out.push_back(char(value >> (8 * i)));
+    }
+
+    void append_u16(std::string& out, uint16_t value)
+    {
+        out.push_back(char(value));
+        out.push_back(char(value >> 8));
+    }
+
+    //16-bit stereo pcm, sample i of the left channel is i, of the
+    //right one -i
+    std::string pcm_frames(size_t num_frames)
+    {
+        std::string pcm;
+        for(size_t i = 0; i < num_frames; i++)
+        {
+            append_u16(pcm, uint16_t(int16_t(i)));
+            append_u16(pcm, uint16_t(int16_t(-int(i))));
+        }
+        return pcm;
+    }
+
+    std::string fmt_chunk(uint32_t size = 16)
+    {
+        std::string chunk = "fmt ";
+        append_u32(chunk, size);
+        append_u16(chunk, 1);           //pcm
+        append_u16(chunk, 2);           //channels
+        append_u32(chunk, 44100);
+        append_u32(chunk, 44100 * 4);
+        append_u16(chunk, 4);           //block align
+        append_u16(chunk, 16);
+        chunk.resize(8 + size + (size & 1), '\0');
+        return chunk;
+    }
+
+    std::string riff(const std::string& chunks)
+    {
+        std::string file = "RIFF";
+        append_u32(file, uint32_t(4 + chunks.size()));
+        return file + "WAVE" + chunks;
+    }
+}
+
+NEUROSYNTH_TEST(wav_stream_read_never_exceeds_max_frames)
+{
+    //headerless input: the 12 bytes probed for a RIFF header are
+    //already 3 frames, read() must not hand them out all at once
+    Logger logger(test::temp_path("wav_stream.log"));
+    std::istringstream input(pcm_frames(10));
+    WavStreamReader reader(input, "pcm", logger);
+    CHECK(reader.good());
+
+    const float guard = 1234.0f;
+    for(size_t i = 0; i < 10; i++)
+    {
+        float out[4] = {0.0f, 0.0f, guard, guard};
+        CHECK(reader.read(out, 1) == 1);
+        CHECK(out[0] == float(i) / 32768.0f);
+        CHECK(out[1] == -float(i) / 32768.0f);
+        CHECK(out[2] == guard && out[3] == guard);
+    }
+
+    float out[2];
+    CHECK(reader.read(out, 1) == 0);
+}
+
+NEUROSYNTH_TEST(wav_stream_reads_rest_after_small_reads)
+{
+    Logger logger(test::temp_path("wav_stream.log"));
+    std::istringstream input(pcm_frames(7));
+    WavStreamReader reader(input, "pcm", logger);
+
+    std::vector<double> out(2 * 8);
+    CHECK(reader.read(out.data(), 2) == 2);
+    CHECK(reader.read(out.data() + 4, 8) == 5);
+    for(size_t i = 0; i < 7; i++)
+        CHECK(out[2 * i] == double(i) / 32768.0);
+}
+
+NEUROSYNTH_TEST(wav_stream_skips_unknown_chunks)
+{
+    //odd sized chunk, padded to even size
+    std::string list = "LIST";
+    append_u32(list, 3);
+    list += "abc";
+    list.push_back('\0');
+
+    std::string data = "data";
+    append_u32(data, 3 * 4);
+    std::string file = riff(fmt_chunk() + list + data + pcm_frames(3));
+
+    Logger logger(test::temp_path("wav_stream.log"));
+    std::istringstream input(file);
+    WavStreamReader reader(input, "wav", logger);
+    CHECK(reader.good());
+    CHECK(reader.frames_left() == 3);
+
+    double out[8];
+    CHECK(reader.read(out, 4) == 3);
+    CHECK(out[4] == 2.0 / 32768.0);
+}
+
+NEUROSYNTH_TEST(wav_stream_rejects_oversized_chunks)
+{
+    Logger logger(test::temp_path("wav_stream.log"));
+
+    //a chunk claiming 4GB is skipped, not allocated, input ends in it
+    std::string huge = "junk";
+    append_u32(huge, 0xFFFFFFF0u);
+    std::istringstream skipped(riff(fmt_chunk() + huge + "xyz"));
+    WavStreamReader reader(skipped, "wav", logger);
+    CHECK(!reader.good());
+
+    std::istringstream oversized(riff(fmt_chunk(1 << 20)));
+    WavStreamReader fmt_reader(oversized, "wav", logger);
+    CHECK(!fmt_reader.good());
+}
@@ -0,0 +1,170 @@
+#include "test.hpp"
+#include "util/wav_utils.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+
+namespace
+{
+    using namespace neurosynth;
+
+    template<class V>
+    void append(std::string& out, V value)
+    {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    //legacy header of 3 coefficients from 25 to 4200hz, 'value_size' 0
+    //leaves it out like the files written before the float32 pipeline
+    std::string legacy_header(size_t value_size)
+    {
+        std::string file;
+        append(file, size_t(3));
+        append(file, 25.0);
+        append(file, 4200.0);
+        if(value_size != 0)
+            append(file, value_size);
+        return file;
+    }
+
+    //L value of coefficient c of frame t is t + c / 10, R is its negative
+    template<class V>
+    void append_frames(std::string& file, size_t num_frames)
+    {
+        for(size_t t = 0; t < num_frames; t++)
+            for(size_t c = 0; c < 3; c++)
+            {
+                append(file, V(t + c / 10.0));
+                append(file, V(-(t + c / 10.0)));
+            }
+    }
+
+    bool load(const std::string& file, StftData<double>& stft_data)
+    {
+        std::string filename = test::temp_path("legacy.stf");
+        std::ofstream(filename, std::ios::binary) << file;
+        Logger logger(test::temp_path("wav_utils.log"));
+        StftParams params;
+        return load_stft(filename, stft_data, params, logger);
+    }
+
+    bool frames_match(const StftData<double>& stft_data, size_t num_frames,
+                      double tolerance)
+    {
+        if(stft_data.num_frames() != num_frames ||
+           stft_data.num_coeff() != 3 || stft_data.min_freq() != 25.0 ||
+           stft_data.max_freq() != 4200.0)
+            return false;
+        for(size_t t = 0; t < num_frames; t++)
+            for(size_t c = 0; c < 3; c++)
+            {
+                double value = t + c / 10.0;
+                if(std::abs(stft_data.row_l(t)[c] - value) > tolerance ||
+                   std::abs(stft_data.row_r(t)[c] + value) > tolerance)
+                    return false;
+            }
+        return true;
+    }
+
+    //headerless 16-bit stereo pcm of 'num_frames' frames of a chirp
+    std::string pcm_file(size_t num_frames)
+    {
+        std::string file;
+        for(size_t i = 0; i < num_frames; i++)
+        {
+            double t = double(i) / 44100.0;
+            double value = std::sin(2.0 * M_PI * (200.0 + 2000.0 * t) * t);
+            append(file, int16_t(10000.0 * value));
+            append(file, int16_t(-5000.0 * value));
+        }
+        return file;
+    }
+}
+
+NEUROSYNTH_TEST(legacy_stft_reads_baseline_layout)
+{
+    //doubles right after the frequency range
+    std::string file = legacy_header(0);
+    append_frames<double>(file, 5);
+    StftData<double> stft_data;
+    CHECK(load(file, stft_data));
+    CHECK(frames_match(stft_data, 5, 0.0));
+}
+
+NEUROSYNTH_TEST(legacy_stft_reads_sized_layout)
+{
+    std::string file = legacy_header(sizeof(double));
+    append_frames<double>(file, 4);
+    StftData<double> stft_data;
+    CHECK(load(file, stft_data));
+    CHECK(frames_match(stft_data, 4, 0.0));
+
+    file = legacy_header(sizeof(float));
+    append_frames<float>(file, 4);
+    CHECK(load(file, stft_data));
+    CHECK(frames_match(stft_data, 4, 1e-6));
+}
+
+NEUROSYNTH_TEST(legacy_stft_rejects_invalid_header)
+{
+    StftData<double> stft_data;
+    CHECK(!load(std::string(10, '\0'), stft_data));
+
+    std::string file;
+    append(file, size_t(0));
+    append(file, 25.0);
+    append(file, 4200.0);
+    CHECK(!load(file, stft_data));
+
+    file.clear();
+    append(file, ~size_t(0));
+    append(file, 25.0);
+    append(file, 4200.0);
+    append_frames<double>(file, 2);
+    CHECK(!load(file, stft_data));
+}
+
+NEUROSYNTH_TEST(stream_stft_hop_beyond_window_matches_batch)
+{
+    //samples between frames are skipped, across reads of any length
+    Logger logger(test::temp_path("wav_utils.log"));
+    StftCache cache(logger, FFTW_ESTIMATE);
+    std::string input_fn = test::temp_path("hop.raw");
+    std::ofstream(input_fn, std::ios::binary) << pcm_file(53333);
+
+    const size_t batch_sizes[] = {1, 3, 32};
+    for(size_t batch_size : batch_sizes)
+    {
+        StftParams params;
+        params.window_size = 1024;
+        params.window_step = 5000;
+        params.batch_size  = batch_size;
+
+        std::string output_fn = test::temp_path("hop.stf");
+        CHECK(stream_stft<double>(input_fn, output_fn, params, cache,
+                                  logger));
+        StftData<double> streamed;
+        load_stft(output_fn, streamed, logger);
+
+        WavData<double> wav_data;
+        CHECK(load_wav(input_fn, wav_data, logger));
+        StftData<double> batch;
+        stft(wav_data, batch, params, cache, logger);
+
+        //frames start every hop and end within the input
+        CHECK(batch.num_frames() == (53333 - 1024) / 5000 + 1);
+        CHECK(streamed.num_frames() == batch.num_frames());
+        bool same = streamed.num_frames() == batch.num_frames();
+        for(size_t t = 0; same && t < batch.num_frames(); t++)
+            for(size_t c = 0; c < batch.num_coeff(); c++)
+                same = same &&
+                    std::abs(streamed.row_l(t)[c] - batch.row_l(t)[c]) <
+                    1e-9 &&
+                    std::abs(streamed.row_r(t)[c] - batch.row_r(t)[c]) <
+                    1e-9;
+        CHECK(same);
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef NEUROSYNTH_ALIGNED_ALLOCATOR_HPP
+#define NEUROSYNTH_ALIGNED_ALLOCATOR_HPP
+
+#include "stage_stats.hpp"
+
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+
+namespace neurosynth
+{
+    //cache line alignment, also satisfies every SIMD width up to AVX-512
+    constexpr size_t simd_alignment = 64;
+
+    //rounds 'count' elements of T up so that consecutive
+    //blocks of that many elements stay simd_alignment aligned
+    template<class T>
+    constexpr size_t aligned_count(size_t count)
+    {
+        return (count * sizeof(T) + simd_alignment - 1) /
+            simd_alignment * simd_alignment / sizeof(T);
+    }
+
+    template<class T, size_t Alignment = simd_alignment>
+    class AlignedAllocator
+    {
+    public:
+        typedef T value_type;
+
+        template<class U>
+        struct rebind
+        {
+            typedef AlignedAllocator<U, Alignment> other;
+        };
+
+        AlignedAllocator() noexcept {}
+
+        template<class U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+        T* allocate(size_t n)
+        {
+            void* pointer = nullptr;
+            if(posix_memalign(&pointer, Alignment, n * sizeof(T)) != 0)
+                throw std::bad_alloc();
+#if NEUROSYNTH_STATS
+            stats_allocated(pointer);
+#endif
+            return static_cast<T*>(pointer);
+        }
+
+        void deallocate(T* pointer, size_t)
+        {
+#if NEUROSYNTH_STATS
+            if(pointer)
+                stats_freed(pointer);
+#endif
+            free(pointer);
+        }
+    };
+
+    template<class T, class U, size_t A>
+    bool operator==(const AlignedAllocator<T, A>&,
+                    const AlignedAllocator<U, A>&)
+    {
+        return true;
+    }
+
+    template<class T, class U, size_t A>
+    bool operator!=(const AlignedAllocator<T, A>&,
+                    const AlignedAllocator<U, A>&)
+    {
+        return false;
+    }
+
+    template<class T>
+    using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+}
+
+#endif
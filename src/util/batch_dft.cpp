@@ -0,0 +1,206 @@
+#include "batch_dft.hpp"
+#include "utils.hpp"
+
+#include <cmath>
+#include <limits>
+
+
+namespace neurosynth
+{
+    template<class T>
+    BatchDft<T>::BatchDft(size_t fft_size,
+                          size_t batch_size,
+                          FftPlanCache& plan_cache,
+                          Logger& logger)
+        : m_fft_size(fft_size),
+          m_batch_size(std::max<size_t>(batch_size, 1)),
+          m_real_dist(fft_real_dist<T>(fft_size)),
+          m_complex_dist(fft_complex_dist<T>(fft_size)),
+          m_frames(2 * m_batch_size * m_real_dist, T(0)),
+          m_spectra(2 * m_batch_size * m_complex_dist)
+    {
+        //both buffers come from AlignedVector, so aligned plans are safe
+        m_batch_plan = plan_cache.r2c_batch<T>(m_fft_size, 2 * m_batch_size,
+                                               true);
+        m_frame_plan = plan_cache.r2c<T>(m_fft_size, true);
+
+        if(!m_batch_plan || !m_frame_plan)
+            handle_error(logger, "Cannot create batched dft of size " +
+                         std::to_string(m_fft_size) + " x " +
+                         std::to_string(m_batch_size));
+    }
+
+    template<class T>
+    void BatchDft<T>::execute(size_t num_frames)
+    {
+        if(num_frames == m_batch_size)
+        {
+            Fftw<T>::execute_r2c(m_batch_plan, m_frames.data(),
+                                 m_spectra.data());
+            return;
+        }
+
+        for(size_t i = 0; i < num_frames; i++)
+        {
+            size_t slot_l = i;
+            size_t slot_r = m_batch_size + i;
+            Fftw<T>::execute_r2c(m_frame_plan,
+                                 &m_frames[slot_l * m_real_dist],
+                                 &m_spectra[slot_l * m_complex_dist]);
+            Fftw<T>::execute_r2c(m_frame_plan,
+                                 &m_frames[slot_r * m_real_dist],
+                                 &m_spectra[slot_r * m_complex_dist]);
+        }
+    }
+
+    template<class T>
+    StereoDft<T>::StereoDft(size_t fft_size,
+                            size_t batch_size,
+                            FftPlanCache& plan_cache,
+                            Logger& logger)
+        : m_fft_size(fft_size),
+          m_batch_size(std::max<size_t>(batch_size, 1)),
+          m_packed_dist(fft_packed_dist<T>(fft_size)),
+          m_frames(m_batch_size * m_packed_dist)
+    {
+        m_batch_plan = plan_cache.c2c_batch<T>(m_fft_size, m_batch_size,
+                                               true);
+        m_frame_plan = plan_cache.c2c_batch<T>(m_fft_size, 1, true);
+
+        if(!m_batch_plan || !m_frame_plan)
+            handle_error(logger, "Cannot create packed stereo dft of size " +
+                         std::to_string(m_fft_size) + " x " +
+                         std::to_string(m_batch_size));
+    }
+
+    template<class T>
+    T StereoDft<T>::tolerance() const
+    {
+        //fft rounding grows with log2 of the size, separating adds a
+        //few operations on top
+        return T(8) * std::numeric_limits<T>::epsilon() *
+            T(std::ceil(std::log2(double(std::max<size_t>(m_fft_size, 2)))));
+    }
+
+    template<class T>
+    void StereoDft<T>::execute(size_t num_frames)
+    {
+        if(num_frames == m_batch_size)
+        {
+            Fftw<T>::execute_c2c(m_batch_plan, m_frames.data());
+            return;
+        }
+
+        for(size_t i = 0; i < num_frames; i++)
+            Fftw<T>::execute_c2c(m_frame_plan, &m_frames[i * m_packed_dist]);
+    }
+
+    template<class T>
+    void StereoDft<T>::separate(size_t i,
+                                std::complex<T>* spectrum_l,
+                                std::complex<T>* spectrum_r) const
+    {
+        const T* __restrict__ z = reinterpret_cast<const T*>
+            (&m_frames[i * m_packed_dist]);
+        T* __restrict__ out_l = reinterpret_cast<T*>(spectrum_l);
+        T* __restrict__ out_r = reinterpret_cast<T*>(spectrum_r);
+        size_t M = m_fft_size;
+
+        //Z[0] is L[0] + i R[0], both real
+        out_l[0] = z[0];
+        out_l[1] = T(0);
+        out_r[0] = z[1];
+        out_r[1] = T(0);
+
+        #pragma omp simd
+        for(size_t k = 1; k <= M/2; k++)
+        {
+            T ar = z[2*k],       ai = z[2*k+1];
+            T br = z[2*(M-k)],   bi = z[2*(M-k)+1];
+            out_l[2*k]   = T(0.5) * (ar + br);
+            out_l[2*k+1] = T(0.5) * (ai - bi);
+            out_r[2*k]   = T(0.5) * (ai + bi);
+            out_r[2*k+1] = T(0.5) * (br - ar);
+        }
+    }
+
+    template<class T>
+    void StereoDft<T>::power_spectra(size_t i,
+                                     T* power_l,
+                                     T* power_r) const
+    {
+        const T* __restrict__ z = reinterpret_cast<const T*>
+            (&m_frames[i * m_packed_dist]);
+        T* __restrict__ out_l = power_l;
+        T* __restrict__ out_r = power_r;
+        size_t M = m_fft_size;
+
+        out_l[0] = z[0] * z[0];
+        out_r[0] = z[1] * z[1];
+
+        #pragma omp simd
+        for(size_t k = 1; k <= M/2; k++)
+        {
+            T ar = z[2*k],       ai = z[2*k+1];
+            T br = z[2*(M-k)],   bi = z[2*(M-k)+1];
+            T lr = ar + br, li = ai - bi;
+            T rr = ai + bi, ri = br - ar;
+            out_l[k] = T(0.25) * (lr * lr + li * li);
+            out_r[k] = T(0.25) * (rr * rr + ri * ri);
+        }
+    }
+
+    template<class T>
+    BatchIdft<T>::BatchIdft(size_t fft_size,
+                            size_t batch_size,
+                            FftPlanCache& plan_cache,
+                            Logger& logger)
+        : m_fft_size(fft_size),
+          m_batch_size(std::max<size_t>(batch_size, 1)),
+          m_real_dist(fft_real_dist<T>(fft_size)),
+          m_complex_dist(fft_complex_dist<T>(fft_size)),
+          m_frames(2 * m_batch_size * m_real_dist, T(0)),
+          m_spectra(2 * m_batch_size * m_complex_dist)
+    {
+        m_batch_plan = plan_cache.c2r_batch<T>(m_fft_size, 2 * m_batch_size,
+                                               true);
+        m_frame_plan = plan_cache.c2r<T>(m_fft_size, true);
+
+        if(!m_batch_plan || !m_frame_plan)
+            handle_error(logger, "Cannot create batched inverse dft of "
+                         "size " + std::to_string(m_fft_size) + " x " +
+                         std::to_string(m_batch_size));
+    }
+
+    template<class T>
+    void BatchIdft<T>::execute(size_t num_frames)
+    {
+        if(num_frames == m_batch_size)
+        {
+            Fftw<T>::execute_c2r(m_batch_plan, m_spectra.data(),
+                                 m_frames.data());
+            return;
+        }
+
+        for(size_t i = 0; i < num_frames; i++)
+        {
+            size_t slot_l = i;
+            size_t slot_r = m_batch_size + i;
+            Fftw<T>::execute_c2r(m_frame_plan,
+                                 &m_spectra[slot_l * m_complex_dist],
+                                 &m_frames[slot_l * m_real_dist]);
+            Fftw<T>::execute_c2r(m_frame_plan,
+                                 &m_spectra[slot_r * m_complex_dist],
+                                 &m_frames[slot_r * m_real_dist]);
+        }
+    }
+
+    template class BatchDft<double>;
+    template class BatchDft<float>;
+
+    template class StereoDft<double>;
+    template class StereoDft<float>;
+
+    template class BatchIdft<double>;
+    template class BatchIdft<float>;
+}
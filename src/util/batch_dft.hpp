@@ -0,0 +1,179 @@
+#ifndef NEUROSYNTH_BATCH_DFT_HPP
+#define NEUROSYNTH_BATCH_DFT_HPP
+
+#include "aligned_allocator.hpp"
+#include "fft_plan.hpp"
+#include "logger.hpp"
+
+#include <complex>
+
+
+namespace neurosynth
+{
+    //Transforms up to 'batch_size' stereo frames with a single
+    //fftw_plan_many_dft_r2c call. Frames of both channels live in one
+    //aligned buffer, left channel frames first, then right channel
+    //frames, each padded to fft_real_dist() elements. Callers fill
+    //frames in place, call execute() and read spectra back in place.
+    template<class T>
+    class BatchDft
+    {
+    public:
+        BatchDft(size_t fft_size,
+                 size_t batch_size,
+                 FftPlanCache& plan_cache,
+                 Logger& logger);
+
+        size_t fft_size() const { return m_fft_size; }
+        size_t batch_size() const { return m_batch_size; }
+        size_t spectrum_size() const { return m_fft_size/2 + 1; }
+
+        T* frame_l(size_t i)
+        {
+            return &m_frames[i * m_real_dist];
+        }
+
+        T* frame_r(size_t i)
+        {
+            return &m_frames[(m_batch_size + i) * m_real_dist];
+        }
+
+        const std::complex<T>* spectrum_l(size_t i) const
+        {
+            return &m_spectra[i * m_complex_dist];
+        }
+
+        const std::complex<T>* spectrum_r(size_t i) const
+        {
+            return &m_spectra[(m_batch_size + i) * m_complex_dist];
+        }
+
+        //transforms first 'num_frames' frames of both channels
+        //full batches go through the batched plan, a partial
+        //(last) batch falls back to the single frame plan
+        void execute(size_t num_frames);
+
+    private:
+        size_t m_fft_size;
+        size_t m_batch_size;
+        size_t m_real_dist;
+        size_t m_complex_dist;
+
+        AlignedVector<T>               m_frames;
+        AlignedVector<std::complex<T>> m_spectra;
+
+        typename Fftw<T>::plan m_batch_plan;
+        typename Fftw<T>::plan m_frame_plan;
+    };
+
+    //Stereo alternative to BatchDft with half the transforms: every
+    //frame is one complex transform of z = l + i r (left samples real,
+    //right samples imaginary part), the spectra are separated again by
+    //conjugate symmetry of real signals,
+    //  L[k] = (Z[k] + conj(Z[M-k])) / 2
+    //  R[k] = (Z[k] - conj(Z[M-k])) / 2i
+    //Callers fill packed frames in place, call execute() and separate
+    //spectra or power spectra. Results match BatchDft's up to
+    //rounding, tolerance() relative to the largest magnitude of the
+    //frame's spectra.
+    template<class T>
+    class StereoDft
+    {
+    public:
+        StereoDft(size_t fft_size,
+                  size_t batch_size,
+                  FftPlanCache& plan_cache,
+                  Logger& logger);
+
+        size_t fft_size() const { return m_fft_size; }
+        size_t batch_size() const { return m_batch_size; }
+        size_t spectrum_size() const { return m_fft_size/2 + 1; }
+
+        //max. deviation from the two-transform spectra, relative
+        T tolerance() const;
+
+        //fft_size() packed samples of frame 'i'
+        std::complex<T>* frame(size_t i)
+        {
+            return &m_frames[i * m_packed_dist];
+        }
+
+        //transforms first 'num_frames' frames in place; full batches
+        //go through the batched plan, a partial one frame by frame
+        void execute(size_t num_frames);
+
+        //spectrum_size() coefficients of both channels of frame 'i'
+        void separate(size_t i,
+                      std::complex<T>* spectrum_l,
+                      std::complex<T>* spectrum_r) const;
+
+        //|L[k]|^2 and |R[k]|^2 of frame 'i' straight from Z,
+        //without separated spectra in between
+        void power_spectra(size_t i, T* power_l, T* power_r) const;
+
+    private:
+        size_t m_fft_size;
+        size_t m_batch_size;
+        size_t m_packed_dist;
+
+        AlignedVector<std::complex<T>> m_frames;
+
+        typename Fftw<T>::plan m_batch_plan;
+        typename Fftw<T>::plan m_frame_plan;
+    };
+
+    //Inverse of BatchDft: callers fill spectra of up to 'batch_size'
+    //stereo frames in place, call execute() and read (unnormalized,
+    //i.e. scaled by fft_size) frames back in place. Layout is the same
+    //as BatchDft's. Spectra are destroyed by execute().
+    template<class T>
+    class BatchIdft
+    {
+    public:
+        BatchIdft(size_t fft_size,
+                  size_t batch_size,
+                  FftPlanCache& plan_cache,
+                  Logger& logger);
+
+        size_t fft_size() const { return m_fft_size; }
+        size_t batch_size() const { return m_batch_size; }
+        size_t spectrum_size() const { return m_fft_size/2 + 1; }
+
+        std::complex<T>* spectrum_l(size_t i)
+        {
+            return &m_spectra[i * m_complex_dist];
+        }
+
+        std::complex<T>* spectrum_r(size_t i)
+        {
+            return &m_spectra[(m_batch_size + i) * m_complex_dist];
+        }
+
+        const T* frame_l(size_t i) const
+        {
+            return &m_frames[i * m_real_dist];
+        }
+
+        const T* frame_r(size_t i) const
+        {
+            return &m_frames[(m_batch_size + i) * m_real_dist];
+        }
+
+        //transforms first 'num_frames' spectra of both channels
+        void execute(size_t num_frames);
+
+    private:
+        size_t m_fft_size;
+        size_t m_batch_size;
+        size_t m_real_dist;
+        size_t m_complex_dist;
+
+        AlignedVector<T>               m_frames;
+        AlignedVector<std::complex<T>> m_spectra;
+
+        typename Fftw<T>::plan m_batch_plan;
+        typename Fftw<T>::plan m_frame_plan;
+    };
+}
+
+#endif
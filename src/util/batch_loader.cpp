@@ -0,0 +1,330 @@
+#include "batch_loader.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+
+
+namespace neurosynth
+{
+    namespace
+    {
+        //splitmix64 finalizer: every input bit affects every output bit
+        uint64_t mix64(uint64_t x)
+        {
+            x ^= x >> 30;
+            x *= 0xbf58476d1ce4e5b9ULL;
+            x ^= x >> 27;
+            x *= 0x94d049bb133111ebULL;
+            x ^= x >> 31;
+            return x;
+        }
+
+        constexpr uint64_t golden_gamma = 0x9e3779b97f4a7c15ULL;
+
+        //key of the shuffle and jitter of one epoch
+        uint64_t epoch_key(uint64_t seed, uint64_t epoch)
+        {
+            return mix64(seed + golden_gamma * (epoch + 1));
+        }
+    }
+
+    FrameIndex::FrameIndex(size_t window_frames, size_t window_step)
+        : m_window_frames(window_frames),
+          m_window_step(window_step)
+    {
+    }
+
+    void FrameIndex::add_file(size_t num_frames)
+    {
+        uint64_t windows = num_frames >= m_window_frames ?
+            (num_frames - m_window_frames) / m_window_step + 1 : 0;
+        m_frames.push_back(num_frames);
+        m_ends.push_back(size() + windows);
+    }
+
+    FrameWindow FrameIndex::window(uint64_t i, size_t shift) const
+    {
+        size_t file = size_t(std::upper_bound(m_ends.begin(), m_ends.end(),
+                                              i) - m_ends.begin());
+        uint64_t before = file > 0 ? m_ends[file - 1] : 0;
+        size_t first = size_t(i - before) * m_window_step + shift;
+        return {file, std::min(first, m_frames[file] - m_window_frames)};
+    }
+
+    Permutation::Permutation(uint64_t size, uint64_t key)
+        : m_size(size),
+          m_key(key),
+          m_half_bits(1)
+    {
+        while(m_half_bits < 32 && (uint64_t(1) << (2 * m_half_bits)) < size)
+            m_half_bits++;
+        m_half_mask = (uint64_t(1) << m_half_bits) - 1;
+    }
+
+    uint64_t Permutation::encrypt(uint64_t x) const
+    {
+        uint64_t left  = x >> m_half_bits;
+        uint64_t right = x & m_half_mask;
+        for(uint64_t round = 0; round < 4; round++)
+        {
+            uint64_t f = mix64(right ^ (m_key + golden_gamma * round));
+            uint64_t next = left ^ (f & m_half_mask);
+            left  = right;
+            right = next;
+        }
+        return (left << m_half_bits) | right;
+    }
+
+    uint64_t Permutation::operator()(uint64_t i) const
+    {
+        //the network permutes a domain less than 4x larger, so the
+        //walk takes a few steps on average
+        uint64_t x = i;
+        do
+            x = encrypt(x);
+        while(x >= m_size);
+        return x;
+    }
+
+    template<class T>
+    BatchLoader<T>::BatchLoader(const std::vector<std::string>& files,
+                                const LoaderParams& params,
+                                Logger& logger)
+        : m_params(params),
+          m_index(params.window_frames,
+                  params.window_step != 0 ? params.window_step :
+                  params.window_frames),
+          m_num_coeff(0),
+          m_num_features(0),
+          m_per_shard(0),
+          m_batches_per_epoch(0),
+          m_num_batches(0),
+          m_claimed(0),
+          m_consumed(0),
+          m_stop(false)
+    {
+        if(m_params.window_step == 0)
+            m_params.window_step = m_params.window_frames;
+        if(m_params.window_frames == 0 || m_params.batch_size == 0)
+            handle_error(logger, "Loader windows and batches need at least "
+                         "one frame and example");
+        if(m_params.num_shards == 0 ||
+           m_params.shard >= m_params.num_shards)
+            handle_error(logger, "Loader shard " +
+                         std::to_string(m_params.shard) + " is not one of " +
+                         std::to_string(m_params.num_shards));
+        m_params.prefetch = std::max<size_t>(m_params.prefetch, 1);
+
+        std::vector<size_t> stream_sizes;
+        for(const std::string& filename : files)
+        {
+            std::unique_ptr<StftFile> file(new StftFile());
+            if(!file->open(filename, logger))
+                continue;
+            if(!file->is_container() || file->num_channels() != 2)
+            {
+                logger.warn("Skipping " + filename +
+                            ", not a L/R stft container");
+                continue;
+            }
+
+            std::vector<const StftStreamHeader*> streams;
+            for(const std::string& name : m_params.streams)
+                streams.push_back(file->stream(name));
+
+            bool first = m_files.empty();
+            bool match = first || file->num_coeff() == m_num_coeff;
+            for(size_t s = 0; s < streams.size() && match; s++)
+                match = streams[s] &&
+                    (first || streams[s]->num_coeff == stream_sizes[s]);
+            if(!match)
+            {
+                logger.warn("Skipping " + filename + ", its coefficients "
+                            "or streams differ from the first file's");
+                continue;
+            }
+
+            if(first)
+            {
+                m_num_coeff    = file->num_coeff();
+                m_num_features = m_num_coeff;
+                for(const StftStreamHeader* stream : streams)
+                {
+                    stream_sizes.push_back(stream->num_coeff);
+                    m_num_features += stream->num_coeff;
+                }
+            }
+            m_index.add_file(file->num_frames());
+            m_files.push_back(std::move(file));
+            m_streams.push_back(std::move(streams));
+        }
+
+        //shards get equal shares so data parallel jobs stay in step
+        m_per_shard = m_index.size() / m_params.num_shards;
+        m_batches_per_epoch = m_params.drop_last ?
+            m_per_shard / m_params.batch_size :
+            (m_per_shard + m_params.batch_size - 1) / m_params.batch_size;
+        m_num_batches = m_params.num_epochs * m_batches_per_epoch;
+
+        logger.info("Loader: " + std::to_string(m_files.size()) + " of " +
+                    std::to_string(files.size()) + " files, " +
+                    std::to_string(m_index.size()) + " windows of " +
+                    std::to_string(m_params.window_frames) + " frames, " +
+                    std::to_string(m_num_features) + " features; " +
+                    std::to_string(m_batches_per_epoch) +
+                    " batches per epoch of shard " +
+                    std::to_string(m_params.shard) + "/" +
+                    std::to_string(m_params.num_shards));
+        if(m_batches_per_epoch == 0)
+            logger.warn("Loader has no complete batch to serve");
+
+        m_slots.resize(m_params.prefetch);
+        size_t num_threads = resolve_num_threads(m_params.num_threads);
+        for(size_t i = 0; i < num_threads; i++)
+            m_workers.emplace_back(&BatchLoader::run, this);
+    }
+
+    template<class T>
+    BatchLoader<T>::~BatchLoader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_claim_cv.notify_all();
+
+        for(std::thread& worker : m_workers)
+            worker.join();
+    }
+
+    template<class T>
+    bool BatchLoader<T>::next(FrameBatch<T>& batch)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if(finished(m_consumed))
+            return false;
+
+        Slot& slot = m_slots[m_consumed % m_slots.size()];
+        m_ready_cv.wait(lock, [&] {
+                return slot.ready && slot.number == m_consumed;
+            });
+
+        //the caller's old buffers are filled next
+        std::swap(batch, slot.batch);
+        slot.ready = false;
+        m_consumed++;
+        lock.unlock();
+        m_claim_cv.notify_all();
+        return true;
+    }
+
+    template<class T>
+    void BatchLoader<T>::run()
+    {
+        std::vector<T> scratch;
+        while(true)
+        {
+            uint64_t number;
+            Slot* slot;
+            {
+                //a slot is free once the batch before in it is consumed
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_claim_cv.wait(lock, [this] {
+                        return m_stop || finished(m_claimed) ||
+                            m_claimed < m_consumed + m_slots.size();
+                    });
+                if(m_stop || finished(m_claimed))
+                    return;
+
+                number = m_claimed++;
+                slot = &m_slots[number % m_slots.size()];
+            }
+
+            fill(slot->batch, number, scratch);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                slot->number = number;
+                slot->ready  = true;
+            }
+            m_ready_cv.notify_all();
+        }
+    }
+
+    template<class T>
+    void BatchLoader<T>::fill(FrameBatch<T>& batch,
+                              uint64_t number,
+                              std::vector<T>& scratch) const
+    {
+        uint64_t epoch = number / m_batches_per_epoch;
+        uint64_t first = number % m_batches_per_epoch * m_params.batch_size;
+        size_t   size  = size_t(std::min<uint64_t>(m_params.batch_size,
+                                                   m_per_shard - first));
+
+        batch.epoch        = size_t(epoch);
+        batch.index        = size_t(number % m_batches_per_epoch);
+        batch.size         = size;
+        batch.num_channels = 2;
+        batch.num_frames   = m_params.window_frames;
+        batch.num_features = m_num_features;
+        batch.data.resize(size * batch.example_size());
+        batch.windows.resize(size);
+
+        uint64_t key = epoch_key(m_params.seed, epoch);
+        Permutation order(m_index.size(), key);
+        size_t rows = m_params.window_frames * m_num_features;
+        for(size_t i = 0; i < size; i++)
+        {
+            //shards take every num_shards-th example of the epoch
+            uint64_t position = (first + i) * m_params.num_shards +
+                m_params.shard;
+            uint64_t w = m_params.shuffle ? order(position) : position;
+            size_t shift = m_params.jitter ?
+                size_t(mix64(key ^ w) % m_params.window_step) : 0;
+
+            FrameWindow window = m_index.window(w, shift);
+            batch.windows[i] = window;
+            T* out = batch.example(i);
+            read_example(window, 0, out, scratch);
+            read_example(window, 1, out + rows, scratch);
+        }
+    }
+
+    template<class T>
+    void BatchLoader<T>::read_example(const FrameWindow& window,
+                                      size_t channel,
+                                      T* out,
+                                      std::vector<T>& scratch) const
+    {
+        const StftFile& file = *m_files[window.file];
+        size_t frames = m_params.window_frames;
+        if(m_num_features == m_num_coeff)
+        {
+            file.read_rows(channel, window.first, frames, out);
+            return;
+        }
+
+        //rows of each part are decoded together, then spread out
+        scratch.resize(frames * m_num_features);
+        file.read_rows(channel, window.first, frames, scratch.data());
+        for(size_t t = 0; t < frames; t++)
+            std::copy_n(&scratch[t * m_num_coeff], m_num_coeff,
+                        out + t * m_num_features);
+
+        size_t column = m_num_coeff;
+        for(const StftStreamHeader* stream : m_streams[window.file])
+        {
+            size_t width = stream->num_coeff;
+            file.read_stream_rows(*stream, channel, window.first, frames,
+                                  scratch.data());
+            for(size_t t = 0; t < frames; t++)
+                std::copy_n(&scratch[t * width], width,
+                            out + t * m_num_features + column);
+            column += width;
+        }
+    }
+
+    template class BatchLoader<double>;
+    template class BatchLoader<float>;
+}
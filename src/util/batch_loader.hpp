@@ -0,0 +1,204 @@
+#ifndef NEUROSYNTH_BATCH_LOADER_HPP
+#define NEUROSYNTH_BATCH_LOADER_HPP
+
+#include "aligned_allocator.hpp"
+#include "logger.hpp"
+#include "stft_file.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace neurosynth
+{
+    struct LoaderParams
+    {
+        size_t window_frames = 64;    // frames per example
+        size_t window_step   = 0;     // frames between example starts,
+                                      // 0 - window_frames
+        size_t batch_size    = 32;    // examples per batch
+        std::vector<std::string> streams; // appended to every frame's
+                                          // features, e.g. mfcc
+        uint64_t seed        = 0;     // of the shuffles
+        bool   shuffle       = true;  // new example order every epoch
+        bool   jitter        = false; // move examples by up to
+                                      // window_step - 1 frames per epoch
+        bool   drop_last     = false; // no smaller last batch
+        size_t num_epochs    = 1;     // 0 - endless
+        size_t shard         = 0;     // this process' share of every
+        size_t num_shards    = 1;     // epoch, for data parallel jobs
+        size_t num_threads   = 2;     // prefetch threads, 0 - one per
+                                      // hardware thread
+        size_t prefetch      = 8;     // batches loaded ahead
+    };
+
+    //first frame of an example and the file it comes from
+    struct FrameWindow
+    {
+        size_t file;
+        size_t first;
+    };
+
+    //Examples of every file: windows of 'window_frames' frames,
+    //'window_step' apart. Only the running count of windows per file
+    //is kept, a window is found by binary search over the files.
+    class FrameIndex
+    {
+    public:
+        FrameIndex(size_t window_frames, size_t window_step);
+
+        //next file; files shorter than a window add no windows
+        void add_file(size_t num_frames);
+
+        size_t num_files() const { return m_ends.size(); }
+        size_t num_frames(size_t file) const { return m_frames[file]; }
+        uint64_t size() const { return m_ends.empty() ? 0 : m_ends.back(); }
+
+        //window 'i' moved by 'shift' frames, within its file
+        FrameWindow window(uint64_t i, size_t shift = 0) const;
+
+    private:
+        size_t                m_window_frames;
+        size_t                m_window_step;
+        std::vector<size_t>   m_frames;
+        std::vector<uint64_t> m_ends;  //windows of files up to this one
+    };
+
+    //Pseudo-random permutation of [0, size) evaluated one position at
+    //a time: a 4-round Feistel network keyed by 'key' over the next
+    //even power of two, walking the cycle until it lands in range.
+    //Needs no memory however large 'size' is, and any position can be
+    //computed by any thread.
+    class Permutation
+    {
+    public:
+        Permutation(uint64_t size, uint64_t key);
+
+        uint64_t operator()(uint64_t i) const;
+
+    private:
+        uint64_t m_size;
+        uint64_t m_key;
+        unsigned m_half_bits;
+        uint64_t m_half_mask;
+
+        uint64_t encrypt(uint64_t x) const;
+    };
+
+    //One minibatch as a contiguous tensor
+    //[size x channels x num_frames x num_features]: frames of an
+    //example are consecutive rows, each row the band energies then
+    //the requested streams.
+    template<class T>
+    struct FrameBatch
+    {
+        size_t epoch        = 0;
+        size_t index        = 0; // of the batch in its epoch
+        size_t size         = 0; // examples, batch_size but for the last
+        size_t num_channels = 2;
+        size_t num_frames   = 0;
+        size_t num_features = 0;
+        AlignedVector<T>         data;
+        std::vector<FrameWindow> windows; // source of every example
+
+        size_t example_size() const
+        {
+            return num_channels * num_frames * num_features;
+        }
+
+        T* example(size_t i) { return data.data() + i * example_size(); }
+
+        const T* example(size_t i) const
+        {
+            return data.data() + i * example_size();
+        }
+    };
+
+    //Serves fixed-length frame windows of many stft containers as
+    //minibatches for training. Files stay memory mapped (for random
+    //access), examples are decoded straight from the mappings into
+    //the batch, so any stored dtype works. Every epoch visits the
+    //examples of its shard once, in an order that only depends on
+    //seed and epoch.
+    //Prefetch threads fill the next 'prefetch' batches in the
+    //background, next() hands them out in order; buffers go back and
+    //forth between caller and loader, nothing is allocated once every
+    //buffer has been used.
+    template<class T>
+    class BatchLoader
+    {
+    public:
+        //files that are not L/R containers or don't match the first one
+        //(coefficients, streams) are skipped with a warning
+        BatchLoader(const std::vector<std::string>& files,
+                    const LoaderParams& params,
+                    Logger& logger);
+
+        ~BatchLoader();
+
+        BatchLoader(const BatchLoader&) = delete;
+        BatchLoader& operator=(const BatchLoader&) = delete;
+
+        //next batch, waits until it is loaded; false after the last
+        //epoch (never if params.num_epochs is 0)
+        bool next(FrameBatch<T>& batch);
+
+        size_t num_files() const { return m_index.num_files(); }
+        uint64_t num_windows() const { return m_index.size(); }
+        size_t num_features() const { return m_num_features; }
+        uint64_t batches_per_epoch() const { return m_batches_per_epoch; }
+
+    private:
+        struct Slot
+        {
+            FrameBatch<T> batch;
+            uint64_t      number = 0;
+            bool          ready  = false;
+        };
+
+        LoaderParams                          m_params;
+        std::vector<std::unique_ptr<StftFile>> m_files;
+        std::vector<std::vector<const StftStreamHeader*>> m_streams;
+        FrameIndex                            m_index;
+        size_t                                m_num_coeff;
+        size_t                                m_num_features;
+        uint64_t                              m_per_shard;
+        uint64_t                              m_batches_per_epoch;
+        uint64_t                              m_num_batches; //0 - endless
+
+        std::vector<Slot>                     m_slots;
+        std::vector<std::thread>              m_workers;
+        std::mutex                            m_mutex;
+        std::condition_variable               m_claim_cv;
+        std::condition_variable               m_ready_cv;
+        uint64_t                              m_claimed;
+        uint64_t                              m_consumed;
+        bool                                  m_stop;
+
+        bool finished(uint64_t number) const
+        {
+            return m_batches_per_epoch == 0 ||
+                (m_num_batches != 0 && number >= m_num_batches);
+        }
+
+        void run();
+
+        //loads batch 'number' counted over all epochs
+        void fill(FrameBatch<T>& batch,
+                  uint64_t number,
+                  std::vector<T>& scratch) const;
+
+        //rows of 'window' of one channel to 'out', num_features apart
+        void read_example(const FrameWindow& window,
+                          size_t channel,
+                          T* out,
+                          std::vector<T>& scratch) const;
+    };
+}
+
+#endif
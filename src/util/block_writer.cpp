@@ -0,0 +1,179 @@
+#include "block_writer.hpp"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace neurosynth
+{
+    namespace
+    {
+        //write() may accept only a part of the data or be interrupted
+        bool write_all(int fd, const char* data, size_t size)
+        {
+            while(size > 0)
+            {
+                ssize_t written = ::write(fd, data, size);
+                if(written < 0)
+                {
+                    if(errno == EINTR)
+                        continue;
+                    return false;
+                }
+                data += written;
+                size -= size_t(written);
+            }
+            return true;
+        }
+    }
+
+    BlockWriter::BlockWriter(int fd, size_t block_size)
+        : m_fd(fd),
+          m_block_size(std::max<size_t>(block_size, 1)),
+          m_active(0),
+          m_fill(0),
+          m_bytes(0),
+          m_pending(false),
+          m_pending_block(0),
+          m_pending_size(0),
+          m_stop(false),
+          m_failed(false)
+    {
+        m_blocks[0].resize(m_block_size);
+        m_blocks[1].resize(m_block_size);
+        m_thread = std::thread(&BlockWriter::run, this);
+    }
+
+    BlockWriter::~BlockWriter()
+    {
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+    }
+
+    void BlockWriter::write(const void* data, size_t size)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        m_bytes += size;
+        while(size > 0)
+        {
+            size_t count = std::min(size, m_block_size - m_fill);
+            memcpy(&m_blocks[m_active][m_fill], bytes, count);
+            m_fill += count;
+            bytes  += count;
+            size   -= count;
+            if(m_fill == m_block_size)
+                submit();
+        }
+    }
+
+    void BlockWriter::write_zeros(size_t size)
+    {
+        m_bytes += size;
+        while(size > 0)
+        {
+            size_t count = std::min(size, m_block_size - m_fill);
+            memset(&m_blocks[m_active][m_fill], 0, count);
+            m_fill += count;
+            size   -= count;
+            if(m_fill == m_block_size)
+                submit();
+        }
+    }
+
+    void BlockWriter::flush()
+    {
+        if(m_fill > 0)
+            submit();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() { return !m_pending; });
+    }
+
+    void BlockWriter::submit()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() { return !m_pending; });
+        m_pending       = true;
+        m_pending_block = m_active;
+        m_pending_size  = m_fill;
+        lock.unlock();
+        m_cv.notify_all();
+
+        //the writer thread owns the submitted block until m_pending
+        //is cleared, keep filling the other one meanwhile
+        m_active ^= 1;
+        m_fill    = 0;
+    }
+
+    void BlockWriter::run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for(;;)
+        {
+            m_cv.wait(lock, [this]() { return m_pending || m_stop; });
+            if(!m_pending)
+                return;
+
+            const char* block = m_blocks[m_pending_block].data();
+            size_t size = m_pending_size;
+            lock.unlock();
+
+            if(!m_failed && !write_all(m_fd, block, size))
+                m_failed = true;
+
+            lock.lock();
+            m_pending = false;
+            m_cv.notify_all();
+        }
+    }
+
+    int open_output(const std::string& filename, Logger& logger)
+    {
+        if(filename == "-")
+        {
+            //anything already in cout's buffer has to come first
+            std::cout.flush();
+            return STDOUT_FILENO;
+        }
+
+        //a file with other hard links (a feature cache entry) is
+        //replaced, truncating it would change every link
+        struct stat file_stat;
+        if(::stat(filename.c_str(), &file_stat) == 0 &&
+           S_ISREG(file_stat.st_mode) && file_stat.st_nlink > 1)
+            ::unlink(filename.c_str());
+
+        int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd == -1)
+            logger.warn("Cannot open file: " + filename +
+                        " - error: " + strerror(errno));
+        return fd;
+    }
+
+    void close_output(int fd)
+    {
+        if(fd >= 0 && fd != STDOUT_FILENO)
+            ::close(fd);
+    }
+
+    bool is_seekable_output(const std::string& filename)
+    {
+        if(filename == "-")
+            return ::lseek(STDOUT_FILENO, 0, SEEK_CUR) != -1;
+
+        //files that don't exist yet are created as regular ones
+        struct stat file_stat;
+        return ::stat(filename.c_str(), &file_stat) != 0 ||
+            !(S_ISFIFO(file_stat.st_mode) || S_ISSOCK(file_stat.st_mode));
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef NEUROSYNTH_BLOCK_WRITER_HPP
+#define NEUROSYNTH_BLOCK_WRITER_HPP
+
+#include "aligned_allocator.hpp"
+#include "logger.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+namespace neurosynth
+{
+    //Double buffered writer of a file descriptor. Callers fill one
+    //block while a background thread writes the other one, so the
+    //output is written with few large write() calls that overlap with
+    //the computation producing it. The descriptor is not owned.
+    class BlockWriter
+    {
+    public:
+        explicit BlockWriter(int fd, size_t block_size = 1 << 20);
+
+        //flushes remaining data
+        ~BlockWriter();
+
+        BlockWriter(const BlockWriter&) = delete;
+        BlockWriter& operator=(const BlockWriter&) = delete;
+
+        void write(const void* data, size_t size);
+
+        void write_zeros(size_t size);
+
+        //blocks until everything written so far reached the descriptor
+        void flush();
+
+        //false once any write() to the descriptor failed
+        bool good() const { return !m_failed; }
+
+        uint64_t bytes_written() const { return m_bytes; }
+
+    private:
+        int                     m_fd;
+        size_t                  m_block_size;
+        AlignedVector<char>     m_blocks[2];
+        size_t                  m_active;  //block being filled
+        size_t                  m_fill;    //bytes in active block
+        uint64_t                m_bytes;
+
+        std::mutex              m_mutex;
+        std::condition_variable m_cv;
+        bool                    m_pending; //a block awaits writing
+        size_t                  m_pending_block;
+        size_t                  m_pending_size;
+        bool                    m_stop;
+        std::atomic<bool>       m_failed;
+        std::thread             m_thread;
+
+        //hands active block to the writer thread
+        void submit();
+
+        void run();
+    };
+
+    //descriptor for writing 'filename' (created/truncated, replaced if
+    //hard linked elsewhere), "-" is stdout, returns -1 (and logs) on
+    //failure
+    int open_output(const std::string& filename, Logger& logger);
+
+    //closes descriptor returned by open_output() (keeps stdout open)
+    void close_output(int fd);
+
+    //false if 'filename' ("-" is stdout) is a pipe or socket, whose
+    //output can't be completed in place once written
+    bool is_seekable_output(const std::string& filename);
+}
+
+#endif
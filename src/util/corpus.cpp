@@ -0,0 +1,148 @@
+#include "corpus.hpp"
+#include "utils.hpp"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+
+
+namespace neurosynth
+{
+    namespace fs = boost::filesystem;
+
+    namespace
+    {
+        bool is_audio_file(const fs::path& path)
+        {
+            std::string extension = path.extension().string();
+            std::transform(extension.begin(), extension.end(),
+                           extension.begin(), ::tolower);
+            return extension == ".wav" || extension == ".raw";
+        }
+
+        bool list_directory(const fs::path& dir,
+                            const fs::path& output_dir,
+                            const std::string& extension,
+                            std::vector<CorpusEntry>& entries,
+                            Logger& logger)
+        {
+            boost::system::error_code error;
+            fs::recursive_directory_iterator it(dir, error);
+            for(; !error && it != fs::recursive_directory_iterator();
+                it.increment(error))
+            {
+                if(!fs::is_regular_file(it->status()) ||
+                   !is_audio_file(it->path()))
+                    continue;
+
+                fs::path output = output_dir /
+                    it->path().lexically_relative(dir);
+                output.replace_extension(extension);
+                entries.push_back({it->path().string(), output.string(), 0});
+            }
+
+            if(error)
+            {
+                logger.warn("Cannot list directory: " + dir.string() +
+                            " - error: " + error.message());
+                return false;
+            }
+            return true;
+        }
+
+        bool list_manifest(const fs::path& manifest,
+                           const fs::path& output_dir,
+                           const std::string& extension,
+                           std::vector<CorpusEntry>& entries,
+                           Logger& logger)
+        {
+            std::ifstream stream(manifest.string());
+            if(!stream)
+            {
+                logger.warn("Cannot open file: " + manifest.string());
+                return false;
+            }
+
+            fs::path base = manifest.parent_path();
+            std::string line;
+            while(std::getline(stream, line))
+            {
+                if(!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                if(line.empty() || line[0] == '#')
+                    continue;
+
+                std::vector<std::string> fields = split('\t', line);
+                fs::path input(fields[0]);
+                if(input.is_relative())
+                    input = base / input;
+
+                fs::path output;
+                if(fields.size() > 1 && !fields[1].empty())
+                {
+                    output = fields[1];
+                    if(output.is_relative())
+                        output = output_dir / output;
+                }
+                else
+                {
+                    output = output_dir / input.filename();
+                    output.replace_extension(extension);
+                }
+                entries.push_back({input.string(), output.string(), 0});
+            }
+            return true;
+        }
+    }
+
+    bool list_corpus(const std::string& corpus,
+                     const std::string& output_dir,
+                     const std::string& extension,
+                     std::vector<CorpusEntry>& entries,
+                     Logger& logger)
+    {
+        entries.clear();
+
+        bool listed = fs::is_directory(corpus) ?
+            list_directory(corpus, output_dir, extension, entries, logger) :
+            list_manifest(corpus, output_dir, extension, entries, logger);
+        if(!listed)
+            return false;
+
+        //size stands in for duration, unreadable inputs are kept so
+        //they get reported with the other per-file errors
+        for(CorpusEntry& entry : entries)
+        {
+            boost::system::error_code error;
+            entry.size = fs::file_size(entry.input, error);
+            if(error)
+                entry.size = 0;
+        }
+
+        std::sort(entries.begin(), entries.end(),
+                  [](const CorpusEntry& a, const CorpusEntry& b) {
+                      return a.size != b.size ? a.size > b.size :
+                          a.input < b.input;
+                  });
+
+        //two entries writing the same output would race
+        std::set<std::string> outputs;
+        auto duplicate = [&](const CorpusEntry& entry)
+        {
+            if(outputs.insert(entry.output).second)
+                return false;
+            logger.warn("Skipping " + entry.input + ", output " +
+                        entry.output + " is written for another input");
+            return true;
+        };
+        entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                     duplicate),
+                      entries.end());
+
+        logger.info("Listed " + std::to_string(entries.size()) +
+                    " files of corpus: " + corpus);
+        return true;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef NEUROSYNTH_CORPUS_HPP
+#define NEUROSYNTH_CORPUS_HPP
+
+#include "logger.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace neurosynth
+{
+    struct CorpusEntry
+    {
+        std::string input;
+        std::string output;
+        uintmax_t   size;   //input size in bytes
+    };
+
+    //Lists the files of a corpus, largest first. 'corpus' is either a
+    //directory, searched recursively for .wav and .raw files, or a
+    //manifest with one input path per line, optionally followed by a
+    //tab and the output path. Empty lines and lines starting with #
+    //are skipped, relative manifest paths are relative to the
+    //manifest's directory.
+    //Outputs go to 'output_dir': directory inputs keep their relative
+    //path, manifest inputs without an output keep their file name,
+    //'extension' replaces the input's one either way.
+    //Returns false if the corpus cannot be read.
+    bool list_corpus(const std::string& corpus,
+                     const std::string& output_dir,
+                     const std::string& extension,
+                     std::vector<CorpusEntry>& entries,
+                     Logger& logger);
+}
+
+#endif
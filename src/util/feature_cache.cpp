@@ -0,0 +1,242 @@
+#include "feature_cache.hpp"
+#include "hash.hpp"
+#include "mapped_file.hpp"
+#include "stft_file.hpp"
+#include "wav_format.hpp"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <sstream>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+
+namespace neurosynth
+{
+    namespace fs = boost::filesystem;
+
+    namespace
+    {
+        //bump whenever the analysis changes its results for the same
+        //parameters, stale entries then simply stop being hit
+        constexpr uint32_t feature_cache_version = 1;
+
+        const char temp_suffix[] = ".tmp";
+
+        bool is_temp(const std::string& name)
+        {
+            size_t length = sizeof(temp_suffix) - 1;
+            return name.size() > length &&
+                name.compare(name.size() - length, length, temp_suffix) == 0;
+        }
+
+        //hard links 'from' to 'to', copies where links are impossible
+        bool link_or_copy(const std::string& from, const std::string& to)
+        {
+            if(::link(from.c_str(), to.c_str()) == 0)
+                return true;
+            if(errno != EXDEV && errno != EPERM && errno != EMLINK)
+                return false;
+
+            boost::system::error_code error;
+            fs::copy_file(from, to, error);
+            return !error;
+        }
+    }
+
+    FeatureCache::FeatureCache(const std::string& directory,
+                               uint64_t max_bytes,
+                               Logger& logger)
+        : m_directory(directory),
+          m_max_bytes(max_bytes),
+          m_logger(logger),
+          m_hits(0),
+          m_misses(0),
+          m_num_temp(0)
+    {
+        boost::system::error_code error;
+        fs::create_directories(directory, error);
+        if(error)
+            logger.warn("Cannot create feature cache: " + directory +
+                        " - error: " + error.message());
+    }
+
+    std::string FeatureCache::key(const std::string& input_fn,
+                                  const StftParams& params,
+                                  FftPrecision precision,
+                                  StftOutput output,
+                                  StftEncoding encoding)
+    {
+        //random access: only the samples are read, once
+        MappedFile file;
+        if(!file.open(input_fn, m_logger, false))
+            return std::string();
+
+        WavFormat format;
+        if(is_riff_wave(file.data(), file.size()))
+        {
+            std::string error;
+            if(!parse_wav_header(file.data(), file.size(), format, error))
+                return std::string();
+        }
+        else
+            format.data_size = file.size();
+
+        double sample_rate = format.sample_rate != 0 ?
+            double(format.sample_rate) : params.sample_rate;
+
+        //batch size, threads and planner effort don't change results
+        std::ostringstream config;
+        config.precision(17);
+        config << feature_cache_version << ' ' << stft_file_version << ' '
+               << int(format.encoding) << ' ' << format.channels << ' '
+               << format.bits_per_sample << ' ' << format.block_align << ' '
+               << sample_rate << ' '
+               << params.window_size << ' ' << stft_fft_size(params) << ' '
+               << params.window_step << ' ' << params.num_coeff << ' '
+               << params.min_freq << ' ' << params.max_freq << ' '
+               << int(params.filter_shape) << ' '
+               << int(params.window_type) << ' '
+               << params.packed_stereo << ' ' << params.num_mfcc << ' '
+               << params.delta_order << ' ' << params.delta_width << ' '
+               << params.chroma << ' ' << params.resample_rate << ' '
+               << params.decimate << ' '
+               << int(precision) << ' ' << int(output) << ' '
+               << int(encoding);
+        std::string config_str = config.str();
+
+        uint64_t samples_hash = hash64(file.data() + format.data_offset,
+                                       format.data_size);
+        uint64_t config_hash  = hash64(config_str.data(), config_str.size());
+        return hex64(samples_hash) + "-" + hex64(config_hash);
+    }
+
+    std::string FeatureCache::entry_path(const std::string& key) const
+    {
+        return (fs::path(m_directory) / key).string();
+    }
+
+    bool FeatureCache::fetch(const std::string& key,
+                             const std::string& output_fn)
+    {
+        std::string entry = entry_path(key);
+        struct stat entry_stat;
+        if(::stat(entry.c_str(), &entry_stat) != 0)
+        {
+            m_misses++;
+            return false;
+        }
+
+        //a link can't replace a file, nor may it be truncated
+        if(::unlink(output_fn.c_str()) != 0 && errno != ENOENT)
+        {
+            m_logger.warn("Cannot replace " + output_fn + " - error: " +
+                          strerror(errno));
+            m_misses++;
+            return false;
+        }
+        if(!link_or_copy(entry, output_fn))
+        {
+            m_logger.warn("Cannot place feature cache entry " + key +
+                          " at " + output_fn + " - error: " +
+                          strerror(errno));
+            m_misses++;
+            return false;
+        }
+
+        //most recently used now
+        ::utimensat(AT_FDCWD, entry.c_str(), nullptr, 0);
+
+        m_hits++;
+        m_logger.info("Feature cache hit " + key + " -> " + output_fn);
+        return true;
+    }
+
+    void FeatureCache::store(const std::string& key,
+                             const std::string& output_fn)
+    {
+        //renamed into place whole, readers never see a partial entry
+        std::string entry = entry_path(key);
+        std::string temp  = entry + "." + std::to_string(::getpid()) + "." +
+            std::to_string(m_num_temp++) + temp_suffix;
+
+        if(!link_or_copy(output_fn, temp))
+        {
+            m_logger.warn("Cannot add " + output_fn + " to feature cache - "
+                          "error: " + strerror(errno));
+            ::unlink(temp.c_str());
+            return;
+        }
+        if(::rename(temp.c_str(), entry.c_str()) != 0)
+        {
+            m_logger.warn("Cannot add " + output_fn + " to feature cache - "
+                          "error: " + strerror(errno));
+            ::unlink(temp.c_str());
+        }
+    }
+
+    void FeatureCache::trim()
+    {
+        struct Entry
+        {
+            fs::path path;
+            uint64_t size;
+            time_t   mtime;
+            long     mtime_ns;
+        };
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+
+        boost::system::error_code error;
+        for(fs::directory_iterator it(m_directory, error), end;
+            !error && it != end; it.increment(error))
+        {
+            struct stat entry_stat;
+            std::string name = it->path().filename().string();
+            if(is_temp(name) ||
+               ::stat(it->path().c_str(), &entry_stat) != 0 ||
+               !S_ISREG(entry_stat.st_mode))
+                continue;
+
+            entries.push_back({it->path(), uint64_t(entry_stat.st_size),
+                               entry_stat.st_mtim.tv_sec,
+                               entry_stat.st_mtim.tv_nsec});
+            total += uint64_t(entry_stat.st_size);
+        }
+        if(error)
+        {
+            m_logger.warn("Cannot list feature cache: " + m_directory +
+                          " - error: " + error.message());
+            return;
+        }
+        if(total <= m_max_bytes)
+            return;
+
+        std::sort(entries.begin(), entries.end(),
+                  [](const Entry& a, const Entry& b)
+                  {
+                      return a.mtime != b.mtime ? a.mtime < b.mtime :
+                          a.mtime_ns < b.mtime_ns;
+                  });
+
+        size_t num_evicted = 0;
+        for(const Entry& entry : entries)
+        {
+            if(total <= m_max_bytes)
+                break;
+            if(::unlink(entry.path.c_str()) == 0)
+            {
+                total -= entry.size;
+                num_evicted++;
+            }
+        }
+        m_logger.info("Evicted " + std::to_string(num_evicted) +
+                      " feature cache entries, " + std::to_string(total) +
+                      " bytes left in " + m_directory);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef NEUROSYNTH_FEATURE_CACHE_HPP
+#define NEUROSYNTH_FEATURE_CACHE_HPP
+
+#include "fft_plan.hpp"
+#include "logger.hpp"
+#include "wav_utils.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+
+namespace neurosynth
+{
+    //Content-addressed store of feature files, so repeated corpus runs
+    //only analyze what changed. An entry is named by a hash of the
+    //input's samples and one of every parameter that changes the
+    //output; a hit hard links (or, across file systems, copies) the
+    //entry to the output instead of decoding and analyzing again.
+    //Entries are evicted least recently used first (by mtime, which a
+    //hit refreshes) once the directory exceeds max_bytes.
+    //All members may be called from several threads.
+    class FeatureCache
+    {
+    public:
+        //creates 'directory' if needed
+        FeatureCache(const std::string& directory,
+                     uint64_t max_bytes,
+                     Logger& logger);
+
+        //key of analyzing 'input_fn' with 'params' (rate of headerless
+        //input) into 'output'/'encoding' at 'precision', empty if the
+        //input cannot be read
+        std::string key(const std::string& input_fn,
+                        const StftParams& params,
+                        FftPrecision precision,
+                        StftOutput output,
+                        StftEncoding encoding);
+
+        //places entry 'key' at 'output_fn', false on a miss
+        bool fetch(const std::string& key, const std::string& output_fn);
+
+        //adds the finished 'output_fn' as entry 'key'
+        void store(const std::string& key, const std::string& output_fn);
+
+        //evicts least recently used entries until max_bytes fit
+        void trim();
+
+        size_t hits() const { return m_hits.load(); }
+        size_t misses() const { return m_misses.load(); }
+
+    private:
+        std::string         m_directory;
+        uint64_t            m_max_bytes;
+        Logger&             m_logger;
+        std::atomic<size_t> m_hits;
+        std::atomic<size_t> m_misses;
+        std::atomic<size_t> m_num_temp;   //unique names of entries
+                                          //being stored
+
+        std::string entry_path(const std::string& key) const;
+    };
+}
+
+#endif
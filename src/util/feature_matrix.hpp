@@ -0,0 +1,146 @@
+#ifndef NEUROSYNTH_FEATURE_MATRIX_HPP
+#define NEUROSYNTH_FEATURE_MATRIX_HPP
+
+#include "aligned_allocator.hpp"
+
+#include <vector>
+
+
+namespace neurosynth
+{
+    enum class ChannelLayout
+    {
+        Planar,     //one [frames x coeff] matrix per channel
+        Interleaved //one [frames x channels x coeff] matrix
+    };
+
+    //Read-only view of one frame of one channel,
+    //mirrors the fields of FreqVector without owning the values
+    template<class T>
+    struct FreqView
+    {
+        double   min_freq;
+        double   max_freq;
+        const T* power;
+        size_t   size;
+
+        const T& operator[](size_t c) const { return power[c]; }
+        const T* begin() const { return power; }
+        const T* end() const { return power + size; }
+    };
+
+    //Features of all frames in contiguous, aligned storage. Band
+    //parameters are stored once for the whole matrix instead of once
+    //per frame, rows can be handed out directly as training tensors.
+    template<class T>
+    class FeatureMatrix
+    {
+    public:
+        explicit FeatureMatrix(size_t num_channels = 2,
+                               ChannelLayout layout = ChannelLayout::Planar)
+            : m_num_channels(num_channels),
+              m_layout(layout),
+              m_num_coeff(0),
+              m_num_frames(0),
+              m_min_freq(0.0),
+              m_max_freq(0.0),
+              m_data(layout == ChannelLayout::Planar ? num_channels : 1)
+        {
+        }
+
+        //drops all frames and sets parameters shared by all of them
+        void reset(size_t num_coeff, double min_freq, double max_freq)
+        {
+            m_num_coeff  = num_coeff;
+            m_min_freq   = min_freq;
+            m_max_freq   = max_freq;
+            m_num_frames = 0;
+            for(AlignedVector<T>& data : m_data)
+                data.clear();
+        }
+
+        //grows or shrinks to 'num_frames', new rows are zeroed
+        void resize(size_t num_frames)
+        {
+            m_num_frames = num_frames;
+            size_t per_buffer = num_frames * m_num_coeff *
+                (m_layout == ChannelLayout::Planar ? 1 : m_num_channels);
+            for(AlignedVector<T>& data : m_data)
+                data.resize(per_buffer);
+        }
+
+        void reserve(size_t num_frames)
+        {
+            size_t per_buffer = num_frames * m_num_coeff *
+                (m_layout == ChannelLayout::Planar ? 1 : m_num_channels);
+            for(AlignedVector<T>& data : m_data)
+                data.reserve(per_buffer);
+        }
+
+        size_t num_channels() const { return m_num_channels; }
+        size_t num_coeff() const { return m_num_coeff; }
+        size_t num_frames() const { return m_num_frames; }
+        double min_freq() const { return m_min_freq; }
+        double max_freq() const { return m_max_freq; }
+        ChannelLayout layout() const { return m_layout; }
+        bool empty() const { return m_num_frames == 0; }
+
+        //elements between the same channel of two consecutive frames
+        size_t row_stride() const
+        {
+            return m_layout == ChannelLayout::Planar ?
+                m_num_coeff : m_num_coeff * m_num_channels;
+        }
+
+        T* row(size_t channel, size_t frame)
+        {
+            return m_layout == ChannelLayout::Planar ?
+                &m_data[channel][frame * m_num_coeff] :
+                &m_data[0][(frame * m_num_channels + channel) * m_num_coeff];
+        }
+
+        const T* row(size_t channel, size_t frame) const
+        {
+            return const_cast<FeatureMatrix*>(this)->row(channel, frame);
+        }
+
+        T* row_l(size_t frame) { return row(0, frame); }
+        T* row_r(size_t frame) { return row(1, frame); }
+        const T* row_l(size_t frame) const { return row(0, frame); }
+        const T* row_r(size_t frame) const { return row(1, frame); }
+
+        FreqView<T> view(size_t channel, size_t frame) const
+        {
+            return {m_min_freq, m_max_freq, row(channel, frame), m_num_coeff};
+        }
+
+        FreqView<T> view_l(size_t frame) const { return view(0, frame); }
+        FreqView<T> view_r(size_t frame) const { return view(1, frame); }
+
+        //whole backing buffer: one channel matrix for planar layout,
+        //all channels for interleaved layout (channel is ignored)
+        T* data(size_t channel = 0)
+        {
+            return m_data[m_layout == ChannelLayout::Planar ? channel : 0]
+                .data();
+        }
+
+        const T* data(size_t channel = 0) const
+        {
+            return m_data[m_layout == ChannelLayout::Planar ? channel : 0]
+                .data();
+        }
+
+    private:
+        size_t        m_num_channels;
+        ChannelLayout m_layout;
+        size_t        m_num_coeff;
+        size_t        m_num_frames;
+        double        m_min_freq;
+        double        m_max_freq;
+
+        std::vector<AlignedVector<T>> m_data;
+    };
+}
+
+#endif
@@ -0,0 +1,232 @@
+#include "features.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+
+
+namespace neurosynth
+{
+    bool parse_feature_list(const std::string& list,
+                            StftParams& params,
+                            std::string& unknown)
+    {
+        for(const std::string& name : split(',', list, true))
+        {
+            if(name == "chroma")
+                params.chroma = true;
+            else if(name == "mfcc" || name == "deltas" || name == "delta2")
+            {
+                if(params.num_mfcc == 0)
+                    params.num_mfcc = default_num_mfcc;
+                if(name == "deltas")
+                    params.delta_order = std::max<size_t>(params.delta_order,
+                                                          1);
+                else if(name == "delta2")
+                    params.delta_order = 2;
+            }
+            else
+            {
+                unknown = name;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<StftStreamInfo> feature_streams(const StftParams& params)
+    {
+        std::vector<StftStreamInfo> streams;
+        size_t num_mfcc = std::min(params.num_mfcc, params.num_coeff);
+        if(num_mfcc > 0)
+        {
+            streams.push_back({"mfcc", num_mfcc});
+            if(params.delta_order >= 1)
+                streams.push_back({"mfcc_delta", num_mfcc});
+            if(params.delta_order >= 2)
+                streams.push_back({"mfcc_delta2", num_mfcc});
+        }
+        if(params.chroma)
+            streams.push_back({"chroma", chroma_size});
+        return streams;
+    }
+
+    template<class T>
+    DeltaFilter<T>::DeltaFilter(size_t num_coeff, size_t width)
+        : m_num_coeff(num_coeff),
+          m_width(width),
+          m_norm(T(1)),
+          m_num_in(0),
+          m_num_out(0),
+          m_finished(false),
+          m_history((2 * width + 1) * 2 * num_coeff)
+    {
+        //width 0 has no neighbours, every delta is 0
+        if(width > 0)
+            m_norm = T(double(width * (width + 1) * (2 * width + 1)) / 3.0);
+    }
+
+    template<class T>
+    const T* DeltaFilter<T>::frame(size_t t) const
+    {
+        t = std::min(t, m_num_in - 1);
+        return &m_history[t % (2 * m_width + 1) * 2 * m_num_coeff];
+    }
+
+    template<class T>
+    void DeltaFilter<T>::push(const T* row_l, const T* row_r)
+    {
+        T* slot = &m_history[m_num_in % (2 * m_width + 1) * 2 * m_num_coeff];
+        std::copy(row_l, row_l + m_num_coeff, slot);
+        std::copy(row_r, row_r + m_num_coeff, slot + m_num_coeff);
+        m_num_in++;
+    }
+
+    template<class T>
+    void DeltaFilter<T>::finish()
+    {
+        m_finished = true;
+    }
+
+    template<class T>
+    bool DeltaFilter<T>::pop(T* delta_l, T* delta_r)
+    {
+        size_t t = m_num_out;
+        if(t >= m_num_in || (!m_finished && t + m_width >= m_num_in))
+            return false;
+
+        size_t C = m_num_coeff;
+        std::fill(delta_l, delta_l + C, T(0));
+        std::fill(delta_r, delta_r + C, T(0));
+        for(size_t n = 1; n <= m_width; n++)
+        {
+            const T* next = frame(t + n);
+            const T* prev = frame(t >= n ? t - n : 0);
+            T weight = T(n) / m_norm;
+            #pragma omp simd
+            for(size_t c = 0; c < C; c++)
+            {
+                delta_l[c] += weight * (next[c] - prev[c]);
+                delta_r[c] += weight * (next[C + c] - prev[C + c]);
+            }
+        }
+        m_num_out++;
+        return true;
+    }
+
+    template<class T>
+    void compute_deltas(const StftData<T>& input,
+                        StftData<T>& deltas,
+                        size_t width)
+    {
+        size_t num_frames = input.num_frames();
+        deltas.reset(input.num_coeff(), input.min_freq(), input.max_freq());
+        deltas.resize(num_frames);
+
+        DeltaFilter<T> filter(input.num_coeff(), width);
+        size_t t = 0;
+        for(size_t i = 0; i < num_frames; i++)
+        {
+            filter.push(input.row_l(i), input.row_r(i));
+            while(t < num_frames &&
+                  filter.pop(deltas.row_l(t), deltas.row_r(t)))
+                t++;
+        }
+        filter.finish();
+        while(t < num_frames &&
+              filter.pop(deltas.row_l(t), deltas.row_r(t)))
+            t++;
+    }
+
+    template<class T>
+    FeatureStreamWriter<T>::FeatureStreamWriter(StftWriter<T>& writer,
+                                                const StftParams& params)
+        : m_writer(writer),
+          m_num_mfcc(std::min(params.num_mfcc, params.num_coeff)),
+          m_chroma(params.chroma),
+          m_chroma_index(0)
+    {
+        if(m_num_mfcc > 0)
+        {
+            m_chroma_index = 1;
+            if(params.delta_order >= 1)
+            {
+                m_delta.reset(new DeltaFilter<T>(m_num_mfcc,
+                                                 params.delta_width));
+                m_row.resize(2 * m_num_mfcc);
+                m_chroma_index++;
+            }
+            if(params.delta_order >= 2)
+            {
+                m_delta2.reset(new DeltaFilter<T>(m_num_mfcc,
+                                                  params.delta_width));
+                m_row2.resize(2 * m_num_mfcc);
+                m_chroma_index++;
+            }
+        }
+    }
+
+    template<class T>
+    void FeatureStreamWriter<T>::write(const T* mfcc_l,
+                                       const T* mfcc_r,
+                                       const T* chroma_l,
+                                       const T* chroma_r)
+    {
+        if(m_num_mfcc > 0)
+        {
+            m_writer.write_stream_frame(0, mfcc_l, mfcc_r);
+            if(m_delta)
+            {
+                m_delta->push(mfcc_l, mfcc_r);
+                write_deltas();
+            }
+        }
+        if(m_chroma)
+            m_writer.write_stream_frame(m_chroma_index, chroma_l, chroma_r);
+    }
+
+    template<class T>
+    void FeatureStreamWriter<T>::write_deltas()
+    {
+        T* delta_l = m_row.data();
+        T* delta_r = delta_l + m_num_mfcc;
+        while(m_delta->pop(delta_l, delta_r))
+        {
+            m_writer.write_stream_frame(1, delta_l, delta_r);
+            if(!m_delta2)
+                continue;
+
+            m_delta2->push(delta_l, delta_r);
+            while(m_delta2->pop(m_row2.data(), m_row2.data() + m_num_mfcc))
+                m_writer.write_stream_frame(2, m_row2.data(),
+                                            m_row2.data() + m_num_mfcc);
+        }
+    }
+
+    template<class T>
+    void FeatureStreamWriter<T>::finish()
+    {
+        if(!m_delta)
+            return;
+
+        m_delta->finish();
+        write_deltas();
+        if(!m_delta2)
+            return;
+
+        m_delta2->finish();
+        while(m_delta2->pop(m_row2.data(), m_row2.data() + m_num_mfcc))
+            m_writer.write_stream_frame(2, m_row2.data(),
+                                        m_row2.data() + m_num_mfcc);
+    }
+
+    template class DeltaFilter<double>;
+    template class DeltaFilter<float>;
+
+    template void compute_deltas<double>(const StftData<double>&,
+                                         StftData<double>&, size_t);
+    template void compute_deltas<float>(const StftData<float>&,
+                                        StftData<float>&, size_t);
+
+    template class FeatureStreamWriter<double>;
+    template class FeatureStreamWriter<float>;
+}
@@ -0,0 +1,102 @@
+#ifndef NEUROSYNTH_FEATURES_HPP
+#define NEUROSYNTH_FEATURES_HPP
+
+#include "stft_file.hpp"
+#include "wav_utils.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace neurosynth
+{
+    //cepstra per frame when mfcc are asked for without a count
+    constexpr size_t default_num_mfcc = 13;
+
+    //enables the features of a comma separated list in 'params':
+    //mfcc, deltas (mfcc deltas), delta2 (also delta-deltas) and
+    //chroma; returns false with 'unknown' set if a name is not
+    //recognized
+    bool parse_feature_list(const std::string& list,
+                            StftParams& params,
+                            std::string& unknown);
+
+    //names and widths of the feature streams 'params' ask for, in
+    //the order they are stored: mfcc, mfcc_delta, mfcc_delta2, chroma
+    std::vector<StftStreamInfo> feature_streams(const StftParams& params);
+
+    //Regression deltas of a sequence of L/R frames, as HTK computes
+    //them: d_t = sum_n n (c_t+n - c_t-n) / (2 sum_n n^2), n = 1..width,
+    //with the first and last frame repeated past the ends. Frames go
+    //in one at a time and a delta comes out once 'width' frames
+    //after it are known, so a stream never keeps more than
+    //2 * width + 1 frames; pop() every ready delta after each push().
+    template<class T>
+    class DeltaFilter
+    {
+    public:
+        DeltaFilter(size_t num_coeff, size_t width);
+
+        void push(const T* row_l, const T* row_r);
+
+        //no more frames, the last 'width' deltas become ready
+        void finish();
+
+        //next delta, false while it still waits for frames
+        bool pop(T* delta_l, T* delta_r);
+
+    private:
+        size_t         m_num_coeff;
+        size_t         m_width;
+        T              m_norm;
+        size_t         m_num_in;
+        size_t         m_num_out;
+        bool           m_finished;
+        std::vector<T> m_history; //last 2 * width + 1 frames, L then R
+
+        //frame 't' with the ends repeated, L then R
+        const T* frame(size_t t) const;
+    };
+
+    //deltas of all frames of 'input'
+    template<class T>
+    void compute_deltas(const StftData<T>& input,
+                        StftData<T>& deltas,
+                        size_t width);
+
+    //Writes the feature streams of 'params' frame by frame next to
+    //the energies of a StftWriter: mfcc and chroma as they come,
+    //deltas as soon as their DeltaFilter has them.
+    template<class T>
+    class FeatureStreamWriter
+    {
+    public:
+        //writer's header must be written with feature_streams(params)
+        FeatureStreamWriter(StftWriter<T>& writer, const StftParams& params);
+
+        //features of the next frame, streams 'params' don't ask for
+        //are ignored (and may be nullptr)
+        void write(const T* mfcc_l,
+                   const T* mfcc_r,
+                   const T* chroma_l,
+                   const T* chroma_r);
+
+        //writes the deltas still waiting, before the writer is closed
+        void finish();
+
+    private:
+        StftWriter<T>&                  m_writer;
+        size_t                          m_num_mfcc;
+        bool                            m_chroma;
+        size_t                          m_chroma_index;
+        std::unique_ptr<DeltaFilter<T>> m_delta;
+        std::unique_ptr<DeltaFilter<T>> m_delta2;
+        std::vector<T>                  m_row;  //delta L then R
+        std::vector<T>                  m_row2; //delta-delta L then R
+
+        void write_deltas();
+    };
+}
+
+#endif
@@ -0,0 +1,248 @@
+#include "fft_plan.hpp"
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <sstream>
+
+
+namespace neurosynth
+{
+    bool parse_precision(const std::string& name, FftPrecision& precision)
+    {
+        if(name == "double")
+            precision = FftPrecision::Double;
+        else if(name == "float")
+            precision = FftPrecision::Single;
+        else
+            return false;
+        return true;
+    }
+
+    std::string precision_name(FftPrecision precision)
+    {
+        return precision == FftPrecision::Double ? "double" : "float";
+    }
+
+    size_t fast_fft_size(size_t size)
+    {
+        if(size <= 16)
+        {
+            size_t power2 = 1;
+            while(power2 < size)
+                power2 *= 2;
+            return power2;
+        }
+
+        for(size_t candidate = (size + 15) / 16 * 16; ; candidate += 16)
+        {
+            size_t rest = candidate;
+            for(size_t factor : {2, 3, 5})
+                while(rest % factor == 0)
+                    rest /= factor;
+            if(rest == 1)
+                return candidate;
+        }
+    }
+
+    bool parse_planner_flags(const std::string& name, unsigned& flags)
+    {
+        if(name == "estimate")
+            flags = FFTW_ESTIMATE;
+        else if(name == "measure")
+            flags = FFTW_MEASURE;
+        else if(name == "patient")
+            flags = FFTW_PATIENT;
+        else if(name == "exhaustive")
+            flags = FFTW_EXHAUSTIVE;
+        else
+            return false;
+        return true;
+    }
+
+    FftPlanCache::FftPlanCache(Logger& logger,
+                               unsigned planner_flags)
+        : m_logger(logger),
+          m_planner_flags(planner_flags)
+    {
+        //plans are requested from several analysis threads,
+        //let fftw guard its planner on top of our own lock
+        static std::once_flag thread_safe_flag;
+        std::call_once(thread_safe_flag, []()
+                       {
+                           fftw_make_planner_thread_safe();
+                           fftwf_make_planner_thread_safe();
+                       });
+    }
+
+    FftPlanCache::~FftPlanCache()
+    {
+        for(auto& entry : m_plans)
+            fftw_destroy_plan(entry.second);
+        for(auto& entry : m_plans_f)
+            fftwf_destroy_plan(entry.second);
+    }
+
+    template<>
+    std::map<FftPlanKey, fftw_plan>& FftPlanCache::plans<double>()
+    {
+        return m_plans;
+    }
+
+    template<>
+    std::map<FftPlanKey, fftwf_plan>& FftPlanCache::plans<float>()
+    {
+        return m_plans_f;
+    }
+
+    template<class T>
+    typename Fftw<T>::plan FftPlanCache::get_plan(const FftPlanKey& key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto& cached = plans<T>();
+        auto it = cached.find(key);
+        if(it != cached.end())
+            return it->second;
+
+        typename Fftw<T>::plan plan = create_plan<T>(key);
+        if(plan)
+            cached[key] = plan;
+        return plan;
+    }
+
+    template<class T>
+    typename Fftw<T>::plan FftPlanCache::create_plan(const FftPlanKey& key)
+    {
+        typedef typename Fftw<T>::complex complex;
+
+        //measuring planners overwrite the arrays they are given,
+        //so plan on scratch buffers and never on caller's data
+        int n     = int(key.size);
+        int count = int(key.howmany);
+        int rdist = int(fft_real_dist<T>(key.size));
+        int cdist = int(fft_complex_dist<T>(key.size));
+        if(key.direction == FftDirection::C2C)
+            cdist = int(fft_packed_dist<T>(key.size));
+
+        T* real = static_cast<T*>
+            (Fftw<T>::malloc(sizeof(T) * size_t(rdist) * count));
+        complex* spectrum = static_cast<complex*>
+            (Fftw<T>::malloc(sizeof(complex) * size_t(cdist) * count));
+
+        unsigned flags = m_planner_flags;
+        if(!key.aligned)
+            flags |= FFTW_UNALIGNED;
+
+        typename Fftw<T>::plan plan = nullptr;
+        if(key.direction == FftDirection::R2C)
+            plan = Fftw<T>::plan_many_r2c(n, count, real, rdist,
+                                          spectrum, cdist, flags);
+        else if(key.direction == FftDirection::C2R)
+            plan = Fftw<T>::plan_many_c2r(n, count, spectrum, cdist,
+                                          real, rdist, flags);
+        else
+            plan = Fftw<T>::plan_many_c2c(n, count, spectrum, cdist, flags);
+
+        Fftw<T>::free(real);
+        Fftw<T>::free(spectrum);
+
+        if(!plan)
+            m_logger.err("Cannot create fft plan of size " +
+                         std::to_string(key.size));
+        else
+            m_logger.info("Created " +
+                          std::string(key.direction == FftDirection::R2C ?
+                                      "r2c" :
+                                      key.direction == FftDirection::C2R ?
+                                      "c2r" : "c2c") +
+                          " " + precision_name(key.precision) +
+                          " fft plan of size " + std::to_string(key.size) +
+                          (key.howmany > 1 ?
+                           " x " + std::to_string(key.howmany) : "") +
+                          (key.aligned ? "" : " (unaligned)"));
+
+        return plan;
+    }
+
+    template fftw_plan FftPlanCache::get_plan<double>(const FftPlanKey&);
+    template fftwf_plan FftPlanCache::get_plan<float>(const FftPlanKey&);
+
+    //wisdom of both precisions shares one file: fftw exports every
+    //precision as a separate s-expression starting with "(fftw-"
+    bool FftPlanCache::load_wisdom(const std::string& filename)
+    {
+        if(!boost::filesystem::exists(filename))
+        {
+            m_logger.info("No fftw wisdom to load at: " + filename);
+            return false;
+        }
+
+        std::ifstream file(filename);
+        std::stringstream contents;
+        contents << file.rdbuf();
+        std::string wisdom = contents.str();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        bool imported = false;
+        size_t start = wisdom.find("(fftw-");
+        while(start != std::string::npos)
+        {
+            size_t end = wisdom.find("\n(fftw-", start);
+            std::string part = wisdom.substr(start, end == std::string::npos ?
+                                             std::string::npos : end - start);
+
+            //each precision only accepts its own wisdom
+            if(part.find(" fftwf_wisdom") != std::string::npos)
+                imported |= fftwf_import_wisdom_from_string(part.c_str());
+            else
+                imported |= fftw_import_wisdom_from_string(part.c_str());
+
+            start = end == std::string::npos ? end : end + 1;
+        }
+
+        if(!imported)
+        {
+            m_logger.warn("Cannot import fftw wisdom from: " + filename);
+            return false;
+        }
+
+        m_logger.info("Imported fftw wisdom from: " + filename);
+        return true;
+    }
+
+    bool FftPlanCache::save_wisdom(const std::string& filename)
+    {
+        boost::filesystem::path path(filename);
+        if(path.has_parent_path())
+            boost::filesystem::create_directories(path.parent_path());
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        char* wisdom   = fftw_export_wisdom_to_string();
+        char* wisdom_f = fftwf_export_wisdom_to_string();
+
+        std::ofstream file(filename);
+        if(wisdom)
+            file << wisdom << "\n";
+        if(wisdom_f)
+            file << wisdom_f << "\n";
+        free(wisdom);
+        free(wisdom_f);
+
+        if(!file || !wisdom || !wisdom_f)
+        {
+            m_logger.warn("Cannot export fftw wisdom to: " + filename);
+            return false;
+        }
+
+        m_logger.info("Exported fftw wisdom to: " + filename);
+        return true;
+    }
+
+    size_t FftPlanCache::size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_plans.size() + m_plans_f.size();
+    }
+}
@@ -0,0 +1,351 @@
+#ifndef NEUROSYNTH_FFT_PLAN_HPP
+#define NEUROSYNTH_FFT_PLAN_HPP
+
+#include "aligned_allocator.hpp"
+#include "logger.hpp"
+
+#include <complex>
+#include <fftw3.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+
+namespace neurosynth
+{
+    enum class FftDirection
+    {
+        R2C, //real input -> half complex spectrum
+        C2R, //half complex spectrum -> real output
+        C2C  //complex input -> full spectrum (forward, in place)
+    };
+
+    enum class FftPrecision
+    {
+        Double,
+        Single
+    };
+
+    //parses precision name (double, float)
+    //returns false if name is not recognized
+    bool parse_precision(const std::string& name, FftPrecision& precision);
+
+    std::string precision_name(FftPrecision precision);
+
+    //maps sample type onto matching fftw API
+    //(fftw_* for double, fftwf_* for float)
+    template<class T>
+    struct Fftw;
+
+    template<>
+    struct Fftw<double>
+    {
+        typedef fftw_plan    plan;
+        typedef fftw_complex complex;
+
+        static constexpr FftPrecision precision = FftPrecision::Double;
+
+        static void execute_r2c(plan p, double* in, std::complex<double>* out)
+        {
+            fftw_execute_dft_r2c(p, in, reinterpret_cast<complex*>(out));
+        }
+
+        static void execute_c2r(plan p, std::complex<double>* in, double* out)
+        {
+            fftw_execute_dft_c2r(p, reinterpret_cast<complex*>(in), out);
+        }
+
+        static void execute_c2c(plan p, std::complex<double>* data)
+        {
+            fftw_execute_dft(p, reinterpret_cast<complex*>(data),
+                             reinterpret_cast<complex*>(data));
+        }
+
+        static int alignment_of(double* p)
+        {
+            return fftw_alignment_of(p);
+        }
+
+        static plan plan_many_r2c(int n, int howmany,
+                                  double* in, int idist,
+                                  complex* out, int odist,
+                                  unsigned flags)
+        {
+            return fftw_plan_many_dft_r2c(1, &n, howmany,
+                                        in, nullptr, 1, idist,
+                                        out, nullptr, 1, odist,
+                                        flags);
+        }
+
+        static plan plan_many_c2r(int n, int howmany,
+                                  complex* in, int idist,
+                                  double* out, int odist,
+                                  unsigned flags)
+        {
+            return fftw_plan_many_dft_c2r(1, &n, howmany,
+                                        in, nullptr, 1, idist,
+                                        out, nullptr, 1, odist,
+                                        flags);
+        }
+
+        static plan plan_many_c2c(int n, int howmany,
+                                  complex* data, int dist,
+                                  unsigned flags)
+        {
+            return fftw_plan_many_dft(1, &n, howmany,
+                                      data, nullptr, 1, dist,
+                                      data, nullptr, 1, dist,
+                                      FFTW_FORWARD, flags);
+        }
+
+        static void destroy_plan(plan p)
+        {
+            fftw_destroy_plan(p);
+        }
+
+        static void* malloc(size_t n)
+        {
+            return fftw_malloc(n);
+        }
+
+        static void free(void* p)
+        {
+            fftw_free(p);
+        }
+    };
+
+    template<>
+    struct Fftw<float>
+    {
+        typedef fftwf_plan    plan;
+        typedef fftwf_complex complex;
+
+        static constexpr FftPrecision precision = FftPrecision::Single;
+
+        static void execute_r2c(plan p, float* in, std::complex<float>* out)
+        {
+            fftwf_execute_dft_r2c(p, in, reinterpret_cast<complex*>(out));
+        }
+
+        static void execute_c2r(plan p, std::complex<float>* in, float* out)
+        {
+            fftwf_execute_dft_c2r(p, reinterpret_cast<complex*>(in), out);
+        }
+
+        static void execute_c2c(plan p, std::complex<float>* data)
+        {
+            fftwf_execute_dft(p, reinterpret_cast<complex*>(data),
+                              reinterpret_cast<complex*>(data));
+        }
+
+        static int alignment_of(float* p)
+        {
+            return fftwf_alignment_of(p);
+        }
+
+        static plan plan_many_r2c(int n, int howmany,
+                                  float* in, int idist,
+                                  complex* out, int odist,
+                                  unsigned flags)
+        {
+            return fftwf_plan_many_dft_r2c(1, &n, howmany,
+                                         in, nullptr, 1, idist,
+                                         out, nullptr, 1, odist,
+                                         flags);
+        }
+
+        static plan plan_many_c2r(int n, int howmany,
+                                  complex* in, int idist,
+                                  float* out, int odist,
+                                  unsigned flags)
+        {
+            return fftwf_plan_many_dft_c2r(1, &n, howmany,
+                                         in, nullptr, 1, idist,
+                                         out, nullptr, 1, odist,
+                                         flags);
+        }
+
+        static plan plan_many_c2c(int n, int howmany,
+                                  complex* data, int dist,
+                                  unsigned flags)
+        {
+            return fftwf_plan_many_dft(1, &n, howmany,
+                                       data, nullptr, 1, dist,
+                                       data, nullptr, 1, dist,
+                                       FFTW_FORWARD, flags);
+        }
+
+        static void destroy_plan(plan p)
+        {
+            fftwf_destroy_plan(p);
+        }
+
+        static void* malloc(size_t n)
+        {
+            return fftwf_malloc(n);
+        }
+
+        static void free(void* p)
+        {
+            fftwf_free(p);
+        }
+    };
+
+    struct FftPlanKey
+    {
+        size_t       size;
+        size_t       howmany; //number of transforms in a batch
+        FftDirection direction;
+        FftPrecision precision;
+        bool         aligned;
+
+        bool operator<(const FftPlanKey& other) const
+        {
+            return std::tie(size, howmany, direction, precision, aligned) <
+                std::tie(other.size, other.howmany, other.direction,
+                         other.precision, other.aligned);
+        }
+    };
+
+    //distance (in elements) between consecutive real frames of a batch
+    //frames are padded so that every one of them starts aligned
+    template<class T>
+    size_t fft_real_dist(size_t size)
+    {
+        return aligned_count<T>(size);
+    }
+
+    //distance (in elements) between consecutive spectra of a batch
+    template<class T>
+    size_t fft_complex_dist(size_t size)
+    {
+        return aligned_count<std::complex<T>>(size/2 + 1);
+    }
+
+    //distance (in elements) between consecutive complex frames of a
+    //batch of c2c transforms
+    template<class T>
+    size_t fft_packed_dist(size_t size)
+    {
+        return aligned_count<std::complex<T>>(size);
+    }
+
+    //smallest size >= 'size' of the form 2^a 3^b 5^c with a >= 4
+    //(or power of two below 16), fftw's real transforms are several
+    //times faster on these than on sizes with larger prime factors
+    size_t fast_fft_size(size_t size);
+
+    //parses planner effort name (estimate, measure, patient, exhaustive)
+    //returns false if name is not recognized
+    bool parse_planner_flags(const std::string& name, unsigned& flags);
+
+    //true if buffer satisfies fftw's SIMD alignment
+    template<class T>
+    bool is_fft_aligned(const T* pointer)
+    {
+        return Fftw<T>::alignment_of(const_cast<T*>(pointer)) == 0;
+    }
+
+    //Owns fftw plans and hands them out for use with the new-array
+    //execute interface (fftw_execute_dft_r2c etc.). Every plan is
+    //created once per key with the configured planner effort, so the
+    //expensive FFTW_MEASURE/FFTW_PATIENT planning is paid only on
+    //first use. Plans are built on private scratch buffers, callers
+    //pass their own arrays on every execute.
+    //
+    //Planning is serialized by an internal mutex, executing returned
+    //plans is thread safe as far as fftw is concerned.
+    class FftPlanCache
+    {
+    public:
+        explicit FftPlanCache(Logger& logger,
+                              unsigned planner_flags = FFTW_MEASURE);
+
+        ~FftPlanCache();
+
+        FftPlanCache(const FftPlanCache&) = delete;
+        FftPlanCache& operator=(const FftPlanCache&) = delete;
+
+        //plan for 'size' real samples -> size/2+1 complex coefficients
+        template<class T>
+        typename Fftw<T>::plan r2c(size_t size, bool aligned)
+        {
+            return get_plan<T>({size, 1, FftDirection::R2C,
+                                Fftw<T>::precision, aligned});
+        }
+
+        //plan for 'howmany' r2c transforms of 'size' samples at once
+        //frames are laid out fft_real_dist<T>(size) elements apart,
+        //spectra fft_complex_dist<T>(size) elements apart
+        template<class T>
+        typename Fftw<T>::plan r2c_batch(size_t size,
+                                         size_t howmany,
+                                         bool aligned)
+        {
+            return get_plan<T>({size, howmany, FftDirection::R2C,
+                                Fftw<T>::precision, aligned});
+        }
+
+        //plan for size/2+1 complex coefficients -> 'size' real samples
+        //NOTE: c2r plans destroy their input array
+        template<class T>
+        typename Fftw<T>::plan c2r(size_t size, bool aligned)
+        {
+            return get_plan<T>({size, 1, FftDirection::C2R,
+                                Fftw<T>::precision, aligned});
+        }
+
+        //plan for 'howmany' c2r transforms of 'size' samples at once,
+        //laid out as with r2c_batch()
+        template<class T>
+        typename Fftw<T>::plan c2r_batch(size_t size,
+                                         size_t howmany,
+                                         bool aligned)
+        {
+            return get_plan<T>({size, howmany, FftDirection::C2R,
+                                Fftw<T>::precision, aligned});
+        }
+
+        //plan for 'howmany' forward complex transforms of 'size'
+        //elements, in place, fft_packed_dist<T>(size) elements apart
+        template<class T>
+        typename Fftw<T>::plan c2c_batch(size_t size,
+                                         size_t howmany,
+                                         bool aligned)
+        {
+            return get_plan<T>({size, howmany, FftDirection::C2C,
+                                Fftw<T>::precision, aligned});
+        }
+
+        //imports wisdom accumulated by previous runs
+        //missing file is not an error - there is simply nothing to load
+        bool load_wisdom(const std::string& filename);
+
+        //exports wisdom of all plans (of both precisions) created so far
+        bool save_wisdom(const std::string& filename);
+
+        unsigned planner_flags() const { return m_planner_flags; }
+
+        size_t size() const;
+
+    private:
+        Logger&  m_logger;
+        unsigned m_planner_flags;
+
+        std::map<FftPlanKey, fftw_plan>  m_plans;
+        std::map<FftPlanKey, fftwf_plan> m_plans_f;
+        mutable std::mutex               m_mutex;
+
+        template<class T>
+        typename Fftw<T>::plan get_plan(const FftPlanKey& key);
+
+        template<class T>
+        typename Fftw<T>::plan create_plan(const FftPlanKey& key);
+
+        template<class T>
+        std::map<FftPlanKey, typename Fftw<T>::plan>& plans();
+    };
+}
+
+#endif
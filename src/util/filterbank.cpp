@@ -0,0 +1,513 @@
+#include "filterbank.hpp"
+#include "wav_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace neurosynth
+{
+    bool parse_filter_shape(const std::string& name, FilterShape& shape)
+    {
+        if(name == "bands")
+            shape = FilterShape::Bands;
+        else if(name == "triangular")
+            shape = FilterShape::Triangular;
+        else
+            return false;
+        return true;
+    }
+
+    std::string filter_shape_name(FilterShape shape)
+    {
+        switch(shape)
+        {
+        case FilterShape::Bands:      return "bands";
+        case FilterShape::Triangular: return "triangular";
+        }
+        return "unknown";
+    }
+
+    MelFilterbank::MelFilterbank(const FilterbankKey& key)
+        : m_key(key)
+    {
+        m_offsets.push_back(0);
+        if(m_key.shape == FilterShape::Bands)
+            build_bands();
+        else
+            build_triangular();
+
+        m_weights_f.assign(m_weights.begin(), m_weights.end());
+    }
+
+    template<>
+    const double* MelFilterbank::weights<double>() const
+    {
+        return m_weights.data();
+    }
+
+    template<>
+    const float* MelFilterbank::weights<float>() const
+    {
+        return m_weights_f.data();
+    }
+
+    //same band edges and weights stft() has always used:
+    //num_coeff disjoint bands evenly spaced on the mel scale,
+    //each weighted by a triangle spanning the whole band
+    void MelFilterbank::build_bands()
+    {
+        size_t N         = spectrum_size();
+        double min_mel   = freq2mel(m_key.min_freq);
+        double max_mel   = freq2mel(m_key.max_freq);
+        size_t num_coeff = m_key.num_coeff;
+
+        for(size_t i = 0; i < num_coeff; i++)
+        {
+            double band_min_freq = mel2freq
+                (min_mel + (max_mel - min_mel) * i / num_coeff);
+            double band_max_freq = mel2freq
+                (min_mel + (max_mel - min_mel) * (i+1) / num_coeff);
+
+            size_t min_bin = size_t(band_min_freq * 2.0 /
+                                    m_key.sample_rate * N);
+            size_t max_bin = size_t(band_max_freq * 2.0 /
+                                    m_key.sample_rate * N);
+            max_bin = std::max(std::min(max_bin, N), min_bin);
+            min_bin = std::min(min_bin, max_bin);
+
+            double width = double(max_bin - min_bin);
+            for(size_t bin = min_bin; bin < max_bin; bin++)
+            {
+                double n = double(bin - min_bin);
+                m_weights.push_back(1.0 - std::abs((n - (width-1)/2) /
+                                                   (width / 2)));
+            }
+
+            m_first_bin.push_back(min_bin);
+            m_offsets.push_back(m_weights.size());
+        }
+    }
+
+    //num_coeff triangles with centers evenly spaced on the mel scale,
+    //each one reaching from its left to its right neighbour's center
+    void MelFilterbank::build_triangular()
+    {
+        size_t N         = spectrum_size();
+        double min_mel   = freq2mel(m_key.min_freq);
+        double max_mel   = freq2mel(m_key.max_freq);
+        size_t num_coeff = m_key.num_coeff;
+        double bin_width = m_key.sample_rate / m_key.fft_size;
+
+        std::vector<double> edges;
+        for(size_t j = 0; j < num_coeff + 2; j++)
+            edges.push_back(mel2freq(min_mel + (max_mel - min_mel) *
+                                     j / (num_coeff + 1)));
+
+        for(size_t i = 0; i < num_coeff; i++)
+        {
+            double left   = edges[i];
+            double center = edges[i+1];
+            double right  = edges[i+2];
+
+            size_t min_bin = std::min(size_t(std::ceil(left / bin_width)),
+                                      N);
+            size_t max_bin = std::min(size_t(std::floor(right / bin_width))
+                                      + 1, N);
+            max_bin = std::max(max_bin, min_bin);
+
+            for(size_t bin = min_bin; bin < max_bin; bin++)
+            {
+                double freq = bin * bin_width;
+                double weight;
+                if(freq <= center)
+                    weight = (freq - left) / (center - left);
+                else
+                    weight = (right - freq) / (right - center);
+                m_weights.push_back(std::max(weight, 0.0));
+            }
+
+            m_first_bin.push_back(min_bin);
+            m_offsets.push_back(m_weights.size());
+        }
+    }
+
+    template<class T>
+    void MelFilterbank::apply(const T* power,
+                              size_t power_stride,
+                              T* energies,
+                              size_t energy_stride,
+                              size_t rows) const
+    {
+        const T* all_weights = weights<T>();
+        size_t   num_coeff   = m_key.num_coeff;
+        for(size_t row = 0; row < rows; row++)
+        {
+            const T* row_power    = power + row * power_stride;
+            T*       row_energies = energies + row * energy_stride;
+            for(size_t c = 0; c < num_coeff; c++)
+            {
+                const T* weights = all_weights + m_offsets[c];
+                const T* bins    = row_power + m_first_bin[c];
+                size_t   width   = m_offsets[c+1] - m_offsets[c];
+
+                T energy = T(0);
+                #pragma omp simd reduction(+:energy)
+                for(size_t k = 0; k < width; k++)
+                    energy += bins[k] * weights[k];
+                row_energies[c] = energy;
+            }
+        }
+    }
+
+    template void MelFilterbank::apply<double>(const double*, size_t,
+                                               double*, size_t,
+                                               size_t) const;
+    template void MelFilterbank::apply<float>(const float*, size_t,
+                                              float*, size_t,
+                                              size_t) const;
+
+    MelPseudoInverse::MelPseudoInverse(const MelFilterbank& filterbank)
+        : m_num_coeff(filterbank.num_coeff()),
+          m_spectrum_size(filterbank.spectrum_size()),
+          m_first_bin(filterbank.spectrum_size()),
+          m_last_bin(0)
+    {
+        size_t C = m_num_coeff;
+        for(size_t c = 0; c < C; c++)
+            if(filterbank.num_bins(c) > 0)
+            {
+                m_first_bin = std::min(m_first_bin, filterbank.first_bin(c));
+                m_last_bin  = std::max(m_last_bin, filterbank.first_bin(c) +
+                                       filterbank.num_bins(c));
+            }
+        if(m_first_bin >= m_last_bin)
+        {
+            m_first_bin = m_last_bin = 0;
+            return;
+        }
+
+        //F restricted to covered bins, one row per filter
+        size_t B = m_last_bin - m_first_bin;
+        std::vector<double> F(C * B, 0.0);
+        for(size_t c = 0; c < C; c++)
+            std::copy(filterbank.filter(c),
+                      filterbank.filter(c) + filterbank.num_bins(c),
+                      &F[c * B + filterbank.first_bin(c) - m_first_bin]);
+
+        //G = F F^T + lambda I
+        std::vector<double> G(C * C, 0.0);
+        double max_diagonal = 0.0;
+        for(size_t a = 0; a < C; a++)
+            for(size_t b = 0; b <= a; b++)
+            {
+                double sum = 0.0;
+                for(size_t k = 0; k < B; k++)
+                    sum += F[a * B + k] * F[b * B + k];
+                G[a * C + b] = G[b * C + a] = sum;
+                max_diagonal = a == b ? std::max(max_diagonal, sum) :
+                    max_diagonal;
+            }
+        double lambda = std::max(max_diagonal * 1e-10, 1e-300);
+        for(size_t a = 0; a < C; a++)
+            G[a * C + a] += lambda;
+
+        //Cholesky factorization G = L L^T, L in the lower triangle
+        for(size_t j = 0; j < C; j++)
+        {
+            double diagonal = G[j * C + j];
+            for(size_t k = 0; k < j; k++)
+                diagonal -= G[j * C + k] * G[j * C + k];
+            diagonal = std::sqrt(std::max(diagonal, lambda));
+            G[j * C + j] = diagonal;
+            for(size_t i = j + 1; i < C; i++)
+            {
+                double sum = G[i * C + j];
+                for(size_t k = 0; k < j; k++)
+                    sum -= G[i * C + k] * G[j * C + k];
+                G[i * C + j] = sum / diagonal;
+            }
+        }
+
+        //columns of G^-1 F by forward and back substitution,
+        //stored transposed: m_matrix[bin * C + c]
+        m_matrix.resize(B * C);
+        std::vector<double> x(C);
+        for(size_t k = 0; k < B; k++)
+        {
+            for(size_t i = 0; i < C; i++)
+            {
+                double sum = F[i * B + k];
+                for(size_t j = 0; j < i; j++)
+                    sum -= G[i * C + j] * x[j];
+                x[i] = sum / G[i * C + i];
+            }
+            for(size_t i = C; i-- > 0;)
+            {
+                double sum = x[i];
+                for(size_t j = i + 1; j < C; j++)
+                    sum -= G[j * C + i] * x[j];
+                x[i] = sum / G[i * C + i];
+            }
+            std::copy(x.begin(), x.end(), &m_matrix[k * C]);
+        }
+
+        m_matrix_f.assign(m_matrix.begin(), m_matrix.end());
+    }
+
+    template<>
+    const double* MelPseudoInverse::matrix<double>() const
+    {
+        return m_matrix.data();
+    }
+
+    template<>
+    const float* MelPseudoInverse::matrix<float>() const
+    {
+        return m_matrix_f.data();
+    }
+
+    template<class T>
+    void MelPseudoInverse::apply(const T* energies,
+                                 size_t energy_stride,
+                                 T* power,
+                                 size_t power_stride,
+                                 size_t rows) const
+    {
+        const T* all_weights = matrix<T>();
+        size_t   num_coeff   = m_num_coeff;
+        for(size_t row = 0; row < rows; row++)
+        {
+            const T* row_energies = energies + row * energy_stride;
+            T*       row_power    = power + row * power_stride;
+
+            std::fill(row_power, row_power + m_first_bin, T(0));
+            for(size_t bin = m_first_bin; bin < m_last_bin; bin++)
+            {
+                const T* weights = all_weights +
+                    (bin - m_first_bin) * num_coeff;
+
+                T value = T(0);
+                #pragma omp simd reduction(+:value)
+                for(size_t c = 0; c < num_coeff; c++)
+                    value += row_energies[c] * weights[c];
+                row_power[bin] = std::max(value, T(0));
+            }
+            std::fill(row_power + m_last_bin, row_power + m_spectrum_size,
+                      T(0));
+        }
+    }
+
+    template void MelPseudoInverse::apply<double>(const double*, size_t,
+                                                  double*, size_t,
+                                                  size_t) const;
+    template void MelPseudoInverse::apply<float>(const float*, size_t,
+                                                 float*, size_t,
+                                                 size_t) const;
+
+    FeatureProjection::FeatureProjection(size_t num_inputs,
+                                         size_t num_outputs,
+                                         size_t first_input,
+                                         size_t num_columns)
+        : m_num_inputs(num_inputs),
+          m_num_outputs(num_outputs),
+          m_first_input(first_input),
+          m_num_columns(num_columns),
+          m_matrix(num_outputs * num_columns, 0.0)
+    {
+    }
+
+    FeatureProjection FeatureProjection::dct(size_t num_inputs,
+                                             size_t num_outputs)
+    {
+        FeatureProjection dct(num_inputs, num_outputs, 0, num_inputs);
+        double N = double(num_inputs);
+        for(size_t k = 0; k < num_outputs; k++)
+        {
+            double scale = std::sqrt((k == 0 ? 1.0 : 2.0) / N);
+            for(size_t n = 0; n < num_inputs; n++)
+                dct.m_matrix[k * num_inputs + n] = scale *
+                    std::cos(M_PI * double(k) * (double(n) + 0.5) / N);
+        }
+        dct.m_matrix_f.assign(dct.m_matrix.begin(), dct.m_matrix.end());
+        return dct;
+    }
+
+    FeatureProjection FeatureProjection::chroma(const FilterbankKey& key)
+    {
+        size_t N         = key.fft_size/2 + 1;
+        double bin_width = key.sample_rate / key.fft_size;
+
+        //bin 0 has no pitch
+        size_t min_bin = std::max<size_t>(size_t(std::ceil(key.min_freq /
+                                                           bin_width)), 1);
+        size_t max_bin = size_t(std::floor(key.max_freq / bin_width)) + 1;
+        max_bin = std::min(max_bin, N);
+        min_bin = std::min(min_bin, max_bin);
+
+        FeatureProjection chroma(N, chroma_size, min_bin, max_bin - min_bin);
+        for(size_t bin = min_bin; bin < max_bin; bin++)
+        {
+            //semitones above the C below A440
+            double pitch = 12.0 * std::log2(bin * bin_width / 440.0) + 9.0;
+            pitch -= 12.0 * std::floor(pitch / 12.0);
+
+            size_t lower    = size_t(pitch) % chroma_size;
+            size_t upper    = (lower + 1) % chroma_size;
+            double fraction = pitch - std::floor(pitch);
+            size_t column   = bin - min_bin;
+            chroma.m_matrix[lower * chroma.m_num_columns + column] +=
+                1.0 - fraction;
+            chroma.m_matrix[upper * chroma.m_num_columns + column] +=
+                fraction;
+        }
+        chroma.m_matrix_f.assign(chroma.m_matrix.begin(),
+                                 chroma.m_matrix.end());
+        return chroma;
+    }
+
+    template<>
+    const double* FeatureProjection::matrix<double>() const
+    {
+        return m_matrix.data();
+    }
+
+    template<>
+    const float* FeatureProjection::matrix<float>() const
+    {
+        return m_matrix_f.data();
+    }
+
+    template<class T>
+    void FeatureProjection::apply(const T* inputs,
+                                  size_t input_stride,
+                                  T* outputs,
+                                  size_t output_stride,
+                                  size_t rows) const
+    {
+        const T* all_weights = matrix<T>();
+        size_t   width       = m_num_columns;
+        for(size_t row = 0; row < rows; row++)
+        {
+            const T* row_inputs  = inputs + row * input_stride +
+                m_first_input;
+            T*       row_outputs = outputs + row * output_stride;
+            for(size_t k = 0; k < m_num_outputs; k++)
+            {
+                const T* weights = all_weights + k * width;
+
+                T value = T(0);
+                #pragma omp simd reduction(+:value)
+                for(size_t n = 0; n < width; n++)
+                    value += row_inputs[n] * weights[n];
+                row_outputs[k] = value;
+            }
+        }
+    }
+
+    template void FeatureProjection::apply<double>(const double*, size_t,
+                                                   double*, size_t,
+                                                   size_t) const;
+    template void FeatureProjection::apply<float>(const float*, size_t,
+                                                  float*, size_t,
+                                                  size_t) const;
+
+    std::shared_ptr<const MelFilterbank>
+    FilterbankCache::get(const FilterbankKey& key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_banks.find(key);
+        if(it != m_banks.end())
+            return it->second;
+
+        auto bank = std::make_shared<const MelFilterbank>(key);
+        m_banks[key] = bank;
+        return bank;
+    }
+
+    std::shared_ptr<const MelPseudoInverse>
+    FilterbankCache::inverse(const FilterbankKey& key)
+    {
+        std::shared_ptr<const MelFilterbank> bank = get(key);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_inverses.find(key);
+        if(it != m_inverses.end())
+            return it->second;
+
+        auto inverse = std::make_shared<const MelPseudoInverse>(*bank);
+        m_inverses[key] = inverse;
+        return inverse;
+    }
+
+    std::shared_ptr<const FeatureProjection>
+    FilterbankCache::chroma(const FilterbankKey& key)
+    {
+        FilterbankKey chroma_key = key;
+        chroma_key.num_coeff = chroma_size;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_chroma.find(chroma_key);
+        if(it != m_chroma.end())
+            return it->second;
+
+        auto chroma = std::make_shared<const FeatureProjection>
+            (FeatureProjection::chroma(chroma_key));
+        m_chroma[chroma_key] = chroma;
+        return chroma;
+    }
+
+    std::shared_ptr<const FeatureProjection>
+    FilterbankCache::dct(size_t num_inputs, size_t num_outputs)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto it = m_dct.find({num_inputs, num_outputs});
+        if(it != m_dct.end())
+            return it->second;
+
+        auto dct = std::make_shared<const FeatureProjection>
+            (FeatureProjection::dct(num_inputs, num_outputs));
+        m_dct[{num_inputs, num_outputs}] = dct;
+        return dct;
+    }
+
+    template<class T>
+    void power_spectrum(const std::complex<T>* spectrum,
+                        T* power,
+                        size_t size)
+    {
+        //std::complex is layout compatible with T[2]
+        const T* values = reinterpret_cast<const T*>(spectrum);
+        #pragma omp simd
+        for(size_t k = 0; k < size; k++)
+            power[k] = values[2*k] * values[2*k] +
+                values[2*k+1] * values[2*k+1];
+    }
+
+    template<class T>
+    void log_compress(T* energies, size_t size)
+    {
+        for(size_t k = 0; k < size; k++)
+            energies[k] = std::log1p(energies[k]);
+    }
+
+    template<class T>
+    void log_expand(T* energies, size_t size)
+    {
+        for(size_t k = 0; k < size; k++)
+            energies[k] = std::max(std::expm1(energies[k]), T(0));
+    }
+
+    template void power_spectrum<double>(const std::complex<double>*,
+                                         double*, size_t);
+    template void power_spectrum<float>(const std::complex<float>*,
+                                        float*, size_t);
+    template void log_compress<double>(double*, size_t);
+    template void log_compress<float>(float*, size_t);
+    template void log_expand<double>(double*, size_t);
+    template void log_expand<float>(float*, size_t);
+}
@@ -0,0 +1,229 @@
+#ifndef NEUROSYNTH_FILTERBANK_HPP
+#define NEUROSYNTH_FILTERBANK_HPP
+
+#include <complex>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+
+namespace neurosynth
+{
+    enum class FilterShape
+    {
+        Bands,     //triangle inside each of disjoint mel bands
+        Triangular //overlapping triangular mel filters
+    };
+
+    //parses filter shape name (bands, triangular)
+    //returns false if name is not recognized
+    bool parse_filter_shape(const std::string& name, FilterShape& shape);
+
+    std::string filter_shape_name(FilterShape shape);
+
+    struct FilterbankKey
+    {
+        size_t      fft_size;
+        double      sample_rate;
+        size_t      num_coeff;
+        double      min_freq;
+        double      max_freq;
+        FilterShape shape;
+
+        bool operator<(const FilterbankKey& other) const
+        {
+            return std::tie(fft_size, sample_rate, num_coeff,
+                            min_freq, max_freq, shape) <
+                std::tie(other.fft_size, other.sample_rate, other.num_coeff,
+                         other.min_freq, other.max_freq, other.shape);
+        }
+    };
+
+    //Mel filterbank precomputed for one fft size. Every filter covers
+    //a contiguous run of bins, so weights are stored banded (CSR with
+    //implicit column indices): filter c has weights
+    //m_weights[m_offsets[c] .. m_offsets[c+1]) for bins starting at
+    //m_first_bin[c].
+    class MelFilterbank
+    {
+    public:
+        explicit MelFilterbank(const FilterbankKey& key);
+
+        size_t num_coeff() const { return m_key.num_coeff; }
+        size_t spectrum_size() const { return m_key.fft_size/2 + 1; }
+        const FilterbankKey& key() const { return m_key; }
+
+        //filter 'c' weighs num_bins(c) bins starting at first_bin(c)
+        size_t first_bin(size_t c) const { return m_first_bin[c]; }
+        size_t num_bins(size_t c) const
+        {
+            return m_offsets[c+1] - m_offsets[c];
+        }
+        const double* filter(size_t c) const
+        {
+            return &m_weights[m_offsets[c]];
+        }
+
+        //power    - 'rows' power spectra, 'power_stride' elements apart
+        //energies - 'rows' output vectors of num_coeff() energies,
+        //           'energy_stride' elements apart
+        template<class T>
+        void apply(const T* power,
+                   size_t power_stride,
+                   T* energies,
+                   size_t energy_stride,
+                   size_t rows) const;
+
+    private:
+        FilterbankKey       m_key;
+        std::vector<size_t> m_first_bin;
+        std::vector<size_t> m_offsets;
+        std::vector<double> m_weights;
+        std::vector<float>  m_weights_f; //m_weights for float pipeline
+
+        template<class T>
+        const T* weights() const;
+
+        void build_bands();
+        void build_triangular();
+    };
+
+    //Maps band energies back onto power spectra through the
+    //pseudo-inverse of a filterbank's matrix F: F^T (F F^T + lambda I)^-1,
+    //a small lambda keeps empty bands from making F F^T singular.
+    //Bins no filter covers come out as 0, so does any negative estimate.
+    //The inverse is dense, but only over the bins covered by a filter.
+    class MelPseudoInverse
+    {
+    public:
+        explicit MelPseudoInverse(const MelFilterbank& filterbank);
+
+        size_t num_coeff() const { return m_num_coeff; }
+        size_t spectrum_size() const { return m_spectrum_size; }
+
+        //energies - 'rows' vectors of num_coeff() energies,
+        //           'energy_stride' elements apart
+        //power    - 'rows' output power spectra, 'power_stride'
+        //           elements apart
+        template<class T>
+        void apply(const T* energies,
+                   size_t energy_stride,
+                   T* power,
+                   size_t power_stride,
+                   size_t rows) const;
+
+    private:
+        size_t              m_num_coeff;
+        size_t              m_spectrum_size;
+        size_t              m_first_bin;
+        size_t              m_last_bin;
+        std::vector<double> m_matrix;   //bin-major, num_coeff per bin
+        std::vector<float>  m_matrix_f; //m_matrix for float pipeline
+
+        template<class T>
+        const T* matrix() const;
+    };
+
+    //pitch classes of a chroma vector, C first
+    constexpr size_t chroma_size = 12;
+
+    //Dense matrix of features that mix most of their inputs: the
+    //cepstra of log mel energies (dct()) or the pitch classes of a
+    //power spectrum (chroma()). Only columns [first_input(),
+    //first_input() + num_columns) can be nonzero, the rest of an
+    //input vector is never read.
+    class FeatureProjection
+    {
+    public:
+        //orthonormal DCT-II of 'num_inputs' values,
+        //first 'num_outputs' coefficients
+        static FeatureProjection dct(size_t num_inputs, size_t num_outputs);
+
+        //chroma_size pitch classes of the power spectra of 'key'
+        //(num_coeff is ignored): every bin between min_freq and
+        //max_freq adds to the two classes nearest its pitch,
+        //weighted by distance
+        static FeatureProjection chroma(const FilterbankKey& key);
+
+        size_t num_inputs() const { return m_num_inputs; }
+        size_t num_outputs() const { return m_num_outputs; }
+        size_t first_input() const { return m_first_input; }
+        size_t num_columns() const { return m_num_columns; }
+
+        //inputs  - 'rows' vectors of num_inputs() values,
+        //          'input_stride' elements apart
+        //outputs - 'rows' output vectors of num_outputs() values,
+        //          'output_stride' elements apart
+        template<class T>
+        void apply(const T* inputs,
+                   size_t input_stride,
+                   T* outputs,
+                   size_t output_stride,
+                   size_t rows) const;
+
+    private:
+        FeatureProjection(size_t num_inputs,
+                          size_t num_outputs,
+                          size_t first_input,
+                          size_t num_columns);
+
+        size_t              m_num_inputs;
+        size_t              m_num_outputs;
+        size_t              m_first_input;
+        size_t              m_num_columns;
+        std::vector<double> m_matrix;   //output-major, num_columns each
+        std::vector<float>  m_matrix_f; //m_matrix for float pipeline
+
+        template<class T>
+        const T* matrix() const;
+    };
+
+    //Filterbanks shared between stft() calls, built once per key
+    class FilterbankCache
+    {
+    public:
+        std::shared_ptr<const MelFilterbank> get(const FilterbankKey& key);
+
+        //pseudo-inverse of get(key), also built once per key
+        std::shared_ptr<const MelPseudoInverse>
+        inverse(const FilterbankKey& key);
+
+        //FeatureProjection::chroma(key), num_coeff of 'key' is ignored
+        std::shared_ptr<const FeatureProjection>
+        chroma(const FilterbankKey& key);
+
+        //FeatureProjection::dct(num_inputs, num_outputs)
+        std::shared_ptr<const FeatureProjection>
+        dct(size_t num_inputs, size_t num_outputs);
+
+    private:
+        std::map<FilterbankKey, std::shared_ptr<const MelFilterbank>> m_banks;
+        std::map<FilterbankKey,
+                 std::shared_ptr<const MelPseudoInverse>> m_inverses;
+        std::map<FilterbankKey,
+                 std::shared_ptr<const FeatureProjection>> m_chroma;
+        std::map<std::pair<size_t, size_t>,
+                 std::shared_ptr<const FeatureProjection>> m_dct;
+        std::mutex m_mutex;
+    };
+
+    //|X|^2 of 'size' coefficients, no sqrt involved
+    template<class T>
+    void power_spectrum(const std::complex<T>* spectrum,
+                        T* power,
+                        size_t size);
+
+    //energy -> log(1 + energy) in place
+    template<class T>
+    void log_compress(T* energies, size_t size);
+
+    //inverse of log_compress(), negative energies are clamped to 0
+    template<class T>
+    void log_expand(T* energies, size_t size);
+}
+
+#endif
@@ -0,0 +1,181 @@
+#include "frame_analyzer.hpp"
+#include "stage_stats.hpp"
+#include "window.hpp"
+
+#include <algorithm>
+
+
+namespace neurosynth
+{
+    template<class T>
+    FrameAnalyzer<T>::FrameAnalyzer(const StftParams& params,
+                                    StftCache& cache,
+                                    Logger& logger)
+        : m_window_size(params.window_size),
+          m_fft_size(stft_fft_size(params)),
+          m_energy_scale(T(double(params.window_size) / double(m_fft_size))),
+          m_num_coeff(params.num_coeff),
+          m_num_mfcc(std::min(params.num_mfcc, params.num_coeff)),
+          m_num_chroma(params.chroma ? chroma_size : 0),
+          m_count(0)
+    {
+        if(params.packed_stereo)
+        {
+            m_packed.reset(new StereoDft<T>(m_fft_size, params.batch_size,
+                                            cache.plans, logger));
+            m_batch_size = m_packed->batch_size();
+        }
+        else
+        {
+            m_split.reset(new BatchDft<T>(m_fft_size, params.batch_size,
+                                          cache.plans, logger));
+            m_batch_size = m_split->batch_size();
+        }
+
+        m_window = cache.windows.get<T>(params.window_type,
+                                        params.window_size);
+        FilterbankKey key = {m_fft_size, params.sample_rate,
+                             params.num_coeff, params.min_freq,
+                             params.max_freq, params.filter_shape};
+        m_filterbank = cache.filterbanks.get(key);
+        if(m_num_mfcc > 0)
+            m_dct = cache.filterbanks.dct(m_num_coeff, m_num_mfcc);
+        if(m_num_chroma > 0)
+            m_chroma_bank = cache.filterbanks.chroma(key);
+
+        m_power_stride = aligned_count<T>(m_fft_size/2 + 1);
+        m_power.resize(2 * m_batch_size * m_power_stride);
+        m_energies.resize(2 * m_batch_size * m_num_coeff);
+        m_mfcc.resize(2 * m_batch_size * m_num_mfcc);
+        m_chroma.resize(2 * m_batch_size * m_num_chroma);
+    }
+
+    template<class T>
+    void FrameAnalyzer<T>::load_frame(size_t i,
+                                      const T* samples_l,
+                                      const T* samples_r)
+    {
+        NEUROSYNTH_STAGE(Window);
+        NEUROSYNTH_STAGE_COUNT(Window, 1, 2 * m_window_size * sizeof(T));
+        if(m_packed)
+            window_frame_packed(samples_l, samples_r, m_window->data(),
+                                m_packed->frame(i), m_window_size);
+        else
+            window_frame(samples_l, samples_r, m_window->data(),
+                         m_split->frame_l(i), m_split->frame_r(i),
+                         m_window_size);
+        zero_padding(i);
+    }
+
+    template<class T>
+    void FrameAnalyzer<T>::load_frame_interleaved(size_t i,
+                                                  const T* samples)
+    {
+        NEUROSYNTH_STAGE(Window);
+        NEUROSYNTH_STAGE_COUNT(Window, 1, 2 * m_window_size * sizeof(T));
+        if(m_packed)
+            window_frame_packed_interleaved(samples, m_window->data(),
+                                            m_packed->frame(i),
+                                            m_window_size);
+        else
+            window_frame_interleaved(samples, m_window->data(),
+                                     m_split->frame_l(i),
+                                     m_split->frame_r(i), m_window_size);
+        zero_padding(i);
+    }
+
+    template<class T>
+    void FrameAnalyzer<T>::zero_padding(size_t i)
+    {
+        if(m_packed)
+        {
+            std::fill(m_packed->frame(i) + m_window_size,
+                      m_packed->frame(i) + m_fft_size, std::complex<T>(0));
+            return;
+        }
+        std::fill(m_split->frame_l(i) + m_window_size,
+                  m_split->frame_l(i) + m_fft_size, T(0));
+        std::fill(m_split->frame_r(i) + m_window_size,
+                  m_split->frame_r(i) + m_fft_size, T(0));
+    }
+
+    template<class T>
+    void FrameAnalyzer<T>::analyze(size_t count)
+    {
+        m_count = count;
+        {
+            NEUROSYNTH_STAGE(Fft);
+            NEUROSYNTH_STAGE_COUNT(Fft, count,
+                                   2 * count * m_window_size * sizeof(T));
+            if(m_packed)
+                m_packed->execute(count);
+            else
+                m_split->execute(count);
+        }
+
+        size_t spectrum_size = m_fft_size/2 + 1;
+        NEUROSYNTH_STAGE(Filterbank);
+        NEUROSYNTH_STAGE_COUNT(Filterbank, count,
+                               2 * count * spectrum_size *
+                               sizeof(std::complex<T>));
+        for(size_t i = 0; i < count; i++)
+        {
+            if(m_packed)
+            {
+                m_packed->power_spectra(i, &m_power[i * m_power_stride],
+                                        &m_power[(count + i) *
+                                                 m_power_stride]);
+                continue;
+            }
+            power_spectrum(m_split->spectrum_l(i),
+                           &m_power[i * m_power_stride], spectrum_size);
+            power_spectrum(m_split->spectrum_r(i),
+                           &m_power[(count + i) * m_power_stride],
+                           spectrum_size);
+        }
+
+        m_filterbank->apply(m_power.data(), m_power_stride,
+                            m_energies.data(), m_num_coeff,
+                            2 * count);
+        if(m_fft_size != m_window_size)
+        {
+            T* energies = m_energies.data();
+            #pragma omp simd
+            for(size_t k = 0; k < 2 * count * m_num_coeff; k++)
+                energies[k] *= m_energy_scale;
+        }
+        log_compress(m_energies.data(), 2 * count * m_num_coeff);
+
+        if(m_dct)
+            m_dct->apply(m_energies.data(), m_num_coeff,
+                         m_mfcc.data(), m_num_mfcc, 2 * count);
+
+        if(m_chroma_bank)
+        {
+            m_chroma_bank->apply(m_power.data(), m_power_stride,
+                                 m_chroma.data(), m_num_chroma, 2 * count);
+            for(size_t row = 0; row < 2 * count; row++)
+            {
+                T* chroma = &m_chroma[row * m_num_chroma];
+                T  peak   = *std::max_element(chroma, chroma + m_num_chroma);
+                if(peak > T(0))
+                    for(size_t k = 0; k < m_num_chroma; k++)
+                        chroma[k] /= peak;
+            }
+        }
+    }
+
+    template<class T>
+    void FrameAnalyzer<T>::copy_frame(size_t i, T* frame) const
+    {
+        frame = std::copy(energies_l(i), energies_l(i) + m_num_coeff, frame);
+        frame = std::copy(energies_r(i), energies_r(i) + m_num_coeff, frame);
+        frame = std::copy(mfcc_l(i), mfcc_l(i) + m_num_mfcc, frame);
+        frame = std::copy(mfcc_r(i), mfcc_r(i) + m_num_mfcc, frame);
+        frame = std::copy(chroma_l(i), chroma_l(i) + m_num_chroma, frame);
+        std::copy(chroma_r(i), chroma_r(i) + m_num_chroma, frame);
+    }
+
+    template class FrameAnalyzer<double>;
+    template class FrameAnalyzer<float>;
+}
@@ -0,0 +1,125 @@
+#ifndef NEUROSYNTH_FRAME_ANALYZER_HPP
+#define NEUROSYNTH_FRAME_ANALYZER_HPP
+
+#include "aligned_allocator.hpp"
+#include "batch_dft.hpp"
+#include "filterbank.hpp"
+#include "logger.hpp"
+#include "wav_utils.hpp"
+
+#include <memory>
+
+
+namespace neurosynth
+{
+    //Analysis state of a single thread: batch buffers, window table
+    //and filterbank. Frames are loaded (and windowed) into slots,
+    //zero padded to stft_fft_size(), analyze() turns loaded frames
+    //into log mel energies. Energies are scaled by window/fft size,
+    //so they don't depend on the padding. params.packed_stereo
+    //transforms both channels of a frame with one StereoDft instead
+    //of two real transforms of BatchDft.
+    //The same power spectra also give chroma (params.chroma, peak
+    //normalized per frame) and the log mel energies mfcc
+    //(params.num_mfcc), so every feature takes one transform.
+    //Plans, windows and filterbanks come from the shared StftCache,
+    //buffers are private, so every thread needs its own analyzer.
+    template<class T>
+    class FrameAnalyzer
+    {
+    public:
+        FrameAnalyzer(const StftParams& params,
+                      StftCache& cache,
+                      Logger& logger);
+
+        size_t batch_size() const { return m_batch_size; }
+        size_t num_coeff() const { return m_num_coeff; }
+        size_t num_mfcc() const { return m_num_mfcc; }
+        size_t num_chroma() const { return m_num_chroma; }
+
+        //values per frame of copy_frame()
+        size_t frame_size() const
+        {
+            return 2 * (m_num_coeff + m_num_mfcc + m_num_chroma);
+        }
+
+        //windows one frame of planar samples into slot 'i'
+        void load_frame(size_t i,
+                        const T* samples_l,
+                        const T* samples_r);
+
+        //windows one frame of interleaved L/R samples into slot 'i'
+        void load_frame_interleaved(size_t i, const T* samples);
+
+        //analyzes slots [0, count)
+        void analyze(size_t count);
+
+        //num_coeff() energies of slot 'i' from last analyze()
+        const T* energies_l(size_t i) const
+        {
+            return &m_energies[i * m_num_coeff];
+        }
+
+        const T* energies_r(size_t i) const
+        {
+            return &m_energies[(m_count + i) * m_num_coeff];
+        }
+
+        //num_mfcc() cepstra of slot 'i' from last analyze()
+        const T* mfcc_l(size_t i) const
+        {
+            return m_mfcc.data() + i * m_num_mfcc;
+        }
+
+        const T* mfcc_r(size_t i) const
+        {
+            return m_mfcc.data() + (m_count + i) * m_num_mfcc;
+        }
+
+        //num_chroma() pitch classes of slot 'i' from last analyze()
+        const T* chroma_l(size_t i) const
+        {
+            return m_chroma.data() + i * m_num_chroma;
+        }
+
+        const T* chroma_r(size_t i) const
+        {
+            return m_chroma.data() + (m_count + i) * m_num_chroma;
+        }
+
+        //all features of slot 'i' as one row of frame_size() values:
+        //energies, mfcc and chroma, each L then R
+        void copy_frame(size_t i, T* frame) const;
+
+    private:
+        size_t   m_window_size;
+        size_t   m_fft_size;
+        T        m_energy_scale;
+        size_t   m_num_coeff;
+        size_t   m_num_mfcc;
+        size_t   m_num_chroma;
+        size_t   m_power_stride;
+        size_t   m_batch_size;
+        size_t   m_count;
+
+        std::unique_ptr<BatchDft<T>>  m_split;
+        std::unique_ptr<StereoDft<T>> m_packed;
+
+        std::shared_ptr<const AlignedVector<T>> m_window;
+        std::shared_ptr<const MelFilterbank>    m_filterbank;
+        std::shared_ptr<const FeatureProjection> m_dct;
+        std::shared_ptr<const FeatureProjection> m_chroma_bank;
+
+        //power spectra and features of the whole batch,
+        //rows [0, count) hold left, [count, 2*count) right channel
+        AlignedVector<T> m_power;
+        AlignedVector<T> m_energies;
+        AlignedVector<T> m_mfcc;
+        AlignedVector<T> m_chroma;
+
+        //zero pads slot 'i' past the window
+        void zero_padding(size_t i);
+    };
+}
+
+#endif
@@ -0,0 +1,352 @@
+#include "griffin_lim.hpp"
+#include "batch_dft.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <random>
+
+
+namespace neurosynth
+{
+    namespace
+    {
+        //buffers of one thread
+        template<class T>
+        struct Workspace
+        {
+            Workspace(size_t fft_size,
+                      size_t batch_size,
+                      size_t num_coeff,
+                      FftPlanCache& plans,
+                      Logger& logger)
+                : dft(fft_size, batch_size, plans, logger),
+                  idft(fft_size, batch_size, plans, logger),
+                  energies(num_coeff),
+                  error(0.0),
+                  target(0.0) {}
+
+            BatchDft<T>      dft;
+            BatchIdft<T>     idft;
+            AlignedVector<T> energies;
+            double           error;  //sum of (|X| - magnitude)^2
+            double           target; //sum of magnitude^2
+        };
+    }
+
+    template<class T>
+    void griffin_lim(const StftData<T>& stft_data,
+                     const StftParams& params,
+                     const GriffinLimParams& gl_params,
+                     StftCache& cache,
+                     WavData<T>& wav_data,
+                     Logger& logger)
+    {
+        size_t N = params.window_size;
+        size_t H = params.window_step;
+        size_t F = stft_data.num_frames();
+        size_t M = gl_params.fft_size == 0 ? fast_fft_size(N) :
+            std::max(gl_params.fft_size, N);
+        size_t K = M/2 + 1;
+        T      momentum = T(gl_params.momentum);
+
+        wav_data.sample_rate = size_t(params.sample_rate + 0.5);
+        wav_data.samples_l.clear();
+        wav_data.samples_r.clear();
+        if(F == 0)
+            return;
+
+        logger.info("Performing Griffin-Lim with parameters: "
+                    "Window size: " + std::to_string(N) +
+                    "; fft size: " + std::to_string(M) +
+                    "; window step: " + std::to_string(H) +
+                    "; sample rate: " + std::to_string(params.sample_rate) +
+                    "; # coefficients: " + std::to_string(params.num_coeff) +
+                    "; iterations: " + std::to_string(gl_params.iterations) +
+                    "; momentum: " + std::to_string(gl_params.momentum) +
+                    "; batch size: " + std::to_string(params.batch_size) +
+                    "; threads: " + std::to_string(params.num_threads));
+
+        std::shared_ptr<const MelPseudoInverse> inverse =
+            cache.filterbanks.inverse({M,
+                                       params.sample_rate,
+                                       params.num_coeff,
+                                       params.min_freq,
+                                       params.max_freq,
+                                       params.filter_shape});
+        std::shared_ptr<const AlignedVector<T>> window =
+            cache.windows.get<T>(params.window_type, N);
+
+        //band energies grow with the number of bins they sum up
+        T energy_scale = T(M) / T(N);
+
+        //least squares overlap-add: x = sum w * frame / sum w^2,
+        //fftw's inverse is unnormalized, so 1/M goes into the window
+        size_t L = (F - 1) * H + N;
+        AlignedVector<T> synthesis(N);
+        for(size_t n = 0; n < N; n++)
+            synthesis[n] = (*window)[n] / T(M);
+
+        AlignedVector<T> norm(L, T(0));
+        for(size_t t = 0; t < F; t++)
+            for(size_t n = 0; n < N; n++)
+                norm[t * H + n] += (*window)[n] * (*window)[n];
+        T max_norm = *std::max_element(norm.begin(), norm.end());
+        for(T& value : norm)
+            value = value > max_norm * T(1e-6) ? T(1) / value : T(0);
+
+        //rows [0, F) hold left, [F, 2F) right channel
+        size_t mag_stride   = aligned_count<T>(K);
+        size_t spec_stride  = fft_complex_dist<T>(M);
+        size_t frame_stride = fft_real_dist<T>(N);
+        AlignedVector<T>               magnitude(2 * F * mag_stride);
+        AlignedVector<std::complex<T>> current(2 * F * spec_stride);
+        AlignedVector<std::complex<T>> projected(2 * F * spec_stride);
+        AlignedVector<T>               frames(2 * F * frame_stride);
+
+        std::vector<T>& x_l = wav_data.samples_l;
+        std::vector<T>& x_r = wav_data.samples_r;
+        x_l.resize(L);
+        x_r.resize(L);
+
+        size_t batch_size  = std::max<size_t>(params.batch_size, 1);
+        size_t num_batches = (F + batch_size - 1) / batch_size;
+        size_t num_threads = std::min(resolve_num_threads(params.num_threads),
+                                      num_batches);
+
+        std::vector<std::unique_ptr<Workspace<T>>> workspaces;
+        for(size_t i = 0; i < num_threads; i++)
+            workspaces.emplace_back(new Workspace<T>(M, batch_size,
+                                                     params.num_coeff,
+                                                     cache.plans, logger));
+
+        std::unique_ptr<ThreadPool> pool;
+        if(num_threads > 1)
+            pool.reset(new ThreadPool(num_threads));
+
+        //runs task(workspace, item) for items [0, num_items),
+        //each thread picks the next item when done with one
+        auto parallel = [&](size_t num_items,
+                            const std::function<void(Workspace<T>&,
+                                                     size_t)>& task)
+        {
+            std::atomic<size_t> next_item(0);
+            auto worker = [&](Workspace<T>& workspace)
+            {
+                size_t item;
+                while((item = next_item++) < num_items)
+                    task(workspace, item);
+            };
+
+            if(!pool)
+            {
+                worker(*workspaces[0]);
+                return;
+            }
+            for(size_t i = 0; i < num_threads; i++)
+            {
+                Workspace<T>* workspace = workspaces[i].get();
+                pool->submit([&worker, workspace] { worker(*workspace); });
+            }
+            pool->wait();
+        };
+
+        //inverse transform of batch 'b' of 'spectra' into frames
+        auto synthesize = [&](Workspace<T>& ws, size_t b,
+                              const std::complex<T>* spectra)
+        {
+            size_t first = b * batch_size;
+            size_t count = std::min(batch_size, F - first);
+            for(size_t i = 0; i < count; i++)
+            {
+                const std::complex<T>* row_l =
+                    &spectra[(first + i) * spec_stride];
+                const std::complex<T>* row_r =
+                    &spectra[(F + first + i) * spec_stride];
+                std::copy(row_l, row_l + K, ws.idft.spectrum_l(i));
+                std::copy(row_r, row_r + K, ws.idft.spectrum_r(i));
+            }
+
+            ws.idft.execute(count);
+
+            const T* w = synthesis.data();
+            for(size_t i = 0; i < count; i++)
+            {
+                const T* in_l  = ws.idft.frame_l(i);
+                const T* in_r  = ws.idft.frame_r(i);
+                T*       out_l = &frames[(first + i) * frame_stride];
+                T*       out_r = &frames[(F + first + i) * frame_stride];
+                #pragma omp simd
+                for(size_t n = 0; n < N; n++)
+                {
+                    out_l[n] = in_l[n] * w[n];
+                    out_r[n] = in_r[n] * w[n];
+                }
+            }
+        };
+
+        //sums frames overlapping samples of chunk 'c'
+        const size_t chunk_size = 1 << 14;
+        size_t num_chunks = (L + chunk_size - 1) / chunk_size;
+        auto overlap_add = [&](Workspace<T>&, size_t c)
+        {
+            size_t begin = c * chunk_size;
+            size_t end   = std::min(begin + chunk_size, L);
+            size_t first = begin >= N ? (begin - N) / H + 1 : 0;
+            size_t last  = std::min((end - 1) / H, F - 1);
+
+            std::fill(&x_l[begin], &x_l[begin] + (end - begin), T(0));
+            std::fill(&x_r[begin], &x_r[begin] + (end - begin), T(0));
+            for(size_t t = first; t <= last; t++)
+            {
+                size_t from = std::max(begin, t * H);
+                size_t to   = std::min(end, t * H + N);
+                const T* in_l = &frames[t * frame_stride] - t * H;
+                const T* in_r = &frames[(F + t) * frame_stride] - t * H;
+                #pragma omp simd
+                for(size_t n = from; n < to; n++)
+                {
+                    x_l[n] += in_l[n];
+                    x_r[n] += in_r[n];
+                }
+            }
+
+            #pragma omp simd
+            for(size_t n = begin; n < end; n++)
+            {
+                x_l[n] *= norm[n];
+                x_r[n] *= norm[n];
+            }
+        };
+
+        //target magnitudes and random initial phase
+        auto initialize = [&](Workspace<T>& ws, size_t b)
+        {
+            size_t first = b * batch_size;
+            size_t count = std::min(batch_size, F - first);
+            for(size_t i = 0; i < 2 * count; i++)
+            {
+                size_t   t    = first + i % count;
+                size_t   row  = (i < count ? 0 : F) + t;
+                T*       mag  = &magnitude[row * mag_stride];
+                const T* feat = stft_data.row(i < count ? 0 : 1, t);
+
+                std::copy(feat, feat + params.num_coeff, ws.energies.data());
+                log_expand(ws.energies.data(), params.num_coeff);
+                for(size_t c = 0; c < params.num_coeff; c++)
+                    ws.energies[c] *= energy_scale;
+                inverse->apply(ws.energies.data(), params.num_coeff,
+                               mag, mag_stride, 1);
+
+                //seeded per row, so the result doesn't depend on threads
+                std::mt19937 rng(gl_params.seed + uint32_t(row));
+                std::uniform_real_distribution<double> phase(0.0,
+                                                             2.0 * M_PI);
+                std::complex<T>* c = &current[row * spec_stride];
+                for(size_t k = 0; k < K; k++)
+                {
+                    mag[k] = std::sqrt(mag[k]);
+                    c[k]   = std::polar(mag[k], T(phase(rng)));
+                }
+                std::copy(c, c + K, &projected[row * spec_stride]);
+            }
+
+            synthesize(ws, b, current.data());
+        };
+
+        //spectra of the current signal are projected onto the target
+        //magnitudes, then extrapolated along the last step
+        bool last_iteration = false;
+        auto project = [&](Workspace<T>& ws, size_t b)
+        {
+            size_t first = b * batch_size;
+            size_t count = std::min(batch_size, F - first);
+            //samples past N stay zero from BatchDft's construction
+            for(size_t i = 0; i < count; i++)
+            {
+                size_t t = (first + i) * H;
+                window_frame(&x_l[t], &x_r[t], window->data(),
+                             ws.dft.frame_l(i), ws.dft.frame_r(i), N);
+            }
+
+            ws.dft.execute(count);
+
+            double error  = 0.0;
+            double target = 0.0;
+            for(size_t i = 0; i < 2 * count; i++)
+            {
+                size_t row = (i < count ? 0 : F) + first + i % count;
+                const T* y = reinterpret_cast<const T*>
+                    (i < count ? ws.dft.spectrum_l(i) :
+                     ws.dft.spectrum_r(i - count));
+                const T* mag  = &magnitude[row * mag_stride];
+                T*       prev = reinterpret_cast<T*>
+                    (&projected[row * spec_stride]);
+                T*       c    = reinterpret_cast<T*>
+                    (&current[row * spec_stride]);
+
+                #pragma omp simd reduction(+:error, target)
+                for(size_t k = 0; k < K; k++)
+                {
+                    T re = y[2*k];
+                    T im = y[2*k+1];
+                    T a  = std::sqrt(re * re + im * im);
+                    T scale = a > T(0) ? mag[k] / a : T(0);
+                    T p_re  = a > T(0) ? re * scale : mag[k];
+                    T p_im  = im * scale;
+
+                    c[2*k]      = p_re + momentum * (p_re - prev[2*k]);
+                    c[2*k+1]    = p_im + momentum * (p_im - prev[2*k+1]);
+                    prev[2*k]   = p_re;
+                    prev[2*k+1] = p_im;
+
+                    error  += double((a - mag[k]) * (a - mag[k]));
+                    target += double(mag[k] * mag[k]);
+                }
+            }
+            ws.error  += error;
+            ws.target += target;
+
+            //the final signal comes from consistent magnitudes
+            synthesize(ws, b, last_iteration ? projected.data() :
+                       current.data());
+        };
+
+        parallel(num_batches, initialize);
+        for(size_t it = 1; it <= gl_params.iterations; it++)
+        {
+            last_iteration = it == gl_params.iterations;
+            for(auto& ws : workspaces)
+                ws->error = ws->target = 0.0;
+            parallel(num_chunks, overlap_add);
+            parallel(num_batches, project);
+        }
+        parallel(num_chunks, overlap_add);
+
+        double error  = 0.0;
+        double target = 0.0;
+        for(auto& ws : workspaces)
+        {
+            error  += ws->error;
+            target += ws->target;
+        }
+        if(gl_params.iterations > 0 && target > 0.0)
+            logger.info("Griffin-Lim spectral convergence of the last "
+                        "iteration: " + std::to_string(std::sqrt(error /
+                                                                 target)));
+    }
+
+    template void griffin_lim<double>(const StftData<double>&,
+                                      const StftParams&,
+                                      const GriffinLimParams&,
+                                      StftCache&, WavData<double>&,
+                                      Logger&);
+    template void griffin_lim<float>(const StftData<float>&,
+                                     const StftParams&,
+                                     const GriffinLimParams&,
+                                     StftCache&, WavData<float>&,
+                                     Logger&);
+}
@@ -0,0 +1,40 @@
+#ifndef NEUROSYNTH_GRIFFIN_LIM_HPP
+#define NEUROSYNTH_GRIFFIN_LIM_HPP
+
+#include "logger.hpp"
+#include "wav_utils.hpp"
+
+#include <cstdint>
+
+
+namespace neurosynth
+{
+    struct GriffinLimParams
+    {
+        size_t   iterations = 32;   // # of phase recovery iterations
+        double   momentum   = 0.99; // 0 - plain Griffin-Lim
+        uint32_t seed       = 1;    // of the random initial phase
+        size_t   fft_size   = 0;    // 0 - fast_fft_size(window_size)
+    };
+
+    //Reconstructs audio from stft() features. Band energies are mapped
+    //back onto power spectra by the filterbank's pseudo-inverse, then
+    //phase is recovered by fast Griffin-Lim (Perraudin et al.):
+    //alternating projections onto consistent spectrograms and onto the
+    //target magnitudes, extrapolated by 'momentum' after every step.
+    //Frames are zero padded to gl_params.fft_size and go through
+    //batched forward/inverse ffts of params.batch_size frames, target
+    //magnitudes come from the pseudo-inverse of the filterbank at that
+    //size. Batches and overlap-add are split between
+    //params.num_threads threads.
+    //Output has (frames - 1) * window_step + window_size samples.
+    template<class T>
+    void griffin_lim(const StftData<T>& stft_data,
+                     const StftParams& params,
+                     const GriffinLimParams& gl_params,
+                     StftCache& cache,
+                     WavData<T>& wav_data,
+                     Logger& logger);
+}
+
+#endif
@@ -0,0 +1,119 @@
+#include "hash.hpp"
+
+#include <cstring>
+
+
+namespace neurosynth
+{
+    namespace
+    {
+        constexpr uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+        constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+        constexpr uint64_t prime3 = 0x165667B19E3779F9ULL;
+        constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+        constexpr uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+        //little endian hosts only, as the stft container
+        uint64_t read64(const unsigned char* p)
+        {
+            uint64_t value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        uint32_t read32(const unsigned char* p)
+        {
+            uint32_t value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        uint64_t rotl(uint64_t x, int r)
+        {
+            return (x << r) | (x >> (64 - r));
+        }
+
+        uint64_t round(uint64_t acc, uint64_t input)
+        {
+            acc += input * prime2;
+            acc  = rotl(acc, 31);
+            return acc * prime1;
+        }
+
+        uint64_t merge_round(uint64_t acc, uint64_t value)
+        {
+            acc ^= round(0, value);
+            return acc * prime1 + prime4;
+        }
+    }
+
+    uint64_t hash64(const void* data, size_t size, uint64_t seed)
+    {
+        const unsigned char* p   = static_cast<const unsigned char*>(data);
+        const unsigned char* end = p + size;
+        uint64_t h;
+
+        if(size >= 32)
+        {
+            uint64_t v1 = seed + prime1 + prime2;
+            uint64_t v2 = seed + prime2;
+            uint64_t v3 = seed;
+            uint64_t v4 = seed - prime1;
+
+            //four independent lanes keep the multipliers busy
+            const unsigned char* limit = end - 32;
+            do
+            {
+                v1 = round(v1, read64(p));
+                v2 = round(v2, read64(p + 8));
+                v3 = round(v3, read64(p + 16));
+                v4 = round(v4, read64(p + 24));
+                p += 32;
+            }
+            while(p <= limit);
+
+            h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+            h = merge_round(h, v1);
+            h = merge_round(h, v2);
+            h = merge_round(h, v3);
+            h = merge_round(h, v4);
+        }
+        else
+            h = seed + prime5;
+
+        h += uint64_t(size);
+
+        for(; p + 8 <= end; p += 8)
+        {
+            h ^= round(0, read64(p));
+            h  = rotl(h, 27) * prime1 + prime4;
+        }
+        if(p + 4 <= end)
+        {
+            h ^= uint64_t(read32(p)) * prime1;
+            h  = rotl(h, 23) * prime2 + prime3;
+            p += 4;
+        }
+        for(; p < end; p++)
+        {
+            h ^= uint64_t(*p) * prime5;
+            h  = rotl(h, 11) * prime1;
+        }
+
+        h ^= h >> 33;
+        h *= prime2;
+        h ^= h >> 29;
+        h *= prime3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    std::string hex64(uint64_t value)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex(16, '0');
+        for(size_t i = 0; i < 16; i++)
+            hex[15 - i] = digits[(value >> (4 * i)) & 0xF];
+        return hex;
+    }
+}
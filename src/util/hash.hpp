@@ -0,0 +1,19 @@
+#ifndef NEUROSYNTH_HASH_HPP
+#define NEUROSYNTH_HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+namespace neurosynth
+{
+    //XXH64 of 'size' bytes: non-cryptographic, reads several GB/s,
+    //for content addressing of files we produce ourselves
+    uint64_t hash64(const void* data, size_t size, uint64_t seed = 0);
+
+    //16 lowercase hex digits
+    std::string hex64(uint64_t value);
+}
+
+#endif
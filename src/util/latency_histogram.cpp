@@ -0,0 +1,83 @@
+#include "latency_histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+
+namespace neurosynth
+{
+    LatencyHistogram::LatencyHistogram()
+        : m_count(0),
+          m_max_ns(0),
+          m_sum_ns(0.0)
+    {
+        m_counts.fill(0);
+    }
+
+    //values below 16ns get a bucket each, above that the 4 bits
+    //following the leading one select one of 16 sub-buckets
+    size_t LatencyHistogram::bucket(uint64_t ns)
+    {
+        if(ns < sub_buckets)
+            return size_t(ns);
+        size_t exponent = size_t(63 - __builtin_clzll(ns));
+        size_t sub      = size_t(ns >> (exponent - 4)) & (sub_buckets - 1);
+        return (exponent - 3) * sub_buckets + sub;
+    }
+
+    //smallest value of the next bucket
+    uint64_t LatencyHistogram::bucket_limit(size_t index)
+    {
+        if(index < sub_buckets)
+            return index + 1;
+        size_t exponent = index / sub_buckets + 3;
+        uint64_t sub    = index % sub_buckets;
+        return (sub_buckets + sub + 1) << (exponent - 4);
+    }
+
+    void LatencyHistogram::add(double seconds)
+    {
+        uint64_t ns = uint64_t(std::max(seconds, 0.0) * 1e9);
+        m_counts[bucket(ns)]++;
+        m_count++;
+        m_max_ns  = std::max(m_max_ns, ns);
+        m_sum_ns += double(ns);
+    }
+
+    double LatencyHistogram::mean() const
+    {
+        return m_count > 0 ? m_sum_ns / double(m_count) * 1e-9 : 0.0;
+    }
+
+    double LatencyHistogram::percentile(double p) const
+    {
+        if(m_count == 0)
+            return 0.0;
+
+        uint64_t rank = uint64_t(std::ceil(p / 100.0 * double(m_count)));
+        rank = std::min(std::max<uint64_t>(rank, 1), m_count);
+
+        uint64_t seen = 0;
+        for(size_t i = 0; i < m_counts.size(); i++)
+        {
+            seen += m_counts[i];
+            if(seen >= rank)
+                return double(std::min(bucket_limit(i), m_max_ns)) * 1e-9;
+        }
+        return max();
+    }
+
+    std::string LatencyHistogram::describe() const
+    {
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer),
+                 "%llu frames, mean %.3fms, p50 %.3fms, p90 %.3fms, "
+                 "p99 %.3fms, p99.9 %.3fms, max %.3fms",
+                 (unsigned long long)m_count, mean() * 1e3,
+                 percentile(50.0) * 1e3, percentile(90.0) * 1e3,
+                 percentile(99.0) * 1e3, percentile(99.9) * 1e3,
+                 max() * 1e3);
+        return buffer;
+    }
+}
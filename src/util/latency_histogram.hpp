@@ -0,0 +1,44 @@
+#ifndef NEUROSYNTH_LATENCY_HISTOGRAM_HPP
+#define NEUROSYNTH_LATENCY_HISTOGRAM_HPP
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+
+namespace neurosynth
+{
+    //Log-linear histogram of durations: 16 buckets per power of two
+    //of nanoseconds, i.e. percentiles within ~6%. Storage is fixed, so
+    //add() can be called from real-time code.
+    class LatencyHistogram
+    {
+    public:
+        LatencyHistogram();
+
+        void add(double seconds);
+
+        uint64_t count() const { return m_count; }
+        double   max() const { return double(m_max_ns) * 1e-9; }
+        double   mean() const;
+
+        //upper bound of the 'p' (0 - 100) percentile, in seconds
+        double percentile(double p) const;
+
+        //"n, mean, p50, p90, p99, p99.9 and max" in milliseconds
+        std::string describe() const;
+
+    private:
+        static constexpr size_t sub_buckets = 16;
+
+        std::array<uint64_t, 64 * sub_buckets> m_counts;
+        uint64_t m_count;
+        uint64_t m_max_ns;
+        double   m_sum_ns;
+
+        static size_t bucket(uint64_t ns);
+        static uint64_t bucket_limit(size_t index);
+    };
+}
+
+#endif
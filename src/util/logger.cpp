@@ -0,0 +1,169 @@
+#include "logger.hpp"
+
+#include <boost/filesystem.hpp>
+#include <chrono>
+
+
+namespace neurosynth
+{
+    bool parse_log_level(const std::string& name, LogLevel& level)
+    {
+        if(name == "info")
+            level = LogLevel::Info;
+        else if(name == "warn")
+            level = LogLevel::Warning;
+        else if(name == "error")
+            level = LogLevel::Error;
+        else if(name == "off")
+            level = LogLevel::Off;
+        else
+            return false;
+        return true;
+    }
+
+    namespace
+    {
+        const char* level_prefix(LogLevel level)
+        {
+            switch(level)
+            {
+            case LogLevel::Info:
+                return "INFO: ";
+            case LogLevel::Warning:
+                return "WARNING: ";
+            case LogLevel::Error:
+                return "ERROR: ";
+            case LogLevel::Off:
+                break;
+            }
+            return "";
+        }
+    }
+
+    Logger::Logger(const std::string& filename,
+                   LogLevel level)
+        : m_filename(filename),
+          m_level(level),
+          m_head(nullptr),
+          m_tail(nullptr),
+          m_pushed(0),
+          m_written(0),
+          m_waiting(false),
+          m_stop(false)
+    {
+        boost::filesystem::path path(filename);
+        boost::system::error_code error;
+        boost::filesystem::create_directories(path.parent_path(), error);
+
+        m_file_stream.open(filename.c_str(), std::ios_base::out);
+
+        Node* stub = new Node();
+        stub->next.store(nullptr);
+        m_head.store(stub);
+        m_tail = stub;
+
+        m_writer = std::thread(&Logger::run, this);
+    }
+
+    Logger::~Logger()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop.store(true);
+        }
+        m_wake.notify_one();
+        m_writer.join();
+
+        delete m_tail;
+    }
+
+    void Logger::push(LogLevel level, std::string&& message)
+    {
+        Node* node = new Node();
+        node->next.store(nullptr, std::memory_order_relaxed);
+        node->level   = level;
+        node->message = std::move(message);
+
+        //until 'prev' is linked the writer sees the queue end before
+        //'node', messages of one thread stay in order
+        Node* prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+        m_pushed.fetch_add(1, std::memory_order_release);
+
+        if(m_waiting.load(std::memory_order_acquire))
+            m_wake.notify_one();
+    }
+
+    void Logger::flush()
+    {
+        uint64_t target = m_pushed.load(std::memory_order_acquire);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.notify_one();
+        m_done.wait(lock, [&]()
+                    {
+                        return m_written.load(std::memory_order_acquire) >=
+                            target;
+                    });
+    }
+
+    void Logger::run()
+    {
+        std::string batch;
+        while(true)
+        {
+            uint64_t count = 0;
+            batch.clear();
+
+            Node* next;
+            while((next = m_tail->next.load(std::memory_order_acquire)))
+            {
+                batch += level_prefix(next->level);
+                batch += next->message;
+                batch += '\n';
+                next->message = std::string();
+
+                delete m_tail;
+                m_tail = next;
+                count++;
+            }
+
+            if(count > 0)
+            {
+                if(m_file_stream)
+                {
+                    m_file_stream.write(batch.data(), batch.size());
+                    m_file_stream.flush();
+                }
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_written.fetch_add(count, std::memory_order_release);
+                m_done.notify_all();
+                continue;
+            }
+
+            //a message may be counted, but not linked yet
+            uint64_t written = m_written.load(std::memory_order_relaxed);
+            if(m_pushed.load(std::memory_order_acquire) != written)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if(m_stop.load())
+                break;
+
+            //producers don't take the lock to notify, so a wakeup
+            //can be missed; the timeout bounds how long a line waits
+            m_waiting.store(true, std::memory_order_release);
+            m_wake.wait_for(lock, std::chrono::milliseconds(50), [&]()
+                            {
+                                return m_stop.load() ||
+                                    m_pushed.load(std::memory_order_acquire) !=
+                                    written;
+                            });
+            m_waiting.store(false, std::memory_order_relaxed);
+        }
+    }
+}
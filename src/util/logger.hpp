@@ -1,58 +1,104 @@
 #ifndef NEUROSYNTH_LOGGER_HPP
 #define NEUROSYNTH_LOGGER_HPP
 
-#include <boost/filesystem.hpp>
-#include <iostream>
+#include <atomic>
+#include <condition_variable>
 #include <fstream>
+#include <mutex>
 #include <string>
+#include <thread>
 
 
 namespace neurosynth
 {
+    enum class LogLevel
+    {
+        Info,
+        Warning,
+        Error,
+        Off
+    };
+
+    //parses level name (info, warn, error, off)
+    //returns false if name is not recognized
+    bool parse_log_level(const std::string& name, LogLevel& level);
+
+    //Asynchronous log file. Messages of any thread are linked into a
+    //lock-free multi-producer queue; a background thread writes them
+    //in batches, one write and flush per batch instead of per line.
+    //Messages below level() are dropped before anything is copied.
+    //flush() waits until everything logged so far is in the file, the
+    //destructor drains the queue.
     class Logger
     {
     public:
-        Logger(const std::string& filename)
-            : m_filename(filename)
-        {
-            boost::filesystem::path path(filename);
-            boost::filesystem::create_directories(path.parent_path());
+        explicit Logger(const std::string& filename,
+                        LogLevel level = LogLevel::Info);
 
-            m_file_stream.open(filename.c_str(), std::ios_base::out);
-        }
+        ~Logger();
+
+        Logger(const Logger&) = delete;
+        Logger& operator=(const Logger&) = delete;
 
-        ~Logger() {}
+        void info(std::string message)
+        {
+            if(enabled(LogLevel::Info))
+                push(LogLevel::Info, std::move(message));
+        }
 
-        void info(const std::string& message)
+        void warn(std::string message)
         {
-            if(m_file_stream)
-            {
-                m_file_stream << "INFO: " << message << "\n";
-                m_file_stream.flush();
-            }
+            if(enabled(LogLevel::Warning))
+                push(LogLevel::Warning, std::move(message));
         }
 
-        void warn(const std::string& message)
+        void err(std::string message)
         {
-            if(m_file_stream)
-            {
-                m_file_stream << "WARNING: " << message << "\n";
-                m_file_stream.flush();
-            }
+            if(enabled(LogLevel::Error))
+                push(LogLevel::Error, std::move(message));
         }
 
-        void err(const std::string& message)
+        //lets callers skip building messages nobody will read
+        bool enabled(LogLevel level) const
         {
-            if(m_file_stream)
-            {
-                m_file_stream << "ERROR: " << message << "\n";
-                m_file_stream.flush();
-            }
+            return level >= m_level.load(std::memory_order_relaxed);
         }
 
+        LogLevel level() const { return m_level.load(); }
+        void set_level(LogLevel level) { m_level.store(level); }
+
+        void flush();
+
     private:
-        std::string   m_filename;
-        std::ofstream m_file_stream;
+        struct Node
+        {
+            std::atomic<Node*> next;
+            LogLevel           level;
+            std::string        message;
+        };
+
+        std::string           m_filename;
+        std::ofstream         m_file_stream;
+        std::atomic<LogLevel> m_level;
+
+        //producers link behind m_head, the writer pops at m_tail,
+        //which is always a consumed (stub) node
+        std::atomic<Node*>    m_head;
+        Node*                 m_tail;
+
+        std::atomic<uint64_t> m_pushed;   //messages queued so far
+        std::atomic<uint64_t> m_written;  //... and written by the writer
+        std::atomic<bool>     m_waiting;  //writer is idle
+        std::atomic<bool>     m_stop;
+
+        std::mutex              m_mutex;  //guards the waits only
+        std::condition_variable m_wake;   //writer waits for messages
+        std::condition_variable m_done;   //flush() waits for the writer
+        std::thread             m_writer;
+
+        void push(LogLevel level, std::string&& message);
+
+        void run();
     };
 }
 
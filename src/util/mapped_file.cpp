@@ -0,0 +1,103 @@
+#include "mapped_file.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace neurosynth
+{
+    MappedFile::MappedFile()
+        : m_data(nullptr),
+          m_size(0),
+          m_open(false)
+    {
+    }
+
+    MappedFile::~MappedFile()
+    {
+        close();
+    }
+
+    MappedFile::MappedFile(MappedFile&& other)
+        : m_data(other.m_data),
+          m_size(other.m_size),
+          m_open(other.m_open)
+    {
+        other.m_data = nullptr;
+        other.m_size = 0;
+        other.m_open = false;
+    }
+
+    MappedFile& MappedFile::operator=(MappedFile&& other)
+    {
+        if(this != &other)
+        {
+            close();
+            m_data = other.m_data;
+            m_size = other.m_size;
+            m_open = other.m_open;
+            other.m_data = nullptr;
+            other.m_size = 0;
+            other.m_open = false;
+        }
+        return *this;
+    }
+
+    bool MappedFile::open(const std::string& filename,
+                          Logger& logger,
+                          bool sequential)
+    {
+        close();
+
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd == -1)
+        {
+            logger.warn("Cannot open file: " + filename +
+                        " - error: " + strerror(errno));
+            return false;
+        }
+
+        struct stat st;
+        if(fstat(fd, &st) == -1)
+        {
+            logger.warn("Cannot stat file: " + filename +
+                        " - error: " + strerror(errno));
+            ::close(fd);
+            return false;
+        }
+
+        m_size = size_t(st.st_size);
+        if(m_size > 0)
+        {
+            void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(data == MAP_FAILED)
+            {
+                logger.warn("Cannot map file: " + filename +
+                            " - error: " + strerror(errno));
+                ::close(fd);
+                m_size = 0;
+                return false;
+            }
+            madvise(data, m_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+            m_data = static_cast<const char*>(data);
+        }
+
+        //mapping stays valid after the descriptor is closed
+        ::close(fd);
+        m_open = true;
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if(m_data)
+            munmap(const_cast<char*>(m_data), m_size);
+        m_data = nullptr;
+        m_size = 0;
+        m_open = false;
+    }
+}
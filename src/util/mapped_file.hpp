@@ -0,0 +1,44 @@
+#ifndef NEUROSYNTH_MAPPED_FILE_HPP
+#define NEUROSYNTH_MAPPED_FILE_HPP
+
+#include "logger.hpp"
+
+#include <string>
+
+
+namespace neurosynth
+{
+    //Read-only memory mapping of a whole file
+    class MappedFile
+    {
+    public:
+        MappedFile();
+
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        MappedFile(MappedFile&& other);
+        MappedFile& operator=(MappedFile&& other);
+
+        //maps 'filename', returns false (and logs) on failure
+        //'sequential' hints the kernel to read ahead aggressively
+        bool open(const std::string& filename,
+                  Logger& logger,
+                  bool sequential = true);
+
+        void close();
+
+        bool is_open() const { return m_open; }
+        const char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+    private:
+        const char* m_data;
+        size_t      m_size;
+        bool        m_open;
+    };
+}
+
+#endif
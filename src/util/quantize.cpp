@@ -0,0 +1,239 @@
+#include "quantize.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+
+namespace neurosynth
+{
+    namespace
+    {
+        uint32_t float_bits(float value)
+        {
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            return bits;
+        }
+
+        float bits_float(uint32_t bits)
+        {
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+#ifdef __F16C__
+        __m256 load8(const float* in)
+        {
+            return _mm256_loadu_ps(in);
+        }
+
+        __m256 load8(const double* in)
+        {
+            __m128 low  = _mm256_cvtpd_ps(_mm256_loadu_pd(in));
+            __m128 high = _mm256_cvtpd_ps(_mm256_loadu_pd(in + 4));
+            return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+        }
+
+        void store8(__m256 values, float* out)
+        {
+            _mm256_storeu_ps(out, values);
+        }
+
+        void store8(__m256 values, double* out)
+        {
+            _mm256_storeu_pd(out, _mm256_cvtps_pd(_mm256_castps256_ps128(values)));
+            _mm256_storeu_pd(out + 4,
+                             _mm256_cvtps_pd(_mm256_extractf128_ps(values, 1)));
+        }
+#endif
+    }
+
+    //bit manipulation after F. Giesen's branch-light conversions:
+    //subnormals are rounded by the FPU through a magic addend,
+    //normal numbers by adding half an ulp (plus one if odd)
+    uint16_t float_to_half(float value)
+    {
+        const uint32_t f32_infinity = 255u << 23;
+        const uint32_t f16_overflow = (127u + 16u) << 23;
+        const float    denorm_magic = bits_float(((127u - 15u) +
+                                                  (23u - 10u) + 1u) << 23);
+
+        uint32_t bits = float_bits(value);
+        uint32_t sign = bits & 0x80000000u;
+        bits ^= sign;
+
+        //NaNs keep the top of their payload and are made quiet, as
+        //F16C converts them
+        uint16_t half;
+        if(bits >= f16_overflow)
+            half = bits > f32_infinity ?
+                uint16_t(0x7e00 | ((bits >> 13) & 0x3ff)) : 0x7c00;
+        else if(bits < (113u << 23))
+            half = uint16_t(float_bits(bits_float(bits) + denorm_magic) -
+                            float_bits(denorm_magic));
+        else
+        {
+            uint32_t odd = (bits >> 13) & 1u;
+            bits += ((15u - 127u) << 23) + 0xfffu + odd;
+            half = uint16_t(bits >> 13);
+        }
+
+        return uint16_t(half | (sign >> 16));
+    }
+
+    float half_to_float(uint16_t value)
+    {
+        const float    magic = bits_float(113u << 23);
+        const uint32_t shifted_exponent = 0x7c00u << 13;
+
+        uint32_t bits = (value & 0x7fffu) << 13;
+        uint32_t exponent = bits & shifted_exponent;
+        bits += (127u - 15u) << 23;
+
+        if(exponent == shifted_exponent)   //inf/NaN, made quiet
+        {
+            bits += (128u - 16u) << 23;
+            if(bits & 0x7fffffu)
+                bits |= 0x400000u;
+        }
+        else if(exponent == 0)             //zero/subnormal
+        {
+            bits += 1u << 23;
+            bits = float_bits(bits_float(bits) - magic);
+        }
+
+        return bits_float(bits | uint32_t(value & 0x8000u) << 16);
+    }
+
+    template<class T>
+    void encode_float16(const T* in, size_t count, uint16_t* out)
+    {
+        size_t i = 0;
+#ifdef __F16C__
+        for(; i + 8 <= count; i += 8)
+            _mm_storeu_si128((__m128i*)(out + i),
+                             _mm256_cvtps_ph(load8(in + i),
+                                             _MM_FROUND_TO_NEAREST_INT));
+#endif
+        for(; i < count; i++)
+            out[i] = float_to_half(float(in[i]));
+    }
+
+    template<class T>
+    void decode_float16(const uint16_t* in, size_t count, T* out)
+    {
+        size_t i = 0;
+#ifdef __F16C__
+        for(; i + 8 <= count; i += 8)
+            store8(_mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(in + i))),
+                   out + i);
+#endif
+        for(; i < count; i++)
+            out[i] = T(half_to_float(in[i]));
+    }
+
+    QuantRange quant_range(double min, double max)
+    {
+        QuantRange range;
+        range.offset = float(min);
+        range.scale  = max > min ? float((max - min) / 255.0) : 0.0f;
+        return range;
+    }
+
+    template<class T>
+    void min_max(const T* in, size_t count, T& min, T& max)
+    {
+        T lo = std::numeric_limits<T>::max();
+        T hi = std::numeric_limits<T>::lowest();
+#pragma omp simd reduction(min:lo) reduction(max:hi)
+        for(size_t i = 0; i < count; i++)
+        {
+            lo = std::min(lo, in[i]);
+            hi = std::max(hi, in[i]);
+        }
+        min = lo;
+        max = hi;
+    }
+
+    template<class T>
+    void quantize_u8(const T* in,
+                     size_t count,
+                     QuantRange range,
+                     uint8_t* out)
+    {
+        float inv_scale = range.scale > 0.0f ? 1.0f / range.scale : 0.0f;
+        float offset    = range.offset;
+#pragma omp simd
+        for(size_t i = 0; i < count; i++)
+        {
+            float code = (float(in[i]) - offset) * inv_scale + 0.5f;
+            code = std::min(std::max(code, 0.0f), 255.0f);
+            out[i] = uint8_t(code);
+        }
+    }
+
+    template<class T>
+    void dequantize_u8(const uint8_t* in,
+                       size_t count,
+                       QuantRange range,
+                       T* out)
+    {
+        float scale  = range.scale;
+        float offset = range.offset;
+#pragma omp simd
+        for(size_t i = 0; i < count; i++)
+            out[i] = T(offset + scale * float(in[i]));
+    }
+
+    template<class T>
+    void QuantError::add(const T* original, const T* decoded, size_t count)
+    {
+        double max_abs = m_max_abs;
+        double sum_sq  = 0.0;
+#pragma omp simd reduction(max:max_abs) reduction(+:sum_sq)
+        for(size_t i = 0; i < count; i++)
+        {
+            double diff = double(original[i]) - double(decoded[i]);
+            max_abs = std::max(max_abs, std::abs(diff));
+            sum_sq += diff * diff;
+        }
+        m_max_abs = max_abs;
+        m_sum_sq += sum_sq;
+        m_count  += count;
+    }
+
+    double QuantError::rms() const
+    {
+        return m_count > 0 ? std::sqrt(m_sum_sq / double(m_count)) : 0.0;
+    }
+
+    template void encode_float16<double>(const double*, size_t, uint16_t*);
+    template void encode_float16<float>(const float*, size_t, uint16_t*);
+
+    template void decode_float16<double>(const uint16_t*, size_t, double*);
+    template void decode_float16<float>(const uint16_t*, size_t, float*);
+
+    template void min_max<double>(const double*, size_t, double&, double&);
+    template void min_max<float>(const float*, size_t, float&, float&);
+
+    template void quantize_u8<double>(const double*, size_t, QuantRange,
+                                      uint8_t*);
+    template void quantize_u8<float>(const float*, size_t, QuantRange,
+                                     uint8_t*);
+
+    template void dequantize_u8<double>(const uint8_t*, size_t, QuantRange,
+                                        double*);
+    template void dequantize_u8<float>(const uint8_t*, size_t, QuantRange,
+                                       float*);
+
+    template void QuantError::add<double>(const double*, const double*,
+                                          size_t);
+    template void QuantError::add<float>(const float*, const float*, size_t);
+}
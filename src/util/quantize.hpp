@@ -0,0 +1,70 @@
+#ifndef NEUROSYNTH_QUANTIZE_HPP
+#define NEUROSYNTH_QUANTIZE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace neurosynth
+{
+    //IEEE 754 binary16 conversions, rounding to nearest even
+    uint16_t float_to_half(float value);
+
+    float half_to_float(uint16_t value);
+
+    //bulk conversions, F16C instructions are used when the target has
+    //them, results are the same either way (doubles are rounded to
+    //float first)
+    template<class T>
+    void encode_float16(const T* in, size_t count, uint16_t* out);
+
+    template<class T>
+    void decode_float16(const uint16_t* in, size_t count, T* out);
+
+    //affine 8-bit quantization: value ~ offset + scale * code
+    struct QuantRange
+    {
+        float scale  = 0.0f;
+        float offset = 0.0f;
+    };
+
+    //range mapping [min, max] onto codes 0-255
+    QuantRange quant_range(double min, double max);
+
+    template<class T>
+    void min_max(const T* in, size_t count, T& min, T& max);
+
+    //codes are rounded and clamped to 0-255
+    template<class T>
+    void quantize_u8(const T* in,
+                     size_t count,
+                     QuantRange range,
+                     uint8_t* out);
+
+    template<class T>
+    void dequantize_u8(const uint8_t* in,
+                       size_t count,
+                       QuantRange range,
+                       T* out);
+
+    //Accumulates difference between original and decoded values
+    class QuantError
+    {
+    public:
+        QuantError() : m_max_abs(0.0), m_sum_sq(0.0), m_count(0) {}
+
+        template<class T>
+        void add(const T* original, const T* decoded, size_t count);
+
+        double max_abs() const { return m_max_abs; }
+        double rms() const;
+        size_t count() const { return m_count; }
+
+    private:
+        double m_max_abs;
+        double m_sum_sq;
+        size_t m_count;
+    };
+}
+
+#endif
@@ -0,0 +1,267 @@
+#include "realtime_stft.hpp"
+#include "features.hpp"
+#include "frame_analyzer.hpp"
+#include "resampler.hpp"
+#include "spsc_ring.hpp"
+#include "stft_file.hpp"
+#include "utils.hpp"
+#include "wav_format.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+
+namespace neurosynth
+{
+    namespace
+    {
+        typedef std::chrono::steady_clock clock;
+
+        //arrival of the samples before 'end'
+        struct BlockStamp
+        {
+            size_t            end;
+            clock::time_point arrival;
+        };
+    }
+
+    template<class T>
+    bool realtime_stft(std::string& input_fn,
+                       std::string& output_fn,
+                       const StftParams& params,
+                       const RealtimeParams& rt_params,
+                       StftCache& cache,
+                       RealtimeStats& stats,
+                       Logger& logger,
+                       StftOutput output,
+                       StftEncoding encoding)
+    {
+        std::streambuf* buf;
+        std::ifstream ifstream;
+
+        if(input_fn == "-")
+            buf = std::cin.rdbuf();
+        else
+        {
+            ifstream.open(input_fn, std::ios::binary);
+            buf = ifstream.rdbuf();
+        }
+
+        std::istream stream(buf);
+        if(!stream || (input_fn != "-" && !ifstream.is_open()))
+            logger.warn("Cannot open file: " + input_fn);
+
+        WavStreamReader reader(stream, input_fn, logger);
+        if(!reader.good())
+            handle_error(logger, "Cannot read wav header from: " + input_fn);
+
+        double input_rate = params.sample_rate;
+        if(reader.format().sample_rate != 0)
+            input_rate = double(reader.format().sample_rate);
+        StftParams frame_params = analysis_params(params, input_rate);
+        frame_params.batch_size = 1;
+
+        //the reader thread resamples, analysis only sees the new rate
+        ResamplingReader<T> input(reader, input_rate,
+                                  frame_params.sample_rate, params.max_freq);
+
+        size_t N = frame_params.window_size;
+        size_t H = frame_params.window_step;
+        double budget = rt_params.latency_budget;
+
+        //buffering a block adds its length to the latency of the
+        //frames ending in it, so it gets a quarter of the budget
+        size_t block_size = size_t(budget * frame_params.sample_rate / 4.0);
+        block_size = std::min(std::max<size_t>(block_size, 1), H);
+
+        logger.info("Real-time STFT with parameters: "
+                    "Window size: " + std::to_string(N) +
+                    "; window step: " + std::to_string(H) +
+                    "; sample rate: " +
+                    std::to_string(frame_params.sample_rate) +
+                    "; # coefficients: " + std::to_string(params.num_coeff) +
+                    "; latency budget: " + std::to_string(budget * 1e3) +
+                    "ms; block size: " + std::to_string(block_size) +
+                    (rt_params.paced ? "; paced" : "") +
+                    "; input: " + describe_format(reader.format()));
+
+        //everything below is set up before the threads start
+        FrameAnalyzer<T> analyzer(frame_params, cache, logger);
+        size_t C = analyzer.num_coeff();
+        size_t M = analyzer.num_mfcc();
+        size_t F = analyzer.frame_size(); //energies, mfcc and chroma
+
+        StftWriter<T> writer(output_fn, logger, output, encoding);
+        writer.write_header(frame_params, C, feature_streams(frame_params));
+        FeatureStreamWriter<T> streams(writer, frame_params);
+
+        //stamps stay queued until a frame ends past them, i.e. for
+        //blocks in the ring and in the frame being filled
+        size_t ring_size = 2 * std::max(4 * block_size, N + H);
+        SpscRing<T>          samples(ring_size);
+        SpscRing<BlockStamp> stamps((samples.capacity() / 2 + N) /
+                                    block_size + 4);
+        SpscRing<T>          features(F * 64);
+
+        std::atomic<bool> input_done(false);
+        std::atomic<bool> analysis_done(false);
+        size_t overruns = 0;
+        size_t late     = 0;
+        size_t stalls   = 0;
+        stats = RealtimeStats();
+        stats.block_size = block_size;
+
+        std::vector<T> block(2 * block_size);
+        auto read = [&]()
+        {
+            clock::time_point start = clock::now();
+            size_t total = 0;
+            size_t num_read;
+            while((num_read = input.read(block.data(), block_size)) > 0)
+            {
+                if(rt_params.paced)
+                    std::this_thread::sleep_until
+                        (start + std::chrono::duration_cast<clock::duration>
+                         (std::chrono::duration<double>
+                          (double(total + num_read) /
+                           frame_params.sample_rate)));
+
+                total += num_read;
+                BlockStamp stamp = {total, clock::now()};
+                while(stamps.push(&stamp, 1) == 0)
+                    std::this_thread::yield();
+
+                size_t pushed = samples.push(block.data(), 2 * num_read);
+                if(pushed < 2 * num_read)
+                    overruns++;
+                while(pushed < 2 * num_read)
+                {
+                    std::this_thread::yield();
+                    pushed += samples.push(&block[pushed],
+                                           2 * num_read - pushed);
+                }
+            }
+            input_done.store(true, std::memory_order_release);
+        };
+
+        AlignedVector<T> frame(2 * N);
+        std::vector<T>   features_row(F);
+        auto analyze = [&]()
+        {
+            size_t filled = 0; //interleaved values in frame
+            size_t skip   = 0; //values between frames (hop > window)
+            size_t end    = N; //samples up to the current frame's end
+            BlockStamp stamp = {0, clock::time_point()};
+
+            while(true)
+            {
+                if(skip > 0)
+                    skip -= samples.discard(skip);
+                else
+                    filled += samples.pop(&frame[filled], 2 * N - filled);
+
+                if(skip > 0 || filled < 2 * N)
+                {
+                    if(input_done.load(std::memory_order_acquire) &&
+                       samples.read_available() == 0)
+                        break;
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                analyzer.load_frame_interleaved(0, frame.data());
+                analyzer.analyze(1);
+
+                if(features.write_available() < F)
+                    stalls++;
+                while(features.write_available() < F)
+                    std::this_thread::yield();
+                analyzer.copy_frame(0, features_row.data());
+                features.push(features_row.data(), F);
+
+                //stamps are pushed ahead of their samples
+                while(stamp.end < end)
+                    stamps.pop(&stamp, 1);
+                double latency = std::chrono::duration<double>
+                    (clock::now() - stamp.arrival).count();
+                stats.latency.add(latency);
+                if(latency > budget)
+                    late++;
+
+                if(H < N)
+                {
+                    memmove(frame.data(), frame.data() + 2 * H,
+                            2 * (N - H) * sizeof(T));
+                    filled = 2 * (N - H);
+                }
+                else
+                {
+                    filled = 0;
+                    skip   = 2 * (H - N);
+                }
+                end += H;
+            }
+            analysis_done.store(true, std::memory_order_release);
+        };
+
+        std::thread reader_thread(read);
+        std::thread analysis_thread(analyze);
+
+        std::vector<T> row(F);
+        const T* mfcc   = row.data() + 2 * C;
+        const T* chroma = mfcc + 2 * M;
+        while(true)
+        {
+            if(features.read_available() >= F)
+            {
+                features.pop(row.data(), F);
+                writer.write_frame(row.data(), row.data() + C);
+                streams.write(mfcc, mfcc + M, chroma,
+                              chroma + analyzer.num_chroma());
+                writer.flush();
+                continue;
+            }
+            if(analysis_done.load(std::memory_order_acquire) &&
+               features.read_available() == 0)
+                break;
+            std::this_thread::yield();
+        }
+
+        reader_thread.join();
+        analysis_thread.join();
+        stats.late     = late;
+        stats.overruns = overruns;
+        stats.stalls   = stalls;
+
+        streams.finish();
+        if(!writer.close())
+            return false;
+
+        logger.info("Real-time STFT of " + input_fn + " to: " + output_fn +
+                    ", " + describe_realtime_stats(stats, budget));
+        return true;
+    }
+
+    std::string describe_realtime_stats(const RealtimeStats& stats,
+                                        double latency_budget)
+    {
+        return "latency: " + stats.latency.describe() + "; " +
+            std::to_string(stats.late) + " over the " +
+            std::to_string(latency_budget * 1e3) + "ms budget, " +
+            std::to_string(stats.overruns) + " reader overruns, " +
+            std::to_string(stats.stalls) + " writer stalls";
+    }
+
+    template bool realtime_stft<double>(std::string&, std::string&,
+                                        const StftParams&,
+                                        const RealtimeParams&, StftCache&,
+                                        RealtimeStats&, Logger&,
+                                        StftOutput, StftEncoding);
+    template bool realtime_stft<float>(std::string&, std::string&,
+                                       const StftParams&,
+                                       const RealtimeParams&, StftCache&,
+                                       RealtimeStats&, Logger&,
+                                       StftOutput, StftEncoding);
+}
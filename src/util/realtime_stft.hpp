@@ -0,0 +1,59 @@
+#ifndef NEUROSYNTH_REALTIME_STFT_HPP
+#define NEUROSYNTH_REALTIME_STFT_HPP
+
+#include "latency_histogram.hpp"
+#include "logger.hpp"
+#include "wav_utils.hpp"
+
+#include <string>
+
+
+namespace neurosynth
+{
+    struct RealtimeParams
+    {
+        double latency_budget = 0.05;  // seconds from a frame's last
+                                       // sample arriving to its emission
+        bool   paced          = false; // deliver input at the audio clock
+    };
+
+    struct RealtimeStats
+    {
+        LatencyHistogram latency;
+        size_t late       = 0; // frames over the latency budget
+        size_t overruns   = 0; // blocks the reader found the ring full
+        size_t stalls     = 0; // frames the writer wasn't ready for
+        size_t block_size = 0; // samples per reader block
+    };
+
+    //Analyzes input with bounded latency instead of batch throughput.
+    //A reader thread pushes blocks of PCM (a quarter of the latency
+    //budget long, at most one hop) into a lock-free SPSC ring, an
+    //analysis thread pops them into its frame, runs the stft() window
+    //and mel pipeline on every frame as soon as it is complete and
+    //hands the features through a second ring to this thread, which
+    //writes them. Past setup, the analysis thread neither allocates
+    //nor locks.
+    //Latency is measured per frame from the arrival of its last sample
+    //to its hand-off. With 'paced', samples arrive at the sample rate
+    //as from a live source, otherwise as fast as they can be read.
+    //Binary output spools until the end (see StftWriter), live
+    //consumers should read --text or --csv.
+    //Returns false if the output could not be written.
+    template<class T>
+    bool realtime_stft(std::string& input_fn,
+                       std::string& output_fn,
+                       const StftParams& params,
+                       const RealtimeParams& rt_params,
+                       StftCache& cache,
+                       RealtimeStats& stats,
+                       Logger& logger,
+                       StftOutput output = StftOutput::Binary,
+                       StftEncoding encoding = StftEncoding::Native);
+
+    //one line summary of 'stats'
+    std::string describe_realtime_stats(const RealtimeStats& stats,
+                                        double latency_budget);
+}
+
+#endif
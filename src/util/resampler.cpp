@@ -0,0 +1,442 @@
+#include "resampler.hpp"
+#include "stage_stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+//gcc's unroll-and-jam pairs up the taps of filter_outputs() and loads
+//the second one's inputs element by element, 5x slower
+#if defined(__GNUC__) && !defined(__clang__)
+#define NEUROSYNTH_NO_JAM __attribute__((optimize("no-loop-unroll-and-jam")))
+#else
+#define NEUROSYNTH_NO_JAM
+#endif
+
+
+namespace neurosynth
+{
+    namespace
+    {
+        //decimated rates stay this far above twice max_freq, the
+        //rest is the transition band of the anti-aliasing filter
+        constexpr double decimation_margin = 1.2;
+
+        //stopband attenuation of the resampling filter in dB
+        constexpr double resampler_attenuation = 80.0;
+
+        size_t gcd(size_t a, size_t b)
+        {
+            while(b != 0)
+            {
+                size_t r = a % b;
+                a = b;
+                b = r;
+            }
+            return a;
+        }
+
+        //zeroth order modified Bessel function of the first kind
+        double bessel_i0(double x)
+        {
+            double sum  = 1.0;
+            double term = 1.0;
+            for(size_t k = 1; k < 64 && term > sum * 1e-17; k++)
+            {
+                double half = x / (2.0 * double(k));
+                term *= half * half;
+                sum  += term;
+            }
+            return sum;
+        }
+
+        size_t round_size(double value, size_t min_value)
+        {
+            return std::max(size_t(std::lround(value)), min_value);
+        }
+
+        //outputs filtered together, a multiple of every simd width
+        constexpr size_t filter_block = 64;
+
+        //acc[i] = sum_k taps[k] * x[inputs[k] + i] over a block of
+        //outputs, summing the taps of each output in order
+        template<class T>
+        NEUROSYNTH_NO_JAM
+        void filter_outputs(const T* __restrict__ x,
+                            const size_t* __restrict__ inputs,
+                            const T* __restrict__ taps,
+                            size_t num_taps,
+                            T* __restrict__ acc)
+        {
+            for(size_t i = 0; i < filter_block; i++)
+                acc[i] = T(0);
+            for(size_t k = 0; k < num_taps; k++)
+            {
+                const T* in  = x + inputs[k];
+                T        tap = taps[k];
+                #pragma omp simd
+                for(size_t i = 0; i < filter_block; i++)
+                    acc[i] += tap * in[i];
+            }
+        }
+    }
+
+    StftParams analysis_params(const StftParams& params, double input_rate)
+    {
+        StftParams analysis = params;
+        size_t rate = size_t(std::lround(params.resample_rate > 0.0 ?
+                                         params.resample_rate : input_rate));
+
+        size_t factor = 1;
+        if(params.decimate)
+            for(size_t d = 2; double(rate) / double(d) >=
+                    2.0 * decimation_margin * params.max_freq; d++)
+                if(rate % d == 0)
+                    factor = d;
+
+        analysis.sample_rate = double(rate / factor);
+        if(factor == 1)
+            return analysis;
+
+        double scale = 1.0 / double(factor);
+        analysis.window_size = round_size(params.window_size * scale, 2);
+        analysis.window_step = round_size(params.window_step * scale, 1);
+        if(params.fft_size != 0)
+            analysis.fft_size = std::max(round_size(params.fft_size * scale,
+                                                    1),
+                                         analysis.window_size);
+        return analysis;
+    }
+
+    template<class T>
+    Resampler<T>::Resampler(size_t input_rate,
+                            size_t output_rate,
+                            double max_freq)
+        : m_history_first(0),
+          m_num_input(0),
+          m_num_output(0)
+    {
+        size_t divisor = gcd(input_rate, output_rate);
+        m_up   = output_rate / divisor;
+        m_down = input_rate / divisor;
+
+        //frequencies in cycles per sample of the upsampled signal
+        double lower      = double(std::min(input_rate, output_rate));
+        double upsampled  = double(input_rate) * double(m_up);
+        double pass       = std::min(max_freq, 0.45 * lower);
+        double transition = (lower - 2.0 * pass) / upsampled;
+        double cutoff     = 0.5 * lower / upsampled;
+
+        //Kaiser's estimates of length and shape for the attenuation
+        double A    = resampler_attenuation;
+        double beta = 0.1102 * (A - 8.7);
+        size_t length = size_t(std::ceil((A - 7.95) /
+                                         (2.285 * 2.0 * M_PI * transition)));
+        length |= 1;
+        m_delay    = (length - 1) / 2;
+        m_num_taps = (length + m_up - 1) / m_up;
+
+        //gain up, the stuffed zeros carry no energy
+        std::vector<double> h(m_num_taps * m_up, 0.0);
+        double norm = bessel_i0(beta);
+        for(size_t j = 0; j < length; j++)
+        {
+            double x = double(j) - double(m_delay);
+            double r = m_delay > 0 ? x / double(m_delay) : 0.0;
+            double sinc = x == 0.0 ? 2.0 * cutoff :
+                std::sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+            double window = bessel_i0(beta * std::sqrt(std::max(1.0 - r * r,
+                                                                0.0)));
+            h[j] = double(m_up) * sinc * window / norm;
+        }
+
+        //phase p weighs inputs last, last - 1, ... with h[p], h[p + up],
+        //..., reversed so a dot product runs forward over the input
+        m_taps.resize(m_up * m_num_taps);
+        for(size_t p = 0; p < m_up; p++)
+            for(size_t k = 0; k < m_num_taps; k++)
+                m_taps[(p + 1) * m_num_taps - 1 - k] = T(h[p + k * m_up]);
+
+        m_history_l.assign(m_num_taps - 1, T(0));
+        m_history_r.assign(m_num_taps - 1, T(0));
+        m_inputs.resize(m_num_taps);
+    }
+
+    template<class T>
+    size_t Resampler<T>::output_size(size_t num_frames) const
+    {
+        return (num_frames * m_up + m_down - 1) / m_down;
+    }
+
+    template<class T>
+    void Resampler<T>::reserve(size_t num_frames)
+    {
+        //outputs of one call, finish() adds those of the filter's tail;
+        //their inputs span at most one more than outputs * down / up
+        size_t count = output_size(num_frames + m_num_taps) + 1;
+        size_t span  = (count - 1) * m_down / m_up + 1 + m_num_taps;
+        size_t M     = (span + m_down - 1) / m_down + filter_block;
+        if(m_planes.size() < m_down * M)
+            m_planes.resize(m_down * M);
+
+        //compact() keeps less than twice what later outputs need
+        m_history_l.reserve(2 * (num_frames + m_num_taps));
+        m_history_r.reserve(2 * (num_frames + m_num_taps));
+    }
+
+    template<class T>
+    size_t Resampler<T>::planes_size(size_t first, size_t last) const
+    {
+        size_t span = last_input(last - 1) + m_num_taps - last_input(first);
+        return m_down * ((span + m_down - 1) / m_down + filter_block);
+    }
+
+    template<class T>
+    void Resampler<T>::filter(const T* input,
+                              size_t start,
+                              size_t size,
+                              size_t first,
+                              size_t last,
+                              T* output,
+                              size_t stride)
+    {
+        //outputs of one phase share their taps and start m_down inputs
+        //apart: with the inputs split into m_down planes, every tap is
+        //a multiply-add over contiguous inputs of a block of outputs,
+        //each output still sums its taps in order
+        size_t block = filter_block;
+        size_t K     = m_num_taps;
+        size_t base  = last_input(first);
+        size_t M     = planes_size(first, last) / m_down; //+ last block
+
+        //grows only past the size reserve() was given
+        if(m_planes.size() < m_down * M)
+            m_planes.resize(m_down * M);
+        T* planes = m_planes.data();
+        std::fill(planes, planes + m_down * M, T(0));
+        for(size_t q = 0; q < m_down; q++)
+        {
+            //plane q holds padded inputs base + q + m * m_down, those
+            //from 'start' to 'start + size' are given
+            size_t j  = base + q;
+            size_t lo = j < start ? (start - j + m_down - 1) / m_down : 0;
+            size_t hi = start + size > j ?
+                (start + size - j + m_down - 1) / m_down : 0;
+            const T* in = input + (j + lo * m_down - start);
+            T* plane = &planes[q * M];
+            for(size_t m = lo; m < std::min(hi, M); m++, in += m_down)
+                plane[m] = *in;
+        }
+
+        T acc[filter_block];
+        size_t* inputs = m_inputs.data();
+        for(size_t r = first; r < std::min(first + m_up, last); r++)
+        {
+            const T* taps = &m_taps[(r * m_down + m_delay) % m_up * K];
+            size_t offset = last_input(r) - base;
+            size_t count  = (last - r + m_up - 1) / m_up;
+
+            //plane and position of every tap's input for the first output
+            for(size_t k = 0; k < K; k++)
+                inputs[k] = (offset + k) % m_down * M + (offset + k) / m_down;
+
+            for(size_t i0 = 0; i0 < count; i0 += block)
+            {
+                filter_outputs(planes + i0, inputs, taps, K, acc);
+                size_t B = std::min(block, count - i0);
+                for(size_t i = 0; i < B; i++)
+                    output[(r - first + (i0 + i) * m_up) * stride] = acc[i];
+            }
+        }
+    }
+
+    template<class T>
+    void Resampler<T>::resample(const std::vector<T>& input,
+                                std::vector<T>& output)
+    {
+        NEUROSYNTH_STAGE(Resample);
+        size_t num_output = output_size(input.size());
+        size_t chunk      = std::max<size_t>(4096, 64 * m_up);
+
+        output.resize(num_output);
+        for(size_t n = 0; n < num_output; n += chunk)
+            filter(input.data(), m_num_taps - 1, input.size(),
+                   n, std::min(n + chunk, num_output), &output[n], 1);
+        NEUROSYNTH_STAGE_COUNT(Resample, num_output,
+                               input.size() * sizeof(T));
+    }
+
+    template<class T>
+    void Resampler<T>::compact()
+    {
+        //history before the next output's first input is done with
+        size_t done = std::min(last_input(m_num_output) - m_history_first,
+                               m_history_l.size());
+        if(done < m_history_l.size() / 2)
+            return;
+        m_history_l.erase(m_history_l.begin(), m_history_l.begin() + done);
+        m_history_r.erase(m_history_r.begin(), m_history_r.begin() + done);
+        m_history_first += done;
+    }
+
+    template<class T>
+    size_t Resampler<T>::process(const T* input,
+                                 size_t num_frames,
+                                 std::vector<T>& output)
+    {
+        NEUROSYNTH_STAGE(Resample);
+        for(size_t i = 0; i < num_frames; i++)
+        {
+            m_history_l.push_back(input[2 * i]);
+            m_history_r.push_back(input[2 * i + 1]);
+        }
+        m_num_input += num_frames;
+
+        size_t first = m_num_output;
+        while(last_input(m_num_output) < m_num_input)
+            m_num_output++;
+        if(m_num_output > first)
+        {
+            size_t size = output.size();
+            output.resize(size + 2 * (m_num_output - first));
+            filter(m_history_l.data(), m_history_first, m_history_l.size(),
+                   first, m_num_output, &output[size], 2);
+            filter(m_history_r.data(), m_history_first, m_history_r.size(),
+                   first, m_num_output, &output[size + 1], 2);
+        }
+        compact();
+        NEUROSYNTH_STAGE_COUNT(Resample, m_num_output - first,
+                               2 * num_frames * sizeof(T));
+        return m_num_output - first;
+    }
+
+    template<class T>
+    size_t Resampler<T>::finish(std::vector<T>& output)
+    {
+        NEUROSYNTH_STAGE(Resample);
+        size_t num_output = output_size(m_num_input);
+        size_t first      = m_num_output;
+        if(m_num_output >= num_output)
+            return 0;
+
+        //inputs past the end of the history count as 0
+        size_t size = output.size();
+        output.resize(size + 2 * (num_output - first));
+        filter(m_history_l.data(), m_history_first, m_history_l.size(),
+               first, num_output, &output[size], 2);
+        filter(m_history_r.data(), m_history_first, m_history_r.size(),
+               first, num_output, &output[size + 1], 2);
+        m_num_output = num_output;
+        return m_num_output - first;
+    }
+
+    template<class T>
+    StftParams resample_input(WavData<T>& wav_data,
+                              const StftParams& params,
+                              double input_rate,
+                              Logger& logger)
+    {
+        StftParams analysis = analysis_params(params, input_rate);
+        size_t from = size_t(std::lround(input_rate));
+        size_t to   = size_t(std::lround(analysis.sample_rate));
+        if(from == to)
+            return analysis;
+
+        Resampler<T> resampler(from, to, params.max_freq);
+        logger.info("Resampling " + std::to_string(from) + "hz to " +
+                    std::to_string(to) + "hz (up " +
+                    std::to_string(resampler.up()) + ", down " +
+                    std::to_string(resampler.down()) + ", " +
+                    std::to_string(resampler.num_taps()) +
+                    " taps per phase); window size: " +
+                    std::to_string(analysis.window_size) + ", hop: " +
+                    std::to_string(analysis.window_step));
+
+        std::vector<T> samples;
+        resampler.resample(wav_data.samples_l, samples);
+        wav_data.samples_l.swap(samples);
+        resampler.resample(wav_data.samples_r, samples);
+        wav_data.samples_r.swap(samples);
+        wav_data.sample_rate = to;
+        return analysis;
+    }
+
+    template<class T>
+    ResamplingReader<T>::ResamplingReader(WavStreamReader& reader,
+                                          double input_rate,
+                                          double output_rate,
+                                          double max_freq)
+        : m_reader(reader),
+          m_position(0),
+          m_max_frames(0),
+          m_finished(false)
+    {
+        size_t from = size_t(std::lround(input_rate));
+        size_t to   = size_t(std::lround(output_rate));
+        if(from != to)
+            m_resampler.reset(new Resampler<T>(from, to, max_freq));
+    }
+
+    template<class T>
+    size_t ResamplingReader<T>::read(T* out, size_t max_frames)
+    {
+        if(!m_resampler)
+            return m_reader.read(out, max_frames);
+
+        //inputs of about one read of outputs at a time
+        size_t block = std::max<size_t>(max_frames * m_resampler->down() /
+                                        m_resampler->up(), 1);
+        if(max_frames > m_max_frames)
+        {
+            //less than a read is left when more is resampled, which adds
+            //at most the outputs of a block, or of the filter's tail
+            size_t tail = m_resampler->output_size(block +
+                                                   m_resampler->num_taps());
+            m_input.resize(2 * block);
+            m_output.reserve(2 * (max_frames + tail + 1));
+            m_resampler->reserve(block);
+            m_max_frames = max_frames;
+        }
+
+        size_t unread = m_output.size() - m_position;
+        if(unread / 2 < max_frames && !m_finished && m_position > 0)
+        {
+            //the unread rest moves to the front, within capacity
+            std::copy(m_output.begin() + m_position, m_output.end(),
+                      m_output.begin());
+            m_output.resize(unread);
+            m_position = 0;
+        }
+        while((m_output.size() - m_position) / 2 < max_frames && !m_finished)
+        {
+            size_t num_read = m_reader.read(m_input.data(), block);
+            if(num_read == 0)
+            {
+                m_resampler->finish(m_output);
+                m_finished = true;
+            }
+            else
+                m_resampler->process(m_input.data(), num_read, m_output);
+        }
+
+        size_t frames = std::min((m_output.size() - m_position) / 2,
+                                 max_frames);
+        std::copy(m_output.begin() + m_position,
+                  m_output.begin() + m_position + 2 * frames, out);
+        m_position += 2 * frames;
+        return frames;
+    }
+
+    template class Resampler<double>;
+    template class Resampler<float>;
+
+    template StftParams resample_input<double>(WavData<double>&,
+                                               const StftParams&, double,
+                                               Logger&);
+    template StftParams resample_input<float>(WavData<float>&,
+                                              const StftParams&, double,
+                                              Logger&);
+
+    template class ResamplingReader<double>;
+    template class ResamplingReader<float>;
+}
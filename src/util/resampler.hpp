@@ -0,0 +1,143 @@
+#ifndef NEUROSYNTH_RESAMPLER_HPP
+#define NEUROSYNTH_RESAMPLER_HPP
+
+#include "aligned_allocator.hpp"
+#include "logger.hpp"
+#include "wav_format.hpp"
+#include "wav_utils.hpp"
+
+#include <memory>
+#include <vector>
+
+
+namespace neurosynth
+{
+    //Parameters an input sampled at 'input_rate' is analyzed with.
+    //The rate is params.resample_rate, or the input rate if that is 0;
+    //window size, hop and fft size are given in samples at it. With
+    //params.decimate the rate is further divided by the largest integer
+    //that keeps max_freq clear of aliases (see Resampler), sizes are
+    //scaled by the same factor, so frames keep their duration.
+    StftParams analysis_params(const StftParams& params, double input_rate);
+
+    //Rational polyphase resampler: up by up(), Kaiser windowed sinc
+    //lowpass, down by down(), computing only the outputs that are kept
+    //and only from the nonzero (not stuffed) inputs. The filter cuts
+    //off at half the lower rate and reaches 80dB where aliases would
+    //fold back below 'max_freq', so bins the filterbank reads stay
+    //clean while the filter stays short. Output n is input time
+    //n / output_rate: the filter's delay is compensated, samples
+    //before and after the input count as 0.
+    //resample() takes one whole channel, process()/finish() stream
+    //interleaved L/R; both give the same samples for the same input.
+    template<class T>
+    class Resampler
+    {
+    public:
+        Resampler(size_t input_rate, size_t output_rate, double max_freq);
+
+        size_t up() const { return m_up; }
+        size_t down() const { return m_down; }
+        size_t num_taps() const { return m_num_taps; }
+
+        //output samples of 'num_frames' input samples
+        size_t output_size(size_t num_frames) const;
+
+        void resample(const std::vector<T>& input,
+                      std::vector<T>& output);
+
+        //sizes scratch and history for process() calls of up to
+        //'num_frames' frames, so those don't allocate
+        void reserve(size_t num_frames);
+
+        //appends the outputs 'num_frames' more interleaved L/R input
+        //frames complete to 'output', returns number of frames appended
+        size_t process(const T* input,
+                       size_t num_frames,
+                       std::vector<T>& output);
+
+        //end of input, appends the remaining frames
+        size_t finish(std::vector<T>& output);
+
+    private:
+        size_t           m_up;
+        size_t           m_down;
+        size_t           m_num_taps;  //per phase
+        size_t           m_delay;     //of the filter, at up * input rate
+        AlignedVector<T> m_taps;      //phase-major, reversed
+
+        //filter() scratch: inputs split into m_down planes, and the
+        //plane position of every tap's input
+        std::vector<T>      m_planes;
+        std::vector<size_t> m_inputs;
+
+        //streaming state: planar history starting at padded index
+        //m_history_first, input i is padded index i + m_num_taps - 1
+        std::vector<T>   m_history_l;
+        std::vector<T>   m_history_r;
+        size_t           m_history_first;
+        size_t           m_num_input;
+        size_t           m_num_output;
+
+        //padded index of the first input output 'n' depends on, which
+        //is the input index of the last one
+        size_t last_input(size_t n) const
+        {
+            return (n * m_down + m_delay) / m_up;
+        }
+
+        //outputs 'first' to 'last' (exclusive) to output[(n - first) *
+        //stride], from 'size' inputs that start at padded index 'start',
+        //inputs outside of them are 0
+        void filter(const T* input,
+                    size_t start,
+                    size_t size,
+                    size_t first,
+                    size_t last,
+                    T* output,
+                    size_t stride);
+
+        //m_planes values filter() needs for outputs 'first' to 'last'
+        size_t planes_size(size_t first, size_t last) const;
+
+        //drops history no later output needs
+        void compact();
+    };
+
+    //resamples both channels of 'wav_data' from 'input_rate' as
+    //analysis_params() asks for and returns the parameters to analyze
+    //the result with
+    template<class T>
+    StftParams resample_input(WavData<T>& wav_data,
+                              const StftParams& params,
+                              double input_rate,
+                              Logger& logger);
+
+    //WavStreamReader with samples resampled to 'output_rate' on the
+    //way out, passed through unchanged if rates match
+    template<class T>
+    class ResamplingReader
+    {
+    public:
+        ResamplingReader(WavStreamReader& reader,
+                         double input_rate,
+                         double output_rate,
+                         double max_freq);
+
+        //reads up to 'max_frames' frames as interleaved L/R samples
+        //returns number of frames read, 0 at the end of data
+        size_t read(T* out, size_t max_frames);
+
+    private:
+        WavStreamReader&              m_reader;
+        std::unique_ptr<Resampler<T>> m_resampler;
+        std::vector<T>                m_input;
+        std::vector<T>                m_output;   //interleaved frames
+        size_t                        m_position; //first unread value
+        size_t                        m_max_frames; //m_output is sized
+                                                    //for reads this long
+        bool                          m_finished;
+    };
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef NEUROSYNTH_SPSC_RING_HPP
+#define NEUROSYNTH_SPSC_RING_HPP
+
+#include "aligned_allocator.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+
+namespace neurosynth
+{
+    //Lock-free ring buffer between exactly one producer and one
+    //consumer thread. Capacity is rounded up to a power of two and
+    //fixed at construction, push/pop never allocate or block: they
+    //move as many elements as fit/are available and return the count.
+    //Head and tail live on separate cache lines, each side keeps a
+    //private copy of the other side's index and push/pop reload it only
+    //when it shows too little room/data.
+    template<class T>
+    class SpscRing
+    {
+    public:
+        explicit SpscRing(size_t min_capacity)
+            : m_mask(round_up_power2(std::max<size_t>(min_capacity, 2)) - 1),
+              m_buffer(m_mask + 1),
+              m_head(0),
+              m_tail_cache(0),
+              m_tail(0),
+              m_head_cache(0) {}
+
+        SpscRing(const SpscRing&) = delete;
+        SpscRing& operator=(const SpscRing&) = delete;
+
+        size_t capacity() const { return m_mask + 1; }
+
+        //producer side
+
+        size_t write_available()
+        {
+            m_tail_cache = m_tail.load(std::memory_order_acquire);
+            return free_space();
+        }
+
+        size_t push(const T* data, size_t count)
+        {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            if(free_space() < count)
+                m_tail_cache = m_tail.load(std::memory_order_acquire);
+            count = std::min(count, free_space());
+            for(size_t i = 0; i < count; i++)
+                m_buffer[(head + i) & m_mask] = data[i];
+            m_head.store(head + count, std::memory_order_release);
+            return count;
+        }
+
+        //consumer side
+
+        size_t read_available()
+        {
+            m_head_cache = m_head.load(std::memory_order_acquire);
+            return used_space();
+        }
+
+        size_t pop(T* out, size_t count)
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            if(used_space() < count)
+                m_head_cache = m_head.load(std::memory_order_acquire);
+            count = std::min(count, used_space());
+            for(size_t i = 0; i < count; i++)
+                out[i] = m_buffer[(tail + i) & m_mask];
+            m_tail.store(tail + count, std::memory_order_release);
+            return count;
+        }
+
+        //oldest element, read_available() must be > 0
+        const T& front() const
+        {
+            return m_buffer[m_tail.load(std::memory_order_relaxed) & m_mask];
+        }
+
+        size_t discard(size_t count)
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            if(used_space() < count)
+                m_head_cache = m_head.load(std::memory_order_acquire);
+            count = std::min(count, used_space());
+            m_tail.store(tail + count, std::memory_order_release);
+            return count;
+        }
+
+    private:
+        //as far as the cached index of the other side tells
+        size_t free_space() const
+        {
+            return capacity() -
+                (m_head.load(std::memory_order_relaxed) - m_tail_cache);
+        }
+
+        size_t used_space() const
+        {
+            return m_head_cache - m_tail.load(std::memory_order_relaxed);
+        }
+
+        static size_t round_up_power2(size_t n)
+        {
+            size_t power2 = 1;
+            while(power2 < n)
+                power2 *= 2;
+            return power2;
+        }
+
+        size_t           m_mask;
+        AlignedVector<T> m_buffer;
+
+        //written by producer
+        alignas(simd_alignment) std::atomic<size_t> m_head;
+        size_t                                      m_tail_cache;
+
+        //written by consumer
+        alignas(simd_alignment) std::atomic<size_t> m_tail;
+        size_t                                      m_head_cache;
+    };
+}
+
+#endif
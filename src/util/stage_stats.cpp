@@ -0,0 +1,297 @@
+#include "stage_stats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <mutex>
+#include <new>
+#include <sys/resource.h>
+#include <vector>
+
+
+namespace neurosynth
+{
+    std::string stage_name(Stage stage)
+    {
+        switch(stage)
+        {
+        case Stage::Read:
+            return "read";
+        case Stage::Resample:
+            return "resample";
+        case Stage::Window:
+            return "window";
+        case Stage::Fft:
+            return "fft";
+        case Stage::Filterbank:
+            return "filterbank";
+        case Stage::Write:
+            return "write";
+        case Stage::Count:
+            break;
+        }
+        return "unknown";
+    }
+
+    namespace
+    {
+        constexpr size_t num_stages = size_t(Stage::Count);
+
+        //written by the owning thread only, atomic so that
+        //stage_stats_json() may read them at any time
+        struct StageCounters
+        {
+            std::atomic<uint64_t> nanoseconds{0};
+            std::atomic<uint64_t> calls{0};
+            std::atomic<uint64_t> frames{0};
+            std::atomic<uint64_t> bytes{0};
+            std::atomic<uint64_t> allocations{0};
+            std::atomic<uint64_t> allocated_bytes{0};
+            std::atomic<uint64_t> peak_heap{0};
+        };
+
+        struct ThreadCounters
+        {
+            StageCounters stages[num_stages];
+        };
+
+        std::atomic<uint64_t> heap_peak{0};
+
+        //counters outlive their threads, e.g. those of a finished pool
+        std::mutex registry_mutex;
+        std::vector<ThreadCounters*>& registry()
+        {
+            static std::vector<ThreadCounters*>* threads =
+                new std::vector<ThreadCounters*>();
+            return *threads;
+        }
+
+        //sum over threads, the peak is the maximum
+        struct StageTotals
+        {
+            uint64_t nanoseconds     = 0;
+            uint64_t calls           = 0;
+            uint64_t frames          = 0;
+            uint64_t bytes           = 0;
+            uint64_t allocations     = 0;
+            uint64_t allocated_bytes = 0;
+            uint64_t peak_heap       = 0;
+        };
+    }
+
+#if NEUROSYNTH_STATS
+    namespace
+    {
+        std::atomic<int64_t> heap_live{0};
+
+        thread_local ThreadCounters* thread_counters = nullptr;
+        thread_local int             thread_stage    = -1;
+
+        void add(std::atomic<uint64_t>& counter, uint64_t value)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + value,
+                          std::memory_order_relaxed);
+        }
+
+        void raise(std::atomic<uint64_t>& counter, uint64_t value)
+        {
+            if(counter.load(std::memory_order_relaxed) < value)
+                counter.store(value, std::memory_order_relaxed);
+        }
+
+        ThreadCounters& local_counters()
+        {
+            if(!thread_counters)
+            {
+                ThreadCounters* counters = new ThreadCounters();
+                std::lock_guard<std::mutex> lock(registry_mutex);
+                registry().push_back(counters);
+                thread_counters = counters;
+            }
+            return *thread_counters;
+        }
+    }
+
+    StageTimer::StageTimer(Stage stage)
+        : m_previous(thread_stage),
+          m_stage(stage)
+    {
+        StageCounters& counters = local_counters().stages[size_t(stage)];
+        int64_t live = heap_live.load(std::memory_order_relaxed);
+        raise(counters.peak_heap, uint64_t(std::max<int64_t>(live, 0)));
+        thread_stage = int(stage);
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    StageTimer::~StageTimer()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - m_start;
+        StageCounters& counters = thread_counters->stages[size_t(m_stage)];
+        add(counters.nanoseconds, uint64_t(std::chrono::duration_cast
+                                           <std::chrono::nanoseconds>
+                                           (elapsed).count()));
+        add(counters.calls, 1);
+        thread_stage = m_previous;
+    }
+
+    void stage_count(Stage stage, uint64_t frames, uint64_t bytes)
+    {
+        StageCounters& counters = local_counters().stages[size_t(stage)];
+        add(counters.frames, frames);
+        add(counters.bytes, bytes);
+    }
+
+    void stats_allocated(void* pointer)
+    {
+        uint64_t size = malloc_usable_size(pointer);
+        int64_t live = heap_live.fetch_add(int64_t(size),
+                                           std::memory_order_relaxed) +
+            int64_t(size);
+
+        uint64_t peak = heap_peak.load(std::memory_order_relaxed);
+        while(uint64_t(live) > peak &&
+              !heap_peak.compare_exchange_weak(peak, uint64_t(live),
+                                               std::memory_order_relaxed))
+            ;
+
+        //a thread inside a stage is registered already
+        if(thread_stage >= 0)
+        {
+            StageCounters& counters = thread_counters->stages[thread_stage];
+            add(counters.allocations, 1);
+            add(counters.allocated_bytes, size);
+            raise(counters.peak_heap, uint64_t(live));
+        }
+    }
+
+    void stats_freed(void* pointer)
+    {
+        heap_live.fetch_sub(int64_t(malloc_usable_size(pointer)),
+                            std::memory_order_relaxed);
+    }
+#endif
+
+    std::string stage_stats_json()
+    {
+        StageTotals totals[num_stages];
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            for(ThreadCounters* counters : registry())
+            {
+                for(size_t s = 0; s < num_stages; s++)
+                {
+                    const StageCounters& c = counters->stages[s];
+                    StageTotals& t = totals[s];
+                    t.nanoseconds     += c.nanoseconds.load();
+                    t.calls           += c.calls.load();
+                    t.frames          += c.frames.load();
+                    t.bytes           += c.bytes.load();
+                    t.allocations     += c.allocations.load();
+                    t.allocated_bytes += c.allocated_bytes.load();
+                    t.peak_heap = std::max(t.peak_heap, c.peak_heap.load());
+                }
+            }
+        }
+
+        struct rusage usage;
+        uint64_t peak_rss = 0;
+        if(getrusage(RUSAGE_SELF, &usage) == 0)
+            peak_rss = uint64_t(usage.ru_maxrss) * 1024;
+
+        char line[512];
+        std::string json = "{\n  \"stages\": [\n";
+        for(size_t s = 0; s < num_stages; s++)
+        {
+            const StageTotals& t = totals[s];
+            snprintf(line, sizeof(line),
+                     "    {\"stage\": \"%s\", \"seconds\": %.6f, "
+                     "\"calls\": %llu, \"frames\": %llu, \"bytes\": %llu, "
+                     "\"allocations\": %llu, \"allocated_bytes\": %llu, "
+                     "\"peak_heap_bytes\": %llu}%s\n",
+                     stage_name(Stage(s)).c_str(),
+                     double(t.nanoseconds) * 1e-9,
+                     (unsigned long long)t.calls,
+                     (unsigned long long)t.frames,
+                     (unsigned long long)t.bytes,
+                     (unsigned long long)t.allocations,
+                     (unsigned long long)t.allocated_bytes,
+                     (unsigned long long)t.peak_heap,
+                     s + 1 < num_stages ? "," : "");
+            json += line;
+        }
+        snprintf(line, sizeof(line),
+                 "  ],\n  \"peak_heap_bytes\": %llu,\n"
+                 "  \"peak_rss_bytes\": %llu\n}\n",
+                 (unsigned long long)heap_peak.load(),
+                 (unsigned long long)peak_rss);
+        return json + line;
+    }
+}
+
+#if NEUROSYNTH_STATS
+//every heap allocation of the process is accounted for, see
+//stats_allocated()
+
+void* operator new(size_t size)
+{
+    void* pointer = malloc(size ? size : 1);
+    if(!pointer)
+        throw std::bad_alloc();
+    neurosynth::stats_allocated(pointer);
+    return pointer;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    void* pointer = malloc(size ? size : 1);
+    if(pointer)
+        neurosynth::stats_allocated(pointer);
+    return pointer;
+}
+
+void* operator new[](size_t size, const std::nothrow_t& nothrow) noexcept
+{
+    return operator new(size, nothrow);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    if(pointer)
+    {
+        neurosynth::stats_freed(pointer);
+        free(pointer);
+    }
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept
+{
+    operator delete(pointer);
+}
+#endif
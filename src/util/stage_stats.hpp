@@ -0,0 +1,82 @@
+#ifndef NEUROSYNTH_STAGE_STATS_HPP
+#define NEUROSYNTH_STAGE_STATS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//compiled in by the Makefile (STATS=1), without it the macros below
+//expand to nothing and no allocation is counted
+#ifndef NEUROSYNTH_STATS
+#define NEUROSYNTH_STATS 0
+#endif
+
+
+namespace neurosynth
+{
+    //stages of the analysis pipeline stats are collected for
+    enum class Stage
+    {
+        Read,       //decoding of pcm input, mapped or streamed
+        Resample,   //rate conversion ahead of the analysis
+        Window,     //loading frames into the batch
+        Fft,        //batched transforms
+        Filterbank, //power spectrum, mel filters and log compression
+        Write,      //encoding and handing feature rows to the writer
+        Count
+    };
+
+    std::string stage_name(Stage stage);
+
+    constexpr bool stage_stats_enabled = NEUROSYNTH_STATS != 0;
+
+    //Counters of all threads summed up per stage as JSON: time, calls,
+    //frames, bytes, heap allocations and peak heap while a stage was
+    //running, plus peak resident memory of the process. Best called
+    //once the work is done, counters of busy threads may lag.
+    std::string stage_stats_json();
+
+#if NEUROSYNTH_STATS
+    //Adds the lifetime of the scope to its stage on the calling thread.
+    //Counters are per thread, a timer costs two clock reads and never
+    //locks. Allocations made in the scope are charged to the stage, in
+    //nested scopes to the innermost one.
+    class StageTimer
+    {
+    public:
+        explicit StageTimer(Stage stage);
+        ~StageTimer();
+
+        StageTimer(const StageTimer&) = delete;
+        StageTimer& operator=(const StageTimer&) = delete;
+
+    private:
+        int                                   m_previous;
+        Stage                                 m_stage;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    void stage_count(Stage stage, uint64_t frames, uint64_t bytes);
+
+    //heap accounting, called by the replaced operator new/delete
+    //and AlignedAllocator
+    void stats_allocated(void* pointer);
+    void stats_freed(void* pointer);
+#endif
+}
+
+#if NEUROSYNTH_STATS
+#define NEUROSYNTH_STATS_CONCAT2(a, b) a ## b
+#define NEUROSYNTH_STATS_CONCAT(a, b) NEUROSYNTH_STATS_CONCAT2(a, b)
+#define NEUROSYNTH_STAGE(stage) \
+    ::neurosynth::StageTimer NEUROSYNTH_STATS_CONCAT(stage_timer_, __LINE__) \
+        (::neurosynth::Stage::stage)
+#define NEUROSYNTH_STAGE_COUNT(stage, frames, bytes) \
+    ::neurosynth::stage_count(::neurosynth::Stage::stage, (frames), (bytes))
+#else
+#define NEUROSYNTH_STAGE(stage) do {} while(0)
+#define NEUROSYNTH_STAGE_COUNT(stage, frames, bytes) do {} while(0)
+#endif
+
+#endif
@@ -0,0 +1,1181 @@
+#include "stft_file.hpp"
+#include "stage_stats.hpp"
+#include "text_format.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <unistd.h>
+#include <vector>
+
+
+namespace neurosynth
+{
+    namespace
+    {
+        size_t round_up(size_t size, size_t alignment)
+        {
+            return (size + alignment - 1) / alignment * alignment;
+        }
+
+        //a * b and a + b of untrusted header fields, false if the result
+        //doesn't fit in size_t
+        bool checked_mul(size_t a, size_t b, size_t& result)
+        {
+            if(b != 0 && a > std::numeric_limits<size_t>::max() / b)
+                return false;
+            result = a * b;
+            return true;
+        }
+
+        bool checked_add(size_t a, size_t b, size_t& result)
+        {
+            if(a > std::numeric_limits<size_t>::max() - b)
+                return false;
+            result = a + b;
+            return true;
+        }
+
+        //end of 'num_channels' planes of 'plane_size' bytes,
+        //'channel_stride' apart from 'offset'; false if any of them
+        //reaches beyond 'size'
+        bool planes_fit(size_t offset,
+                        size_t num_channels,
+                        size_t channel_stride,
+                        size_t plane_size,
+                        size_t size,
+                        size_t& end)
+        {
+            if(offset > size || channel_stride > size ||
+               plane_size > channel_stride)
+                return false;
+            if(channel_stride != 0 &&
+               num_channels - 1 > (size - offset) / channel_stride)
+                return false;
+
+            size_t last;
+            return checked_mul(num_channels - 1, channel_stride, last) &&
+                checked_add(offset, last, end) &&
+                checked_add(end, plane_size, end) && end <= size;
+        }
+
+        //appends whole contents of a spool file to 'writer'
+        void copy_spool(std::FILE* spool, BlockWriter& writer)
+        {
+            std::rewind(spool);
+            std::vector<char> buffer(1 << 20);
+            size_t num_read;
+            while((num_read = std::fread(buffer.data(), 1,
+                                         buffer.size(), spool)) > 0)
+                writer.write(buffer.data(), num_read);
+        }
+
+        template<class T, class U>
+        void convert_rows(const char* data, size_t count, U* out)
+        {
+            const T* values = reinterpret_cast<const T*>(data);
+            std::copy(values, values + count, out);
+        }
+
+        //header, stream table and zeros up to the first plane
+        void write_header_block(const StftFileHeader& header,
+                                const std::vector<StftStreamHeader>& table,
+                                BlockWriter& writer)
+        {
+            writer.write(&header, sizeof(header));
+            size_t table_size = table.size() * sizeof(StftStreamHeader);
+            if(table_size > 0)
+                writer.write(table.data(), table_size);
+            writer.write_zeros(header.data_offset - sizeof(header) -
+                               table_size);
+        }
+    }
+
+    size_t dtype_size(StftDtype dtype)
+    {
+        switch(dtype)
+        {
+        case StftDtype::Float64:
+            return sizeof(double);
+        case StftDtype::Float32:
+            return sizeof(float);
+        case StftDtype::Float16:
+            return sizeof(uint16_t);
+        case StftDtype::UInt8:
+            return sizeof(uint8_t);
+        }
+        return 0;
+    }
+
+    std::string dtype_name(StftDtype dtype)
+    {
+        switch(dtype)
+        {
+        case StftDtype::Float64:
+            return "float64";
+        case StftDtype::Float32:
+            return "float32";
+        case StftDtype::Float16:
+            return "float16";
+        case StftDtype::UInt8:
+            return "uint8";
+        }
+        return "unknown";
+    }
+
+    size_t stft_channel_stride(StftDtype dtype,
+                               size_t num_coeff,
+                               size_t num_frames)
+    {
+        return round_up(num_frames * num_coeff * dtype_size(dtype),
+                        stft_file_alignment);
+    }
+
+    size_t stft_quant_table_offset(const StftFileHeader& header)
+    {
+        return header.data_offset +
+            header.num_channels * header.channel_stride;
+    }
+
+    size_t stft_quant_table_size(const StftFileHeader& header)
+    {
+        if(StftQuantization(header.quantization) !=
+           StftQuantization::PerFrame)
+            return 0;
+        return header.num_frames * header.num_channels * 2 * sizeof(float);
+    }
+
+    size_t stft_streams_offset(const StftFileHeader& header)
+    {
+        return round_up(stft_quant_table_offset(header) +
+                        stft_quant_table_size(header),
+                        stft_file_alignment);
+    }
+
+    std::vector<StftStreamHeader>
+    make_stft_stream_table(StftFileHeader& header,
+                           const std::vector<StftStreamInfo>& streams,
+                           StftDtype dtype)
+    {
+        std::vector<StftStreamHeader> table;
+        if(streams.empty())
+            return table;
+
+        header.version = stft_file_streams_version;
+        size_t offset = stft_streams_offset(header);
+        for(const StftStreamInfo& info : streams)
+        {
+            StftStreamHeader stream;
+            memset(&stream, 0, sizeof(stream));
+            strncpy(stream.name, info.name.c_str(), sizeof(stream.name) - 1);
+            stream.num_coeff      = info.num_coeff;
+            stream.offset         = offset;
+            stream.channel_stride = stft_channel_stride(dtype,
+                                                        info.num_coeff,
+                                                        header.num_frames);
+            stream.dtype          = uint32_t(dtype);
+            table.push_back(stream);
+
+            offset += header.num_channels * stream.channel_stride;
+        }
+        return table;
+    }
+
+    StftFileHeader make_stft_header(const StftParams& params,
+                                    StftDtype dtype,
+                                    size_t num_channels,
+                                    size_t num_coeff,
+                                    size_t num_frames)
+    {
+        StftFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, stft_file_magic, sizeof(header.magic));
+        header.version        = stft_file_version;
+        header.byte_order     = stft_file_byte_order;
+        header.dtype          = uint32_t(dtype);
+        header.num_channels   = uint32_t(num_channels);
+        header.num_frames     = num_frames;
+        header.num_coeff      = num_coeff;
+        header.data_offset    = stft_file_alignment;
+        header.channel_stride = stft_channel_stride(dtype, num_coeff,
+                                                    num_frames);
+        header.sample_rate    = params.sample_rate;
+        header.min_freq       = params.min_freq;
+        header.max_freq       = params.max_freq;
+        header.window_size    = params.window_size;
+        header.window_step    = params.window_step;
+        header.fft_size       = uint32_t(stft_fft_size(params));
+        header.filter_shape   = uint32_t(params.filter_shape);
+        header.window_type    = uint32_t(params.window_type);
+        return header;
+    }
+
+    bool is_stft_file(const char* data, size_t size)
+    {
+        return size >= sizeof(stft_file_magic) &&
+            memcmp(data, stft_file_magic, sizeof(stft_file_magic)) == 0;
+    }
+
+    bool parse_stft_header(const char* data,
+                           size_t size,
+                           StftFileHeader& header,
+                           std::string& error)
+    {
+        if(size < sizeof(header) || !is_stft_file(data, size))
+        {
+            error = "missing stft header";
+            return false;
+        }
+
+        memcpy(&header, data, sizeof(header));
+
+        if(header.byte_order != stft_file_byte_order)
+        {
+            error = "written with different byte order";
+            return false;
+        }
+
+        if(header.version != stft_file_version &&
+           header.version != stft_file_streams_version)
+        {
+            error = "unsupported version " + std::to_string(header.version);
+            return false;
+        }
+
+        size_t value_size = dtype_size(StftDtype(header.dtype));
+        if(value_size == 0)
+        {
+            error = "unknown dtype " + std::to_string(header.dtype);
+            return false;
+        }
+
+        if(header.num_channels == 0 || header.num_coeff == 0)
+        {
+            error = "no channels or coefficients";
+            return false;
+        }
+
+        //every plane has to be aligned for its values and fit in the file
+        size_t plane_size;
+        size_t end;
+        if(header.data_offset < sizeof(header) ||
+           header.data_offset % value_size != 0 ||
+           header.channel_stride % value_size != 0 ||
+           !checked_mul(header.num_frames, header.num_coeff, plane_size) ||
+           !checked_mul(plane_size, value_size, plane_size) ||
+           !planes_fit(header.data_offset, header.num_channels,
+                       header.channel_stride, plane_size, size, end))
+        {
+            error = "invalid data layout";
+            return false;
+        }
+
+        //resynthesis divides by the hop and allocates per window sample
+        if(header.window_size < 2 ||
+           header.window_size > stft_file_max_window ||
+           header.window_step < 1 ||
+           header.window_step > stft_file_max_window ||
+           (header.fft_size != 0 && header.fft_size < header.window_size) ||
+           header.fft_size > stft_file_max_window ||
+           !(header.sample_rate > 0.0) ||
+           !(header.sample_rate <= stft_file_max_rate))
+        {
+            error = "invalid window, hop, fft size or sample rate";
+            return false;
+        }
+
+        //unknown ones would leave the synthesis window unset
+        if(header.window_type > uint32_t(WindowType::SqrtHann) ||
+           header.filter_shape > uint32_t(FilterShape::Triangular))
+        {
+            error = "invalid window type " +
+                std::to_string(header.window_type) + " or filter shape " +
+                std::to_string(header.filter_shape);
+            return false;
+        }
+
+        StftQuantization quantization = StftQuantization(header.quantization);
+        bool quantized = StftDtype(header.dtype) == StftDtype::UInt8;
+        if(quantized != (quantization == StftQuantization::PerFile ||
+                         quantization == StftQuantization::PerFrame))
+        {
+            error = "invalid quantization " +
+                std::to_string(header.quantization) + " for " +
+                dtype_name(StftDtype(header.dtype));
+            return false;
+        }
+
+        //the planes fit, so the table offset does too; its size is
+        //checked before it is added
+        size_t table_size;
+        if(quantization == StftQuantization::PerFrame &&
+           (!checked_mul(header.num_frames, header.num_channels,
+                         table_size) ||
+            !checked_mul(table_size, 2 * sizeof(float), table_size) ||
+            !checked_add(stft_quant_table_offset(header), table_size, end) ||
+            end > size))
+        {
+            error = "truncated quantization table, file has " +
+                std::to_string(size) + " bytes";
+            return false;
+        }
+
+        return true;
+    }
+
+    bool parse_stft_streams(const char* data,
+                            size_t size,
+                            const StftFileHeader& header,
+                            std::vector<StftStreamHeader>& streams,
+                            std::string& error)
+    {
+        streams.clear();
+        if(header.version < stft_file_streams_version)
+            return true;
+
+        for(size_t offset = sizeof(header); ;
+            offset += sizeof(StftStreamHeader))
+        {
+            if(offset + sizeof(StftStreamHeader) > header.data_offset)
+            {
+                error = "unterminated stream table";
+                return false;
+            }
+
+            StftStreamHeader stream;
+            memcpy(&stream, data + offset, sizeof(stream));
+            if(stream.name[0] == '\0')
+                return true;
+
+            std::string name(stream.name, strnlen(stream.name,
+                                                  sizeof(stream.name)));
+            StftDtype dtype = StftDtype(stream.dtype);
+            size_t value_size = dtype_size(dtype);
+            if(name.size() == sizeof(stream.name) || value_size == 0 ||
+               dtype == StftDtype::UInt8 || stream.num_coeff == 0)
+            {
+                error = "invalid stream " + name;
+                return false;
+            }
+
+            size_t plane_size;
+            size_t end;
+            if(stream.offset % value_size != 0 ||
+               stream.channel_stride % value_size != 0 ||
+               !checked_mul(header.num_frames, stream.num_coeff,
+                            plane_size) ||
+               !checked_mul(plane_size, value_size, plane_size) ||
+               !planes_fit(stream.offset, header.num_channels,
+                           stream.channel_stride, plane_size, size, end))
+            {
+                error = "invalid layout of stream " + name;
+                return false;
+            }
+
+            streams.push_back(stream);
+        }
+    }
+
+    StftFile::StftFile()
+        : m_data(nullptr),
+          m_size(0),
+          m_open(false),
+          m_container(false)
+    {
+        memset(&m_header, 0, sizeof(m_header));
+    }
+
+    bool StftFile::open(const std::string& filename,
+                        Logger& logger,
+                        bool sequential)
+    {
+        close();
+
+        if(filename == "-")
+        {
+            //stdin can't be mapped, read it whole
+            const size_t chunk = 1 << 20;
+            while(std::cin)
+            {
+                size_t offset = m_buffer.size();
+                m_buffer.resize(offset + chunk);
+                std::cin.read(&m_buffer[offset], chunk);
+                m_buffer.resize(offset + size_t(std::cin.gcount()));
+            }
+            m_data = m_buffer.data();
+            m_size = m_buffer.size();
+        }
+        else
+        {
+            if(!m_file.open(filename, logger, sequential))
+                return false;
+            m_data = m_file.data();
+            m_size = m_file.size();
+        }
+
+        m_open = true;
+        m_container = is_stft_file(m_data, m_size);
+        if(!m_container)
+            return true;
+
+        std::string error;
+        if(!parse_stft_header(m_data, m_size, m_header, error) ||
+           !parse_stft_streams(m_data, m_size, m_header, m_streams, error))
+        {
+            logger.warn("Invalid stft file: " + filename + " - " + error);
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void StftFile::close()
+    {
+        m_file.close();
+        m_buffer.clear();
+        m_buffer.shrink_to_fit();
+        m_data = nullptr;
+        m_size = 0;
+        m_open = false;
+        m_container = false;
+        memset(&m_header, 0, sizeof(m_header));
+        m_streams.clear();
+    }
+
+    const StftStreamHeader* StftFile::stream(const std::string& name) const
+    {
+        for(const StftStreamHeader& stream : m_streams)
+            if(strncmp(stream.name, name.c_str(), sizeof(stream.name)) == 0)
+                return &stream;
+        return nullptr;
+    }
+
+    template<class T>
+    void StftFile::read_stream_rows(const StftStreamHeader& stream,
+                                    size_t channel,
+                                    size_t first,
+                                    size_t count,
+                                    T* out) const
+    {
+        StftDtype dtype = StftDtype(stream.dtype);
+        size_t num_values = count * stream.num_coeff;
+        const char* data = m_data + stream.offset +
+            channel * stream.channel_stride +
+            first * stream.num_coeff * dtype_size(dtype);
+
+        switch(dtype)
+        {
+        case StftDtype::Float64:
+            convert_rows<double>(data, num_values, out);
+            break;
+        case StftDtype::Float32:
+            convert_rows<float>(data, num_values, out);
+            break;
+        case StftDtype::Float16:
+            decode_float16((const uint16_t*)data, num_values, out);
+            break;
+        case StftDtype::UInt8:
+            break;
+        }
+    }
+
+    StftParams StftFile::params() const
+    {
+        StftParams params;
+        params.window_size  = m_header.window_size;
+        params.window_step  = m_header.window_step;
+        params.fft_size     = m_header.fft_size != 0 ? m_header.fft_size :
+            m_header.window_size;
+        params.num_coeff    = m_header.num_coeff;
+        params.min_freq     = m_header.min_freq;
+        params.max_freq     = m_header.max_freq;
+        params.sample_rate  = m_header.sample_rate;
+        params.filter_shape = FilterShape(m_header.filter_shape);
+        params.window_type  = WindowType(m_header.window_type);
+        return params;
+    }
+
+    QuantRange StftFile::quant_range(size_t channel, size_t frame) const
+    {
+        QuantRange range;
+        switch(StftQuantization(m_header.quantization))
+        {
+        case StftQuantization::PerFile:
+            range.scale  = float(m_header.quant_scale);
+            range.offset = float(m_header.quant_offset);
+            break;
+        case StftQuantization::PerFrame:
+            memcpy(&range.scale,
+                   m_data + stft_quant_table_offset(m_header) +
+                   (frame * num_channels() + channel) * 2 * sizeof(float),
+                   sizeof(float));
+            memcpy(&range.offset,
+                   m_data + stft_quant_table_offset(m_header) +
+                   ((frame * num_channels() + channel) * 2 + 1) *
+                   sizeof(float),
+                   sizeof(float));
+            break;
+        default:
+            break;
+        }
+        return range;
+    }
+
+    template<class T>
+    void StftFile::read_rows(size_t channel,
+                             size_t first,
+                             size_t count,
+                             T* out) const
+    {
+        const char* data = raw_rows(channel, first);
+        size_t num_coeff = this->num_coeff();
+        size_t num_values = count * num_coeff;
+
+        switch(dtype())
+        {
+        case StftDtype::Float64:
+            convert_rows<double>(data, num_values, out);
+            break;
+        case StftDtype::Float32:
+            convert_rows<float>(data, num_values, out);
+            break;
+        case StftDtype::Float16:
+            decode_float16((const uint16_t*)data, num_values, out);
+            break;
+        case StftDtype::UInt8:
+            if(StftQuantization(m_header.quantization) ==
+               StftQuantization::PerFile)
+                dequantize_u8((const uint8_t*)data, num_values,
+                              quant_range(channel, first), out);
+            else
+                for(size_t i = 0; i < count; i++)
+                    dequantize_u8((const uint8_t*)data + i * num_coeff,
+                                  num_coeff,
+                                  quant_range(channel, first + i),
+                                  out + i * num_coeff);
+            break;
+        }
+    }
+
+    template<class T>
+    StftRowEncoder<T>::StftRowEncoder(StftEncoding encoding,
+                                      size_t num_coeff)
+        : m_encoding(encoding),
+          m_num_coeff(num_coeff),
+          m_encoded(row_size()),
+          m_decoded(num_coeff)
+    {
+    }
+
+    template<class T>
+    const char* StftRowEncoder<T>::encode(const T* row, QuantRange range)
+    {
+        switch(m_encoding)
+        {
+        case StftEncoding::Native:
+            return (const char*)row;
+        case StftEncoding::Float16:
+            encode_float16(row, m_num_coeff, (uint16_t*)m_encoded.data());
+            decode_float16((const uint16_t*)m_encoded.data(), m_num_coeff,
+                           m_decoded.data());
+            break;
+        case StftEncoding::UInt8:
+        case StftEncoding::UInt8Frame:
+            quantize_u8(row, m_num_coeff, range, (uint8_t*)m_encoded.data());
+            dequantize_u8((const uint8_t*)m_encoded.data(), m_num_coeff,
+                          range, m_decoded.data());
+            break;
+        }
+
+        m_error.add(row, m_decoded.data(), m_num_coeff);
+        return m_encoded.data();
+    }
+
+    template<class T>
+    QuantRange StftRowEncoder<T>::row_range(const T* row) const
+    {
+        T min, max;
+        min_max(row, m_num_coeff, min, max);
+        return neurosynth::quant_range(min, max);
+    }
+
+    void log_encoding_error(const std::string& filename,
+                            StftEncoding encoding,
+                            const QuantError& error,
+                            Logger& logger)
+    {
+        if(encoding == StftEncoding::Native)
+            return;
+
+        logger.info("Encoded " + std::to_string(error.count()) +
+                    " values as " + stft_encoding_name(encoding) +
+                    ", reconstruction error max: " +
+                    std::to_string(error.max_abs()) + ", rms: " +
+                    std::to_string(error.rms()) + " in: " + filename);
+    }
+
+    template<class T>
+    StftWriter<T>::StftWriter(const std::string& filename,
+                              Logger& logger,
+                              StftOutput output,
+                              StftEncoding encoding)
+        : m_filename(filename),
+          m_logger(logger),
+          m_output(output),
+          m_encoding(encoding),
+          m_fd(open_output(filename, logger)),
+          m_seekable(m_fd != -1 && lseek(m_fd, 0, SEEK_CUR) != -1),
+          m_spool_l(nullptr),
+          m_spool_r(nullptr),
+          m_spool_q(nullptr),
+          m_min(std::numeric_limits<T>::max()),
+          m_max(std::numeric_limits<T>::lowest()),
+          m_num_coeff(0),
+          m_num_frames(0),
+          m_open(false)
+    {
+        if(m_fd != -1)
+            m_writer.reset(new BlockWriter(m_fd));
+    }
+
+    template<class T>
+    StftWriter<T>::~StftWriter()
+    {
+        close();
+    }
+
+    template<class T>
+    void StftWriter<T>::write_header(const StftParams& params,
+                                     size_t num_coeff,
+                                     const std::vector<StftStreamInfo>&
+                                     streams)
+    {
+        NEUROSYNTH_STAGE(Write);
+        m_params    = params;
+        m_num_coeff = num_coeff;
+        m_open      = m_writer != nullptr;
+        if(!m_open)
+            return;
+
+        if(!streams.empty() && m_output != StftOutput::Binary)
+            m_logger.warn("Feature streams need binary output, dropping "
+                          "them from: " + m_filename);
+        else if(streams.size() > stft_max_streams)
+            m_logger.warn("Too many feature streams for: " + m_filename);
+        else
+        {
+            //frame counts are known at the end only, so streams are
+            //spooled whatever the output
+            m_streams = streams;
+            m_stream_frames.assign(streams.size(), 0);
+            for(size_t i = 0; i < 2 * streams.size(); i++)
+            {
+                m_stream_spools.push_back(std::tmpfile());
+                if(!m_stream_spools.back())
+                    m_logger.warn("Cannot create temporary file for: " +
+                                  m_filename);
+            }
+        }
+
+        if(m_output == StftOutput::Text)
+        {
+            m_text.resize(3 * max_formatted_size +
+                          2 * num_coeff * (max_formatted_size + 1) + 3);
+            char* p = m_text.data();
+            p += format_unsigned(num_coeff, p);
+            *p++ = '\n';
+            p += format_general(params.min_freq, stft_text_digits, p);
+            *p++ = '\n';
+            p += format_general(params.max_freq, stft_text_digits, p);
+            *p++ = '\n';
+            m_writer->write(m_text.data(), size_t(p - m_text.data()));
+            return;
+        }
+
+        if(m_output == StftOutput::Csv)
+        {
+            m_text.resize(max_formatted_size +
+                          num_coeff * (max_formatted_size + 1) + 8);
+            std::string line = "frame,channel";
+            for(size_t c = 0; c < num_coeff; c++)
+                line += ",c" + std::to_string(c);
+            line += '\n';
+            m_writer->write(line.data(), line.size());
+            return;
+        }
+
+        m_encoder.reset(new StftRowEncoder<T>(m_encoding, num_coeff));
+
+        m_spool_r = std::tmpfile();
+        if(!m_seekable || m_encoding == StftEncoding::UInt8)
+            m_spool_l = std::tmpfile();
+        else
+            m_writer->write_zeros(stft_file_alignment); //filled by close()
+        if(m_encoding == StftEncoding::UInt8Frame)
+            m_spool_q = std::tmpfile();
+
+        bool spool_l = !m_seekable || m_encoding == StftEncoding::UInt8;
+        if(!m_spool_r || (spool_l && !m_spool_l) ||
+           (m_encoding == StftEncoding::UInt8Frame && !m_spool_q))
+            m_logger.warn("Cannot create temporary file for: " + m_filename);
+    }
+
+    template<class T>
+    void StftWriter<T>::write_text_frame(const T* power_l,
+                                         const T* power_r)
+    {
+        char* p = m_text.data();
+        if(m_output == StftOutput::Text)
+        {
+            for(size_t c = 0; c < m_num_coeff; c++)
+            {
+                p += format_general(power_l[c], stft_text_digits, p);
+                *p++ = ' ';
+                p += format_general(power_r[c], stft_text_digits, p);
+                *p++ = '\n';
+            }
+            p = std::fill_n(p, 3, '\n');
+            m_writer->write(m_text.data(), size_t(p - m_text.data()));
+            return;
+        }
+
+        const T* powers[2] = {power_l, power_r};
+        for(size_t channel = 0; channel < 2; channel++)
+        {
+            p = m_text.data();
+            p += format_unsigned(m_num_frames, p);
+            *p++ = ',';
+            *p++ = channel == 0 ? 'L' : 'R';
+            for(size_t c = 0; c < m_num_coeff; c++)
+            {
+                *p++ = ',';
+                p += format_general(powers[channel][c], stft_text_digits, p);
+            }
+            *p++ = '\n';
+            m_writer->write(m_text.data(), size_t(p - m_text.data()));
+        }
+    }
+
+    template<class T>
+    void StftWriter<T>::write_binary_frame(const T* power_l,
+                                           const T* power_r)
+    {
+        //per-file range is known only after the last frame,
+        //keep values as they are until then
+        if(m_encoding == StftEncoding::UInt8)
+        {
+            T min, max;
+            min_max(power_l, m_num_coeff, min, max);
+            m_min = std::min(m_min, min);
+            m_max = std::max(m_max, max);
+            min_max(power_r, m_num_coeff, min, max);
+            m_min = std::min(m_min, min);
+            m_max = std::max(m_max, max);
+
+            if(m_spool_l)
+                std::fwrite(power_l, sizeof(T), m_num_coeff, m_spool_l);
+            if(m_spool_r)
+                std::fwrite(power_r, sizeof(T), m_num_coeff, m_spool_r);
+            return;
+        }
+
+        QuantRange range_l;
+        QuantRange range_r;
+        if(m_encoding == StftEncoding::UInt8Frame)
+        {
+            range_l = m_encoder->row_range(power_l);
+            range_r = m_encoder->row_range(power_r);
+            float ranges[4] = {range_l.scale, range_l.offset,
+                               range_r.scale, range_r.offset};
+            if(m_spool_q)
+                std::fwrite(ranges, sizeof(float), 4, m_spool_q);
+        }
+
+        size_t row_size = m_encoder->row_size();
+        const char* row = m_encoder->encode(power_l, range_l);
+        if(m_spool_l)
+            std::fwrite(row, 1, row_size, m_spool_l);
+        else
+            m_writer->write(row, row_size);
+
+        row = m_encoder->encode(power_r, range_r);
+        if(m_spool_r)
+            std::fwrite(row, 1, row_size, m_spool_r);
+    }
+
+    template<class T>
+    void StftWriter<T>::write_frame(const T* power_l,
+                                    const T* power_r)
+    {
+        if(!m_open)
+            return;
+
+        NEUROSYNTH_STAGE(Write);
+        NEUROSYNTH_STAGE_COUNT(Write, 1, 0);
+        if(m_output != StftOutput::Binary)
+            write_text_frame(power_l, power_r);
+        else
+            write_binary_frame(power_l, power_r);
+
+        m_num_frames++;
+    }
+
+    template<class T>
+    void StftWriter<T>::write_stream_frame(size_t stream,
+                                           const T* row_l,
+                                           const T* row_r)
+    {
+        if(!m_open || stream >= m_streams.size())
+            return;
+
+        NEUROSYNTH_STAGE(Write);
+        size_t num_coeff = m_streams[stream].num_coeff;
+        if(m_stream_spools[2 * stream])
+            std::fwrite(row_l, sizeof(T), num_coeff,
+                        m_stream_spools[2 * stream]);
+        if(m_stream_spools[2 * stream + 1])
+            std::fwrite(row_r, sizeof(T), num_coeff,
+                        m_stream_spools[2 * stream + 1]);
+        m_stream_frames[stream]++;
+    }
+
+    template<class T>
+    bool StftWriter<T>::write_streams(const std::vector<StftStreamHeader>&
+                                      table)
+    {
+        bool good = true;
+        for(size_t s = 0; s < table.size(); s++)
+        {
+            if(m_stream_frames[s] != m_num_frames ||
+               !m_stream_spools[2 * s] || !m_stream_spools[2 * s + 1])
+            {
+                m_logger.warn("Stream " + m_streams[s].name + " has " +
+                              std::to_string(m_stream_frames[s]) + " of " +
+                              std::to_string(m_num_frames) + " frames in: " +
+                              m_filename);
+                good = false;
+            }
+
+            //a short stream is padded, so the layout stays valid
+            size_t plane_size = std::min(m_stream_frames[s], m_num_frames) *
+                table[s].num_coeff * sizeof(T);
+            for(size_t channel = 0; channel < 2; channel++)
+            {
+                std::FILE* spool = m_stream_spools[2 * s + channel];
+                size_t written = 0;
+                if(spool)
+                {
+                    std::rewind(spool);
+                    std::vector<char> buffer(1 << 20);
+                    size_t num_read;
+                    while(written < plane_size &&
+                          (num_read = std::fread(buffer.data(), 1,
+                                                 std::min(buffer.size(),
+                                                          plane_size -
+                                                          written),
+                                                 spool)) > 0)
+                    {
+                        m_writer->write(buffer.data(), num_read);
+                        written += num_read;
+                    }
+                }
+                m_writer->write_zeros(table[s].channel_stride - written);
+            }
+        }
+        return good;
+    }
+
+    template<class T>
+    void StftWriter<T>::flush()
+    {
+        NEUROSYNTH_STAGE(Write);
+        if(m_writer)
+            m_writer->flush();
+    }
+
+    template<class T>
+    void StftWriter<T>::copy_encoded(std::FILE* spool, QuantRange range)
+    {
+        std::rewind(spool);
+        std::vector<T> row(m_num_coeff);
+        while(std::fread(row.data(), sizeof(T), m_num_coeff, spool) ==
+              m_num_coeff)
+            m_writer->write(m_encoder->encode(row.data(), range),
+                            m_encoder->row_size());
+    }
+
+    template<class T>
+    bool StftWriter<T>::close()
+    {
+        NEUROSYNTH_STAGE(Write);
+        bool good = m_writer != nullptr;
+        if(m_open && m_output == StftOutput::Binary)
+        {
+            StftFileHeader header = make_stft_header(m_params,
+                                                     m_encoder->dtype(),
+                                                     2,
+                                                     m_num_coeff,
+                                                     m_num_frames);
+
+            QuantRange range;
+            if(m_encoding == StftEncoding::UInt8)
+            {
+                if(m_num_frames > 0)
+                    range = quant_range(m_min, m_max);
+                header.quantization = uint32_t(StftQuantization::PerFile);
+                header.quant_scale  = range.scale;
+                header.quant_offset = range.offset;
+            }
+            else if(m_encoding == StftEncoding::UInt8Frame)
+                header.quantization = uint32_t(StftQuantization::PerFrame);
+
+            std::vector<StftStreamHeader> table =
+                make_stft_stream_table(header, m_streams,
+                                       StftDtypeOf<T>::value);
+
+            size_t plane_size = m_num_frames * m_encoder->row_size();
+            size_t padding    = header.channel_stride - plane_size;
+
+            if(m_spool_l)
+            {
+                write_header_block(header, table, *m_writer);
+                if(m_encoding == StftEncoding::UInt8)
+                    copy_encoded(m_spool_l, range);
+                else
+                    copy_spool(m_spool_l, *m_writer);
+            }
+            m_writer->write_zeros(padding);
+            if(m_spool_r)
+            {
+                if(m_encoding == StftEncoding::UInt8)
+                    copy_encoded(m_spool_r, range);
+                else
+                    copy_spool(m_spool_r, *m_writer);
+            }
+            m_writer->write_zeros(padding);
+
+            if(m_spool_q)
+            {
+                size_t table_size = stft_quant_table_size(header);
+                copy_spool(m_spool_q, *m_writer);
+                m_writer->write_zeros(round_up(table_size,
+                                               stft_file_alignment) -
+                                      table_size);
+            }
+            if(!write_streams(table))
+                good = false;
+            m_writer->flush();
+
+            size_t table_size = table.size() * sizeof(StftStreamHeader);
+            if(!m_spool_l &&
+               (pwrite(m_fd, &header, sizeof(header), 0) != sizeof(header) ||
+                (table_size > 0 &&
+                 pwrite(m_fd, table.data(), table_size, sizeof(header)) !=
+                 ssize_t(table_size))))
+            {
+                m_logger.warn("Cannot write stft header to: " + m_filename);
+                good = false;
+            }
+
+            if(!m_spool_r || (!m_seekable && !m_spool_l))
+            {
+                m_logger.warn("Cannot write stft file: " + m_filename);
+                good = false;
+            }
+
+            log_encoding_error(m_filename, m_encoding,
+                               m_encoder->error(), m_logger);
+        }
+
+        if(m_writer)
+        {
+            m_writer->flush();
+            if(!m_writer->good())
+            {
+                m_logger.warn("Cannot write to: " + m_filename);
+                good = false;
+            }
+            NEUROSYNTH_STAGE_COUNT(Write, 0, m_writer->bytes_written());
+            m_writer.reset();
+        }
+
+        for(std::FILE** spool : {&m_spool_l, &m_spool_r, &m_spool_q})
+        {
+            if(*spool)
+                std::fclose(*spool);
+            *spool = nullptr;
+        }
+        for(std::FILE* spool : m_stream_spools)
+            if(spool)
+                std::fclose(spool);
+        m_stream_spools.clear();
+        m_streams.clear();
+        m_stream_frames.clear();
+
+        close_output(m_fd);
+        m_fd   = -1;
+        m_open = false;
+        return good;
+    }
+
+    template<class T>
+    bool write_stft_file(const std::string& filename,
+                         const StftData<T>& stft_data,
+                         const StftParams& params,
+                         Logger& logger,
+                         StftEncoding encoding,
+                         const std::vector<StftStream<T>>& streams)
+    {
+        NEUROSYNTH_STAGE(Write);
+        int fd = open_output(filename, logger);
+        if(fd == -1)
+            return false;
+
+        size_t num_coeff  = stft_data.num_coeff();
+        size_t num_frames = stft_data.num_frames();
+        StftRowEncoder<T> encoder(encoding, num_coeff);
+        StftFileHeader header = make_stft_header(params,
+                                                 encoder.dtype(),
+                                                 2,
+                                                 num_coeff,
+                                                 num_frames);
+        size_t row_size   = encoder.row_size();
+        size_t plane_size = num_frames * row_size;
+
+        //per-file range spans both channels of all frames
+        QuantRange file_range;
+        if(encoding == StftEncoding::UInt8)
+        {
+            T min = std::numeric_limits<T>::max();
+            T max = std::numeric_limits<T>::lowest();
+            for(size_t channel = 0; channel < 2; channel++)
+                for(size_t t = 0; t < num_frames; t++)
+                {
+                    T row_min, row_max;
+                    min_max(stft_data.row(channel, t), num_coeff,
+                            row_min, row_max);
+                    min = std::min(min, row_min);
+                    max = std::max(max, row_max);
+                }
+            if(num_frames > 0)
+                file_range = quant_range(min, max);
+            header.quantization = uint32_t(StftQuantization::PerFile);
+            header.quant_scale  = file_range.scale;
+            header.quant_offset = file_range.offset;
+        }
+        else if(encoding == StftEncoding::UInt8Frame)
+            header.quantization = uint32_t(StftQuantization::PerFrame);
+
+        std::vector<float> table(stft_quant_table_size(header) /
+                                 sizeof(float));
+
+        std::vector<StftStreamInfo> infos;
+        for(const StftStream<T>& stream : streams)
+        {
+            if(stream.data.num_frames() != num_frames ||
+               stream.data.num_channels() != 2)
+            {
+                logger.warn("Stream " + stream.name + " doesn't match the "
+                            "frames of: " + filename);
+                close_output(fd);
+                return false;
+            }
+            infos.push_back({stream.name, stream.data.num_coeff()});
+        }
+        if(infos.size() > stft_max_streams)
+        {
+            logger.warn("Too many feature streams for: " + filename);
+            close_output(fd);
+            return false;
+        }
+        std::vector<StftStreamHeader> stream_table =
+            make_stft_stream_table(header, infos, StftDtypeOf<T>::value);
+
+        bool good;
+        {
+            BlockWriter writer(fd);
+            write_header_block(header, stream_table, writer);
+            for(size_t channel = 0; channel < 2; channel++)
+            {
+                if(encoding == StftEncoding::Native &&
+                   stft_data.layout() == ChannelLayout::Planar)
+                    writer.write(stft_data.data(channel), plane_size);
+                else
+                    for(size_t t = 0; t < num_frames; t++)
+                    {
+                        const T* row = stft_data.row(channel, t);
+                        QuantRange range = file_range;
+                        if(encoding == StftEncoding::UInt8Frame)
+                        {
+                            range = encoder.row_range(row);
+                            table[(t * 2 + channel) * 2]     = range.scale;
+                            table[(t * 2 + channel) * 2 + 1] = range.offset;
+                        }
+                        writer.write(encoder.encode(row, range), row_size);
+                    }
+                writer.write_zeros(header.channel_stride - plane_size);
+            }
+            if(!table.empty())
+            {
+                size_t table_size = table.size() * sizeof(float);
+                writer.write(table.data(), table_size);
+                writer.write_zeros(round_up(table_size,
+                                            stft_file_alignment) -
+                                   table_size);
+            }
+            for(size_t s = 0; s < streams.size(); s++)
+            {
+                const StftData<T>& data = streams[s].data;
+                size_t stream_plane = num_frames * data.num_coeff() *
+                    sizeof(T);
+                for(size_t channel = 0; channel < 2; channel++)
+                {
+                    if(data.layout() == ChannelLayout::Planar)
+                        writer.write(data.data(channel), stream_plane);
+                    else
+                        for(size_t t = 0; t < num_frames; t++)
+                            writer.write(data.row(channel, t),
+                                         data.num_coeff() * sizeof(T));
+                    writer.write_zeros(stream_table[s].channel_stride -
+                                       stream_plane);
+                }
+            }
+            writer.flush();
+            good = writer.good();
+            NEUROSYNTH_STAGE_COUNT(Write, num_frames, writer.bytes_written());
+        }
+        close_output(fd);
+
+        if(!good)
+            logger.warn("Cannot write stft file: " + filename);
+        log_encoding_error(filename, encoding, encoder.error(), logger);
+        return good;
+    }
+
+    template void StftFile::read_rows<double>(size_t, size_t, size_t,
+                                              double*) const;
+    template void StftFile::read_rows<float>(size_t, size_t, size_t,
+                                             float*) const;
+
+    template void StftFile::read_stream_rows<double>(const StftStreamHeader&,
+                                                     size_t, size_t, size_t,
+                                                     double*) const;
+    template void StftFile::read_stream_rows<float>(const StftStreamHeader&,
+                                                    size_t, size_t, size_t,
+                                                    float*) const;
+
+    template class StftRowEncoder<double>;
+    template class StftRowEncoder<float>;
+
+    template class StftWriter<double>;
+    template class StftWriter<float>;
+
+    template bool write_stft_file<double>
+    (const std::string&, const StftData<double>&, const StftParams&,
+     Logger&, StftEncoding, const std::vector<StftStream<double>>&);
+    template bool write_stft_file<float>
+    (const std::string&, const StftData<float>&, const StftParams&,
+     Logger&, StftEncoding, const std::vector<StftStream<float>>&);
+}
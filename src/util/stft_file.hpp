@@ -0,0 +1,461 @@
+#ifndef NEUROSYNTH_STFT_FILE_HPP
+#define NEUROSYNTH_STFT_FILE_HPP
+
+#include "aligned_allocator.hpp"
+#include "block_writer.hpp"
+#include "logger.hpp"
+#include "mapped_file.hpp"
+#include "quantize.hpp"
+#include "wav_utils.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace neurosynth
+{
+    enum class StftDtype : uint32_t
+    {
+        Float64 = 1,
+        Float32 = 2,
+        Float16 = 3,
+        UInt8   = 4  //quantized, see StftQuantization
+    };
+
+    enum class StftQuantization : uint32_t
+    {
+        None     = 0,
+        PerFile  = 1, //scale/offset in the header
+        PerFrame = 2  //scale/offset table after the planes
+    };
+
+    template<class T>
+    struct StftDtypeOf;
+
+    template<>
+    struct StftDtypeOf<double>
+    {
+        static constexpr StftDtype value = StftDtype::Float64;
+    };
+
+    template<>
+    struct StftDtypeOf<float>
+    {
+        static constexpr StftDtype value = StftDtype::Float32;
+    };
+
+    //bytes per stored value, 0 for unknown dtypes
+    size_t dtype_size(StftDtype dtype);
+
+    std::string dtype_name(StftDtype dtype);
+
+    //dtype stored for features of type T written with 'encoding'
+    template<class T>
+    StftDtype encoding_dtype(StftEncoding encoding)
+    {
+        switch(encoding)
+        {
+        case StftEncoding::Float16:
+            return StftDtype::Float16;
+        case StftEncoding::UInt8:
+        case StftEncoding::UInt8Frame:
+            return StftDtype::UInt8;
+        default:
+            return StftDtypeOf<T>::value;
+        }
+    }
+
+    //"\r\n" catches text mode transfers mangling the file
+    constexpr char stft_file_magic[8] = {'N', 'S', 'S', 'T',
+                                         'F', 'T', '\r', '\n'};
+
+    constexpr uint32_t stft_file_version    = 1;
+    constexpr uint32_t stft_file_byte_order = 0x01020304;
+
+    //files with named streams next to the primary features, readers
+    //of version 1 don't know where those end
+    constexpr uint32_t stft_file_streams_version = 2;
+
+    //channel planes start at multiples of this many bytes,
+    //so each of them can be mapped (or read with O_DIRECT) on its own
+    constexpr size_t stft_file_alignment = 4096;
+
+    //largest window, hop and fft size (samples) and sample rate a
+    //container may declare; larger ones are taken for corruption
+    constexpr size_t stft_file_max_window = size_t(1) << 24;
+    constexpr double stft_file_max_rate   = 1e7;
+
+    //Fixed size header of the stft container
+    //
+    //File layout:
+    //header (128 bytes), zero padding up to data_offset,
+    //then one plane per channel, channel_stride bytes apart:
+    //num_frames rows of num_coeff values of type dtype, zero padded
+    //to a multiple of stft_file_alignment
+    //
+    //UInt8 values decode as offset + scale * code. Per-file scale and
+    //offset are in the header, per-frame ones follow the last plane
+    //(at stft_quant_table_offset()) as float scale/offset pairs for
+    //every frame and channel, [frames x channels x 2]
+    //
+    //Version 2 files carry named streams (mfcc, chroma, ...) of the
+    //same frames: a table of StftStreamHeader right after the header,
+    //ended by an entry with an empty name, and the streams' planes
+    //after everything else (see stft_streams_offset()), laid out like
+    //the primary ones.
+    //
+    //All fields are in the byte order of the producer, byte_order
+    //holds stft_file_byte_order so readers can detect a mismatch.
+    struct StftFileHeader
+    {
+        char     magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t dtype;          //StftDtype
+        uint32_t num_channels;
+        uint64_t num_frames;
+        uint64_t num_coeff;
+        uint64_t data_offset;    //bytes from file start to first plane
+        uint64_t channel_stride; //bytes between channel planes
+        double   sample_rate;
+        double   min_freq;
+        double   max_freq;
+        uint64_t window_size;
+        uint64_t window_step;
+        uint32_t filter_shape;   //FilterShape
+        uint32_t window_type;    //WindowType
+        uint32_t quantization;   //StftQuantization, UInt8 only
+        uint32_t fft_size;       //0 - window_size (older files)
+        double   quant_scale;    //StftQuantization::PerFile only
+        double   quant_offset;
+    };
+
+    static_assert(sizeof(StftFileHeader) == 128,
+                  "stft file header must stay 128 bytes");
+
+    //Entry of the stream table of version 2 files
+    struct StftStreamHeader
+    {
+        char     name[16];       //NUL padded
+        uint64_t num_coeff;
+        uint64_t offset;         //bytes from file start to first plane
+        uint64_t channel_stride;
+        uint32_t dtype;          //StftDtype, never UInt8
+        uint32_t reserved;
+    };
+
+    static_assert(sizeof(StftStreamHeader) == 48,
+                  "stft stream header must stay 48 bytes");
+
+    //streams that fit between header and data_offset, with the
+    //terminating entry
+    constexpr size_t stft_max_streams =
+        (stft_file_alignment - sizeof(StftFileHeader)) /
+        sizeof(StftStreamHeader) - 1;
+
+    //name and width of a stream to be written
+    struct StftStreamInfo
+    {
+        std::string name;
+        size_t      num_coeff;
+    };
+
+    //header for 'num_frames' frames of 'num_coeff' values
+    //per channel computed with 'params'
+    StftFileHeader make_stft_header(const StftParams& params,
+                                    StftDtype dtype,
+                                    size_t num_channels,
+                                    size_t num_coeff,
+                                    size_t num_frames);
+
+    //bytes taken by one channel plane including padding
+    size_t stft_channel_stride(StftDtype dtype,
+                               size_t num_coeff,
+                               size_t num_frames);
+
+    //byte offset of the per-frame quantization table; like the size
+    //below unchecked, only for headers written or parsed here
+    size_t stft_quant_table_offset(const StftFileHeader& header);
+
+    //bytes of the per-frame quantization table, 0 if there is none
+    size_t stft_quant_table_size(const StftFileHeader& header);
+
+    //byte offset of the first stream plane, past the primary planes
+    //and the quantization table
+    size_t stft_streams_offset(const StftFileHeader& header);
+
+    //stream table for 'streams' of 'dtype' values after the data
+    //described by 'header', which is upgraded to version 2
+    std::vector<StftStreamHeader>
+    make_stft_stream_table(StftFileHeader& header,
+                           const std::vector<StftStreamInfo>& streams,
+                           StftDtype dtype);
+
+    //true if 'data' starts with the stft container magic
+    bool is_stft_file(const char* data, size_t size);
+
+    //validates header of an in-memory container against its size
+    //returns false and sets 'error' for unsupported/corrupt files
+    bool parse_stft_header(const char* data,
+                           size_t size,
+                           StftFileHeader& header,
+                           std::string& error);
+
+    //validates the stream table of a version 2 container
+    bool parse_stft_streams(const char* data,
+                            size_t size,
+                            const StftFileHeader& header,
+                            std::vector<StftStreamHeader>& streams,
+                            std::string& error);
+
+    //Zero-copy reader of stft containers. Files are memory mapped,
+    //stdin ("-") is read into memory. Rows of any frame range are
+    //addressed in O(1) straight from the mapping, nothing is parsed
+    //beyond the header.
+    //
+    //Inputs without the container magic are still opened, so callers
+    //can fall back to older formats through data()/size().
+    class StftFile
+    {
+    public:
+        StftFile();
+
+        //returns false (and logs) if input can't be read or it is
+        //a container with invalid header
+        //'sequential' should be set when all frames are read in order
+        bool open(const std::string& filename,
+                  Logger& logger,
+                  bool sequential = false);
+
+        void close();
+
+        bool is_open() const { return m_open; }
+
+        //false for inputs in a pre-container format
+        bool is_container() const { return m_container; }
+
+        const StftFileHeader& header() const { return m_header; }
+
+        size_t num_channels() const { return m_header.num_channels; }
+        size_t num_frames() const { return m_header.num_frames; }
+        size_t num_coeff() const { return m_header.num_coeff; }
+        StftDtype dtype() const { return StftDtype(m_header.dtype); }
+
+        //parameters the features were computed with
+        StftParams params() const;
+
+        //named streams of version 2 files, empty for older ones
+        const std::vector<StftStreamHeader>& streams() const
+        {
+            return m_streams;
+        }
+
+        //stream called 'name', nullptr if there is none
+        const StftStreamHeader* stream(const std::string& name) const;
+
+        //copies frames [first, first + count) of 'channel' of 'stream'
+        //to 'out', converting values to T
+        template<class T>
+        void read_stream_rows(const StftStreamHeader& stream,
+                              size_t channel,
+                              size_t first,
+                              size_t count,
+                              T* out) const;
+
+        //first value of frame 'first' of 'channel', rows of the
+        //following frames come right after it (num_coeff apart)
+        //nullptr if stored values are not of type T
+        template<class T>
+        const T* rows(size_t channel, size_t first) const
+        {
+            if(dtype() != StftDtypeOf<T>::value)
+                return nullptr;
+            return reinterpret_cast<const T*>(plane(channel)) +
+                first * num_coeff();
+        }
+
+        //stored (possibly encoded) values of frame 'first' of 'channel'
+        //rows of the following frames come right after it
+        const char* raw_rows(size_t channel, size_t first) const
+        {
+            return plane(channel) +
+                first * num_coeff() * dtype_size(dtype());
+        }
+
+        //scale/offset of UInt8 values of one frame of 'channel'
+        QuantRange quant_range(size_t channel, size_t frame) const;
+
+        //copies frames [first, first + count) of 'channel'
+        //to 'out', decoding/converting values to T
+        template<class T>
+        void read_rows(size_t channel,
+                       size_t first,
+                       size_t count,
+                       T* out) const;
+
+        const char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+    private:
+        MappedFile          m_file;
+        AlignedVector<char> m_buffer;
+        const char*         m_data;
+        size_t              m_size;
+        bool                m_open;
+        bool                m_container;
+        StftFileHeader      m_header;
+        std::vector<StftStreamHeader> m_streams;
+
+        const char* plane(size_t channel) const
+        {
+            return m_data + m_header.data_offset +
+                channel * m_header.channel_stride;
+        }
+    };
+
+    //Encodes rows of features into their stored representation
+    //and keeps track of the reconstruction error
+    template<class T>
+    class StftRowEncoder
+    {
+    public:
+        StftRowEncoder(StftEncoding encoding, size_t num_coeff);
+
+        StftEncoding encoding() const { return m_encoding; }
+        StftDtype dtype() const { return encoding_dtype<T>(m_encoding); }
+
+        //bytes of an encoded row
+        size_t row_size() const { return m_num_coeff * dtype_size(dtype()); }
+
+        //'range' is used by 8-bit encodings only, returned
+        //pointer is valid until the next call
+        const char* encode(const T* row, QuantRange range = QuantRange());
+
+        //scale/offset covering all values of 'row'
+        QuantRange row_range(const T* row) const;
+
+        const QuantError& error() const { return m_error; }
+
+    private:
+        StftEncoding      m_encoding;
+        size_t            m_num_coeff;
+        std::vector<char> m_encoded;
+        std::vector<T>    m_decoded;
+        QuantError        m_error;
+    };
+
+    //significant digits of text and csv values
+    constexpr int stft_text_digits = 9;
+
+    //Writes stft features frame by frame, so features can be emitted
+    //before the whole input is analyzed. Output goes through a
+    //BlockWriter, i.e. in large blocks from a background thread.
+    //
+    //Binary output is a stft container. Frame count is known only at
+    //the end, so the L plane goes straight to the output while R rows
+    //are spooled to an anonymous temporary file and appended by
+    //close(), which also fills in the final header. Non seekable
+    //outputs (stdout, pipes) spool both planes, and so does per-file
+    //8-bit quantization, whose range is known only at the end too.
+    //Either way the container is usable only after close(); text and
+    //csv output is complete frame by frame.
+    template<class T>
+    class StftWriter
+    {
+    public:
+        StftWriter(const std::string& filename,
+                   Logger& logger,
+                   StftOutput output = StftOutput::Binary,
+                   StftEncoding encoding = StftEncoding::Native);
+
+        ~StftWriter();
+
+        StftWriter(const StftWriter&) = delete;
+        StftWriter& operator=(const StftWriter&) = delete;
+
+        //'streams' are written next to the primary features (binary
+        //output only), always at the precision of T
+        void write_header(const StftParams& params,
+                          size_t num_coeff,
+                          const std::vector<StftStreamInfo>& streams =
+                          std::vector<StftStreamInfo>());
+
+        void write_frame(const T* power_l,
+                         const T* power_r);
+
+        //next frame of stream 'stream' (index into write_header()'s
+        //streams); may lag behind write_frame(), but every stream
+        //needs as many frames as the primary one by close()
+        void write_stream_frame(size_t stream,
+                                const T* row_l,
+                                const T* row_r);
+
+        //hands buffered data over to the writer thread
+        void flush();
+
+        //completes the file, called by destructor if needed
+        //returns false if the output could not be written
+        bool close();
+
+        size_t num_frames() const { return m_num_frames; }
+
+    private:
+        std::string                  m_filename;
+        Logger&                      m_logger;
+        StftOutput                   m_output;
+        StftEncoding                 m_encoding;
+        int                          m_fd;
+        bool                         m_seekable;
+        std::unique_ptr<BlockWriter> m_writer;
+        std::FILE*                   m_spool_l; //nullptr - L goes to m_fd
+        std::FILE*                   m_spool_r;
+        std::FILE*                   m_spool_q; //per-frame ranges
+        std::vector<StftStreamInfo>  m_streams;
+        std::vector<std::FILE*>      m_stream_spools; //L, R per stream
+        std::vector<size_t>          m_stream_frames;
+        std::unique_ptr<StftRowEncoder<T>> m_encoder;
+        T                            m_min;     //per-file range
+        T                            m_max;
+        std::vector<char>            m_text;
+        StftParams                   m_params;
+        size_t                       m_num_coeff;
+        size_t                       m_num_frames;
+        bool                         m_open;
+
+        void write_text_frame(const T* power_l,
+                              const T* power_r);
+
+        void write_binary_frame(const T* power_l,
+                                const T* power_r);
+
+        //appends spooled rows of type T, encoding them with 'range'
+        void copy_encoded(std::FILE* spool, QuantRange range);
+
+        //appends spooled stream planes as laid out by 'table'
+        bool write_streams(const std::vector<StftStreamHeader>& table);
+    };
+
+    //writes all features at once as stft container, both planes
+    //(and those of 'streams', which need as many frames) go straight
+    //to the output without spooling
+    //returns false (and logs) on failure
+    template<class T>
+    bool write_stft_file(const std::string& filename,
+                         const StftData<T>& stft_data,
+                         const StftParams& params,
+                         Logger& logger,
+                         StftEncoding encoding = StftEncoding::Native,
+                         const std::vector<StftStream<T>>& streams =
+                         std::vector<StftStream<T>>());
+
+    //logs reconstruction error of an encoding
+    void log_encoding_error(const std::string& filename,
+                            StftEncoding encoding,
+                            const QuantError& error,
+                            Logger& logger);
+}
+
+#endif
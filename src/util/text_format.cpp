@@ -0,0 +1,154 @@
+#include "text_format.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+
+namespace neurosynth
+{
+    namespace
+    {
+        const uint64_t pow10_int[] =
+        {
+            1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull,
+            10000000ull, 100000000ull, 1000000000ull, 10000000000ull,
+            100000000000ull, 1000000000000ull, 10000000000000ull,
+            100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+            100000000000000000ull
+        };
+
+        //powers of ten exactly representable as double
+        const double pow10_exact[] =
+        {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+
+        //value * 10^exponent rounded half to even, as printf does
+        //for exactly representable ties
+        uint64_t scale_round(double value, int exponent)
+        {
+            //scaling in steps keeps extreme exponents from overflowing
+            while(exponent > 22)
+            {
+                value *= pow10_exact[22];
+                exponent -= 22;
+            }
+            while(exponent < -22)
+            {
+                value /= pow10_exact[22];
+                exponent += 22;
+            }
+
+            double scaled = exponent >= 0 ?
+                value * pow10_exact[exponent] :
+                value / pow10_exact[-exponent];
+
+            double whole = std::floor(scaled);
+            double fraction = scaled - whole;
+            uint64_t rounded = uint64_t(whole);
+            if(fraction > 0.5 || (fraction == 0.5 && rounded % 2 == 1))
+                rounded++;
+            return rounded;
+        }
+    }
+
+    size_t format_general(double value, int digits, char* out)
+    {
+        if(!std::isfinite(value))
+            return size_t(snprintf(out, max_formatted_size, "%g", value));
+
+        char* p = out;
+        if(std::signbit(value))
+        {
+            *p++  = '-';
+            value = -value;
+        }
+        if(value == 0.0)
+        {
+            *p++ = '0';
+            return size_t(p - out);
+        }
+
+        digits = std::min(std::max(digits, 1), 17);
+
+        //mantissa holds exactly 'digits' digits, log10 may be off
+        //by one next to powers of ten and rounding may carry over
+        int exponent = int(std::floor(std::log10(value)));
+        uint64_t mantissa = scale_round(value, digits - 1 - exponent);
+        if(mantissa >= pow10_int[digits])
+            mantissa = scale_round(value, digits - 1 - ++exponent);
+        else if(mantissa < pow10_int[digits - 1])
+            mantissa = scale_round(value, digits - 1 - --exponent);
+        if(mantissa >= pow10_int[digits])
+        {
+            mantissa /= 10;
+            exponent++;
+        }
+
+        char buffer[17];
+        for(int i = digits - 1; i >= 0; i--)
+        {
+            buffer[i] = char('0' + mantissa % 10);
+            mantissa /= 10;
+        }
+
+        //trailing zeros are dropped as with %g
+        int last = digits;
+        while(last > 1 && buffer[last - 1] == '0')
+            last--;
+
+        if(exponent < -4 || exponent >= digits)
+        {
+            *p++ = buffer[0];
+            if(last > 1)
+            {
+                *p++ = '.';
+                p = std::copy(buffer + 1, buffer + last, p);
+            }
+            *p++ = 'e';
+            *p++ = exponent < 0 ? '-' : '+';
+            int abs_exponent = std::abs(exponent);
+            if(abs_exponent >= 100)
+                *p++ = char('0' + abs_exponent / 100);
+            *p++ = char('0' + abs_exponent / 10 % 10);
+            *p++ = char('0' + abs_exponent % 10);
+        }
+        else if(exponent >= 0)
+        {
+            int int_digits = exponent + 1;
+            p = std::copy(buffer, buffer + int_digits, p);
+            if(last > int_digits)
+            {
+                *p++ = '.';
+                p = std::copy(buffer + int_digits, buffer + last, p);
+            }
+        }
+        else
+        {
+            *p++ = '0';
+            *p++ = '.';
+            p = std::fill_n(p, -exponent - 1, '0');
+            p = std::copy(buffer, buffer + last, p);
+        }
+
+        return size_t(p - out);
+    }
+
+    size_t format_unsigned(size_t value, char* out)
+    {
+        char buffer[20];
+        size_t length = 0;
+        do
+        {
+            buffer[length++] = char('0' + value % 10);
+            value /= 10;
+        }
+        while(value > 0);
+
+        std::reverse_copy(buffer, buffer + length, out);
+        return length;
+    }
+}
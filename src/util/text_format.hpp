@@ -0,0 +1,22 @@
+#ifndef NEUROSYNTH_TEXT_FORMAT_HPP
+#define NEUROSYNTH_TEXT_FORMAT_HPP
+
+#include <cstddef>
+
+
+namespace neurosynth
+{
+    //longest output of format_general()
+    constexpr size_t max_formatted_size = 32;
+
+    //writes 'value' with 'digits' (1-17) significant digits in the style
+    //of printf("%.*g") without going through printf/iostreams, beyond
+    //about 10 digits the last one may differ from printf for near-ties
+    //returns number of characters written, output is not terminated
+    size_t format_general(double value, int digits, char* out);
+
+    //writes decimal 'value', returns number of characters written
+    size_t format_unsigned(size_t value, char* out);
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include "thread_pool.hpp"
+
+
+namespace neurosynth
+{
+    size_t resolve_num_threads(size_t num_threads)
+    {
+        if(num_threads == 0)
+            num_threads = std::thread::hardware_concurrency();
+        return std::max<size_t>(num_threads, 1);
+    }
+
+    ThreadPool::ThreadPool(size_t num_threads)
+        : m_pending(0),
+          m_stop(false)
+    {
+        num_threads = resolve_num_threads(num_threads);
+        for(size_t i = 0; i < num_threads; i++)
+            m_workers.emplace_back(&ThreadPool::run, this);
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_task_cv.notify_all();
+
+        for(std::thread& worker : m_workers)
+            worker.join();
+    }
+
+    void ThreadPool::submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(std::move(task));
+            m_pending++;
+        }
+        m_task_cv.notify_one();
+    }
+
+    void ThreadPool::wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done_cv.wait(lock, [this] { return m_pending == 0; });
+    }
+
+    void ThreadPool::run()
+    {
+        while(true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_task_cv.wait(lock, [this] {
+                        return m_stop || !m_tasks.empty();
+                    });
+                if(m_tasks.empty())
+                    return;
+
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+
+            task();
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_pending--;
+            }
+            m_done_cv.notify_all();
+        }
+    }
+}
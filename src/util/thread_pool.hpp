@@ -0,0 +1,49 @@
+#ifndef NEUROSYNTH_THREAD_POOL_HPP
+#define NEUROSYNTH_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace neurosynth
+{
+    //Fixed set of worker threads executing submitted tasks.
+    //wait() blocks until every task submitted so far is finished.
+    class ThreadPool
+    {
+    public:
+        //num_threads == 0 means one thread per hardware thread
+        explicit ThreadPool(size_t num_threads);
+
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        size_t size() const { return m_workers.size(); }
+
+        void submit(std::function<void()> task);
+
+        void wait();
+
+    private:
+        std::vector<std::thread>          m_workers;
+        std::deque<std::function<void()>> m_tasks;
+        std::mutex                        m_mutex;
+        std::condition_variable           m_task_cv;
+        std::condition_variable           m_done_cv;
+        size_t                            m_pending;
+        bool                              m_stop;
+
+        void run();
+    };
+
+    //resolves 0 to the number of hardware threads
+    size_t resolve_num_threads(size_t num_threads);
+}
+
+#endif
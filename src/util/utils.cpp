@@ -1,5 +1,6 @@
 #include "utils.hpp"
 
+#include <iostream>
 #include <unistd.h>
 
 
@@ -18,6 +19,22 @@ namespace std
 
 namespace neurosynth
 {
+    namespace
+    {
+        thread_local bool throw_errors = false;
+    }
+
+    ErrorScope::ErrorScope()
+        : m_previous(throw_errors)
+    {
+        throw_errors = true;
+    }
+
+    ErrorScope::~ErrorScope()
+    {
+        throw_errors = m_previous;
+    }
+
     std::string join(const std::string& delim,
                      const std::vector<std::string>& vec)
     {
@@ -103,6 +120,9 @@ namespace neurosynth
         {
             message += std::string(" - error: ") + strerror(errno);
             logger.err(message);
+            logger.flush();
+            if(throw_errors)
+                throw ProcessingError(message);
             std::cerr << message << "\n";
             std::exit(1);
         }
@@ -112,6 +132,9 @@ namespace neurosynth
                       std::string message)
     {
         logger.err(message);
+        logger.flush();
+        if(throw_errors)
+            throw ProcessingError(message);
         std::cerr << message << "\n";
         std::exit(1);
     }
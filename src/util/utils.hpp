@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <cstdlib>
 #include <errno.h>
+#include <stdexcept>
 #include <string>
 #include <string.h>
 #include <vector>
@@ -37,12 +38,36 @@ namespace neurosynth
                                const std::string& from,
                                const std::string& to);
 
+    //both log 'message' and exit, unless an ErrorScope is alive on
+    //the calling thread, which makes them throw ProcessingError
     void handle_errno(ssize_t result, Logger& logger,
                       std::string message);
 
     void handle_error(Logger& logger,
                       std::string message);
 
+    class ProcessingError : public std::runtime_error
+    {
+    public:
+        explicit ProcessingError(const std::string& message)
+            : std::runtime_error(message) {}
+    };
+
+    //Lets the calling thread recover from errors that would end the
+    //process, e.g. to go on with the next file of a batch. Scopes nest.
+    class ErrorScope
+    {
+    public:
+        ErrorScope();
+        ~ErrorScope();
+
+        ErrorScope(const ErrorScope&) = delete;
+        ErrorScope& operator=(const ErrorScope&) = delete;
+
+    private:
+        bool m_previous;
+    };
+
     std::string get_working_dir();
 
     template<class T>
@@ -0,0 +1,517 @@
+#include "wav_format.hpp"
+#include "stage_stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+
+namespace neurosynth
+{
+    namespace
+    {
+        //largest fmt chunk accepted, WAVE_FORMAT_EXTENSIBLE takes 40
+        constexpr size_t max_fmt_chunk_size = 1024;
+
+        //all RIFF fields are little endian
+        uint32_t read_u32(const char* p)
+        {
+            const unsigned char* u = (const unsigned char*)p;
+            return uint32_t(u[0]) | uint32_t(u[1]) << 8 |
+                uint32_t(u[2]) << 16 | uint32_t(u[3]) << 24;
+        }
+
+        uint16_t read_u16(const char* p)
+        {
+            const unsigned char* u = (const unsigned char*)p;
+            return uint16_t(u[0] | u[1] << 8);
+        }
+
+        char* write_u32(char* p, uint32_t value)
+        {
+            for(size_t i = 0; i < 4; i++)
+                *p++ = char(value >> (8 * i));
+            return p;
+        }
+
+        char* write_u16(char* p, uint16_t value)
+        {
+            *p++ = char(value);
+            *p++ = char(value >> 8);
+            return p;
+        }
+
+        struct ReadU8
+        {
+            double operator()(const char* p) const
+            {
+                return (double((unsigned char)*p) - 128.0) / 128.0;
+            }
+        };
+
+        struct ReadS16
+        {
+            double operator()(const char* p) const
+            {
+                int16_t s;
+                memcpy(&s, p, sizeof(s));
+                return double(s) / double(0x8000);
+            }
+        };
+
+        struct ReadS24
+        {
+            double operator()(const char* p) const
+            {
+                const unsigned char* u = (const unsigned char*)p;
+                int32_t s = int32_t(uint32_t(u[0]) << 8 |
+                                    uint32_t(u[1]) << 16 |
+                                    uint32_t(u[2]) << 24) >> 8;
+                return double(s) / double(0x800000);
+            }
+        };
+
+        struct ReadS32
+        {
+            double operator()(const char* p) const
+            {
+                int32_t s;
+                memcpy(&s, p, sizeof(s));
+                return double(s) / 2147483648.0;
+            }
+        };
+
+        struct ReadF32
+        {
+            double operator()(const char* p) const
+            {
+                float s;
+                memcpy(&s, p, sizeof(s));
+                return double(s);
+            }
+        };
+
+        struct ReadF64
+        {
+            double operator()(const char* p) const
+            {
+                double s;
+                memcpy(&s, p, sizeof(s));
+                return s;
+            }
+        };
+
+        template<class Read, class T>
+        void decode(const char* data,
+                    const WavFormat& format,
+                    size_t num_frames,
+                    T* out_l, T* out_r, size_t out_stride)
+        {
+            Read   read;
+            size_t block  = format.block_align;
+            size_t second = format.channels > 1 ? format.bytes_per_sample() : 0;
+            for(size_t i = 0; i < num_frames; i++)
+            {
+                const char* frame = data + i * block;
+                out_l[i * out_stride] = T(read(frame));
+                out_r[i * out_stride] = T(read(frame + second));
+            }
+        }
+
+        //16-bit mono/stereo without padding, the common case: samples
+        //are contiguous, so conversion (and deinterleaving) vectorizes;
+        //scaling by 2^-15 gives the same values as ReadS16
+        template<class T>
+        void decode_s16(const char* data,
+                        size_t channels,
+                        size_t num_frames,
+                        T* out_l, T* out_r, size_t out_stride)
+        {
+            const int16_t* samples = reinterpret_cast<const int16_t*>(data);
+            const T        scale   = T(1.0 / double(0x8000));
+
+            if(channels == 1)
+            {
+                #pragma omp simd
+                for(size_t i = 0; i < num_frames; i++)
+                {
+                    T s = T(samples[i]) * scale;
+                    out_l[i * out_stride] = s;
+                    out_r[i * out_stride] = s;
+                }
+            }
+            else if(out_stride == 1)
+            {
+                #pragma omp simd
+                for(size_t i = 0; i < num_frames; i++)
+                {
+                    out_l[i] = T(samples[2*i])   * scale;
+                    out_r[i] = T(samples[2*i+1]) * scale;
+                }
+            }
+            else //interleaved output keeps the input order
+            {
+                #pragma omp simd
+                for(size_t i = 0; i < 2 * num_frames; i++)
+                    out_l[i] = T(samples[i]) * scale;
+            }
+        }
+
+        template<class T>
+        void decode_any(const char* data,
+                        const WavFormat& format,
+                        size_t num_frames,
+                        T* out_l, T* out_r, size_t out_stride)
+        {
+            if(format.encoding == SampleEncoding::Float)
+            {
+                if(format.bits_per_sample == 32)
+                    decode<ReadF32>(data, format, num_frames,
+                                    out_l, out_r, out_stride);
+                else
+                    decode<ReadF64>(data, format, num_frames,
+                                    out_l, out_r, out_stride);
+                return;
+            }
+
+            switch(format.bits_per_sample)
+            {
+            case 8:
+                decode<ReadU8>(data, format, num_frames,
+                               out_l, out_r, out_stride);
+                break;
+            case 16:
+                if(format.channels <= 2 &&
+                   format.block_align == 2 * format.channels &&
+                   (out_stride == 1 || out_r == out_l + 1))
+                    decode_s16(data, format.channels, num_frames,
+                               out_l, out_r, out_stride);
+                else
+                    decode<ReadS16>(data, format, num_frames,
+                                    out_l, out_r, out_stride);
+                break;
+            case 24:
+                decode<ReadS24>(data, format, num_frames,
+                                out_l, out_r, out_stride);
+                break;
+            default:
+                decode<ReadS32>(data, format, num_frames,
+                                out_l, out_r, out_stride);
+                break;
+            }
+        }
+
+        //fills format from contents of a 'fmt ' chunk
+        bool parse_fmt_chunk(const char* chunk,
+                             size_t size,
+                             WavFormat& format,
+                             std::string& error)
+        {
+            if(size < 16)
+            {
+                error = "fmt chunk too short";
+                return false;
+            }
+
+            uint16_t tag        = read_u16(chunk);
+            format.channels     = read_u16(chunk + 2);
+            format.sample_rate  = read_u32(chunk + 4);
+            format.block_align  = read_u16(chunk + 12);
+            format.bits_per_sample = read_u16(chunk + 14);
+
+            //WAVE_FORMAT_EXTENSIBLE - real format is in the subformat GUID
+            if(tag == 0xFFFE && size >= 26)
+                tag = read_u16(chunk + 24);
+
+            if(tag == 1)
+                format.encoding = SampleEncoding::Int;
+            else if(tag == 3)
+                format.encoding = SampleEncoding::Float;
+            else
+            {
+                error = "unsupported format tag " + std::to_string(tag);
+                return false;
+            }
+
+            size_t bits = format.bits_per_sample;
+            bool supported = format.encoding == SampleEncoding::Int ?
+                (bits == 8 || bits == 16 || bits == 24 || bits == 32) :
+                (bits == 32 || bits == 64);
+            if(!supported)
+            {
+                error = "unsupported sample size " + std::to_string(bits);
+                return false;
+            }
+
+            if(format.channels == 0 ||
+               format.block_align < format.channels * bits / 8)
+            {
+                error = "invalid channel count or block align";
+                return false;
+            }
+
+            format.has_header = true;
+            return true;
+        }
+    }
+
+    bool is_riff_wave(const char* data, size_t size)
+    {
+        return size >= 12 &&
+            memcmp(data, "RIFF", 4) == 0 &&
+            memcmp(data + 8, "WAVE", 4) == 0;
+    }
+
+    bool parse_wav_header(const char* data,
+                          size_t size,
+                          WavFormat& format,
+                          std::string& error)
+    {
+        if(!is_riff_wave(data, size))
+        {
+            error = "not a RIFF/WAVE file";
+            return false;
+        }
+
+        bool has_fmt = false;
+        size_t pos = 12;
+        while(pos + 8 <= size)
+        {
+            const char* id    = data + pos;
+            size_t      chunk = read_u32(data + pos + 4);
+            pos += 8;
+
+            if(memcmp(id, "fmt ", 4) == 0)
+            {
+                if(!parse_fmt_chunk(data + pos,
+                                    std::min(chunk, size - pos),
+                                    format, error))
+                    return false;
+                has_fmt = true;
+            }
+            else if(memcmp(id, "data", 4) == 0)
+            {
+                if(!has_fmt)
+                {
+                    error = "data chunk before fmt chunk";
+                    return false;
+                }
+                //streamed files often leave the size unset (0 or ~0),
+                //samples then simply run to the end of file
+                format.data_offset = pos;
+                format.data_size   = size - pos;
+                if(chunk != 0 && chunk < format.data_size)
+                    format.data_size = chunk;
+                return true;
+            }
+
+            //chunks are padded to even size
+            pos += chunk + (chunk & 1);
+        }
+
+        error = "no data chunk";
+        return false;
+    }
+
+    template<class T>
+    void decode_frames(const char* data,
+                       const WavFormat& format,
+                       size_t num_frames,
+                       T* out_l,
+                       T* out_r)
+    {
+        decode_any(data, format, num_frames, out_l, out_r, 1);
+    }
+
+    template<class T>
+    void decode_frames_interleaved(const char* data,
+                                   const WavFormat& format,
+                                   size_t num_frames,
+                                   T* out)
+    {
+        decode_any(data, format, num_frames, out, out + 1, 2);
+    }
+
+    std::string describe_format(const WavFormat& format)
+    {
+        if(!format.has_header)
+            return "headerless 16-bit stereo PCM";
+
+        return std::to_string(format.channels) + " channel " +
+            std::to_string(format.bits_per_sample) + "-bit " +
+            (format.encoding == SampleEncoding::Float ? "float" : "PCM") +
+            " at " + std::to_string(format.sample_rate) + "hz";
+    }
+
+    void make_wav_header(const WavFormat& format,
+                         size_t num_frames,
+                         char* out)
+    {
+        uint32_t data_size = uint32_t(num_frames * format.block_align);
+        uint16_t tag = format.encoding == SampleEncoding::Float ? 3 : 1;
+
+        char* p = out;
+        p = std::copy_n("RIFF", 4, p);
+        p = write_u32(p, uint32_t(wav_header_size - 8) + data_size);
+        p = std::copy_n("WAVEfmt ", 8, p);
+        p = write_u32(p, 16);
+        p = write_u16(p, tag);
+        p = write_u16(p, uint16_t(format.channels));
+        p = write_u32(p, uint32_t(format.sample_rate));
+        p = write_u32(p, uint32_t(format.sample_rate * format.block_align));
+        p = write_u16(p, uint16_t(format.block_align));
+        p = write_u16(p, uint16_t(format.bits_per_sample));
+        p = std::copy_n("data", 4, p);
+        write_u32(p, data_size);
+    }
+
+    template<class T>
+    void encode_frames_16(const T* in_l,
+                          const T* in_r,
+                          size_t num_frames,
+                          char* out)
+    {
+        int16_t* samples = reinterpret_cast<int16_t*>(out);
+        const T  scale   = T(0x8000);
+        #pragma omp simd
+        for(size_t i = 0; i < num_frames; i++)
+        {
+            T l = std::nearbyint(in_l[i] * scale);
+            T r = std::nearbyint(in_r[i] * scale);
+            samples[2*i]   = int16_t(std::min(std::max(l, T(-32768)),
+                                              T(32767)));
+            samples[2*i+1] = int16_t(std::min(std::max(r, T(-32768)),
+                                              T(32767)));
+        }
+    }
+
+    WavStreamReader::WavStreamReader(std::istream& stream,
+                                     const std::string& name,
+                                     Logger& logger)
+        : m_stream(stream),
+          m_good(true),
+          m_buffered(0),
+          m_remaining(std::numeric_limits<size_t>::max())
+    {
+        m_good = read_header(logger, name);
+    }
+
+    bool WavStreamReader::read_header(Logger& logger,
+                                      const std::string& name)
+    {
+        char riff[12];
+        m_stream.read(riff, sizeof(riff));
+        size_t got = size_t(m_stream.gcount());
+
+        //no header - bytes already read are the first samples
+        if(!is_riff_wave(riff, got))
+        {
+            m_buffer.assign(riff, riff + got);
+            m_buffered = got;
+            return true;
+        }
+
+        bool has_fmt = false;
+        char chunk_header[8];
+        while(m_stream.read(chunk_header, sizeof(chunk_header)))
+        {
+            size_t chunk = read_u32(chunk_header + 4);
+
+            if(memcmp(chunk_header, "data", 4) == 0)
+            {
+                if(!has_fmt)
+                {
+                    logger.err("Data chunk before fmt chunk in: " + name);
+                    return false;
+                }
+                if(chunk != 0 && chunk != 0xFFFFFFFF)
+                    m_remaining = chunk;
+                return true;
+            }
+
+            //chunks are word aligned, sizes come from the input, so
+            //only the small fmt chunk is ever held in memory
+            size_t padded = chunk + (chunk & 1);
+            if(memcmp(chunk_header, "fmt ", 4) != 0)
+            {
+                m_stream.ignore(std::streamsize(padded));
+                continue;
+            }
+            if(chunk > max_fmt_chunk_size)
+            {
+                logger.err("Cannot parse " + name + ": fmt chunk of " +
+                           std::to_string(chunk) + " bytes");
+                return false;
+            }
+
+            std::vector<char> contents(padded);
+            m_stream.read(contents.data(), contents.size());
+            std::string error;
+            if(!parse_fmt_chunk(contents.data(), chunk, m_format, error))
+            {
+                logger.err("Cannot parse " + name + ": " + error);
+                return false;
+            }
+            has_fmt = true;
+        }
+
+        logger.err("No data chunk in: " + name);
+        return false;
+    }
+
+    template<class T>
+    size_t WavStreamReader::read(T* out, size_t max_frames)
+    {
+        if(!m_good)
+            return 0;
+
+        NEUROSYNTH_STAGE(Read);
+        size_t block = m_format.block_align;
+        size_t want  = std::min(max_frames * block, m_remaining);
+        if(m_buffer.size() < want)
+            m_buffer.resize(want);
+
+        if(want > m_buffered)
+        {
+            m_stream.read(m_buffer.data() + m_buffered, want - m_buffered);
+            m_buffered += size_t(m_stream.gcount());
+        }
+
+        //bytes buffered ahead (the header probe) may hold more frames
+        //than asked for, they stay for the next call
+        size_t num_frames = std::min(m_buffered / block, max_frames);
+        size_t used       = num_frames * block;
+        decode_frames_interleaved(m_buffer.data(), m_format, num_frames, out);
+
+        //keep the rest for the next call
+        std::copy(m_buffer.begin() + used,
+                  m_buffer.begin() + m_buffered,
+                  m_buffer.begin());
+        m_buffered  -= used;
+        m_remaining -= std::min(m_remaining, used);
+        NEUROSYNTH_STAGE_COUNT(Read, num_frames, used);
+        return num_frames;
+    }
+
+    template void decode_frames<double>(const char*, const WavFormat&,
+                                        size_t, double*, double*);
+    template void decode_frames<float>(const char*, const WavFormat&,
+                                       size_t, float*, float*);
+
+    template void decode_frames_interleaved<double>(const char*,
+                                                    const WavFormat&,
+                                                    size_t, double*);
+    template void decode_frames_interleaved<float>(const char*,
+                                                   const WavFormat&,
+                                                   size_t, float*);
+
+    template void encode_frames_16<double>(const double*, const double*,
+                                           size_t, char*);
+    template void encode_frames_16<float>(const float*, const float*,
+                                          size_t, char*);
+
+    template size_t WavStreamReader::read<double>(double*, size_t);
+    template size_t WavStreamReader::read<float>(float*, size_t);
+}
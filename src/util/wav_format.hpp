@@ -0,0 +1,124 @@
+#ifndef NEUROSYNTH_WAV_FORMAT_HPP
+#define NEUROSYNTH_WAV_FORMAT_HPP
+
+#include "logger.hpp"
+
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+
+namespace neurosynth
+{
+    enum class SampleEncoding
+    {
+        Int,  //PCM, unsigned for 8 bits, signed otherwise
+        Float //IEEE float
+    };
+
+    //Layout of sample data. Defaults describe headerless
+    //16-bit interleaved stereo PCM, the original wav2stf input.
+    struct WavFormat
+    {
+        bool           has_header      = false;
+        SampleEncoding encoding        = SampleEncoding::Int;
+        size_t         channels        = 2;
+        size_t         bits_per_sample = 16;
+        size_t         block_align     = 4;   //bytes per frame
+        size_t         sample_rate     = 0;   //0 - not known from input
+        size_t         data_offset     = 0;   //bytes before samples
+        size_t         data_size       = 0;   //bytes of samples
+
+        size_t bytes_per_sample() const { return bits_per_sample / 8; }
+    };
+
+    //true if 'data' starts with a RIFF/WAVE header
+    bool is_riff_wave(const char* data, size_t size);
+
+    //walks RIFF chunks of an in-memory file up to the 'data' chunk
+    //returns false and sets 'error' for unsupported/corrupt files
+    bool parse_wav_header(const char* data,
+                          size_t size,
+                          WavFormat& format,
+                          std::string& error);
+
+    //converts 'num_frames' frames of raw sample data to planar L/R
+    //mono is duplicated into both channels,
+    //channels beyond the second one are ignored
+    template<class T>
+    void decode_frames(const char* data,
+                       const WavFormat& format,
+                       size_t num_frames,
+                       T* out_l,
+                       T* out_r);
+
+    //same as decode_frames(), but output is interleaved L/R
+    template<class T>
+    void decode_frames_interleaved(const char* data,
+                                   const WavFormat& format,
+                                   size_t num_frames,
+                                   T* out);
+
+    std::string describe_format(const WavFormat& format);
+
+    //size of the header written by make_wav_header()
+    constexpr size_t wav_header_size = 44;
+
+    //16-bit stereo frames that fit in a RIFF/WAVE file (32-bit sizes)
+    constexpr size_t wav_max_frames_16 = (0xffffffffu - wav_header_size) / 4;
+
+    //canonical RIFF/WAVE header (fmt and data chunk only) for
+    //'num_frames' frames of 'format'
+    void make_wav_header(const WavFormat& format,
+                         size_t num_frames,
+                         char* out);
+
+    //converts planar L/R samples to interleaved 16-bit stereo PCM,
+    //rounded to nearest and clipped to the 16-bit range
+    template<class T>
+    void encode_frames_16(const T* in_l,
+                          const T* in_r,
+                          size_t num_frames,
+                          char* out);
+
+    //Sequential reader for inputs that can't be mapped (stdin, pipes).
+    //Parses RIFF/WAVE header if there is one, otherwise treats the
+    //stream as headerless 16-bit stereo PCM.
+    class WavStreamReader
+    {
+    public:
+        WavStreamReader(std::istream& stream,
+                        const std::string& name,
+                        Logger& logger);
+
+        //false if header was present but couldn't be parsed
+        bool good() const { return m_good; }
+
+        const WavFormat& format() const { return m_format; }
+
+        //frames left in the data chunk, 0 if its size is not known
+        size_t frames_left() const
+        {
+            return m_remaining == std::numeric_limits<size_t>::max() ? 0 :
+                m_remaining / m_format.block_align;
+        }
+
+        //reads up to 'max_frames' frames as interleaved L/R samples
+        //returns number of frames read, 0 at the end of data
+        template<class T>
+        size_t read(T* out, size_t max_frames);
+
+    private:
+        std::istream&     m_stream;
+        WavFormat         m_format;
+        bool              m_good;
+        std::vector<char> m_buffer;
+        size_t            m_buffered;  //bytes carried over in m_buffer
+        size_t            m_remaining; //bytes of data chunk left
+
+        bool read_header(Logger& logger, const std::string& name);
+    };
+}
+
+#endif
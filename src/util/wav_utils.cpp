@@ -1,11 +1,75 @@
 #include "wav_utils.hpp"
-
-#include <cassert>
+#include "block_writer.hpp"
+#include "features.hpp"
+#include "frame_analyzer.hpp"
+#include "mapped_file.hpp"
+#include "resampler.hpp"
+#include "stage_stats.hpp"
+#include "stft_file.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+#include "wav_format.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <vector>
 
 
 namespace neurosynth
 {
+    size_t stft_fft_size(const StftParams& params)
+    {
+        if(params.fft_size == 0)
+            return fast_fft_size(params.window_size);
+        return std::max(params.fft_size, params.window_size);
+    }
+
+    std::string stft_output_name(StftOutput output)
+    {
+        switch(output)
+        {
+        case StftOutput::Binary:
+            return "binary";
+        case StftOutput::Text:
+            return "text";
+        case StftOutput::Csv:
+            return "csv";
+        }
+        return "unknown";
+    }
+
+    bool parse_stft_encoding(const std::string& name,
+                             StftEncoding& encoding)
+    {
+        if(name == "native")
+            encoding = StftEncoding::Native;
+        else if(name == "float16")
+            encoding = StftEncoding::Float16;
+        else if(name == "uint8")
+            encoding = StftEncoding::UInt8;
+        else if(name == "uint8-frame")
+            encoding = StftEncoding::UInt8Frame;
+        else
+            return false;
+        return true;
+    }
+
+    std::string stft_encoding_name(StftEncoding encoding)
+    {
+        switch(encoding)
+        {
+        case StftEncoding::Native:
+            return "native";
+        case StftEncoding::Float16:
+            return "float16";
+        case StftEncoding::UInt8:
+            return "uint8";
+        case StftEncoding::UInt8Frame:
+            return "uint8-frame";
+        }
+        return "unknown";
+    }
 
     double freq2mel(double s)
     {
@@ -27,304 +91,704 @@ namespace neurosynth
         return short(s * double(0x8000));
     }
 
-    void load_wav(std::string& filename,
-                  WavData& wav_data,
+    template<class T>
+    bool load_wav(std::string& filename,
+                  WavData<T>& wav_data,
                   Logger& logger)
     {
-        std::streambuf* buf;
-        std::ifstream ifstream;
+        wav_data.samples_l.clear();
+        wav_data.samples_r.clear();
+        wav_data.sample_rate = 0;
 
+        WavFormat format;
         if(filename == "-")
-            buf = std::cin.rdbuf();
+        {
+            WavStreamReader reader(std::cin, filename, logger);
+            if(!reader.good())
+                handle_error(logger, "Cannot read wav header from: " +
+                             filename);
+            format = reader.format();
+
+            //the data chunk usually tells the size up front
+            size_t expected = reader.frames_left();
+            wav_data.samples_l.reserve(expected);
+            wav_data.samples_r.reserve(expected);
+
+            constexpr size_t block_size = 1 << 16;
+            std::vector<T> block(2 * block_size);
+            size_t num_read;
+            while((num_read = reader.read(block.data(), block_size)) > 0)
+            {
+                size_t offset = wav_data.samples_l.size();
+                wav_data.samples_l.resize(offset + num_read);
+                wav_data.samples_r.resize(offset + num_read);
+
+                T* out_l = &wav_data.samples_l[offset];
+                T* out_r = &wav_data.samples_r[offset];
+                #pragma omp simd
+                for(size_t i = 0; i < num_read; i++)
+                {
+                    out_l[i] = block[2*i];
+                    out_r[i] = block[2*i+1];
+                }
+            }
+        }
         else
         {
-            ifstream.open(filename, std::ios::binary);
-            buf = ifstream.rdbuf();
+            NEUROSYNTH_STAGE(Read);
+            MappedFile file;
+            if(!file.open(filename, logger))
+                return false;
+
+            if(is_riff_wave(file.data(), file.size()))
+            {
+                std::string error;
+                if(!parse_wav_header(file.data(), file.size(), format, error))
+                    handle_error(logger, "Cannot parse " + filename +
+                                 ": " + error);
+            }
+            else
+                format.data_size = file.size();
+
+            //samples are converted straight out of the mapping
+            size_t num_frames = format.data_size / format.block_align;
+            wav_data.samples_l.resize(num_frames);
+            wav_data.samples_r.resize(num_frames);
+            decode_frames(file.data() + format.data_offset, format,
+                          num_frames,
+                          wav_data.samples_l.data(),
+                          wav_data.samples_r.data());
+            NEUROSYNTH_STAGE_COUNT(Read, num_frames, format.data_size);
         }
 
-        std::istream stream(buf);
-        if(!stream)
-            logger.warn("Cannot open file: " + filename);
+        wav_data.sample_rate = format.sample_rate;
 
-        wav_data.samples_l.clear();
-        wav_data.samples_r.clear();
+        logger.info("Read " + std::to_string(wav_data.samples_l.size()) +
+                    "/" + std::to_string(wav_data.samples_r.size()) +
+                    " samples for L/R channel (" + describe_format(format) +
+                    ") from: " + filename);
+        return true;
+    }
+
+    template<class T>
+    bool save_wav(std::string& filename,
+                  WavData<T>& wav_data,
+                  Logger& logger)
+    {
+        int fd = open_output(filename, logger);
+        if(fd == -1)
+            return false;
+
+        WavFormat format;
+        format.has_header  = true;
+        format.sample_rate = wav_data.sample_rate;
+        size_t num_frames  = std::min(wav_data.samples_l.size(),
+                                      wav_data.samples_r.size());
+
+        bool good;
+        {
+            BlockWriter writer(fd);
+            char header[wav_header_size];
+            make_wav_header(format, num_frames, header);
+            writer.write(header, sizeof(header));
+
+            constexpr size_t block_size = 1 << 16;
+            std::vector<char> block(block_size * format.block_align);
+            for(size_t first = 0; first < num_frames; first += block_size)
+            {
+                size_t count = std::min(block_size, num_frames - first);
+                encode_frames_16(&wav_data.samples_l[first],
+                                 &wav_data.samples_r[first],
+                                 count, block.data());
+                writer.write(block.data(), count * format.block_align);
+            }
+            writer.flush();
+            good = writer.good();
+        }
+        close_output(fd);
 
-        short sample_l, sample_r;
-        while(true) {
-            stream.read((char*)&sample_l, sizeof(short));
-            stream.read((char*)&sample_r, sizeof(short));
-            if(!stream)
-                break;
-            wav_data.samples_l.push_back(int2double_16(sample_l));
-            wav_data.samples_r.push_back(int2double_16(sample_r));
+        if(!good)
+        {
+            logger.warn("Cannot write wav file: " + filename);
+            return false;
         }
 
-        logger.info("Read " + std::to_string(wav_data.samples_l.size()) +
-                    "/" + std::to_string(wav_data.samples_r.size()) +
-                    " samples for L/R channel from: " + filename);
+        logger.info("Written " + std::to_string(num_frames) +
+                    " samples for L/R channel (" + describe_format(format) +
+                    ") to: " + filename);
+        return true;
     }
 
-    void dft(WavData& wav_data,
-             DftData& dft_data,
+    template<class T>
+    void dft(WavData<T>& wav_data,
+             DftData<T>& dft_data,
+             FftPlanCache& plan_cache,
              Logger& logger)
     {
-        int input_size  = wav_data.samples_l.size();
-        int output_size = input_size/2 + 1;
+        size_t input_size  = wav_data.samples_l.size();
+        size_t output_size = input_size/2 + 1;
 
         dft_data.spectrum_l.resize(output_size);
         dft_data.spectrum_r.resize(output_size);
 
-        fftw_plan plan = fftw_plan_dft_r2c_1d
-            (input_size,
-             wav_data.samples_l.data(),
-             reinterpret_cast<fftw_complex*>(dft_data.spectrum_l.data()),
-             FFTW_ESTIMATE);
-
-        fftw_execute(plan);
-        fftw_destroy_plan(plan);
+        T*               in_l  = wav_data.samples_l.data();
+        T*               in_r  = wav_data.samples_r.data();
+        std::complex<T>* out_l = dft_data.spectrum_l.data();
+        std::complex<T>* out_r = dft_data.spectrum_r.data();
 
-        plan = fftw_plan_dft_r2c_1d
-            (input_size,
-             wav_data.samples_r.data(),
-             reinterpret_cast<fftw_complex*>(dft_data.spectrum_r.data()),
-             FFTW_ESTIMATE);
+        //both channels go through the same plan,
+        //so it has to fit the alignment of all four arrays
+        bool aligned = is_fft_aligned(in_l) && is_fft_aligned(in_r) &&
+            is_fft_aligned((T*)out_l) && is_fft_aligned((T*)out_r);
 
-        fftw_execute(plan);
-        fftw_destroy_plan(plan);
-    }
+        typename Fftw<T>::plan plan = plan_cache.r2c<T>(input_size, aligned);
+        if(!plan)
+            handle_error(logger, "Cannot perform dft of size " +
+                         std::to_string(input_size));
 
-    double triangular_window(double n, double N)
-    {
-        return 1.0 - std::abs((n-(N-1)/2) /
-                              (N / 2));
+        Fftw<T>::execute_r2c(plan, in_l, out_l);
+        Fftw<T>::execute_r2c(plan, in_r, out_r);
     }
 
-    double hann_window(double n, double N)
+    template<class T>
+    void stft(WavData<T>& wav_data,
+              StftData<T>& stft_data,
+              const StftParams& params,
+              StftCache& cache,
+              Logger& logger,
+              std::vector<StftStream<T>>* streams)
     {
-        constexpr double pi = M_PI;
-        return 0.5 * (1.0 - cos(2.0*pi*n/(N-1)));
-    }
+        size_t window_size = params.window_size;
+        size_t window_step = params.window_step;
 
-    void compute_spectral_energy(DftData& dft_data,
-                                 double min_freq,
-                                 double max_freq,
-                                 double sample_rate,
-                                 double& energy_l,
-                                 double& energy_r)
-    {
-        size_t N = dft_data.spectrum_l.size();
-        size_t min_frame = size_t(min_freq * 2.0 / sample_rate * N);
-        size_t max_frame = size_t(max_freq * 2.0 / sample_rate * N);
-        N = max_frame - min_frame;
-
-        energy_l = 0.0;
-        energy_r = 0.0;
-        for(size_t frame = min_frame; frame < max_frame; frame++)
+        logger.info("Performing STFT with parameters: "
+                    "Window size: " + std::to_string(window_size) +
+                    " frames = " + std::to_string(window_size /
+                                                  params.sample_rate *
+                                                  1000.0) +
+                    " ms; fft size: " + std::to_string(stft_fft_size(params)) +
+                    "; sample rate: " + std::to_string(params.sample_rate) +
+                    "; frequency range: " + std::to_string(params.min_freq) +
+                    "hz - " + std::to_string(params.max_freq) +
+                    "hz; # coefficients: " + std::to_string(params.num_coeff) +
+                    "; batch size: " + std::to_string(params.batch_size) +
+                    "; filters: " + filter_shape_name(params.filter_shape) +
+                    "; window: " + window_type_name(params.window_type) +
+                    "; threads: " + std::to_string(params.num_threads));
+
+        size_t input_size = wav_data.samples_l.size();
+        size_t num_frames = 0;
+        if(input_size >= window_size)
+            num_frames = (input_size - window_size) / window_step + 1;
+
+        //every frame gets its slot up front, so threads can write
+        //results in place and frame order doesn't depend on scheduling
+        if(stft_data.empty())
+            stft_data.reset(params.num_coeff, params.min_freq, params.max_freq);
+        else if(stft_data.num_coeff() != params.num_coeff ||
+                stft_data.min_freq() != params.min_freq ||
+                stft_data.max_freq() != params.max_freq)
+            handle_error(logger, "Cannot append stft frames with "
+                         "different band parameters");
+
+        size_t offset = stft_data.num_frames();
+        stft_data.resize(offset + num_frames);
+
+        //mfcc and chroma are written in place like the energies,
+        //deltas follow once all frames are known
+        std::vector<StftStreamInfo> infos;
+        if(streams)
+            infos = feature_streams(params);
+        if(streams && streams->size() != infos.size())
+        {
+            streams->clear();
+            for(const StftStreamInfo& info : infos)
+            {
+                streams->push_back({info.name, StftData<T>()});
+                streams->back().data.reset(info.num_coeff, params.min_freq,
+                                           params.max_freq);
+            }
+        }
+        StftData<T>* mfcc   = nullptr;
+        StftData<T>* chroma = nullptr;
+        for(size_t s = 0; s < infos.size(); s++)
         {
-            double window = triangular_window(frame - min_frame, N);
-            double mag_coeff_l = std::abs(dft_data.spectrum_l[frame]);
-            double mag_coeff_r = std::abs(dft_data.spectrum_r[frame]);
-            energy_l += mag_coeff_l * mag_coeff_l * window;
-            energy_r += mag_coeff_r * mag_coeff_r * window;
+            if(infos[s].name == "mfcc")
+                mfcc = &(*streams)[s].data;
+            else if(infos[s].name == "chroma")
+                chroma = &(*streams)[s].data;
+            (*streams)[s].data.resize(offset + num_frames);
         }
 
-        energy_l = log(1.0 + energy_l);
-        energy_r = log(1.0 + energy_r);
-    }
+        size_t batch_size  = std::max<size_t>(params.batch_size, 1);
+        size_t num_batches = (num_frames + batch_size - 1) / batch_size;
+        std::atomic<size_t> next_batch(0);
 
-    void dft2stft(DftData& dft_data,
-                  StftData& stft_data,
-                  size_t num_coeff,
-                  double min_freq,
-                  double max_freq,
-                  double sample_rate)
+        auto worker = [&]()
+        {
+            FrameAnalyzer<T> analyzer(params, cache, logger);
+            size_t num_coeff  = analyzer.num_coeff();
+            size_t num_mfcc   = analyzer.num_mfcc();
+            size_t num_chroma = analyzer.num_chroma();
 
-    {
-        FreqVector<double> freq_vec_l(min_freq, max_freq);
-        FreqVector<double> freq_vec_r(min_freq, max_freq);
+            size_t b;
+            while((b = next_batch++) < num_batches)
+            {
+                size_t first = b * batch_size;
+                size_t count = std::min(batch_size, num_frames - first);
+
+                for(size_t i = 0; i < count; i++)
+                {
+                    size_t t = (first + i) * window_step;
+                    analyzer.load_frame(i,
+                                        &wav_data.samples_l[t],
+                                        &wav_data.samples_r[t]);
+                }
+
+                analyzer.analyze(count);
+
+                for(size_t i = 0; i < count; i++)
+                {
+                    const T* energies_l = analyzer.energies_l(i);
+                    const T* energies_r = analyzer.energies_r(i);
+                    std::copy(energies_l, energies_l + num_coeff,
+                              stft_data.row_l(offset + first + i));
+                    std::copy(energies_r, energies_r + num_coeff,
+                              stft_data.row_r(offset + first + i));
+
+                    size_t t = offset + first + i;
+                    if(mfcc)
+                    {
+                        std::copy(analyzer.mfcc_l(i),
+                                  analyzer.mfcc_l(i) + num_mfcc,
+                                  mfcc->row_l(t));
+                        std::copy(analyzer.mfcc_r(i),
+                                  analyzer.mfcc_r(i) + num_mfcc,
+                                  mfcc->row_r(t));
+                    }
+                    if(chroma)
+                    {
+                        std::copy(analyzer.chroma_l(i),
+                                  analyzer.chroma_l(i) + num_chroma,
+                                  chroma->row_l(t));
+                        std::copy(analyzer.chroma_r(i),
+                                  analyzer.chroma_r(i) + num_chroma,
+                                  chroma->row_r(t));
+                    }
+                }
+            }
+        };
 
-        for(size_t i = 0; i < num_coeff; i++)
+        size_t num_threads = std::min(resolve_num_threads(params.num_threads),
+                                      num_batches);
+        if(num_threads <= 1)
+            worker();
+        else
         {
-            double window_min_freq = mel2freq
-                (freq2mel(min_freq) +
-                 (freq2mel(max_freq) - freq2mel(min_freq)) * i / num_coeff);
-            double window_max_freq = mel2freq
-                (freq2mel(min_freq) +
-                 (freq2mel(max_freq) - freq2mel(min_freq)) * (i+1) / num_coeff);
-
-            double energy_l, energy_r;
-            compute_spectral_energy(dft_data,
-                                    window_min_freq,
-                                    window_max_freq,
-                                    sample_rate,
-                                    energy_l,
-                                    energy_r);
-            freq_vec_l.power.push_back(energy_l);
-            freq_vec_r.power.push_back(energy_r);
+            ThreadPool pool(num_threads);
+            for(size_t i = 0; i < pool.size(); i++)
+                pool.submit(worker);
+            pool.wait();
         }
 
-        stft_data.spectrum_l.emplace_back(std::move(freq_vec_l));
-        stft_data.spectrum_r.emplace_back(std::move(freq_vec_r));
+        //mfcc_delta follows mfcc, mfcc_delta2 mfcc_delta
+        for(size_t s = 1; s < infos.size(); s++)
+            if(infos[s].name == "mfcc_delta" ||
+               infos[s].name == "mfcc_delta2")
+                compute_deltas((*streams)[s - 1].data, (*streams)[s].data,
+                               params.delta_width);
     }
 
-    void stft(WavData& wav_data,
-              StftData& stft_data,
-              size_t window_size,
-              size_t window_step,
-              size_t num_coeff,
-              double min_freq,
-              double max_freq,
-              double sample_rate,
-              Logger& logger)
+    namespace
     {
-        logger.info("Performing STFT with parameters: "
-                    "Window size: " + std::to_string(window_size) +
-                    " frames = " + std::to_string(window_size /
-                                                  sample_rate * 1000.0) +
-                    " ms; sample rate: " + std::to_string(sample_rate) +
-                    "; frequency range: " + std::to_string(min_freq) +
-                    "hz - " + std::to_string(max_freq) +
-                    "hz; # coefficients: " + std::to_string(num_coeff));
+        //features written before the stft container: size_t num_coeff,
+        //double min_freq, double max_freq, then for every frame
+        //num_coeff pairs of L/R doubles (native endianness). Files of the
+        //float32 pipeline have a size_t value_size (4 or 8) before the
+        //values; as the bits of a first double it would be a power of
+        //~1e-323, so the two layouts can't be confused.
+        template<class T>
+        bool load_legacy_stft(const char* data,
+                              size_t size,
+                              const std::string& filename,
+                              StftData<T>& stft_data,
+                              Logger& logger)
+        {
+            size_t num_coeff;
+            double min_freq;
+            double max_freq;
+            size_t value_size = sizeof(double);
+            size_t header_size = sizeof(num_coeff) + sizeof(min_freq) +
+                sizeof(max_freq);
+
+            if(size < header_size)
+            {
+                logger.warn("Invalid stft header in: " + filename);
+                return false;
+            }
 
-        int input_size  = wav_data.samples_l.size();
+            memcpy(&num_coeff, data, sizeof(num_coeff));
+            memcpy(&min_freq, data + 8, sizeof(min_freq));
+            memcpy(&max_freq, data + 16, sizeof(max_freq));
 
-        WavData window_data;
-        window_data.samples_l.resize(window_size);
-        window_data.samples_r.resize(window_size);
+            size_t sized_value;
+            if(size >= header_size + sizeof(sized_value))
+            {
+                memcpy(&sized_value, data + header_size,
+                       sizeof(sized_value));
+                if(sized_value == sizeof(double) ||
+                   sized_value == sizeof(float))
+                {
+                    value_size = sized_value;
+                    header_size += sizeof(sized_value);
+                }
+            }
 
-        for(size_t t = 0; t <= input_size - window_size; t += window_step)
-        {
-            for(size_t dt = 0; dt < window_size; dt++)
+            if(num_coeff == 0 || num_coeff > stft_file_max_window)
+            {
+                logger.warn("Invalid stft header in: " + filename);
+                return false;
+            }
+
+            //one frame of interleaved L/R values as stored on disk
+            size_t frame_size = 2 * num_coeff * value_size;
+            size_t num_frames = (size - header_size) / frame_size;
+
+            stft_data.reset(num_coeff, min_freq, max_freq);
+            stft_data.resize(num_frames);
+
+            for(size_t t = 0; t < num_frames; t++)
             {
-                double window = hann_window(dt, window_size);
-                window_data.samples_l[dt] = wav_data.samples_l[t+dt] * window;
-                window_data.samples_r[dt] = wav_data.samples_r[t+dt] * window;
+                const char* frame = data + header_size + t * frame_size;
+                T* row_l = stft_data.row_l(t);
+                T* row_r = stft_data.row_r(t);
+                for(size_t c = 0; c < num_coeff; c++)
+                {
+                    if(value_size == sizeof(double))
+                    {
+                        const double* values = (const double*)frame;
+                        row_l[c] = T(values[2*c]);
+                        row_r[c] = T(values[2*c+1]);
+                    }
+                    else
+                    {
+                        const float* values = (const float*)frame;
+                        row_l[c] = T(values[2*c]);
+                        row_r[c] = T(values[2*c+1]);
+                    }
+                }
             }
 
-            DftData dft_data;
-            dft(window_data, dft_data, logger);
-            dft2stft(dft_data, stft_data,
-                     num_coeff, min_freq, max_freq, sample_rate);
+            logger.info("Read " + std::to_string(num_frames) +
+                        " features for L/R channel (" +
+                        std::to_string(num_coeff) + " dimensions, " +
+                        std::to_string(value_size) +
+                        " byte values, legacy format) from: " + filename);
+            return true;
         }
     }
 
+    template<class T>
     void load_stft(std::string& filename,
-                   StftData& stft_data,
+                   StftData<T>& stft_data,
                    Logger& logger)
     {
-        std::streambuf* buf;
-        std::ifstream ifstream;
+        StftParams params;
+        load_stft(filename, stft_data, params, logger);
+    }
 
-        if(filename == "-")
-            buf = std::cin.rdbuf();
-        else
+    template<class T>
+    bool load_stft(std::string& filename,
+                   StftData<T>& stft_data,
+                   StftParams& params,
+                   Logger& logger)
+    {
+        StftFile file;
+        if(!file.open(filename, logger, true))
+            return false;
+
+        if(!file.is_container())
         {
-            ifstream.open(filename, std::ios::binary);
-            buf = ifstream.rdbuf();
+            if(!load_legacy_stft(file.data(), file.size(), filename,
+                                 stft_data, logger))
+                return false;
+            params = StftParams();
+            params.num_coeff = stft_data.num_coeff();
+            params.min_freq  = stft_data.min_freq();
+            params.max_freq  = stft_data.max_freq();
+            return true;
         }
 
-        std::istream stream(buf);
-        if(!stream)
-            logger.warn("Cannot open file: " + filename);
-
-        size_t num_coeff;
-        double min_freq;
-        double max_freq;
-        stream.read((char*)&num_coeff, sizeof(num_coeff));
-        stream.read((char*)&min_freq, sizeof(min_freq));
-        stream.read((char*)&max_freq, sizeof(max_freq));
-
-        while(true) {
-            stft_data.spectrum_l.emplace_back();
-            stft_data.spectrum_r.emplace_back();
-            FreqVector<double>& freq_vec_l = stft_data.spectrum_l.back();
-            FreqVector<double>& freq_vec_r = stft_data.spectrum_r.back();
-            freq_vec_l.min_freq = min_freq;
-            freq_vec_l.max_freq = max_freq;
-            freq_vec_r.min_freq = min_freq;
-            freq_vec_r.max_freq = max_freq;
-            for(size_t c = 0; c < num_coeff; c++)
-            {
-                freq_vec_l.power.push_back(0);
-                freq_vec_r.power.push_back(0);
-                stream.read((char*)&freq_vec_l.power[c], sizeof(double));
-                stream.read((char*)&freq_vec_r.power[c], sizeof(double));
-            }
+        if(file.num_channels() != 2)
+        {
+            logger.warn("Expected L/R features, found " +
+                        std::to_string(file.num_channels()) +
+                        " channels in: " + filename);
+            return false;
         }
 
-        logger.info("Read " + std::to_string(stft_data.spectrum_l.size()) +
-                    "/" + std::to_string(stft_data.spectrum_r.size()) +
-                    " features for L/R channel(" + std::to_string(num_coeff) +
-                    "dimensions, " + std::to_string(min_freq) +
-                    " - " + std::to_string(min_freq) +
-                    "frequency range) from: " + filename);
+        params = file.params();
+        size_t num_frames = file.num_frames();
+        stft_data.reset(file.num_coeff(),
+                        file.header().min_freq,
+                        file.header().max_freq);
+        stft_data.resize(num_frames);
+
+        for(size_t c = 0; c < 2; c++)
+        {
+            if(stft_data.layout() == ChannelLayout::Planar)
+                file.read_rows(c, 0, num_frames, stft_data.data(c));
+            else
+                for(size_t t = 0; t < num_frames; t++)
+                    file.read_rows(c, t, 1, stft_data.row(c, t));
+        }
+
+        logger.info("Read " + std::to_string(num_frames) +
+                    " features for L/R channel (" +
+                    std::to_string(file.num_coeff()) + " dimensions, " +
+                    std::to_string(file.header().min_freq) + " - " +
+                    std::to_string(file.header().max_freq) +
+                    "hz, " + dtype_name(file.dtype()) +
+                    ") from: " + filename);
+        return true;
     }
 
-    void save_stft(std::string& filename,
-                   StftData& stft_data,
-                   Logger& logger)
+    template<class T>
+    bool save_stft(std::string& filename,
+                   StftData<T>& stft_data,
+                   const StftParams& params,
+                   Logger& logger,
+                   StftOutput output,
+                   StftEncoding encoding,
+                   const std::vector<StftStream<T>>& streams)
     {
-        std::streambuf* buf;
-        std::ofstream ofstream;
+        if(stft_data.empty())
+            logger.warn("Attempted to write 0 feats to: " + filename);
 
-        if(filename == "-")
-            buf = std::cout.rdbuf();
+        size_t num_coeff = stft_data.num_coeff();
+        double min_freq = stft_data.min_freq();
+        double max_freq = stft_data.max_freq();
+
+        StftParams file_params = params;
+        file_params.num_coeff = num_coeff;
+        file_params.min_freq  = min_freq;
+        file_params.max_freq  = max_freq;
+
+        bool good;
+        if(output == StftOutput::Binary)
+            good = write_stft_file(filename, stft_data, file_params,
+                                   logger, encoding, streams);
         else
         {
-            ofstream.open(filename, std::ios::binary);
-            buf = ofstream.rdbuf();
+            if(!streams.empty())
+                logger.warn("Feature streams need binary output, dropping "
+                            "them from: " + filename);
+            StftWriter<T> writer(filename, logger, output);
+            writer.write_header(file_params, num_coeff);
+            for(size_t t = 0; t < stft_data.num_frames(); t++)
+                writer.write_frame(stft_data.row_l(t), stft_data.row_r(t));
+            good = writer.close();
         }
+        if(!good)
+            return false;
 
-        std::ostream stream(buf);
-        if(!stream)
-            logger.warn("Cannot open file: " + filename);
+        logger.info("Written " + std::to_string(stft_data.num_frames()) +
+                    "/" + std::to_string(stft_data.num_frames()) +
+                    " features for L/R channel (" + std::to_string(num_coeff) +
+                    "dimensions, " + std::to_string(min_freq) +
+                    " - " + std::to_string(min_freq) +
+                    "frequency range, " + stft_output_name(output) +
+                    ") to: " + filename);
+        return true;
+    }
 
-        assert(stft_data.spectrum_l.size() == stft_data.spectrum_r.size());
+    template<class T>
+    bool stream_stft(std::string& input_fn,
+                     std::string& output_fn,
+                     const StftParams& params,
+                     StftCache& cache,
+                     Logger& logger,
+                     StftOutput output,
+                     StftEncoding encoding)
+    {
+        std::streambuf* buf;
+        std::ifstream ifstream;
 
-        if(stft_data.spectrum_l.empty())
+        if(input_fn == "-")
+            buf = std::cin.rdbuf();
+        else
         {
-            logger.warn("Attempted to write 0 feats to: " + filename);
-            return;
+            ifstream.open(input_fn, std::ios::binary);
+            buf = ifstream.rdbuf();
         }
 
-        size_t num_coeff = stft_data.spectrum_l[0].power.size();
-        double min_freq = stft_data.spectrum_l[0].min_freq;
-        double max_freq = stft_data.spectrum_l[0].max_freq;
-        stream.write((char*)&num_coeff, sizeof(num_coeff));
-        stream.write((char*)&min_freq, sizeof(min_freq));
-        stream.write((char*)&max_freq, sizeof(max_freq));
-
-        std::cout << num_coeff << '\n';
-        std::cout << min_freq << '\n';
-        std::cout << max_freq << '\n';
-
-        for(size_t t = 0; t < stft_data.spectrum_l.size(); t++)
+        std::istream stream(buf);
+        if(!stream || (input_fn != "-" && !ifstream.is_open()))
+            logger.warn("Cannot open file: " + input_fn);
+
+        WavStreamReader reader(stream, input_fn, logger);
+        if(!reader.good())
+            handle_error(logger, "Cannot read wav header from: " + input_fn);
+
+        //sample rate stored in the header overrides the configured one,
+        //the analysis may run at another (see analysis_params())
+        double input_rate = params.sample_rate;
+        if(reader.format().sample_rate != 0)
+            input_rate = double(reader.format().sample_rate);
+        StftParams stream_params = analysis_params(params, input_rate);
+        ResamplingReader<T> input(reader, input_rate,
+                                  stream_params.sample_rate, params.max_freq);
+
+        size_t window_size = stream_params.window_size;
+        size_t window_step = stream_params.window_step;
+
+        logger.info("Streaming STFT with parameters: "
+                    "Window size: " + std::to_string(window_size) +
+                    "; fft size: " +
+                    std::to_string(stft_fft_size(stream_params)) +
+                    "; window step: " + std::to_string(window_step) +
+                    "; sample rate: " +
+                    std::to_string(stream_params.sample_rate) +
+                    "; # coefficients: " + std::to_string(params.num_coeff) +
+                    "; batch size: " + std::to_string(params.batch_size) +
+                    "; input: " + describe_format(reader.format()));
+
+        FrameAnalyzer<T> analyzer(stream_params, cache, logger);
+        size_t batch_size = analyzer.batch_size();
+        size_t num_coeff  = analyzer.num_coeff();
+
+        StftWriter<T> writer(output_fn, logger, output, encoding);
+        writer.write_header(stream_params, num_coeff,
+                            feature_streams(stream_params));
+        FeatureStreamWriter<T> streams(writer, stream_params);
+
+        //one read brings in samples for (at most) one batch of frames,
+        //so --batch also bounds the latency of the stream
+        size_t block_size = batch_size * window_step;
+
+        //interleaved L/R samples starting at the next frame to emit;
+        //after emitting, everything but the overlap with the next
+        //frame is dropped, so fewer than window_size samples wait for
+        //the next read and it never holds more than
+        //window_size - 1 + block_size samples. With a hop larger than
+        //the window, samples between frames aren't kept at all: they
+        //are skipped as they arrive.
+        std::vector<T> samples(2 * (window_size - 1 + block_size));
+        size_t num_samples = 0;
+        size_t total_samples = 0;
+        size_t skip = 0;
+
+        size_t num_read;
+        while((num_read = input.read(&samples[2 * num_samples],
+                                     block_size)) > 0)
         {
-            FreqVector<double>& freq_vec_l = stft_data.spectrum_l[t];
-            FreqVector<double>& freq_vec_r = stft_data.spectrum_r[t];
-            assert(freq_vec_l.power.size() == num_coeff);
-            assert(freq_vec_l.min_freq == min_freq);
-            assert(freq_vec_l.max_freq == max_freq);
-            assert(freq_vec_r.power.size() == num_coeff);
-            assert(freq_vec_r.min_freq == min_freq);
-            assert(freq_vec_r.max_freq == max_freq);
-            for(size_t c = 0; c < num_coeff; c++)
+            total_samples += num_read;
+            if(skip > 0)
             {
-                std::cout << freq_vec_l.power[c] << ' ';
-                std::cout << freq_vec_r.power[c] << '\n';
+                //nothing is buffered while skipping
+                size_t skipped = std::min(skip, num_read);
+                std::copy(samples.begin() + 2 * skipped,
+                          samples.begin() + 2 * num_read,
+                          samples.begin());
+                skip     -= skipped;
+                num_read -= skipped;
+            }
+            num_samples += num_read;
 
-                stream.write((char*)&freq_vec_l.power[c], sizeof(double));
-                stream.write((char*)&freq_vec_r.power[c], sizeof(double));
+            size_t num_frames = 0;
+            if(num_samples >= window_size)
+                num_frames = (num_samples - window_size) / window_step + 1;
+
+            for(size_t first = 0; first < num_frames; first += batch_size)
+            {
+                size_t count = std::min(batch_size, num_frames - first);
+                for(size_t i = 0; i < count; i++)
+                    analyzer.load_frame_interleaved
+                        (i, &samples[2 * (first + i) * window_step]);
+
+                analyzer.analyze(count);
+
+                for(size_t i = 0; i < count; i++)
+                {
+                    writer.write_frame(analyzer.energies_l(i),
+                                       analyzer.energies_r(i));
+                    streams.write(analyzer.mfcc_l(i), analyzer.mfcc_r(i),
+                                  analyzer.chroma_l(i),
+                                  analyzer.chroma_r(i));
+                }
             }
 
-            std::cout << "\n\n\n";
+            if(num_frames > 0)
+            {
+                size_t consumed = num_frames * window_step;
+                if(consumed >= num_samples)
+                {
+                    skip = consumed - num_samples;
+                    num_samples = 0;
+                }
+                else
+                {
+                    std::copy(samples.begin() + 2 * consumed,
+                              samples.begin() + 2 * num_samples,
+                              samples.begin());
+                    num_samples -= consumed;
+                }
+                writer.flush();
+            }
         }
 
-        logger.info("Written " + std::to_string(stft_data.spectrum_l.size()) +
-                    "/" + std::to_string(stft_data.spectrum_r.size()) +
+        streams.finish();
+        if(!writer.close())
+            return false;
+
+        logger.info("Streamed " + std::to_string(writer.num_frames()) +
                     " features for L/R channel (" + std::to_string(num_coeff) +
-                    "dimensions, " + std::to_string(min_freq) +
-                    " - " + std::to_string(min_freq) +
-                    "frequency range) to: " + filename);
+                    " dimensions) from " + std::to_string(total_samples) +
+                    " samples of: " + input_fn + " to: " + output_fn);
+        return true;
     }
+
+    template bool load_wav<double>(std::string&, WavData<double>&, Logger&);
+    template bool load_wav<float>(std::string&, WavData<float>&, Logger&);
+
+    template bool save_wav<double>(std::string&, WavData<double>&, Logger&);
+    template bool save_wav<float>(std::string&, WavData<float>&, Logger&);
+
+    template void dft<double>(WavData<double>&, DftData<double>&,
+                              FftPlanCache&, Logger&);
+    template void dft<float>(WavData<float>&, DftData<float>&,
+                             FftPlanCache&, Logger&);
+
+    template void stft<double>(WavData<double>&, StftData<double>&,
+                               const StftParams&, StftCache&, Logger&,
+                               std::vector<StftStream<double>>*);
+    template void stft<float>(WavData<float>&, StftData<float>&,
+                              const StftParams&, StftCache&, Logger&,
+                              std::vector<StftStream<float>>*);
+
+    template void load_stft<double>(std::string&, StftData<double>&,
+                                    Logger&);
+    template void load_stft<float>(std::string&, StftData<float>&,
+                                   Logger&);
+
+    template bool load_stft<double>(std::string&, StftData<double>&,
+                                    StftParams&, Logger&);
+    template bool load_stft<float>(std::string&, StftData<float>&,
+                                   StftParams&, Logger&);
+
+    template bool save_stft<double>(std::string&, StftData<double>&,
+                                    const StftParams&, Logger&, StftOutput,
+                                    StftEncoding,
+                                    const std::vector<StftStream<double>>&);
+    template bool save_stft<float>(std::string&, StftData<float>&,
+                                   const StftParams&, Logger&, StftOutput,
+                                   StftEncoding,
+                                   const std::vector<StftStream<float>>&);
+
+    template bool stream_stft<double>(std::string&, std::string&,
+                                      const StftParams&, StftCache&,
+                                      Logger&, StftOutput, StftEncoding);
+    template bool stream_stft<float>(std::string&, std::string&,
+                                     const StftParams&, StftCache&,
+                                     Logger&, StftOutput, StftEncoding);
 }
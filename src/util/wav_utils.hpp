@@ -1,27 +1,35 @@
 #ifndef NEUROSYNTH_WAV_UTILS_HPP
 #define NEUROSYNTH_WAV_UTILS_HPP
 
+#include "feature_matrix.hpp"
+#include "fft_plan.hpp"
+#include "filterbank.hpp"
 #include "logger.hpp"
+#include "window.hpp"
 
 #include <complex>
 #include <fftw3.h>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
 
 
 namespace neurosynth
 {
+    template<class T>
     struct WavData
     {
-        std::vector<double> samples_l;
-        std::vector<double> samples_r;
+        std::vector<T> samples_l;
+        std::vector<T> samples_r;
+        size_t sample_rate = 0; //from file header, 0 if unknown
     };
 
+    template<class T>
     struct DftData
     {
-        std::vector<std::complex<double>> spectrum_l;
-        std::vector<std::complex<double>> spectrum_r;
+        std::vector<std::complex<T>> spectrum_l;
+        std::vector<std::complex<T>> spectrum_r;
     };
 
     template<class T>
@@ -42,10 +50,85 @@ namespace neurosynth
         std::vector<T> power;
     };
 
-    struct StftData
+    //L/R band energies of all frames, see FeatureMatrix
+    template<class T>
+    using StftData = FeatureMatrix<T>;
+
+    //named features of the same frames (mfcc, chroma, ...), stored
+    //next to the band energies
+    template<class T>
+    struct StftStream
+    {
+        std::string  name;
+        StftData<T>  data;
+    };
+
+    struct StftParams
+    {
+        size_t window_size = 2204; // 50ms
+        size_t window_step = 1102; // move by 25ms
+        size_t fft_size    = 0;    // frames are zero padded to it,
+                                   // 0 - see stft_fft_size()
+        size_t num_coeff   = 88;   // # of frequency frames
+        double min_freq    = 25;   // minimum 25hz
+        double max_freq    = 4200; // maximum 4200hz
+        double sample_rate = 44100;
+        size_t batch_size  = 32;   // # of frames per batched fft
+        FilterShape filter_shape = FilterShape::Bands;
+        WindowType  window_type  = WindowType::Hann;
+        bool packed_stereo = false; // both channels in one complex fft
+        size_t num_mfcc    = 0;    // cepstra of the log mel, 0 - none
+        size_t delta_order = 0;    // mfcc deltas: 1 - delta, 2 - also
+                                   // delta-delta
+        size_t delta_width = 2;    // frames each side of a delta
+        bool chroma        = false; // 12 pitch class energies
+        double resample_rate = 0;  // analysis rate, sizes are given
+                                   // at it, 0 - rate of the input
+        bool decimate      = false; // analyze at the lowest rate
+                                    // that covers max_freq
+        size_t num_threads = 1;    // 0 - one per hardware thread
+    };
+
+    enum class StftOutput
+    {
+        Binary, //stft container
+        Text,   //header lines, then "L R" line per coefficient
+        Csv     //line of all coefficients per frame and channel
+    };
+
+    //transform length of the analysis: params.fft_size (at least the
+    //window size) or, if 0, the next size fftw transforms fast
+    size_t stft_fft_size(const StftParams& params);
+
+    std::string stft_output_name(StftOutput output);
+
+    //how binary output stores feature values
+    enum class StftEncoding
+    {
+        Native,    //values of the analysis precision (float64/float32)
+        Float16,
+        UInt8,     //8-bit codes, one scale/offset per file
+        UInt8Frame //8-bit codes, scale/offset per frame and channel
+    };
+
+    //parses encoding name (native, float16, uint8, uint8-frame)
+    //returns false if name is not recognized
+    bool parse_stft_encoding(const std::string& name,
+                             StftEncoding& encoding);
+
+    std::string stft_encoding_name(StftEncoding encoding);
+
+    //plans, filterbanks and window tables
+    //shared by all stft() calls of a process
+    struct StftCache
     {
-        std::vector<FreqVector<double>> spectrum_l;
-        std::vector<FreqVector<double>> spectrum_r;
+        explicit StftCache(Logger& logger,
+                           unsigned planner_flags = FFTW_MEASURE)
+            : plans(logger, planner_flags) {}
+
+        FftPlanCache    plans;
+        FilterbankCache filterbanks;
+        WindowCache     windows;
     };
 
     double freq2mel(double s);
@@ -56,31 +139,84 @@ namespace neurosynth
 
     short double2int_16(double s);
 
-    void load_wav(std::string& filename,
-                  WavData& wav_data,
-                  Logger& logger);
-
-    void dft(WavData& wav_data,
-             DftData& dft_data,
+    template<class T>
+    void dft(WavData<T>& wav_data,
+             DftData<T>& dft_data,
+             FftPlanCache& plan_cache,
              Logger& logger);
 
-    void stft(WavData& wav_data,
-              StftData& stft_data,
-              size_t window_size,
-              size_t window_step,
-              size_t num_coeff,
-              double min_freq,
-              double max_freq,
-              double sample_rate,
-              Logger& logger);
-
+    //log mel energies of all frames; with 'streams' also the
+    //feature streams params ask for (see feature_streams()), from the
+    //same transforms, deltas are recomputed over all frames
+    template<class T>
+    void stft(WavData<T>& wav_data,
+              StftData<T>& stft_data,
+              const StftParams& params,
+              StftCache& cache,
+              Logger& logger,
+              std::vector<StftStream<T>>* streams = nullptr);
+
+    //reads stft container (see StftFileHeader) or features written
+    //before it existed, values of either precision are converted to T
+    template<class T>
     void load_stft(std::string& filename,
-                   StftData& stft_data,
+                   StftData<T>& stft_data,
                    Logger& logger);
 
-    void save_stft(std::string& filename,
-                   StftData& stft_data,
+    //same, also returns analysis parameters recorded in the file
+    //(defaults and the file's bands for features written before the
+    //container), returns false if the file cannot be read
+    template<class T>
+    bool load_stft(std::string& filename,
+                   StftData<T>& stft_data,
+                   StftParams& params,
                    Logger& logger);
+
+    //writes features as stft container, 'params' are recorded
+    //in its header (bands are taken from stft_data) and values are
+    //stored with 'encoding', or exports them as text/csv;
+    //'streams' (binary only) are stored at the precision of T
+    //returns false if the output could not be written
+    template<class T>
+    bool save_stft(std::string& filename,
+                   StftData<T>& stft_data,
+                   const StftParams& params,
+                   Logger& logger,
+                   StftOutput output = StftOutput::Binary,
+                   StftEncoding encoding = StftEncoding::Native,
+                   const std::vector<StftStream<T>>& streams =
+                   std::vector<StftStream<T>>());
+
+    //loads RIFF/WAVE (PCM 8/16/24/32-bit, float 32/64-bit, any number
+    //of channels) or headerless 16-bit stereo PCM, files are memory
+    //mapped and decoded in place
+    //only the first two channels are kept, mono is duplicated
+    //returns false if the file could not be opened
+    template<class T>
+    bool load_wav(std::string& filename,
+                  WavData<T>& wav_data,
+                  Logger& logger);
+
+    //writes 16-bit stereo RIFF/WAVE at wav_data.sample_rate, samples
+    //are rounded and clipped, returns false if it cannot be written
+    template<class T>
+    bool save_wav(std::string& filename,
+                  WavData<T>& wav_data,
+                  Logger& logger);
+
+    //analyzes load_wav() compatible input as it arrives and writes
+    //every feature frame as soon as its window is complete, feature
+    //streams of 'params' too (deltas delta_width frames later),
+    //memory use doesn't depend on the length of the input
+    //returns false if the output could not be written
+    template<class T>
+    bool stream_stft(std::string& input_fn,
+                     std::string& output_fn,
+                     const StftParams& params,
+                     StftCache& cache,
+                     Logger& logger,
+                     StftOutput output = StftOutput::Binary,
+                     StftEncoding encoding = StftEncoding::Native);
 }
 
 #endif
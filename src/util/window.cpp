@@ -0,0 +1,204 @@
+#include "window.hpp"
+
+#include <cmath>
+
+
+namespace neurosynth
+{
+    bool parse_window_type(const std::string& name, WindowType& type)
+    {
+        if(name == "hann")
+            type = WindowType::Hann;
+        else if(name == "hamming")
+            type = WindowType::Hamming;
+        else if(name == "blackman-harris")
+            type = WindowType::BlackmanHarris;
+        else if(name == "triangular")
+            type = WindowType::Triangular;
+        else if(name == "sqrt-hann")
+            type = WindowType::SqrtHann;
+        else
+            return false;
+        return true;
+    }
+
+    std::string window_type_name(WindowType type)
+    {
+        switch(type)
+        {
+        case WindowType::Hann:           return "hann";
+        case WindowType::Hamming:        return "hamming";
+        case WindowType::BlackmanHarris: return "blackman-harris";
+        case WindowType::Triangular:     return "triangular";
+        case WindowType::SqrtHann:       return "sqrt-hann";
+        }
+        return "unknown";
+    }
+
+    template<class T>
+    AlignedVector<T> make_window(WindowType type, size_t size)
+    {
+        constexpr double pi = M_PI;
+
+        AlignedVector<T> window(size);
+        double N = double(size);
+        for(size_t i = 0; i < size; i++)
+        {
+            double n = double(i);
+            switch(type)
+            {
+            case WindowType::Hann:
+                window[i] = T(0.5 * (1.0 - cos(2.0*pi*n/(N-1))));
+                break;
+            case WindowType::Hamming:
+                window[i] = T(0.54 - 0.46 * cos(2.0*pi*n/(N-1)));
+                break;
+            case WindowType::BlackmanHarris:
+                window[i] = T(0.35875
+                              - 0.48829 * cos(2.0*pi*n/(N-1))
+                              + 0.14128 * cos(4.0*pi*n/(N-1))
+                              - 0.01168 * cos(6.0*pi*n/(N-1)));
+                break;
+            case WindowType::Triangular:
+                window[i] = T(1.0 - std::abs((n-(N-1)/2) / (N/2)));
+                break;
+            case WindowType::SqrtHann:
+                window[i] = T(sqrt(0.5 * (1.0 - cos(2.0*pi*n/N))));
+                break;
+            }
+        }
+        return window;
+    }
+
+    template<>
+    WindowCache::Tables<double>& WindowCache::tables<double>()
+    {
+        return m_windows;
+    }
+
+    template<>
+    WindowCache::Tables<float>& WindowCache::tables<float>()
+    {
+        return m_windows_f;
+    }
+
+    template<class T>
+    std::shared_ptr<const AlignedVector<T>>
+    WindowCache::get(WindowType type, size_t size)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        Tables<T>& windows = tables<T>();
+        auto key = std::make_pair(type, size);
+        auto it = windows.find(key);
+        if(it != windows.end())
+            return it->second;
+
+        auto window = std::make_shared<const AlignedVector<T>>
+            (make_window<T>(type, size));
+        windows[key] = window;
+        return window;
+    }
+
+    template<class T>
+    void window_frame(const T* __restrict__ in_l,
+                      const T* __restrict__ in_r,
+                      const T* __restrict__ window,
+                      T* __restrict__ out_l,
+                      T* __restrict__ out_r,
+                      size_t size)
+    {
+        #pragma omp simd
+        for(size_t i = 0; i < size; i++)
+        {
+            out_l[i] = in_l[i] * window[i];
+            out_r[i] = in_r[i] * window[i];
+        }
+    }
+
+    template<class T>
+    void window_frame_interleaved(const T* __restrict__ in,
+                                  const T* __restrict__ window,
+                                  T* __restrict__ out_l,
+                                  T* __restrict__ out_r,
+                                  size_t size)
+    {
+        #pragma omp simd
+        for(size_t i = 0; i < size; i++)
+        {
+            out_l[i] = in[2*i]   * window[i];
+            out_r[i] = in[2*i+1] * window[i];
+        }
+    }
+
+    template<class T>
+    void window_frame_packed(const T* __restrict__ in_l,
+                             const T* __restrict__ in_r,
+                             const T* __restrict__ window,
+                             std::complex<T>* out,
+                             size_t size)
+    {
+        T* __restrict__ packed = reinterpret_cast<T*>(out);
+        #pragma omp simd
+        for(size_t i = 0; i < size; i++)
+        {
+            packed[2*i]   = in_l[i] * window[i];
+            packed[2*i+1] = in_r[i] * window[i];
+        }
+    }
+
+    template<class T>
+    void window_frame_packed_interleaved(const T* __restrict__ in,
+                                         const T* __restrict__ window,
+                                         std::complex<T>* out,
+                                         size_t size)
+    {
+        T* __restrict__ packed = reinterpret_cast<T*>(out);
+        #pragma omp simd
+        for(size_t i = 0; i < size; i++)
+        {
+            packed[2*i]   = in[2*i]   * window[i];
+            packed[2*i+1] = in[2*i+1] * window[i];
+        }
+    }
+
+    template AlignedVector<double> make_window<double>(WindowType, size_t);
+    template AlignedVector<float> make_window<float>(WindowType, size_t);
+
+    template std::shared_ptr<const AlignedVector<double>>
+    WindowCache::get<double>(WindowType, size_t);
+    template std::shared_ptr<const AlignedVector<float>>
+    WindowCache::get<float>(WindowType, size_t);
+
+    template void window_frame<double>(const double*, const double*,
+                                       const double*, double*, double*,
+                                       size_t);
+    template void window_frame<float>(const float*, const float*,
+                                      const float*, float*, float*,
+                                      size_t);
+
+    template void window_frame_interleaved<double>(const double*,
+                                                   const double*,
+                                                   double*, double*,
+                                                   size_t);
+    template void window_frame_interleaved<float>(const float*,
+                                                  const float*,
+                                                  float*, float*,
+                                                  size_t);
+
+    template void window_frame_packed<double>(const double*, const double*,
+                                              const double*,
+                                              std::complex<double>*, size_t);
+    template void window_frame_packed<float>(const float*, const float*,
+                                             const float*,
+                                             std::complex<float>*, size_t);
+
+    template void window_frame_packed_interleaved<double>(const double*,
+                                                          const double*,
+                                                          std::complex<double>*,
+                                                          size_t);
+    template void window_frame_packed_interleaved<float>(const float*,
+                                                         const float*,
+                                                         std::complex<float>*,
+                                                         size_t);
+}
@@ -0,0 +1,94 @@
+#ifndef NEUROSYNTH_WINDOW_HPP
+#define NEUROSYNTH_WINDOW_HPP
+
+#include "aligned_allocator.hpp"
+
+#include <complex>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+
+namespace neurosynth
+{
+    enum class WindowType
+    {
+        Hann,
+        Hamming,
+        BlackmanHarris,
+        Triangular,
+        SqrtHann //periodic, sums to constant power at 50% overlap
+    };
+
+    //parses window name (hann, hamming, blackman-harris,
+    //triangular, sqrt-hann), returns false if not recognized
+    bool parse_window_type(const std::string& name, WindowType& type);
+
+    std::string window_type_name(WindowType type);
+
+    //computes 'size' window coefficients
+    //(always in double precision, then rounded to T)
+    template<class T>
+    AlignedVector<T> make_window(WindowType type, size_t size);
+
+    //Window tables shared between stft() calls, computed once per
+    //(type, size) instead of once per sample of every frame
+    class WindowCache
+    {
+    public:
+        template<class T>
+        std::shared_ptr<const AlignedVector<T>> get(WindowType type,
+                                                    size_t size);
+
+    private:
+        template<class T>
+        using Tables = std::map<std::pair<WindowType, size_t>,
+                                std::shared_ptr<const AlignedVector<T>>>;
+
+        Tables<double> m_windows;
+        Tables<float>  m_windows_f;
+        std::mutex     m_mutex;
+
+        template<class T>
+        Tables<T>& tables();
+    };
+
+    //copies and windows one frame of both channels in a single pass
+    template<class T>
+    void window_frame(const T* in_l,
+                      const T* in_r,
+                      const T* window,
+                      T* out_l,
+                      T* out_r,
+                      size_t size);
+
+    //deinterleaves, copies and windows one frame of interleaved
+    //stereo samples (L R L R ...) in a single pass
+    template<class T>
+    void window_frame_interleaved(const T* in,
+                                  const T* window,
+                                  T* out_l,
+                                  T* out_r,
+                                  size_t size);
+
+    //windows one frame of both channels into packed l + i r samples
+    //(see StereoDft)
+    template<class T>
+    void window_frame_packed(const T* in_l,
+                             const T* in_r,
+                             const T* window,
+                             std::complex<T>* out,
+                             size_t size);
+
+    //windows interleaved stereo samples into packed l + i r samples,
+    //which have the same layout
+    template<class T>
+    void window_frame_packed_interleaved(const T* in,
+                                         const T* window,
+                                         std::complex<T>* out,
+                                         size_t size);
+}
+
+#endif
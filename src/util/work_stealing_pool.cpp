@@ -0,0 +1,125 @@
+#include "work_stealing_pool.hpp"
+#include "thread_pool.hpp"
+
+
+namespace neurosynth
+{
+    WorkStealingPool::WorkStealingPool(size_t num_threads)
+        : m_queued(0),
+          m_pending(0),
+          m_next_queue(0),
+          m_stolen(0),
+          m_stop(false)
+    {
+        num_threads = resolve_num_threads(num_threads);
+        for(size_t i = 0; i < num_threads; i++)
+            m_queues.emplace_back(new TaskQueue);
+        for(size_t i = 0; i < num_threads; i++)
+            m_workers.emplace_back(&WorkStealingPool::run, this, i);
+    }
+
+    WorkStealingPool::~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_task_cv.notify_all();
+
+        for(std::thread& worker : m_workers)
+            worker.join();
+    }
+
+    void WorkStealingPool::submit(std::function<void(size_t)> task)
+    {
+        {
+            //push and count in one step: a worker that takes the task
+            //right away can only uncount it after this; take() never
+            //holds both locks, so nesting them here can't deadlock
+            std::lock_guard<std::mutex> lock(m_mutex);
+            TaskQueue& queue = *m_queues[m_next_queue];
+            m_next_queue = (m_next_queue + 1) % m_queues.size();
+            {
+                std::lock_guard<std::mutex> queue_lock(queue.mutex);
+                queue.tasks.push_back(std::move(task));
+            }
+            m_pending++;
+            m_queued++;
+        }
+        m_task_cv.notify_one();
+    }
+
+    void WorkStealingPool::wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done_cv.wait(lock, [this] { return m_pending == 0; });
+    }
+
+    size_t WorkStealingPool::num_stolen() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stolen;
+    }
+
+    bool WorkStealingPool::take(size_t index,
+                                std::function<void(size_t)>& task)
+    {
+        size_t num_queues = m_queues.size();
+        for(size_t i = 0; i < num_queues; i++)
+        {
+            //own queue from the front, others from the back, so owner
+            //and thief rarely meet at the same end
+            TaskQueue& queue = *m_queues[(index + i) % num_queues];
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if(queue.tasks.empty())
+                    continue;
+                if(i == 0)
+                {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+                else
+                {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queued--;
+            if(i != 0)
+                m_stolen++;
+            return true;
+        }
+        return false;
+    }
+
+    void WorkStealingPool::run(size_t index)
+    {
+        while(true)
+        {
+            std::function<void(size_t)> task;
+            if(!take(index, task))
+            {
+                //a task counted in m_queued may have been taken by
+                //now, so queues are searched again after waking up
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_task_cv.wait(lock, [this] {
+                        return m_stop || m_queued > 0;
+                    });
+                if(m_stop && m_queued == 0)
+                    return;
+                continue;
+            }
+
+            task(index);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_pending--;
+            }
+            m_done_cv.notify_all();
+        }
+    }
+}
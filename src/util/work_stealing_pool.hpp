@@ -0,0 +1,66 @@
+#ifndef NEUROSYNTH_WORK_STEALING_POOL_HPP
+#define NEUROSYNTH_WORK_STEALING_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace neurosynth
+{
+    //Worker threads with a task queue each. Tasks are dealt out to the
+    //queues round-robin, a worker runs its own tasks in submission
+    //order and steals from the back of another queue once it runs dry,
+    //so tasks of uneven length still keep every worker busy.
+    //Submitting the longest tasks first shortens the tail of the run.
+    //wait() blocks until every task submitted so far is finished.
+    class WorkStealingPool
+    {
+    public:
+        //num_threads == 0 means one thread per hardware thread
+        explicit WorkStealingPool(size_t num_threads);
+
+        ~WorkStealingPool();
+
+        WorkStealingPool(const WorkStealingPool&) = delete;
+        WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+        size_t size() const { return m_workers.size(); }
+
+        //task is called with the index of the worker running it
+        void submit(std::function<void(size_t)> task);
+
+        void wait();
+
+        //tasks taken from another worker's queue so far
+        size_t num_stolen() const;
+
+    private:
+        struct TaskQueue
+        {
+            std::mutex                               mutex;
+            std::deque<std::function<void(size_t)>> tasks;
+        };
+
+        std::vector<std::unique_ptr<TaskQueue>> m_queues;
+        std::vector<std::thread>                m_workers;
+        mutable std::mutex                      m_mutex;
+        std::condition_variable                 m_task_cv;
+        std::condition_variable                 m_done_cv;
+        size_t                                  m_queued;
+        size_t                                  m_pending;
+        size_t                                  m_next_queue;
+        size_t                                  m_stolen;
+        bool                                    m_stop;
+
+        void run(size_t index);
+
+        bool take(size_t index, std::function<void(size_t)>& task);
+    };
+}
+
+#endif
@@ -1,8 +1,183 @@
+#include "util/corpus.hpp"
+#include "util/feature_cache.hpp"
+#include "util/features.hpp"
 #include "util/parse-opt.hpp"
+#include "util/realtime_stft.hpp"
+#include "util/resampler.hpp"
+#include "util/stage_stats.hpp"
 #include "util/wav_utils.hpp"
+#include "util/work_stealing_pool.hpp"
 
+#include <boost/filesystem.hpp>
+
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+
+//analyzes one input with samples, spectra and features of type T,
+//returns false if input could not be read or output written;
+//with a feature cache (files only) a cached output is linked instead
+template<class T>
+bool wav2stf(std::string& input_fn,
+             std::string& output_fn,
+             neurosynth::StftParams params,
+             bool rate_given,
+             bool streaming,
+             neurosynth::StftOutput output,
+             neurosynth::StftEncoding encoding,
+             neurosynth::StftCache& cache,
+             neurosynth::FeatureCache* features,
+             neurosynth::Logger& logger)
+{
+    using namespace neurosynth;
+
+    std::string cache_key;
+    if(features && input_fn != "-" && output_fn != "-")
+    {
+        FftPrecision precision = std::is_same<T, float>::value ?
+            FftPrecision::Single : FftPrecision::Double;
+        cache_key = features->key(input_fn, params, precision, output,
+                                  encoding);
+        if(!cache_key.empty() && features->fetch(cache_key, output_fn))
+            return true;
+    }
+
+    bool good;
+    if(streaming)
+        good = stream_stft<T>(input_fn, output_fn, params, cache, logger,
+                              output, encoding);
+    else
+    {
+        WavData<T> wav_data;
+        StftData<T> stft_data;
+        std::vector<StftStream<T>> streams;
+        if(!load_wav(input_fn, wav_data, logger))
+            return false;
+        if(wav_data.sample_rate != 0)
+        {
+            if(rate_given && params.sample_rate != wav_data.sample_rate)
+                logger.warn("Ignoring --rate, " + input_fn +
+                            " is sampled at " +
+                            std::to_string(wav_data.sample_rate) + "hz");
+            params.sample_rate = wav_data.sample_rate;
+        }
+        params = resample_input(wav_data, params, params.sample_rate,
+                                logger);
+        stft(wav_data, stft_data, params, cache, logger, &streams);
+        good = save_stft(output_fn, stft_data, params, logger, output,
+                         encoding, streams);
+    }
+
+    if(good && !cache_key.empty())
+        features->store(cache_key, output_fn);
+    return good;
+}
+
+//analyzes every file of a corpus on a work-stealing pool of
+//params.num_threads workers, each file on a single thread; plans,
+//filterbanks and windows are shared and a failing file is reported
+//without stopping the others, returns number of failed files
+template<class T>
+size_t wav2stf_corpus(const std::string& corpus,
+                      const std::string& output_dir,
+                      neurosynth::StftParams params,
+                      bool rate_given,
+                      bool streaming,
+                      neurosynth::StftOutput output,
+                      neurosynth::StftEncoding encoding,
+                      neurosynth::StftCache& cache,
+                      neurosynth::FeatureCache* features,
+                      neurosynth::Logger& logger)
+{
+    using namespace neurosynth;
+    using clock = std::chrono::steady_clock;
+
+    const std::string extension = output == StftOutput::Text ? ".txt" :
+        output == StftOutput::Csv ? ".csv" : ".stf";
+
+    std::vector<CorpusEntry> entries;
+    if(!list_corpus(corpus, output_dir, extension, entries, logger))
+        handle_error(logger, "Cannot read corpus: " + corpus);
+
+    size_t num_workers = params.num_threads;
+    params.num_threads = 1;
+
+    std::mutex          console_mutex;
+    std::atomic<size_t> num_done(0);
+    std::atomic<size_t> num_failed(0);
+    std::string         num_entries = std::to_string(entries.size());
+
+    auto analyze = [&](CorpusEntry& entry)
+    {
+        clock::time_point start = clock::now();
+        std::string error;
+        try
+        {
+            ErrorScope scope;
+
+            boost::system::error_code fs_error;
+            boost::filesystem::create_directories
+                (boost::filesystem::path(entry.output).parent_path(),
+                 fs_error);
+            if(fs_error)
+                error = "cannot create directory - " + fs_error.message();
+            else if(!wav2stf<T>(entry.input, entry.output, params,
+                                rate_given, streaming, output, encoding,
+                                cache, features, logger))
+                error = "cannot read input or write output";
+        }
+        catch(const std::exception& e)
+        {
+            error = e.what();
+        }
+        double seconds = std::chrono::duration<double>(clock::now() -
+                                                       start).count();
+
+        std::string progress = "[" + std::to_string(++num_done) + "/" +
+            num_entries + "] ";
+        if(error.empty())
+            progress += entry.input + " -> " + entry.output + " (" +
+                std::to_string(seconds) + "s)";
+        else
+        {
+            num_failed++;
+            progress += "FAILED " + entry.input + ": " + error;
+            logger.err("Cannot analyze " + entry.input + ": " + error);
+        }
+
+        std::lock_guard<std::mutex> lock(console_mutex);
+        std::cout << progress << "\n";
+    };
+
+    clock::time_point start = clock::now();
+    {
+        WorkStealingPool pool(num_workers);
+        for(CorpusEntry& entry : entries)
+            pool.submit([&analyze, &entry](size_t) { analyze(entry); });
+        pool.wait();
 
+        logger.info("Corpus tasks stolen between workers: " +
+                    std::to_string(pool.num_stolen()) + " of " +
+                    num_entries + " on " + std::to_string(pool.size()) +
+                    " workers");
+    }
+    double seconds = std::chrono::duration<double>(clock::now() -
+                                                   start).count();
+
+    std::string summary = "Analyzed " +
+        std::to_string(entries.size() - num_failed) + "/" + num_entries +
+        " files of " + corpus + " in " + std::to_string(seconds) + "s, " +
+        std::to_string(num_failed) + " failed";
+    if(features)
+        summary += ", " + std::to_string(features->hits()) + " cached";
+    logger.info(summary);
+    std::cout << summary << "\n";
+    return num_failed;
+}
 
 int main(int argc, char** argv)
 {
@@ -10,42 +185,358 @@ int main(int argc, char** argv)
     using namespace std;
 
     ParseOpt parse_opt("Usage: wav2stf <options> [input] [output]\n"
-                       "Input/Output stream can be - (stdin/stdout))");
+                       "Input is RIFF/WAVE or headerless 16-bit stereo PCM\n"
+                       "Input/Output stream can be - (stdin/stdout))\n"
+                       "With --corpus: wav2stf <options> [corpus] "
+                       "[output directory]");
 
+    StftParams params;
     string sample_rate_str;
-    size_t sample_rate = 44100;
+    string batch_size_str;
+    string threads_str;
+    string hop_str;
+    string window_size_str;
+    string fft_size_str;
+    string features_str;
+    string num_mfcc_str;
+    string delta_width_str;
+    string resample_str;
+    string latency_str;
     string logfile = get_working_dir() + "/log/wav2stf.log";
+    string log_level_str = "info";
+    string wisdom_fn;
+    string stats_fn;
+    string feature_cache_dir;
+    string cache_size_str;
+    string planner_str = "measure";
+    string filters_str = "bands";
+    string window_str  = "hann";
+    string precision_str = "double";
+    string encoding_str  = "native";
+    bool   streaming;
+    bool   text_output;
+    bool   csv_output;
+    bool   corpus_mode;
+    bool   realtime;
+    bool   paced;
+    bool   packed_stereo;
+    bool   decimate;
+    parse_opt.register_opt("s|stream", &streaming, true,
+                           "Analyze input while it is being read,\n"
+                           "memory use is constant; --text and --csv\n"
+                           "features are written as soon as their\n"
+                           "window is complete, binary containers are\n"
+                           "completed at the end of the input and need\n"
+                           "a seekable output (no pipe)");
+    parse_opt.register_opt("realtime", &realtime, true,
+                           "Analyze with bounded latency: a reader and\n"
+                           "an analysis thread hand samples over through\n"
+                           "a lock-free ring, latency percentiles are\n"
+                           "reported at the end; output is written as\n"
+                           "with --stream");
+    parse_opt.register_opt("latency", &latency_str, false,
+                           "Real-time latency budget in ms, input is\n"
+                           "read in blocks of a quarter of it (default\n"
+                           "50)");
+    parse_opt.register_opt("pace", &paced, true,
+                           "Deliver real-time input at the audio clock,\n"
+                           "as if a file came from a live source");
+    parse_opt.register_opt("text", &text_output, true,
+                           "Write features as text instead of binary:\n"
+                           "# coefficients, min and max frequency, then\n"
+                           "\"L R\" line per coefficient of every frame");
+    parse_opt.register_opt("csv", &csv_output, true,
+                           "Write features as csv instead of binary:\n"
+                           "frame,channel,c0,c1,... line per frame and\n"
+                           "channel");
+    parse_opt.register_opt("c|corpus", &corpus_mode, true,
+                           "Analyze every file of a corpus in one\n"
+                           "process: input is a directory (searched\n"
+                           "for .wav/.raw) or a manifest (input path\n"
+                           "[tab output path] per line), output is\n"
+                           "the output directory; --threads files are\n"
+                           "analyzed at a time, largest first, and\n"
+                           "failing files don't stop the others");
     parse_opt.register_opt("l|log", &logfile, false,
                            "Log file path");
+    parse_opt.register_opt("log-level", &log_level_str, false,
+                           "Least severe messages logged: info, warn,\n"
+                           "error or off (default info)");
     parse_opt.register_opt("r|rate", &sample_rate_str, false,
-                           "Sample rate of audio (default 44100)");
+                           "Sample rate of headerless audio (default\n"
+                           "44100), wav files use their header's rate");
+    parse_opt.register_opt("window-size", &window_size_str, false,
+                           "Samples per analysis window (default 2204,\n"
+                           "50ms at 44.1khz)");
+    parse_opt.register_opt("fft-size", &fft_size_str, false,
+                           "FFT length, windows are zero padded to it;\n"
+                           "default is the next size fftw transforms\n"
+                           "fast (2^a 3^b 5^c)");
+    parse_opt.register_opt("hop", &hop_str, false,
+                           "Samples between consecutive frames\n"
+                           "(default 1102, 25ms at 44.1khz)");
+    parse_opt.register_opt("b|batch", &batch_size_str, false,
+                           "Number of frames transformed by a single\n"
+                           "batched fft (default 32)");
+    parse_opt.register_opt("j|threads", &threads_str, false,
+                           "Number of analysis threads, 0 means one\n"
+                           "per hardware thread (default 1)");
+    parse_opt.register_opt("f|filters", &filters_str, false,
+                           "Mel filter shape: bands (triangle per\n"
+                           "disjoint band) or triangular (overlapping\n"
+                           "triangular filters), default bands");
+    parse_opt.register_opt("window", &window_str, false,
+                           "Analysis window: hann, hamming,\n"
+                           "blackman-harris, triangular or sqrt-hann\n"
+                           "(default hann)");
+    parse_opt.register_opt("resample", &resample_str, false,
+                           "Analyze at this sample rate: inputs of\n"
+                           "other rates are converted by a polyphase\n"
+                           "resampler, --window-size, --hop and\n"
+                           "--fft-size count samples at it (default:\n"
+                           "each input's own rate)");
+    parse_opt.register_opt("decimate", &decimate, true,
+                           "Analyze at the lowest integer fraction of\n"
+                           "the rate that still covers the maximum\n"
+                           "frequency (11025hz for 44.1khz input),\n"
+                           "window, hop and fft sizes are scaled to\n"
+                           "keep their duration");
+    parse_opt.register_opt("packed-stereo", &packed_stereo, true,
+                           "Transform both channels of a frame with one\n"
+                           "complex fft (L real, R imaginary part) and\n"
+                           "separate the spectra afterwards: half the\n"
+                           "transforms and plans, same features up to\n"
+                           "rounding");
+    parse_opt.register_opt("features", &features_str, false,
+                           "Feature streams stored next to the mel\n"
+                           "energies, computed from the same ffts:\n"
+                           "comma separated mfcc, deltas (of mfcc),\n"
+                           "delta2 (deltas and delta-deltas) and chroma\n"
+                           "(12 pitch classes); binary output only");
+    parse_opt.register_opt("mfcc", &num_mfcc_str, false,
+                           "Cepstra per mfcc frame, at most the number\n"
+                           "of mel bands (default 13), implies\n"
+                           "--features mfcc");
+    parse_opt.register_opt("delta-width", &delta_width_str, false,
+                           "Frames on each side of a delta (default 2)");
+    parse_opt.register_opt("precision", &precision_str, false,
+                           "Sample and feature precision: double or\n"
+                           "float (default double), recorded in output");
+    parse_opt.register_opt("e|encoding", &encoding_str, false,
+                           "Storage of binary feature values: native\n"
+                           "(--precision), float16, uint8 (one\n"
+                           "scale/offset per file) or uint8-frame\n"
+                           "(per frame and channel), default native");
+    parse_opt.register_opt("w|wisdom", &wisdom_fn, false,
+                           "FFTW wisdom file, loaded before and\n"
+                           "updated after the analysis");
+    parse_opt.register_opt("p|planner", &planner_str, false,
+                           "FFT planner effort: estimate, measure,\n"
+                           "patient or exhaustive (default measure)");
+    parse_opt.register_opt("cache", &feature_cache_dir, false,
+                           "Feature cache directory: outputs are kept\n"
+                           "there by a hash of the input samples and\n"
+                           "all analysis parameters, an unchanged\n"
+                           "input is hard linked (or copied) from the\n"
+                           "cache instead of analyzed again; file\n"
+                           "input and output only, not --realtime");
+    parse_opt.register_opt("cache-size", &cache_size_str, false,
+                           "Feature cache limit in MB, least recently\n"
+                           "used entries are evicted after the run\n"
+                           "(default 4096)");
+    parse_opt.register_opt("stats", &stats_fn, false,
+                           "Writes time, frames, bytes, allocations\n"
+                           "and peak memory of the read, resample,\n"
+                           "window, fft, filterbank and write stages\n"
+                           "as JSON to this file, - is the console;\n"
+                           "needs a build with make STATS=1");
     parse_opt.parse(argc, argv);
 
     if(!sample_rate_str.empty())
-        sample_rate = stoi(sample_rate_str);
+        params.sample_rate = stoi(sample_rate_str);
+    if(!batch_size_str.empty())
+        params.batch_size = stoul(batch_size_str);
+    if(!threads_str.empty())
+        params.num_threads = stoul(threads_str);
+    if(!window_size_str.empty())
+        params.window_size = stoul(window_size_str);
+    if(!fft_size_str.empty())
+        params.fft_size = stoul(fft_size_str);
+    if(!hop_str.empty())
+        params.window_step = stoul(hop_str);
+    params.packed_stereo = packed_stereo;
+    params.decimate      = decimate;
+    if(!resample_str.empty())
+        params.resample_rate = stod(resample_str);
+    if(!num_mfcc_str.empty())
+        params.num_mfcc = stoul(num_mfcc_str);
+    if(!delta_width_str.empty())
+        params.delta_width = stoul(delta_width_str);
+
+    RealtimeParams rt_params;
+    if(!latency_str.empty())
+        rt_params.latency_budget = stod(latency_str) / 1000.0;
+    rt_params.paced = paced;
 
     string input_fn  = parse_opt.get_positional(0);
     string output_fn = parse_opt.get_positional(1);
 
-    cout << "Executing wav2stf with log file: " +
+    //keep stdout clean when features are written there
+    ostream& console = output_fn == "-" ? cerr : cout;
+    console << "Executing wav2stf with log file: " +
         logfile +
         ", input: " + input_fn +
         ", output: " + output_fn + "\n";
 
     Logger logger(logfile);
 
-    WavData wav_data;
-    StftData stft_data;
-    load_wav(input_fn, wav_data, logger);
-    stft(wav_data, stft_data,
-         2204, // 50ms
-         1102, // move by 25ms
-         88,   // # of frequency frames
-         25,   // minimum 25hz
-         4200, // maximum 4200hz
-         sample_rate,
-         logger);
-    save_stft(output_fn, stft_data, logger);
-
-    return 0;
+    LogLevel log_level;
+    if(!parse_log_level(log_level_str, log_level))
+        handle_error(logger, "Unknown log level: " + log_level_str);
+    logger.set_level(log_level);
+
+    unsigned planner_flags;
+    if(!parse_planner_flags(planner_str, planner_flags))
+        handle_error(logger, "Unknown planner effort: " + planner_str);
+
+    if(!parse_filter_shape(filters_str, params.filter_shape))
+        handle_error(logger, "Unknown filter shape: " + filters_str);
+
+    if(!parse_window_type(window_str, params.window_type))
+        handle_error(logger, "Unknown window type: " + window_str);
+
+    string unknown_feature;
+    if(!parse_feature_list(features_str, params, unknown_feature))
+        handle_error(logger, "Unknown feature: " + unknown_feature);
+    if(!num_mfcc_str.empty() && params.num_mfcc == 0)
+        handle_error(logger, "--mfcc must be at least 1");
+    if(params.num_mfcc > params.num_coeff)
+        handle_error(logger, "--mfcc must not exceed the " +
+                     to_string(params.num_coeff) + " mel bands");
+    if(params.delta_width == 0)
+        handle_error(logger, "--delta-width must be at least 1");
+    if(!resample_str.empty() && params.resample_rate < 1.0)
+        handle_error(logger, "--resample must be a positive rate");
+
+    FftPrecision precision;
+    if(!parse_precision(precision_str, precision))
+        handle_error(logger, "Unknown precision: " + precision_str);
+
+    if(text_output && csv_output)
+        handle_error(logger, "Only one of --text and --csv can be given");
+    StftOutput output = text_output ? StftOutput::Text :
+        csv_output ? StftOutput::Csv : StftOutput::Binary;
+
+    StftEncoding encoding;
+    if(!parse_stft_encoding(encoding_str, encoding))
+        handle_error(logger, "Unknown encoding: " + encoding_str);
+    if(encoding != StftEncoding::Native && output != StftOutput::Binary)
+        handle_error(logger, "--encoding applies to binary output only");
+    if(!feature_streams(params).empty() && output != StftOutput::Binary)
+        handle_error(logger, "--features applies to binary output only");
+
+    if(!stats_fn.empty() && !stage_stats_enabled)
+        handle_error(logger, "--stats needs a build with STATS=1");
+
+    StftCache cache(logger, planner_flags);
+    if(!wisdom_fn.empty())
+        cache.plans.load_wisdom(wisdom_fn);
+
+    if(params.window_size < 2)
+        handle_error(logger, "--window-size must be at least 2");
+    if(params.fft_size != 0 && params.fft_size < params.window_size)
+        handle_error(logger, "--fft-size must not be below the window size");
+    if(params.window_step == 0)
+        handle_error(logger, "--hop must be at least 1");
+    if(params.window_size > stft_file_max_window ||
+       params.window_step > stft_file_max_window ||
+       params.fft_size > stft_file_max_window)
+        handle_error(logger, "--window-size, --hop and --fft-size must "
+                     "not exceed " + to_string(stft_file_max_window));
+    if(rt_params.latency_budget <= 0.0)
+        handle_error(logger, "--latency must be positive");
+    if(realtime && (streaming || corpus_mode))
+        handle_error(logger, "--realtime cannot be combined with --stream "
+                     "or --corpus");
+    if(realtime && !feature_cache_dir.empty())
+        handle_error(logger, "--realtime cannot be combined with --cache");
+    if((streaming || realtime) && !corpus_mode &&
+       output == StftOutput::Binary && !is_seekable_output(output_fn))
+        handle_error(logger, "Binary --stream and --realtime output is "
+                     "completed at the end, write it to a file or use "
+                     "--text or --csv for pipes");
+
+    uint64_t cache_size = 4096;
+    if(!cache_size_str.empty())
+        cache_size = stoull(cache_size_str);
+    unique_ptr<FeatureCache> features;
+    if(!feature_cache_dir.empty())
+        features.reset(new FeatureCache(feature_cache_dir,
+                                        cache_size << 20, logger));
+
+    bool rate_given = !sample_rate_str.empty();
+    bool good;
+    if(realtime)
+    {
+        RealtimeStats stats;
+        good = precision == FftPrecision::Double ?
+            realtime_stft<double>(input_fn, output_fn, params, rt_params,
+                                  cache, stats, logger, output, encoding) :
+            realtime_stft<float>(input_fn, output_fn, params, rt_params,
+                                 cache, stats, logger, output, encoding);
+        if(!good)
+            handle_error(logger, "Cannot analyze " + input_fn + " to: " +
+                         output_fn);
+        console << "Real-time " +
+            describe_realtime_stats(stats, rt_params.latency_budget) + "\n";
+    }
+    else if(corpus_mode)
+    {
+        if(input_fn == "-" || output_fn == "-")
+            handle_error(logger, "--corpus reads and writes files only");
+
+        size_t num_failed = precision == FftPrecision::Double ?
+            wav2stf_corpus<double>(input_fn, output_fn, params, rate_given,
+                                   streaming, output, encoding, cache,
+                                   features.get(), logger) :
+            wav2stf_corpus<float>(input_fn, output_fn, params, rate_given,
+                                  streaming, output, encoding, cache,
+                                  features.get(), logger);
+        good = num_failed == 0;
+    }
+    else
+    {
+        good = precision == FftPrecision::Double ?
+            wav2stf<double>(input_fn, output_fn, params, rate_given,
+                            streaming, output, encoding, cache,
+                            features.get(), logger) :
+            wav2stf<float>(input_fn, output_fn, params, rate_given,
+                           streaming, output, encoding, cache,
+                           features.get(), logger);
+        if(!good)
+            handle_error(logger, "Cannot analyze " + input_fn + " to: " +
+                         output_fn);
+    }
+
+    if(!wisdom_fn.empty())
+        cache.plans.save_wisdom(wisdom_fn);
+
+    if(features)
+    {
+        features->trim();
+        logger.info("Feature cache: " + to_string(features->hits()) +
+                    " hits, " + to_string(features->misses()) + " misses");
+    }
+
+    if(stats_fn == "-")
+        console << stage_stats_json();
+    else if(!stats_fn.empty())
+    {
+        ofstream stats_file(stats_fn);
+        stats_file << stage_stats_json();
+        if(!stats_file)
+            handle_error(logger, "Cannot write stats to: " + stats_fn);
+    }
+
+    return good ? 0 : 1;
 }